@@ -21,6 +21,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <conio.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#define VERIFY_USE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERIFY_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM) || defined(_M_ARM64)
+#define VERIFY_USE_NEON
+#include <arm_neon.h>
+#endif
 
 #include "lusb0_usb.h"
 
@@ -29,6 +41,18 @@
 
 #define MAX_OUTSTANDING_TRANSFERS 10
 
+// Maximum number of timed test repetitions. (see "repeat=")
+#define MAX_REPETITIONS 100
+
+// Transfer latencies are counted in a log-linear histogram with
+// LATENCY_SUB_BUCKETS buckets for each power of two microseconds. A bucket
+// is never more than 1/LATENCY_SUB_BUCKETS wider than the latencies it holds.
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((32 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#define LATENCY_PERCENTILE_COUNT 4
+
 // This is used only in VerifyData() for display information
 // about data validation mismatches.
 #define CONVDAT(format,...) printf("[data-mismatch] " format,__VA_ARGS__)
@@ -78,6 +102,35 @@ enum BENCHMARK_TRANSFER_MODE
     TRANSFER_MODE_ASYNC,
 };
 
+// Machine-readable report written when the test ends. (see "report=")
+enum BENCHMARK_REPORT_FORMAT
+{
+	REPORT_FORMAT_NONE,
+	REPORT_FORMAT_JSON,
+	REPORT_FORMAT_CSV,
+};
+
+// Latency statistics of the transfers on an endpoint. All times are in
+// microseconds.
+struct BENCHMARK_LATENCY
+{
+	LONG Count;
+	DOUBLE Sum;
+	DWORD Min;
+	DWORD Max;
+	LONG Buckets[LATENCY_BUCKETS];
+};
+
+// The measurements of one test repetition on an endpoint.
+struct BENCHMARK_REPETITION_RESULT
+{
+	LONGLONG Bytes;
+	LONG Transfers;
+	DOUBLE Seconds;
+	DOUBLE BytesSec;
+	struct BENCHMARK_LATENCY Latency;
+};
+
 // Holds all of the information about a test.
 struct BENCHMARK_TEST_PARAM
 {
@@ -101,6 +154,11 @@ struct BENCHMARK_TEST_PARAM
 	BOOL VerifyDetails;	// If true, prints detailed information for each invalid byte.
     enum BENCHMARK_DEVICE_TEST_TYPE TestType;	// The benchmark test type.
 	enum BENCHMARK_TRANSFER_MODE TransferMode;	// Sync or Async
+	INT WarmUp;			// Time to run before measuring (ms)
+	INT Duration;		// Length of a repetition (ms), 0 to run until the user quits.
+	INT Repeat;			// Number of timed repetitions.
+	enum BENCHMARK_REPORT_FORMAT ReportFormat;	// Report written when the test ends.
+	CHAR ReportFile[MAX_PATH];	// Report file name, stdout if empty.
 
     // Internal value use during the test.
     //
@@ -111,6 +169,8 @@ struct BENCHMARK_TEST_PARAM
 
 	BYTE* VerifyBuffer;		// Stores the verify test pattern for 1 packet.
 	WORD VerifyBufferSize;	// Size of VerifyBuffer
+
+	INT Repetition;			// Number of completed repetitions.
 };
 
 // The benchmark transfer context used for asynchronous transfers.  see TransferAsync().
@@ -121,6 +181,7 @@ struct BENCHMARK_TRANSFER_HANDLE
 	CHAR* Data;
 	INT DataMaxLength;
 	INT ReturnCode;
+	LONGLONG SubmitTick;	// When the transfer was submitted. (see GetTimerTick())
 };
 
 // Holds all of the information about a transfer.
@@ -138,9 +199,12 @@ struct BENCHMARK_TRANSFER_PARAM
 	LONG LastTransferred;
 
     LONG Packets;
-    DWORD StartTick;
-    DWORD LastTick;
-    DWORD LastStartTick;
+
+	// Performance counter values. (see GetTimerTick())
+    LONGLONG StartTick;
+    LONGLONG LastTick;
+    LONGLONG LastStartTick;
+	LONGLONG WarmUpEndTick;
 
     INT TotalTimeoutCount;
     INT RunningTimeoutCount;
@@ -149,6 +213,12 @@ struct BENCHMARK_TRANSFER_PARAM
 	INT RunningErrorCount;
 
 	INT ShortTransferCount;
+	INT VerifyErrorCount;
+
+	struct BENCHMARK_LATENCY Latency;
+
+	// One result for each of Test->Repeat repetitions.
+	struct BENCHMARK_REPETITION_RESULT* Results;
 
 	INT TransferHandleNextIndex;
 	INT TransferHandleWaitIndex;
@@ -170,6 +240,9 @@ int Bench_GetTestType(struct usb_dev_handle* dev, enum BENCHMARK_DEVICE_TEST_TYP
 // Critical section for running status. 
 CRITICAL_SECTION DisplayCriticalSection;
 
+// Performance counter ticks per second.
+LONGLONG TimerFrequency;
+
 // Finds the interface for [interface_number] in a libusb-win32 config descriptor.
 // If first_interface is not NULL, it is set to the first interface in the config.
 //
@@ -196,6 +269,17 @@ void ShowTransferInfo(struct BENCHMARK_TRANSFER_PARAM* transferParam);
 
 void WaitForTestTransfer(struct BENCHMARK_TRANSFER_PARAM* transferParam);
 void ResetRunningStatus(struct BENCHMARK_TRANSFER_PARAM* transferParam);
+void StartWarmUp(struct BENCHMARK_TRANSFER_PARAM* transferParam);
+void EndRepetition(struct BENCHMARK_TRANSFER_PARAM* transferParam);
+
+LONGLONG GetTimerTick(void);
+DWORD GetTimerMicroseconds(LONGLONG ticks);
+void AddLatency(struct BENCHMARK_LATENCY* latency, DWORD microseconds);
+void MergeLatency(struct BENCHMARK_LATENCY* latency, CONST struct BENCHMARK_LATENCY* source);
+DWORD GetLatencyPercentile(CONST struct BENCHMARK_LATENCY* latency, DOUBLE percentile);
+void GetBytesSecStats(struct BENCHMARK_TRANSFER_PARAM* transferParam, DOUBLE* mean, DOUBLE* stdDev, DOUBLE* ci95);
+DOUBLE GetStudentT95(INT df);
+int WriteReport(struct BENCHMARK_TEST_PARAM* testParam, struct BENCHMARK_TRANSFER_PARAM* readTest, struct BENCHMARK_TRANSFER_PARAM* writeTest);
 
 // The thread transfer routine.
 DWORD TransferThreadProc(struct BENCHMARK_TRANSFER_PARAM* transferParams);
@@ -208,6 +292,25 @@ DWORD TransferThreadProc(struct BENCHMARK_TRANSFER_PARAM* transferParams);
 #define ENDPOINT_TYPE(TransferParam) (TransferParam->Ep.bmAttributes & 3)
 const char* TestDisplayString[] = {"None", "Read", "Write", "Loop", NULL};
 const char* EndpointTypeDisplayString[] = {"Control", "Isochronous", "Bulk", "Interrupt", NULL};
+const char* TransferModeDisplayString[] = {"Sync", "Async", NULL};
+const char* ReportFormatDisplayString[] = {"None", "JSON", "CSV", NULL};
+
+// Latency percentiles shown and reported for each endpoint.
+const DOUBLE LatencyPercentiles[LATENCY_PERCENTILE_COUNT] = {50.0, 90.0, 99.0, 99.9};
+const char* LatencyPercentileDisplayString[LATENCY_PERCENTILE_COUNT] = {"p50", "p90", "p99", "p99.9"};
+
+// Two-sided 95% Student's t values for 1 to 30 degrees of freedom.
+const DOUBLE StudentT95[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+// Two-sided 95% Student's t values above 30 degrees of freedom, t is
+// interpolated linearly in 1/df between them and tends to 1.960.
+const INT StudentT95LargeDf[] = {30, 40, 60, 80, 100, 120, 200, 500, 1000};
+const DOUBLE StudentT95Large[] = {
+	2.042, 2.021, 2.000, 1.990, 1.984, 1.980, 1.972, 1.965, 1.962};
+#define STUDENT_T95_INFINITE_DF 1.960
 
 void SetTestDefaults(struct BENCHMARK_TEST_PARAM* test)
 {
@@ -222,6 +325,159 @@ void SetTestDefaults(struct BENCHMARK_TEST_PARAM* test)
     test->BufferSize	= 4096;
     test->BufferCount   = 1;
     test->Priority		= THREAD_PRIORITY_NORMAL;
+    test->Repeat		= 1;
+}
+
+// Returns the current value of the high-resolution performance counter.
+LONGLONG GetTimerTick(void)
+{
+	LARGE_INTEGER counter;
+
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+DWORD GetTimerMicroseconds(LONGLONG ticks)
+{
+	LONGLONG microseconds = (ticks * 1000000) / TimerFrequency;
+
+	if (microseconds < 0) return 0;
+	if (microseconds > 0xFFFFFFFF) return 0xFFFFFFFF;
+	return (DWORD)microseconds;
+}
+
+static INT GetLatencyBucket(DWORD microseconds)
+{
+	INT shift = 0;
+
+	if (microseconds < LATENCY_SUB_BUCKETS)
+		return microseconds;
+
+	// Find the highest set bit without shifting a DWORD by 32.
+	while (shift + LATENCY_SUB_BUCKET_BITS + 1 < 32 &&
+		(microseconds >> (shift + LATENCY_SUB_BUCKET_BITS + 1)))
+		shift++;
+
+	return ((shift + 1) << LATENCY_SUB_BUCKET_BITS) + ((microseconds >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// Returns the highest latency counted in a bucket.
+static DWORD GetLatencyBucketMax(INT bucket)
+{
+	INT shift;
+
+	if (bucket < LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	shift = (bucket >> LATENCY_SUB_BUCKET_BITS) - 1;
+	return ((DWORD)(LATENCY_SUB_BUCKETS + (bucket & (LATENCY_SUB_BUCKETS - 1))) << shift) + (((DWORD)1 << shift) - 1);
+}
+
+void AddLatency(struct BENCHMARK_LATENCY* latency, DWORD microseconds)
+{
+	if (!latency->Count || microseconds < latency->Min)
+		latency->Min = microseconds;
+	if (microseconds > latency->Max)
+		latency->Max = microseconds;
+
+	latency->Count++;
+	latency->Sum += microseconds;
+	latency->Buckets[GetLatencyBucket(microseconds)]++;
+}
+
+void MergeLatency(struct BENCHMARK_LATENCY* latency, CONST struct BENCHMARK_LATENCY* source)
+{
+	int i;
+
+	if (!source->Count) return;
+
+	if (!latency->Count || source->Min < latency->Min)
+		latency->Min = source->Min;
+	if (source->Max > latency->Max)
+		latency->Max = source->Max;
+
+	latency->Count += source->Count;
+	latency->Sum += source->Sum;
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		latency->Buckets[i] += source->Buckets[i];
+}
+
+// Returns the latency [percentile]% of the transfers did not exceed, rounded
+// up to the end of its histogram bucket.
+DWORD GetLatencyPercentile(CONST struct BENCHMARK_LATENCY* latency, DOUBLE percentile)
+{
+	LONGLONG rank;
+	LONGLONG count = 0;
+	int i;
+
+	if (!latency->Count) return 0;
+
+	rank = (LONGLONG)ceil(latency->Count * percentile / 100.0);
+	if (rank < 1) rank = 1;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		count += latency->Buckets[i];
+		if (count >= rank)
+			return min(GetLatencyBucketMax(i), latency->Max);
+	}
+	return latency->Max;
+}
+
+// Gets the mean, the standard deviation and the 95% confidence interval
+// (+/-) of the average bytes/sec over the completed repetitions. The
+// deviation and the interval are 0 for less than 2 repetitions.
+void GetBytesSecStats(struct BENCHMARK_TRANSFER_PARAM* transferParam, DOUBLE* mean, DOUBLE* stdDev, DOUBLE* ci95)
+{
+	INT count = transferParam->Test->Repetition;
+	DOUBLE sum = 0;
+	int i;
+
+	*mean = *stdDev = *ci95 = 0;
+	if (count < 1) return;
+
+	for (i = 0; i < count; i++)
+		sum += transferParam->Results[i].BytesSec;
+	*mean = sum / count;
+
+	if (count < 2) return;
+
+	sum = 0;
+	for (i = 0; i < count; i++)
+		sum += (transferParam->Results[i].BytesSec - *mean) * (transferParam->Results[i].BytesSec - *mean);
+	*stdDev = sqrt(sum / (count - 1));
+
+	*ci95 = GetStudentT95(count - 1) * *stdDev / sqrt((DOUBLE)count);
+}
+
+// Gets the two-sided 95% Student's t value for df >= 1 degrees of freedom.
+DOUBLE GetStudentT95(INT df)
+{
+	INT last = _countof(StudentT95LargeDf) - 1;
+	DOUBLE x0, x1, t0, t1;
+	int i;
+
+	if (df <= _countof(StudentT95))
+		return StudentT95[df - 1];
+
+	if (df > StudentT95LargeDf[last])
+	{
+		// between the last value and the limit at 1/df = 0
+		x0 = 1.0 / StudentT95LargeDf[last];
+		t0 = StudentT95Large[last];
+		x1 = 0;
+		t1 = STUDENT_T95_INFINITE_DF;
+	}
+	else
+	{
+		for (i = 1; df > StudentT95LargeDf[i]; i++);
+		x0 = 1.0 / StudentT95LargeDf[i - 1];
+		t0 = StudentT95Large[i - 1];
+		x1 = 1.0 / StudentT95LargeDf[i];
+		t1 = StudentT95Large[i];
+	}
+
+	return t0 + (t1 - t0) * (x0 - 1.0 / df) / (x0 - x1);
 }
 
 struct usb_interface_descriptor* usb_find_interface(struct usb_config_descriptor* config_descriptor,
@@ -324,17 +580,91 @@ enum TRANSFER_VERIFY_STATE
 
 };
 
+#if defined(VERIFY_USE_AVX2) || defined(VERIFY_USE_SSE2)
+// Returns the index of the lowest set bit in a non-zero mask.
+static INT VerifyFirstBit(DWORD mask)
+{
+#if defined(_MSC_VER)
+	DWORD index;
+	_BitScanForward(&index, mask);
+	return (INT)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Compares one packet against the verify pattern without modifying either
+// buffer. Byte 0 is always 0 and byte 1 holds the packet key; the rest must
+// match the pattern built by CreateVerifyBuffer().
+//
+// Returns the offset of the first mismatched byte or -1 if the packet is valid.
+static INT VerifyPacket(CONST BYTE* data, CONST BYTE* pattern, INT length, BYTE key)
+{
+	INT offset = 2;
+
+	if (length > 0 && data[0] != pattern[0])
+		return 0;
+	if (length > 1 && data[1] != key)
+		return 1;
+
+#if defined(VERIFY_USE_AVX2)
+	for (; offset + 32 <= length; offset += 32)
+	{
+		__m256i d = _mm256_loadu_si256((CONST __m256i*)&data[offset]);
+		__m256i p = _mm256_loadu_si256((CONST __m256i*)&pattern[offset]);
+		DWORD mask = ~(DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, p));
+
+		if (mask)
+			return offset + VerifyFirstBit(mask);
+	}
+#endif
+
+#if defined(VERIFY_USE_AVX2) || defined(VERIFY_USE_SSE2)
+	for (; offset + 16 <= length; offset += 16)
+	{
+		__m128i d = _mm_loadu_si128((CONST __m128i*)&data[offset]);
+		__m128i p = _mm_loadu_si128((CONST __m128i*)&pattern[offset]);
+		DWORD mask = ~(DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(d, p)) & 0xFFFF;
+
+		if (mask)
+			return offset + VerifyFirstBit(mask);
+	}
+#elif defined(VERIFY_USE_NEON)
+	for (; offset + 16 <= length; offset += 16)
+	{
+		uint8x16_t eq = vceqq_u8(vld1q_u8(&data[offset]), vld1q_u8(&pattern[offset]));
+		uint64x2_t eq64 = vreinterpretq_u64_u8(eq);
+
+		// Let the scalar loop below locate the mismatched byte in this block.
+		if ((vgetq_lane_u64(eq64, 0) & vgetq_lane_u64(eq64, 1)) != ~(uint64_t)0)
+			break;
+	}
+#endif
+
+	// Scalar fallback and tail bytes.
+	for (; offset < length; offset++)
+	{
+		if (data[offset] != pattern[offset])
+			return offset;
+	}
+
+	return -1;
+}
+
 INT VerifyData(struct BENCHMARK_TRANSFER_PARAM* transferParam, BYTE* data, INT dataLength)
 {
 
 	WORD verifyDataSize = transferParam->Test->VerifyBufferSize;
-	BYTE* verifyData = transferParam->Test->VerifyBuffer;
+	CONST BYTE* verifyData = transferParam->Test->VerifyBuffer;
 	BYTE keyC = 0;
 	BOOL seedKey = TRUE;
 	INT dataLeft = dataLength;
 	INT dataIndex = 0;
 	INT packetIndex = 0;
 	INT verifyIndex = 0;
+	INT mismatchIndex;
+	INT mismatchCount = 0;
 
 	while(dataLeft > 1)
 	{
@@ -354,28 +684,33 @@ INT VerifyData(struct BENCHMARK_TRANSFER_PARAM* transferParam, BYTE* data, INT d
 			}
 		}
 		seedKey = FALSE;
+
 		// Index 0 is always 0.
 		// The key is always at index 1
-		verifyData[1] = keyC;
-		if (memcmp(&data[dataIndex],verifyData,verifyDataSize) != 0)
+		mismatchIndex = VerifyPacket(&data[dataIndex], verifyData, verifyDataSize, keyC);
+		if (mismatchIndex >= 0)
 		{
 			// Packet verification failed.
+			mismatchCount++;
 
 			// Reset the key byte on the next packet.
 			seedKey = TRUE;
 
-			CONVDAT("data mismatch packet-index=%d data-index=%d\n", packetIndex, dataIndex);
+			CONVDAT("data mismatch packet-index=%d data-index=%d packet-offset=%d\n",
+				packetIndex, dataIndex, mismatchIndex);
 
 			if (transferParam->Test->VerifyDetails)
 			{
-				for (verifyIndex=0; verifyIndex<verifyDataSize; verifyIndex++)
+				for (verifyIndex=mismatchIndex; verifyIndex<verifyDataSize; verifyIndex++)
 				{
-					if (verifyData[verifyIndex] == data[dataIndex + verifyIndex])
+					BYTE expected = (verifyIndex == 1) ? keyC : verifyData[verifyIndex];
+
+					if (expected == data[dataIndex + verifyIndex])
 						continue;
 
 					CONVDAT("packet-offset=%d expected %02Xh got %02Xh\n",
 						verifyIndex,
-						verifyData[verifyIndex],
+						expected,
 						data[dataIndex+verifyIndex]);
 
 				}
@@ -390,7 +725,7 @@ INT VerifyData(struct BENCHMARK_TRANSFER_PARAM* transferParam, BYTE* data, INT d
 
 	}
 
-	return 0;
+	return mismatchCount;
 }
 
 int TransferSync(struct BENCHMARK_TRANSFER_PARAM* transferParam)
@@ -469,6 +804,7 @@ int TransferAsync(struct BENCHMARK_TRANSFER_PARAM* transferParam, struct BENCHMA
 
 
 		// Submit this transfer now.
+		handle->SubmitTick = GetTimerTick();
 		handle->ReturnCode = ret = usb_submit_async(handle->Context, handle->Data, handle->DataMaxLength);
 		if (ret < 0) goto Done;
 
@@ -519,22 +855,32 @@ DWORD TransferThreadProc(struct BENCHMARK_TRANSFER_PARAM* transferParam)
     int ret, i;
 	struct BENCHMARK_TRANSFER_HANDLE* handle;
 	char* data;
+	LONGLONG submitTick;
+	LONGLONG completeTick;
     transferParam->IsRunning = TRUE;
 
     while (!transferParam->Test->IsCancelled)
     {
 		data = NULL;
 		handle = NULL;
+		submitTick = 0;
 
 		if (transferParam->Test->TransferMode == TRANSFER_MODE_SYNC)
 		{
+			submitTick = GetTimerTick();
 			ret = TransferSync(transferParam);
+			completeTick = GetTimerTick();
 			if (ret >= 0) data = transferParam->Buffer;
 		}
 		else if (transferParam->Test->TransferMode == TRANSFER_MODE_ASYNC)
 		{
 			ret = TransferAsync(transferParam, &handle);
-			if ((handle) && ret >= 0) data = handle->Data;
+			completeTick = GetTimerTick();
+			if ((handle) && ret >= 0)
+			{
+				data = handle->Data;
+				submitTick = handle->SubmitTick;
+			}
 		}
 		else
 		{
@@ -619,21 +965,27 @@ DWORD TransferThreadProc(struct BENCHMARK_TRANSFER_PARAM* transferParam)
 			if ((transferParam->Test->Verify) && 
 				(transferParam->Ep.bEndpointAddress & USB_ENDPOINT_DIR_MASK))
 			{
-				VerifyData(transferParam, data, ret);
+				transferParam->VerifyErrorCount += VerifyData(transferParam, data, ret);
 			}
         }
 
         EnterCriticalSection(&DisplayCriticalSection);
 
-        if (!transferParam->StartTick && transferParam->Packets >= 0)
+        if (transferParam->WarmUpEndTick && completeTick < transferParam->WarmUpEndTick)
         {
-            transferParam->StartTick = GetTickCount();
+			// Transfers completing during the warm-up are not measured.
+        }
+        else if (!transferParam->StartTick && transferParam->Packets >= 0)
+        {
+            transferParam->StartTick		= completeTick;
 			transferParam->LastStartTick	= transferParam->StartTick;
             transferParam->LastTick			= transferParam->StartTick;
+			transferParam->WarmUpEndTick	= 0;
 
 			transferParam->LastTransferred = 0;
             transferParam->TotalTransferred = 0;
             transferParam->Packets = 0;
+			memset(&transferParam->Latency, 0, sizeof(transferParam->Latency));
         }
         else
         {
@@ -642,11 +994,14 @@ DWORD TransferThreadProc(struct BENCHMARK_TRANSFER_PARAM* transferParam)
 				transferParam->LastStartTick	= transferParam->LastTick;
 				transferParam->LastTransferred = 0;
 			}
-            transferParam->LastTick			= GetTickCount();
+            transferParam->LastTick			= completeTick;
  
 			transferParam->LastTransferred  += ret;
             transferParam->TotalTransferred += ret;
             transferParam->Packets++;
+
+			if (data)
+				AddLatency(&transferParam->Latency, GetTimerMicroseconds(completeTick - submitTick));
         }
 
         LeaveCriticalSection(&DisplayCriticalSection);
@@ -699,6 +1054,25 @@ int ValidateBenchmarkArgs(struct BENCHMARK_TEST_PARAM* testParam)
         return -1;
     }
 
+    if (testParam->WarmUp < 0 || testParam->Duration < 0)
+    {
+		CONERR0("Invalid WarmUp or Duration argument. Times must not be negative.\n");
+        return -1;
+    }
+
+    if (testParam->Repeat < 1 || testParam->Repeat > MAX_REPETITIONS)
+    {
+		CONERR("Invalid Repeat argument %d. Repeat must be greater than 0 and less than or equal to %d.\n",
+			testParam->Repeat, MAX_REPETITIONS);
+        return -1;
+    }
+
+    if (testParam->Repeat > 1 && !testParam->Duration)
+    {
+		CONERR0("Invalid Repeat argument. Repetitions require a Duration.\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -735,6 +1109,32 @@ int ParseBenchmarkArgs(struct BENCHMARK_TEST_PARAM* testParams, int argc, char *
 		}
         else if (GetParamIntValue(arg, "refresh=", &testParams->Refresh)) {}
         else if (GetParamIntValue(arg, "isopacketsize=", &testParams->IsoPacketSize)) {}
+        else if (GetParamIntValue(arg, "warmup=", &testParams->WarmUp)) {}
+        else if (GetParamIntValue(arg, "duration=", &testParams->Duration)) {}
+        else if (GetParamIntValue(arg, "repeat=", &testParams->Repeat)) {}
+        else if ((value=GetParamStrValue(arg,"report=")))
+        {
+            if (!stricmp(value,"json"))
+            {
+				testParams->ReportFormat = REPORT_FORMAT_JSON;
+            }
+            else if (!stricmp(value,"csv"))
+            {
+				testParams->ReportFormat = REPORT_FORMAT_CSV;
+            }
+            else
+            {
+                CONERR("invalid report format argument! %s\n",argv[iarg]);
+                return -1;
+            }
+        }
+        else if (GetParamStrValue(arg,"reportfile="))
+        {
+			// Use the original argument, the file name is case sensitive on some shares.
+			if (strcpy_s(testParams->ReportFile, _countof(testParams->ReportFile),
+				argv[iarg] + strlen("reportfile=")) != ERROR_SUCCESS)
+				return -1;
+        }
         else if ((value=GetParamStrValue(arg,"mode=")))
         {
             if (GetParamStrValue(value,"sync"))
@@ -854,6 +1254,12 @@ void FreeTransferParam(struct BENCHMARK_TRANSFER_PARAM** testTransferRef)
         pTransferParam->ThreadHandle = NULL;
     }
 
+	if (pTransferParam->Results)
+	{
+		free(pTransferParam->Results);
+		pTransferParam->Results = NULL;
+	}
+
     free(pTransferParam);
 
     *testTransferRef = NULL;
@@ -872,6 +1278,15 @@ struct BENCHMARK_TRANSFER_PARAM* CreateTransferParam(struct BENCHMARK_TEST_PARAM
     {
         memset(transferParam, 0, allocSize);
         transferParam->Test = test;
+
+		transferParam->Results = calloc(test->Repeat, sizeof(struct BENCHMARK_REPETITION_RESULT));
+		if (!transferParam->Results)
+		{
+            CONERR("memory allocation failure at line %d!\n",__LINE__);
+            FreeTransferParam(&transferParam);
+			goto Done;
+		}
+
 		if (!(testInterface = usb_find_interface(&test->Device->config[0], test->Intf, test->Altf, NULL)))
 		{
             CONERR("failed locating interface %02Xh!\n", test->Intf);
@@ -997,7 +1412,7 @@ void GetAverageBytesSec(struct BENCHMARK_TRANSFER_PARAM* transferParam, DOUBLE*
     }
     else
     {
-		ticksSec = (transferParam->LastTick - transferParam->StartTick) / 1000.0;
+		ticksSec = (DOUBLE)(transferParam->LastTick - transferParam->StartTick) / TimerFrequency;
 		*bps = (transferParam->TotalTransferred / ticksSec);
     }
 }
@@ -1014,7 +1429,7 @@ void GetCurrentBytesSec(struct BENCHMARK_TRANSFER_PARAM* transferParam, DOUBLE*
     }
     else
     {
-		ticksSec = (transferParam->LastTick - transferParam->LastStartTick) / 1000.0;
+		ticksSec = (DOUBLE)(transferParam->LastTick - transferParam->LastStartTick) / TimerFrequency;
 		*bps = transferParam->LastTransferred / ticksSec;
     }
 }
@@ -1052,6 +1467,7 @@ void ShowTransferInfo(struct BENCHMARK_TRANSFER_PARAM* transferParam)
     DOUBLE bpsAverage;
     DOUBLE bpsCurrent;
     DOUBLE elapsedSeconds;
+	int i;
 
 	if (!transferParam) return;
 
@@ -1080,16 +1496,35 @@ void ShowTransferInfo(struct BENCHMARK_TRANSFER_PARAM* transferParam)
 		{
 			CONMSG("\tOther Errors    : %d\n", transferParam->TotalErrorCount);
 		}
+		if (transferParam->VerifyErrorCount)
+		{
+			CONMSG("\tVerify Errors   : %d\n", transferParam->VerifyErrorCount);
+		}
 
         CONMSG("\tAvg. Bytes/sec  : %.2f\n", bpsAverage);
 
 		if (transferParam->StartTick && transferParam->StartTick < transferParam->LastTick)
 		{
-			elapsedSeconds = (transferParam->LastTick - transferParam->StartTick) / 1000.0;
+			elapsedSeconds = (DOUBLE)(transferParam->LastTick - transferParam->StartTick) / TimerFrequency;
 
 			CONMSG("\tElapsed Time    : %.2f seconds\n", elapsedSeconds);
 		}
 
+		if (transferParam->Latency.Count)
+		{
+			CONMSG("\tLatency (us)    : min %u avg %.1f max %u\n",
+				transferParam->Latency.Min,
+				transferParam->Latency.Sum / transferParam->Latency.Count,
+				transferParam->Latency.Max);
+			CONMSG0("\tLatency (us)    :");
+			for (i = 0; i < LATENCY_PERCENTILE_COUNT; i++)
+			{
+				printf(" %s %u", LatencyPercentileDisplayString[i],
+					GetLatencyPercentile(&transferParam->Latency, LatencyPercentiles[i]));
+			}
+			printf("\n");
+		}
+
 	    CONMSG0("\n");
     }
 
@@ -1112,6 +1547,17 @@ void ShowTestInfo(struct BENCHMARK_TEST_PARAM* testParam)
 		testParam->Verify ? "On" : "Off",
 		(testParam->Verify && testParam->VerifyDetails) ? " (Detailed)" : "");
 
+	if (testParam->WarmUp)
+		CONMSG("\tWarm-up         : %d (ms)\n", testParam->WarmUp);
+	if (testParam->Duration)
+		CONMSG("\tDuration        : %d x %d (ms)\n", testParam->Repeat, testParam->Duration);
+	if (testParam->ReportFormat)
+	{
+		CONMSG("\tReport          : %s %s\n",
+			ReportFormatDisplayString[testParam->ReportFormat],
+			testParam->ReportFile[0] ? testParam->ReportFile : "(stdout)");
+	}
+
     CONMSG0("\n");
 }
 
@@ -1150,6 +1596,261 @@ void ResetRunningStatus(struct BENCHMARK_TRANSFER_PARAM* transferParam)
     transferParam->Packets=-2;
     transferParam->LastTick=0;
     transferParam->RunningTimeoutCount=0;
+	memset(&transferParam->Latency, 0, sizeof(transferParam->Latency));
+
+	StartWarmUp(transferParam);
+}
+
+// Transfers completing in the next Test->WarmUp ms are not measured.
+void StartWarmUp(struct BENCHMARK_TRANSFER_PARAM* transferParam)
+{
+    if (!transferParam || !transferParam->Test->WarmUp) return;
+
+	transferParam->WarmUpEndTick = GetTimerTick() + (transferParam->Test->WarmUp * TimerFrequency) / 1000;
+}
+
+// Stores the measurements of the current repetition in
+// Results[Test->Repetition].
+void EndRepetition(struct BENCHMARK_TRANSFER_PARAM* transferParam)
+{
+	struct BENCHMARK_REPETITION_RESULT* result;
+
+    if (!transferParam) return;
+
+	result = &transferParam->Results[transferParam->Test->Repetition];
+	memset(result, 0, sizeof(*result));
+
+	if (transferParam->StartTick && transferParam->StartTick < transferParam->LastTick)
+	{
+		result->Bytes = transferParam->TotalTransferred;
+		result->Transfers = transferParam->Packets;
+		result->Seconds = (DOUBLE)(transferParam->LastTick - transferParam->StartTick) / TimerFrequency;
+		GetAverageBytesSec(transferParam, &result->BytesSec);
+		memcpy(&result->Latency, &transferParam->Latency, sizeof(result->Latency));
+	}
+}
+
+static void WriteJsonLatency(FILE* file, CONST struct BENCHMARK_LATENCY* latency)
+{
+	int i;
+
+	fprintf(file, "{\"count\": %d, \"min\": %u, \"mean\": %.1f, \"max\": %u",
+		latency->Count,
+		latency->Min,
+		latency->Count ? latency->Sum / latency->Count : 0.0,
+		latency->Max);
+
+	for (i = 0; i < LATENCY_PERCENTILE_COUNT; i++)
+	{
+		fprintf(file, ", \"%s\": %u",
+			LatencyPercentileDisplayString[i],
+			GetLatencyPercentile(latency, LatencyPercentiles[i]));
+	}
+	fprintf(file, "}");
+}
+
+static void WriteJsonReport(FILE* file, struct BENCHMARK_TEST_PARAM* testParam, struct BENCHMARK_TRANSFER_PARAM** transferParams, INT count)
+{
+	struct BENCHMARK_TRANSFER_PARAM* transferParam;
+	struct BENCHMARK_REPETITION_RESULT* result;
+	struct BENCHMARK_LATENCY latency;
+	DOUBLE mean, stdDev, ci95;
+	SYSTEMTIME now;
+	BOOL first;
+	int i, j;
+
+	GetSystemTime(&now);
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"manifest\": {\n");
+	fprintf(file, "    \"version\": \"%s\",\n", RC_VERSION_STR);
+	fprintf(file, "    \"date\": \"%04d-%02d-%02dT%02d:%02d:%02dZ\",\n",
+		now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+	fprintf(file, "    \"vid\": %d,\n", testParam->Vid);
+	fprintf(file, "    \"pid\": %d,\n", testParam->Pid);
+	fprintf(file, "    \"interface\": %d,\n", testParam->Intf);
+	fprintf(file, "    \"alt_interface\": %d,\n", testParam->Altf);
+	fprintf(file, "    \"test_type\": \"%s\",\n", TestDisplayString[testParam->TestType & 3]);
+	fprintf(file, "    \"transfer_mode\": \"%s\",\n", TransferModeDisplayString[testParam->TransferMode]);
+	fprintf(file, "    \"buffer_size\": %d,\n", testParam->BufferSize);
+	fprintf(file, "    \"buffer_count\": %d,\n", testParam->BufferCount);
+	fprintf(file, "    \"iso_packet_size\": %d,\n", testParam->IsoPacketSize);
+	fprintf(file, "    \"timeout_ms\": %d,\n", testParam->Timeout);
+	fprintf(file, "    \"retry\": %d,\n", testParam->Retry);
+	fprintf(file, "    \"priority\": %d,\n", testParam->Priority);
+	fprintf(file, "    \"verify\": %s,\n", testParam->Verify ? "true" : "false");
+	fprintf(file, "    \"verify_details\": %s,\n", testParam->VerifyDetails ? "true" : "false");
+	fprintf(file, "    \"warmup_ms\": %d,\n", testParam->WarmUp);
+	fprintf(file, "    \"duration_ms\": %d,\n", testParam->Duration);
+	fprintf(file, "    \"repetitions\": %d,\n", testParam->Repetition);
+	fprintf(file, "    \"timer_frequency\": %I64d\n", TimerFrequency);
+	fprintf(file, "  },\n");
+	fprintf(file, "  \"endpoints\": [");
+
+	for (i = 0; i < count; i++)
+	{
+		transferParam = transferParams[i];
+
+		fprintf(file, "%s\n    {\n", i ? "," : "");
+		fprintf(file, "      \"endpoint\": %d,\n", transferParam->Ep.bEndpointAddress);
+		fprintf(file, "      \"direction\": \"%s\",\n", TRANSFER_DISPLAY(transferParam, "read", "write"));
+		fprintf(file, "      \"type\": \"%s\",\n", EndpointTypeDisplayString[ENDPOINT_TYPE(transferParam)]);
+		fprintf(file, "      \"max_packet_size\": %d,\n", transferParam->Ep.wMaxPacketSize);
+		fprintf(file, "      \"short_transfers\": %d,\n", transferParam->ShortTransferCount);
+		fprintf(file, "      \"timeouts\": %d,\n", transferParam->TotalTimeoutCount);
+		fprintf(file, "      \"errors\": %d,\n", transferParam->TotalErrorCount);
+		fprintf(file, "      \"verify_errors\": %d,\n", transferParam->VerifyErrorCount);
+		fprintf(file, "      \"repetitions\": [");
+
+		memset(&latency, 0, sizeof(latency));
+		for (j = 0; j < testParam->Repetition; j++)
+		{
+			result = &transferParam->Results[j];
+			MergeLatency(&latency, &result->Latency);
+
+			fprintf(file, "%s\n        {\"bytes\": %I64d, \"transfers\": %d, \"seconds\": %.6f, \"bytes_per_sec\": %.2f, \"latency_us\": ",
+				j ? "," : "",
+				result->Bytes,
+				result->Transfers,
+				result->Seconds,
+				result->BytesSec);
+			WriteJsonLatency(file, &result->Latency);
+			fprintf(file, "}");
+		}
+		fprintf(file, "\n      ],\n");
+
+		GetBytesSecStats(transferParam, &mean, &stdDev, &ci95);
+		fprintf(file, "      \"summary\": {\n");
+		fprintf(file, "        \"bytes_per_sec\": {\"mean\": %.2f, \"stddev\": %.2f, \"ci95\": ", mean, stdDev);
+		if (testParam->Repetition > 1)
+			fprintf(file, "%.2f},\n", ci95);
+		else
+			fprintf(file, "null},\n");
+		fprintf(file, "        \"latency_us\": ");
+		WriteJsonLatency(file, &latency);
+		fprintf(file, ",\n");
+
+		// Non-empty buckets only, as [highest latency in the bucket, count].
+		fprintf(file, "        \"latency_histogram_us\": [");
+		first = TRUE;
+		for (j = 0; j < LATENCY_BUCKETS; j++)
+		{
+			if (!latency.Buckets[j]) continue;
+			fprintf(file, "%s[%u, %d]", first ? "" : ", ", GetLatencyBucketMax(j), latency.Buckets[j]);
+			first = FALSE;
+		}
+		fprintf(file, "]\n");
+		fprintf(file, "      }\n");
+		fprintf(file, "    }");
+	}
+	fprintf(file, "\n  ]\n}\n");
+}
+
+static void WriteCsvRow(FILE* file, struct BENCHMARK_TEST_PARAM* testParam, struct BENCHMARK_TRANSFER_PARAM* transferParam,
+						CONST char* repetition, struct BENCHMARK_REPETITION_RESULT* result, CONST char* ci95)
+{
+	int i;
+
+	fprintf(file, "%d,%s,%s,%s,%I64d,%d,%.6f,%.2f,%s,%d,%u,%.1f",
+		transferParam->Ep.bEndpointAddress,
+		TRANSFER_DISPLAY(transferParam, "read", "write"),
+		EndpointTypeDisplayString[ENDPOINT_TYPE(transferParam)],
+		repetition,
+		result->Bytes,
+		result->Transfers,
+		result->Seconds,
+		result->BytesSec,
+		ci95,
+		result->Latency.Count,
+		result->Latency.Min,
+		result->Latency.Count ? result->Latency.Sum / result->Latency.Count : 0.0);
+
+	for (i = 0; i < LATENCY_PERCENTILE_COUNT; i++)
+		fprintf(file, ",%u", GetLatencyPercentile(&result->Latency, LatencyPercentiles[i]));
+
+	fprintf(file, ",%u,%s,%s,%d,%d,%d,%d,%d,%d\n",
+		result->Latency.Max,
+		TestDisplayString[testParam->TestType & 3],
+		TransferModeDisplayString[testParam->TransferMode],
+		testParam->BufferSize,
+		testParam->BufferCount,
+		testParam->Verify,
+		testParam->WarmUp,
+		testParam->Duration,
+		transferParam->VerifyErrorCount);
+}
+
+// One row for each repetition and a "summary" row for each endpoint. The
+// summary holds the totals, the mean bytes/sec with its 95% confidence
+// interval and the latencies of all repetitions.
+static void WriteCsvReport(FILE* file, struct BENCHMARK_TEST_PARAM* testParam, struct BENCHMARK_TRANSFER_PARAM** transferParams, INT count)
+{
+	struct BENCHMARK_TRANSFER_PARAM* transferParam;
+	struct BENCHMARK_REPETITION_RESULT summary;
+	DOUBLE stdDev, ci95;
+	CHAR text[32];
+	int i, j;
+
+	fprintf(file, "endpoint,direction,type,repetition,bytes,transfers,seconds,bytes_per_sec,bytes_per_sec_ci95,"
+		"latency_count,latency_min_us,latency_mean_us");
+	for (i = 0; i < LATENCY_PERCENTILE_COUNT; i++)
+		fprintf(file, ",latency_%s_us", LatencyPercentileDisplayString[i]);
+	fprintf(file, ",latency_max_us,test_type,transfer_mode,buffer_size,buffer_count,verify,warmup_ms,duration_ms,verify_errors\n");
+
+	for (i = 0; i < count; i++)
+	{
+		transferParam = transferParams[i];
+		memset(&summary, 0, sizeof(summary));
+
+		for (j = 0; j < testParam->Repetition; j++)
+		{
+			sprintf(text, "%d", j + 1);
+			WriteCsvRow(file, testParam, transferParam, text, &transferParam->Results[j], "");
+
+			summary.Bytes += transferParam->Results[j].Bytes;
+			summary.Transfers += transferParam->Results[j].Transfers;
+			summary.Seconds += transferParam->Results[j].Seconds;
+			MergeLatency(&summary.Latency, &transferParam->Results[j].Latency);
+		}
+
+		GetBytesSecStats(transferParam, &summary.BytesSec, &stdDev, &ci95);
+		text[0] = '\0';
+		if (testParam->Repetition > 1)
+			sprintf(text, "%.2f", ci95);
+		WriteCsvRow(file, testParam, transferParam, "summary", &summary, text);
+	}
+}
+
+// Writes the report selected with "report=" to stdout or the "reportfile=".
+int WriteReport(struct BENCHMARK_TEST_PARAM* testParam, struct BENCHMARK_TRANSFER_PARAM* readTest, struct BENCHMARK_TRANSFER_PARAM* writeTest)
+{
+	struct BENCHMARK_TRANSFER_PARAM* transferParams[2];
+	INT count = 0;
+	FILE* file = stdout;
+
+	if (readTest) transferParams[count++] = readTest;
+	if (writeTest) transferParams[count++] = writeTest;
+
+	if (testParam->ReportFile[0])
+	{
+		if (!(file = fopen(testParam->ReportFile, "w")))
+		{
+			CONERR("failed creating report file %s!\n", testParam->ReportFile);
+			return -1;
+		}
+	}
+
+	if (testParam->ReportFormat == REPORT_FORMAT_JSON)
+		WriteJsonReport(file, testParam, transferParams, count);
+	else
+		WriteCsvReport(file, testParam, transferParams, count);
+
+	if (file != stdout)
+		fclose(file);
+	else
+		fflush(file);
+
+	return 0;
 }
 
 int GetTestDeviceFromList(struct BENCHMARK_TEST_PARAM* testParam)
@@ -1299,6 +2000,10 @@ int main(int argc, char** argv)
     struct BENCHMARK_TRANSFER_PARAM* ReadTest	= NULL;
     struct BENCHMARK_TRANSFER_PARAM* WriteTest	= NULL;
     int key;
+	LARGE_INTEGER frequency;
+	DWORD repetitionStartTick;
+	DWORD repetitionTime;
+	DWORD sleepTime;
 
 
     if (argc == 1)
@@ -1321,6 +2026,10 @@ int main(int argc, char** argv)
     if (ParseBenchmarkArgs(&Test, argc, argv) < 0)
         return -1;
 
+    // All test timing is done with the performance counter.
+    QueryPerformanceFrequency(&frequency);
+    TimerFrequency = frequency.QuadPart;
+
     // Initialize the critical section used for locking
     // the volatile members of the transfer params in order
     // to update/modify the running statistics.
@@ -1435,11 +2144,21 @@ int main(int argc, char** argv)
 	CONMSG0("Press 'T' for test details\n");
 	CONMSG0("Press 'I' for status information\n");
 	CONMSG0("Press 'R' to reset averages\n");
-    CONMSG0("\nPress 'Q' to exit, any other key to begin..");
-    key = _getch();
-    CONMSG0("\n");
 
-    if (key=='Q' || key=='q') goto Done;
+	// Timed tests run unattended.
+	if (!Test.Duration)
+	{
+		CONMSG0("\nPress 'Q' to exit, any other key to begin..");
+		key = _getch();
+		CONMSG0("\n");
+
+		if (key=='Q' || key=='q') goto Done;
+	}
+
+	StartWarmUp(ReadTest);
+	StartWarmUp(WriteTest);
+	repetitionTime = Test.WarmUp + Test.Duration;
+	repetitionStartTick = GetTickCount();
 
     // Set the thread priority and start it.
     if (ReadTest)
@@ -1457,7 +2176,12 @@ int main(int argc, char** argv)
 
     while (!Test.IsCancelled)
     {
-        Sleep(Test.Refresh);
+		// Don't sleep past the end of a timed repetition.
+		sleepTime = Test.Refresh;
+		if (Test.Duration && GetTickCount() - repetitionStartTick < repetitionTime)
+			sleepTime = min(sleepTime, repetitionTime - (GetTickCount() - repetitionStartTick));
+
+        Sleep(sleepTime);
 
         if (_kbhit())
         {
@@ -1520,6 +2244,34 @@ int main(int argc, char** argv)
             break;
         }
 
+		// Store the results of a timed repetition and start the next one.
+		if (Test.Duration && GetTickCount() - repetitionStartTick >= repetitionTime)
+		{
+            EnterCriticalSection(&DisplayCriticalSection);
+
+			EndRepetition(ReadTest);
+			EndRepetition(WriteTest);
+			Test.Repetition++;
+
+			if (Test.Repetition < Test.Repeat)
+			{
+				ResetRunningStatus(ReadTest);
+				ResetRunningStatus(WriteTest);
+			}
+
+            LeaveCriticalSection(&DisplayCriticalSection);
+
+			if (Test.Repetition == Test.Repeat)
+			{
+				Test.IsCancelled = TRUE;
+				break;
+			}
+
+			CONMSG("Repetition %d of %d..\n", Test.Repetition + 1, Test.Repeat);
+			repetitionStartTick = GetTickCount();
+			continue;
+		}
+
         // Print benchmark stats
         if (ReadTest)
             ShowRunningStatus(ReadTest);
@@ -1551,11 +2303,22 @@ int main(int argc, char** argv)
     WaitForTestTransfer(ReadTest);
     WaitForTestTransfer(WriteTest);
 
+	// A test that ended before its first timed repetition counts as one.
+	if (!Test.Repetition)
+	{
+		EndRepetition(ReadTest);
+		EndRepetition(WriteTest);
+		Test.Repetition++;
+	}
+
     // Print benchmark detailed stats
 	ShowTestInfo(&Test);
 	if (ReadTest) ShowTransferInfo(ReadTest);
 	if (WriteTest) ShowTransferInfo(WriteTest);
 
+	if (Test.ReportFormat)
+		WriteReport(&Test, ReadTest, WriteTest);
+
 
 Done:
     if (Test.DeviceHandle)
@@ -1574,9 +2337,12 @@ Done:
 
     DeleteCriticalSection(&DisplayCriticalSection);
 
-    CONMSG0("Press any key to exit..");
-    _getch();
-    CONMSG0("\n");
+	if (!Test.Duration)
+	{
+		CONMSG0("Press any key to exit..");
+		_getch();
+		CONMSG0("\n");
+	}
 
     return 0;
 }
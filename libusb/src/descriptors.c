@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include "usbi.h"
 
 int usb_get_descriptor_by_endpoint(usb_dev_handle *udev, int ep,
@@ -75,40 +76,173 @@ int usb_parse_descriptor(unsigned char *source, char *description, void *dest)
     return (int)(sp - source);
 }
 
+/*
+ * Fixed layout decoders for the standard descriptors. These do the same
+ * as usb_parse_descriptor() with the matching format string, without
+ * interpreting it byte by byte. They return the number of bytes read.
+ */
+#define USB_LE16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+
+int usb_parse_header(unsigned char *source, struct usb_descriptor_header *dest)
+{
+    dest->bLength = source[0];
+    dest->bDescriptorType = source[1];
+
+    return DESC_HEADER_LENGTH;
+}
+
+/* "bbwbbbbwwwbbbb" */
+int usb_parse_device_descriptor(unsigned char *source,
+                                struct usb_device_descriptor *dest)
+{
+    dest->bLength = source[0];
+    dest->bDescriptorType = source[1];
+    dest->bcdUSB = USB_LE16(source + 2);
+    dest->bDeviceClass = source[4];
+    dest->bDeviceSubClass = source[5];
+    dest->bDeviceProtocol = source[6];
+    dest->bMaxPacketSize0 = source[7];
+    dest->idVendor = USB_LE16(source + 8);
+    dest->idProduct = USB_LE16(source + 10);
+    dest->bcdDevice = USB_LE16(source + 12);
+    dest->iManufacturer = source[14];
+    dest->iProduct = source[15];
+    dest->iSerialNumber = source[16];
+    dest->bNumConfigurations = source[17];
+
+    return DEVICE_DESC_LENGTH;
+}
+
+/* "bbwbbbbb" */
+int usb_parse_config_descriptor(unsigned char *source,
+                                struct usb_config_descriptor *dest)
+{
+    dest->bLength = source[0];
+    dest->bDescriptorType = source[1];
+    dest->wTotalLength = USB_LE16(source + 2);
+    dest->bNumInterfaces = source[4];
+    dest->bConfigurationValue = source[5];
+    dest->iConfiguration = source[6];
+    dest->bmAttributes = source[7];
+    dest->MaxPower = source[8];
+
+    return CONFIG_DESC_LENGTH;
+}
+
+/* "bbbbbbbbb" */
+int usb_parse_interface_descriptor(unsigned char *source,
+                                   struct usb_interface_descriptor *dest)
+{
+    dest->bLength = source[0];
+    dest->bDescriptorType = source[1];
+    dest->bInterfaceNumber = source[2];
+    dest->bAlternateSetting = source[3];
+    dest->bNumEndpoints = source[4];
+    dest->bInterfaceClass = source[5];
+    dest->bInterfaceSubClass = source[6];
+    dest->bInterfaceProtocol = source[7];
+    dest->iInterface = source[8];
+
+    return INTERFACE_DESC_LENGTH;
+}
+
+/* "bbbbwbbb" for audio endpoints, "bbbbwb" otherwise */
+int usb_parse_endpoint_descriptor(unsigned char *source,
+                                  struct usb_endpoint_descriptor *dest)
+{
+    dest->bLength = source[0];
+    dest->bDescriptorType = source[1];
+    dest->bEndpointAddress = source[2];
+    dest->bmAttributes = source[3];
+    dest->wMaxPacketSize = USB_LE16(source + 4);
+    dest->bInterval = source[6];
+
+    if (source[0] < ENDPOINT_AUDIO_DESC_LENGTH)
+        return ENDPOINT_DESC_LENGTH;
+
+    dest->bRefresh = source[7];
+    dest->bSynchAddress = source[8];
+
+    return ENDPOINT_AUDIO_DESC_LENGTH;
+}
+
+/*
+ * Each configuration is parsed into a single block of memory. A first
+ * pass over the descriptors only counts the space needed (arena->base is
+ * NULL), a second pass builds the tree inside the block. The interface
+ * array comes first, so the whole tree is freed with free(config->interface).
+ */
+struct usb_desc_arena
+{
+    unsigned char *base;
+    int size;
+    int used;
+    int num_altsetting[USB_MAXINTERFACES];
+};
+
+#define USB_DESC_ARENA_ALIGN(n) (((n) + 7) & ~7)
+
+static void *usb_arena_alloc(struct usb_desc_arena *arena, int size)
+{
+    void *p = NULL;
+
+    size = USB_DESC_ARENA_ALIGN(size);
+
+    if (arena->base)
+    {
+        if (arena->used + size > arena->size)
+            return NULL;
+
+        p = arena->base + arena->used;
+        memset(p, 0, size);
+    }
+
+    arena->used += size;
+
+    return p;
+}
+
 /*
  * This code looks surprisingly similar to the code I wrote for the Linux
  * kernel. It's not a coincidence :)
  */
 
-static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned char *buffer, int size)
+static int usb_parse_endpoint(struct usb_desc_arena *arena,
+                              struct usb_endpoint_descriptor *endpoint,
+                              unsigned char *buffer, int size)
 {
     struct usb_descriptor_header header;
     unsigned char *begin;
     int parsed = 0, len, numskipped;
 
-    usb_parse_descriptor(buffer, "bb", &header);
-
     /* Everything should be fine being passed into here, but we sanity */
     /*  check JIC */
+    if (size < DESC_HEADER_LENGTH)
+    {
+        if (usb_debug >= 1 && arena->base)
+            fprintf(stderr, "ran out of descriptors parsing\n");
+        return -1;
+    }
+
+    usb_parse_header(buffer, &header);
+
     if (header.bLength > size)
     {
-        if (usb_debug >= 1)
+        if (usb_debug >= 1 && arena->base)
             fprintf(stderr, "ran out of descriptors parsing\n");
         return -1;
     }
 
     if (header.bDescriptorType != USB_DT_ENDPOINT)
     {
-        if (usb_debug >= 2)
+        if (usb_debug >= 2 && arena->base)
             fprintf(stderr, "unexpected descriptor 0x%X, expecting endpoint descriptor, type 0x%X\n",
                     header.bDescriptorType, USB_DT_ENDPOINT);
         return parsed;
     }
 
-    if (header.bLength >= ENDPOINT_AUDIO_DESC_LENGTH)
-        usb_parse_descriptor(buffer, "bbbbwbbb", endpoint);
-    else if (header.bLength >= ENDPOINT_DESC_LENGTH)
-        usb_parse_descriptor(buffer, "bbbbwb", endpoint);
+    if (header.bLength >= ENDPOINT_DESC_LENGTH)
+        usb_parse_endpoint_descriptor(buffer, endpoint);
 
     buffer += header.bLength;
     size -= header.bLength;
@@ -120,11 +254,11 @@ static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned
     numskipped = 0;
     while (size >= DESC_HEADER_LENGTH)
     {
-        usb_parse_descriptor(buffer, "bb", &header);
+        usb_parse_header(buffer, &header);
 
-        if (header.bLength < 2)
+        if ((header.bLength > size) || (header.bLength < 2))
         {
-            if (usb_debug >= 1)
+            if (usb_debug >= 1 && arena->base)
                 fprintf(stderr, "invalid descriptor length of %d\n", header.bLength);
             return -1;
         }
@@ -136,7 +270,7 @@ static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned
                 (header.bDescriptorType == USB_DT_DEVICE))
             break;
 
-        if (usb_debug >= 1)
+        if (usb_debug >= 1 && arena->base)
             fprintf(stderr, "skipping descriptor 0x%X\n", header.bDescriptorType);
         numskipped++;
 
@@ -145,7 +279,7 @@ static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned
         parsed += header.bLength;
     }
 
-    if (numskipped && usb_debug >= 2)
+    if (numskipped && usb_debug >= 2 && arena->base)
         fprintf(stderr, "skipped %d class/vendor specific endpoint descriptors\n", numskipped);
 
     /* Copy any unknown descriptors into a storage area for drivers */
@@ -158,11 +292,9 @@ static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned
         return parsed;
     }
 
-    endpoint->extra = malloc(len);
+    endpoint->extra = usb_arena_alloc(arena, len);
     if (!endpoint->extra)
     {
-        if (usb_debug >= 1)
-            fprintf(stderr, "couldn't allocate memory for endpoint extra descriptors\n");
         endpoint->extralen = 0;
         return parsed;
     }
@@ -173,30 +305,56 @@ static int usb_parse_endpoint(struct usb_endpoint_descriptor *endpoint, unsigned
     return parsed;
 }
 
-static int usb_parse_interface(struct usb_interface *interface,
+static int usb_parse_interface(struct usb_desc_arena *arena, int index,
+                               struct usb_interface *interface,
                                unsigned char *buffer, int size)
 {
     int i, len, numskipped, retval, parsed = 0;
     struct usb_descriptor_header header;
-    struct usb_interface_descriptor *ifp;
+    struct usb_interface_descriptor *ifp, ifp_count;
+    struct usb_endpoint_descriptor endpoint_count;
     unsigned char *begin;
 
     interface->num_altsetting = 0;
 
+    /* the counting pass knows the number of alternate settings, the */
+    /* build pass allocates them in one piece */
+    interface->altsetting = usb_arena_alloc(arena, sizeof(struct usb_interface_descriptor) * arena->num_altsetting[index]);
+
     while (size >= INTERFACE_DESC_LENGTH)
     {
-        interface->altsetting = realloc(interface->altsetting, sizeof(struct usb_interface_descriptor) * (interface->num_altsetting + 1));
-        if (!interface->altsetting)
+        if (arena->base)
         {
-            if (usb_debug >= 1)
-                fprintf(stderr, "couldn't malloc interface->altsetting\n");
-            return -1;
+            if (interface->num_altsetting >= arena->num_altsetting[index])
+                return -1;
+
+            ifp = interface->altsetting + interface->num_altsetting;
+        }
+        else
+        {
+            memset(&ifp_count, 0, sizeof(ifp_count));
+            ifp = &ifp_count;
+            arena->num_altsetting[index]++;
         }
 
-        ifp = interface->altsetting + interface->num_altsetting;
         interface->num_altsetting++;
 
-        usb_parse_descriptor(buffer, "bbbbbbbbb", ifp);
+        usb_parse_interface_descriptor(buffer, ifp);
+
+        /* a length below the header size wouldn't move on */
+        if (ifp->bLength < DESC_HEADER_LENGTH)
+        {
+            if (usb_debug >= 1 && arena->base)
+                fprintf(stderr, "invalid descriptor length of %d\n", ifp->bLength);
+            return -1;
+        }
+
+        if (ifp->bLength > size)
+        {
+            if (usb_debug >= 1 && arena->base)
+                fprintf(stderr, "ran out of descriptors parsing\n");
+            return -1;
+        }
 
         /* Skip over the interface */
         buffer += ifp->bLength;
@@ -209,11 +367,11 @@ static int usb_parse_interface(struct usb_interface *interface,
         /* Skip over any interface, class or vendor descriptors */
         while (size >= DESC_HEADER_LENGTH)
         {
-            usb_parse_descriptor(buffer, "bb", &header);
+            usb_parse_header(buffer, &header);
 
-            if (header.bLength < 2)
+            if ((header.bLength > size) || (header.bLength < 2))
             {
-                if (usb_debug >= 1)
+                if (usb_debug >= 1 && arena->base)
                     fprintf(stderr, "invalid descriptor length of %d\n", header.bLength);
                 return -1;
             }
@@ -232,7 +390,7 @@ static int usb_parse_interface(struct usb_interface *interface,
             size -= header.bLength;
         }
 
-        if (numskipped && usb_debug >= 2)
+        if (numskipped && usb_debug >= 2 && arena->base)
             fprintf(stderr, "skipped %d class/vendor specific interface descriptors\n", numskipped);
 
         /* Copy any unknown descriptors into a storage area for */
@@ -245,59 +403,61 @@ static int usb_parse_interface(struct usb_interface *interface,
         }
         else
         {
-            ifp->extra = malloc(len);
-            if (!ifp->extra)
-            {
-                if (usb_debug >= 1)
-                    fprintf(stderr, "couldn't allocate memory for interface extra descriptors\n");
-                ifp->extralen = 0;
-                return -1;
-            }
-            memcpy(ifp->extra, begin, len);
-            ifp->extralen = len;
+            ifp->extra = usb_arena_alloc(arena, len);
+            if (ifp->extra)
+                memcpy(ifp->extra, begin, len);
+            ifp->extralen = ifp->extra ? len : 0;
         }
 
         /* Did we hit an unexpected descriptor? */
-        usb_parse_descriptor(buffer, "bb", &header);
-        if ((size >= DESC_HEADER_LENGTH) &&
-                ((header.bDescriptorType == USB_DT_CONFIG) ||
-                 (header.bDescriptorType == USB_DT_DEVICE)))
-            return parsed;
+        if (size >= DESC_HEADER_LENGTH)
+        {
+            usb_parse_header(buffer, &header);
+            if ((header.bDescriptorType == USB_DT_CONFIG) ||
+                    (header.bDescriptorType == USB_DT_DEVICE))
+                return parsed;
+        }
 
         if (ifp->bNumEndpoints > USB_MAXENDPOINTS)
         {
-            if (usb_debug >= 1)
+            if (usb_debug >= 1 && arena->base)
                 fprintf(stderr, "too many endpoints\n");
             return -1;
         }
 
         if (ifp->bNumEndpoints > 0)
         {
-            ifp->endpoint = (struct usb_endpoint_descriptor *)
-                            malloc(ifp->bNumEndpoints *
-                                   sizeof(struct usb_endpoint_descriptor));
-            if (!ifp->endpoint)
-            {
-                if (usb_debug >= 1)
-                    fprintf(stderr, "couldn't allocate memory for ifp->endpoint\n");
-                return -1;
-            }
-
-            memset(ifp->endpoint, 0, ifp->bNumEndpoints *
-                   sizeof(struct usb_endpoint_descriptor));
+            ifp->endpoint = usb_arena_alloc(arena, ifp->bNumEndpoints *
+                                            sizeof(struct usb_endpoint_descriptor));
 
             for (i = 0; i < ifp->bNumEndpoints; i++)
             {
-                usb_parse_descriptor(buffer, "bb", &header);
+                if (size < DESC_HEADER_LENGTH)
+                {
+                    if (usb_debug >= 1 && arena->base)
+                        fprintf(stderr, "ran out of descriptors parsing\n");
+                    return -1;
+                }
+
+                usb_parse_header(buffer, &header);
 
                 if (header.bLength > size)
                 {
-                    if (usb_debug >= 1)
+                    if (usb_debug >= 1 && arena->base)
                         fprintf(stderr, "ran out of descriptors parsing\n");
                     return -1;
                 }
 
-                retval = usb_parse_endpoint(ifp->endpoint + i, buffer, size);
+                if (arena->base)
+                {
+                    retval = usb_parse_endpoint(arena, ifp->endpoint + i, buffer, size);
+                }
+                else
+                {
+                    memset(&endpoint_count, 0, sizeof(endpoint_count));
+                    retval = usb_parse_endpoint(arena, &endpoint_count, buffer, size);
+                }
+
                 if (retval < 0)
                     return retval;
 
@@ -320,33 +480,18 @@ static int usb_parse_interface(struct usb_interface *interface,
     return parsed;
 }
 
-int usb_parse_configuration(struct usb_config_descriptor *config,
-                            unsigned char *buffer)
+static int usb_parse_configuration_arena(struct usb_desc_arena *arena,
+                                         struct usb_config_descriptor *config,
+                                         unsigned char *buffer)
 {
     int i, retval, size;
     struct usb_descriptor_header header;
 
-    usb_parse_descriptor(buffer, "bbwbbbbb", config);
     size = config->wTotalLength;
 
-    if (config->bNumInterfaces > USB_MAXINTERFACES)
-    {
-        if (usb_debug >= 1)
-            fprintf(stderr, "too many interfaces\n");
-        return -1;
-    }
-
     config->interface = (struct usb_interface *)
-                        malloc(config->bNumInterfaces *
-                               sizeof(struct usb_interface));
-    if (!config->interface)
-    {
-        if (usb_debug >= 1)
-            fprintf(stderr, "out of memory\n");
-        return -1;
-    }
-
-    memset(config->interface, 0, config->bNumInterfaces * sizeof(struct usb_interface));
+                        usb_arena_alloc(arena, config->bNumInterfaces *
+                                        sizeof(struct usb_interface));
 
     buffer += config->bLength;
     size -= config->bLength;
@@ -358,6 +503,7 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
     {
         int numskipped, len;
         unsigned char *begin;
+        struct usb_interface interface_count;
 
         /* Skip over the rest of the Class Specific or Vendor */
         /*  Specific descriptors */
@@ -365,11 +511,11 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
         numskipped = 0;
         while (size >= DESC_HEADER_LENGTH)
         {
-            usb_parse_descriptor(buffer, "bb", &header);
+            usb_parse_header(buffer, &header);
 
             if ((header.bLength > size) || (header.bLength < DESC_HEADER_LENGTH))
             {
-                if (usb_debug >= 1)
+                if (usb_debug >= 1 && arena->base)
                     fprintf(stderr, "invalid descriptor length of %d\n", header.bLength);
                 return -1;
             }
@@ -381,7 +527,7 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
                     (header.bDescriptorType == USB_DT_DEVICE))
                 break;
 
-            if (usb_debug >= 2)
+            if (usb_debug >= 2 && arena->base)
                 fprintf(stderr, "skipping descriptor 0x%X\n", header.bDescriptorType);
             numskipped++;
 
@@ -389,7 +535,7 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
             size -= header.bLength;
         }
 
-        if (numskipped && usb_debug >= 2)
+        if (numskipped && usb_debug >= 2 && arena->base)
             fprintf(stderr, "skipped %d class/vendor specific endpoint descriptors\n", numskipped);
 
         /* Copy any unknown descriptors into a storage area for */
@@ -400,21 +546,26 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
             /* FIXME: We should realloc and append here */
             if (!config->extralen)
             {
-                config->extra = malloc(len);
-                if (!config->extra)
-                {
-                    if (usb_debug >= 1)
-                        fprintf(stderr, "couldn't allocate memory for config extra descriptors\n");
-                    config->extralen = 0;
-                    return -1;
-                }
+                config->extra = usb_arena_alloc(arena, len);
+                if (config->extra)
+                    memcpy(config->extra, begin, len);
 
-                memcpy(config->extra, begin, len);
+                /* also set when counting, so only the first block is */
+                /* accounted for */
                 config->extralen = len;
             }
         }
 
-        retval = usb_parse_interface(config->interface + i, buffer, size);
+        if (arena->base)
+        {
+            retval = usb_parse_interface(arena, i, config->interface + i, buffer, size);
+        }
+        else
+        {
+            memset(&interface_count, 0, sizeof(interface_count));
+            retval = usb_parse_interface(arena, i, &interface_count, buffer, size);
+        }
+
         if (retval < 0)
             return retval;
 
@@ -425,49 +576,61 @@ int usb_parse_configuration(struct usb_config_descriptor *config,
     return size;
 }
 
-void usb_destroy_configuration(struct usb_device *dev)
+int usb_parse_configuration(struct usb_config_descriptor *config,
+                            unsigned char *buffer)
 {
-    int c, i, j, k;
+    struct usb_desc_arena arena;
+    int i;
 
-    if (!dev->config)
-        return;
+    usb_parse_config_descriptor(buffer, config);
 
-    for (c = 0; c < dev->descriptor.bNumConfigurations; c++)
+    if (config->bNumInterfaces > USB_MAXINTERFACES)
     {
-        struct usb_config_descriptor *cf = &dev->config[c];
-
-        if (!cf->interface)
-            continue;
-
-        for (i = 0; i < cf->bNumInterfaces; i++)
-        {
-            struct usb_interface *ifp = &cf->interface[i];
+        if (usb_debug >= 1)
+            fprintf(stderr, "too many interfaces\n");
+        return -1;
+    }
 
-            if (!ifp->altsetting)
-                continue;
+    /* counting pass; a parse error is reported by the build pass, which */
+    /* stops at the same place and leaves the same partial tree */
+    memset(&arena, 0, sizeof(arena));
+    usb_parse_configuration_arena(&arena, config, buffer);
 
-            for (j = 0; j < ifp->num_altsetting; j++)
-            {
-                struct usb_interface_descriptor *as = &ifp->altsetting[j];
+    /* the alternate setting arrays are sized once they are counted */
+    for (i = 0; i < config->bNumInterfaces; i++)
+    {
+        arena.used += USB_DESC_ARENA_ALIGN(arena.num_altsetting[i] *
+                                           (int)sizeof(struct usb_interface_descriptor));
+    }
 
-                if (as->extra)
-                    free(as->extra);
+    arena.size = arena.used ? arena.used : 1;
+    arena.used = 0;
+    arena.base = malloc(arena.size);
+    if (!arena.base)
+    {
+        if (usb_debug >= 1)
+            fprintf(stderr, "out of memory\n");
+        config->interface = NULL;
+        config->extra = NULL;
+        config->extralen = 0;
+        return -1;
+    }
 
-                if (!as->endpoint)
-                    continue;
+    return usb_parse_configuration_arena(&arena, config, buffer);
+}
 
-                for (k = 0; k < as->bNumEndpoints; k++)
-                {
-                    if (as->endpoint[k].extra)
-                        free(as->endpoint[k].extra);
-                }
-                free(as->endpoint);
-            }
+void usb_destroy_configuration(struct usb_device *dev)
+{
+    int c;
 
-            free(ifp->altsetting);
-        }
+    if (!dev->config)
+        return;
 
-        free(cf->interface);
+    /* the interface array is the start of the configuration's arena */
+    for (c = 0; c < dev->descriptor.bNumConfigurations; c++)
+    {
+        if (dev->config[c].interface)
+            free(dev->config[c].interface);
     }
 
     free(dev->config);
@@ -476,6 +639,8 @@ void usb_destroy_configuration(struct usb_device *dev)
 void usb_fetch_and_parse_descriptors(usb_dev_handle *udev)
 {
     struct usb_device *dev = udev->device;
+    unsigned char *cache_data = NULL;
+    int cache_size = 0;
     int i;
 
     if (dev->descriptor.bNumConfigurations > USB_MAXCONFIG)
@@ -505,7 +670,7 @@ void usb_fetch_and_parse_descriptors(usb_dev_handle *udev)
 
     for (i = 0; i < dev->descriptor.bNumConfigurations; i++)
     {
-        unsigned char buffer[USB_DT_CONFIG_SIZE], *bigbuffer;
+        unsigned char buffer[USB_DT_CONFIG_SIZE], *bigbuffer, *tmp;
         struct usb_config_descriptor config;
         int res;
 
@@ -524,7 +689,7 @@ void usb_fetch_and_parse_descriptors(usb_dev_handle *udev)
             goto err;
         }
 
-        usb_parse_descriptor(buffer, "bbw", &config);
+        usb_parse_config_descriptor(buffer, &config);
 
         bigbuffer = malloc(config.wTotalLength);
         if (!bigbuffer)
@@ -559,14 +724,324 @@ void usb_fetch_and_parse_descriptors(usb_dev_handle *udev)
                 fprintf(stderr, "Unable to parse descriptors\n");
         }
 
+        /* keep the raw descriptor for the descriptor cache */
+        tmp = realloc(cache_data, cache_size + config.wTotalLength);
+        if (tmp)
+        {
+            memcpy(tmp + cache_size, bigbuffer, config.wTotalLength);
+            cache_data = tmp;
+            cache_size += config.wTotalLength;
+        }
+        else
+        {
+            free(cache_data);
+            cache_data = NULL;
+            cache_size = 0;
+        }
+
         free(bigbuffer);
     }
 
+    if (cache_data)
+        usb_desc_cache_insert(dev, cache_data, cache_size);
+
     return;
 
 err:
-    free(dev->config);
+    if (cache_data)
+        free(cache_data);
+
+    usb_destroy_configuration(dev);
 
     dev->config = NULL;
 }
 
+
+/*
+ * Process wide descriptor cache
+ *
+ * The raw configuration descriptors of every device are kept by device
+ * node name and validated against the device descriptor, which is read on
+ * every bus scan anyway, and against the 9 byte header of each of the
+ * device's configurations, as node names are reused when devices are
+ * replugged. A device whose device descriptor and configuration headers
+ * did not change is only asked for the headers, not for its full
+ * configuration descriptors. If the USB_DESC_CACHE environment
+ * variable names a file, the cache is loaded from it by usb_init() and
+ * written back after each bus scan that changed it.
+ */
+
+#define USB_DESC_CACHE_MAX_ENTRIES  128
+#define USB_DESC_CACHE_MAGIC        "LUSBDC01"
+#define USB_DESC_CACHE_MAGIC_SIZE   8
+#define USB_DESC_CACHE_MAX_SIZE     (USB_MAXCONFIG * 0x10000)
+
+struct usb_desc_cache_entry
+{
+    struct usb_desc_cache_entry *next, *prev;
+
+    char filename[LIBUSB_PATH_MAX];
+    struct usb_device_descriptor descriptor;
+
+    /* all configuration descriptors, back to back */
+    int size;
+    unsigned char *data;
+};
+
+struct usb_desc_cache_record
+{
+    unsigned short filename_length;
+    unsigned short descriptor_length;
+    int size;
+};
+
+static struct usb_desc_cache_entry *usb_desc_cache = NULL;
+static int usb_desc_cache_entries = 0;
+static int usb_desc_cache_dirty = 0;
+static char *usb_desc_cache_path = NULL;
+
+static struct usb_desc_cache_entry *usb_desc_cache_find(const char *filename)
+{
+    struct usb_desc_cache_entry *entry;
+
+    for (entry = usb_desc_cache; entry; entry = entry->next)
+    {
+        if (!strcmp(entry->filename, filename))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void usb_desc_cache_remove(struct usb_desc_cache_entry *entry)
+{
+    LIST_DEL(usb_desc_cache, entry);
+    usb_desc_cache_entries--;
+    usb_desc_cache_dirty = 1;
+
+    free(entry->data);
+    free(entry);
+}
+
+static int usb_desc_cache_add(const char *filename,
+                              struct usb_device_descriptor *descriptor,
+                              unsigned char *data, int size)
+{
+    struct usb_desc_cache_entry *entry, *last;
+
+    entry = usb_desc_cache_find(filename);
+    if (entry)
+        usb_desc_cache_remove(entry);
+
+    /* evict the least recently added device */
+    if (usb_desc_cache_entries >= USB_DESC_CACHE_MAX_ENTRIES)
+    {
+        for (last = usb_desc_cache; last->next; last = last->next)
+            ;
+        usb_desc_cache_remove(last);
+    }
+
+    entry = malloc(sizeof(*entry));
+    if (!entry)
+    {
+        free(data);
+        return -ENOMEM;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->filename, filename, sizeof(entry->filename) - 1);
+    memcpy(&entry->descriptor, descriptor, sizeof(entry->descriptor));
+    entry->data = data;
+    entry->size = size;
+
+    LIST_ADD(usb_desc_cache, entry);
+    usb_desc_cache_entries++;
+    usb_desc_cache_dirty = 1;
+
+    return 0;
+}
+
+void usb_desc_cache_insert(struct usb_device *dev, unsigned char *data,
+                           int size)
+{
+    usb_desc_cache_add(dev->filename, &dev->descriptor, data, size);
+}
+
+int usb_desc_cache_fetch(usb_dev_handle *udev)
+{
+    struct usb_device *dev = udev->device;
+    struct usb_desc_cache_entry *entry;
+    struct usb_config_descriptor config;
+    unsigned char header[USB_DT_CONFIG_SIZE];
+    int i, res, offset = 0;
+
+    entry = usb_desc_cache_find(dev->filename);
+    if (!entry)
+        return -ENOENT;
+
+    /* the device behind this node changed, forget the old one */
+    if (memcmp(&entry->descriptor, &dev->descriptor,
+               sizeof(dev->descriptor)))
+    {
+        usb_desc_cache_remove(entry);
+        return -ENOENT;
+    }
+
+    if (dev->descriptor.bNumConfigurations < 1
+            || dev->descriptor.bNumConfigurations > USB_MAXCONFIG)
+        return -EINVAL;
+
+    /* node names are reused and a different device of the same model can */
+    /* have the same device descriptor, the configuration headers of the */
+    /* device, wTotalLength included, must match the cached ones as well */
+    for (i = 0; i < dev->descriptor.bNumConfigurations; i++)
+    {
+        if (entry->size - offset < USB_DT_CONFIG_SIZE)
+            break;
+
+        usb_parse_config_descriptor(entry->data + offset, &config);
+
+        if (config.wTotalLength < USB_DT_CONFIG_SIZE
+                || config.wTotalLength > entry->size - offset)
+            break;
+
+        res = usb_get_descriptor(udev, USB_DT_CONFIG, (unsigned char)i,
+                                 header, USB_DT_CONFIG_SIZE);
+        if (res != USB_DT_CONFIG_SIZE
+                || memcmp(header, entry->data + offset, USB_DT_CONFIG_SIZE))
+        {
+            if (usb_debug >= 2)
+                fprintf(stderr, "Configuration %d of %s changed\n", i,
+                        dev->filename);
+
+            usb_desc_cache_remove(entry);
+            return -ENOENT;
+        }
+
+        offset += config.wTotalLength;
+    }
+
+    if (i < dev->descriptor.bNumConfigurations)
+    {
+        if (usb_debug >= 1)
+            fprintf(stderr, "Dropping corrupt descriptor cache entry for %s\n",
+                    dev->filename);
+
+        usb_desc_cache_remove(entry);
+        return -EINVAL;
+    }
+
+    dev->config = malloc(dev->descriptor.bNumConfigurations
+                         * sizeof(struct usb_config_descriptor));
+    if (!dev->config)
+        return -ENOMEM;
+
+    memset(dev->config, 0, dev->descriptor.bNumConfigurations
+           * sizeof(struct usb_config_descriptor));
+
+    for (i = 0, offset = 0; i < dev->descriptor.bNumConfigurations; i++)
+    {
+        usb_parse_configuration(&dev->config[i], entry->data + offset);
+        offset += dev->config[i].wTotalLength;
+    }
+
+    return 0;
+}
+
+void usb_desc_cache_init(const char *path)
+{
+    FILE *file;
+    char magic[USB_DESC_CACHE_MAGIC_SIZE];
+    char filename[LIBUSB_PATH_MAX];
+    struct usb_device_descriptor descriptor;
+    struct usb_desc_cache_record record;
+    unsigned char *data;
+
+    if (usb_desc_cache_path || !path || !*path)
+        return;
+
+    usb_desc_cache_path = _strdup(path);
+
+    file = fopen(path, "rb");
+    if (!file)
+        return;
+
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+            || memcmp(magic, USB_DESC_CACHE_MAGIC, sizeof(magic)))
+    {
+        if (usb_debug >= 1)
+            fprintf(stderr, "Ignoring invalid descriptor cache file %s\n",
+                    path);
+        fclose(file);
+        return;
+    }
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (!record.filename_length
+                || record.filename_length >= LIBUSB_PATH_MAX
+                || record.descriptor_length != sizeof(descriptor)
+                || record.size < USB_DT_CONFIG_SIZE
+                || record.size > USB_DESC_CACHE_MAX_SIZE)
+            break;
+
+        memset(filename, 0, sizeof(filename));
+        if (fread(filename, 1, record.filename_length, file)
+                != record.filename_length)
+            break;
+
+        if (fread(&descriptor, sizeof(descriptor), 1, file) != 1)
+            break;
+
+        data = malloc(record.size);
+        if (!data)
+            break;
+
+        if (fread(data, 1, record.size, file) != (size_t)record.size)
+        {
+            free(data);
+            break;
+        }
+
+        usb_desc_cache_add(filename, &descriptor, data, record.size);
+    }
+
+    fclose(file);
+    usb_desc_cache_dirty = 0;
+}
+
+void usb_desc_cache_flush(void)
+{
+    FILE *file;
+    struct usb_desc_cache_entry *entry;
+    struct usb_desc_cache_record record;
+
+    if (!usb_desc_cache_path || !usb_desc_cache_dirty)
+        return;
+
+    file = fopen(usb_desc_cache_path, "wb");
+    if (!file)
+    {
+        if (usb_debug >= 1)
+            fprintf(stderr, "Unable to write descriptor cache file %s\n",
+                    usb_desc_cache_path);
+        return;
+    }
+
+    fwrite(USB_DESC_CACHE_MAGIC, 1, USB_DESC_CACHE_MAGIC_SIZE, file);
+
+    for (entry = usb_desc_cache; entry; entry = entry->next)
+    {
+        record.filename_length = (unsigned short)strlen(entry->filename);
+        record.descriptor_length = sizeof(entry->descriptor);
+        record.size = entry->size;
+
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(entry->filename, 1, record.filename_length, file);
+        fwrite(&entry->descriptor, sizeof(entry->descriptor), 1, file);
+        fwrite(entry->data, 1, entry->size, file);
+    }
+
+    fclose(file);
+    usb_desc_cache_dirty = 0;
+}
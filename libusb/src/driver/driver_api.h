@@ -178,15 +178,45 @@ enum
 #define LIBUSB_IOCTL_RESET_DEVICE_EX CTL_CODE(FILE_DEVICE_UNKNOWN,\
 0x817, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+// returns the current bus frame number as an unsigned int
+#define LIBUSB_IOCTL_GET_CURRENT_FRAME CTL_CODE(FILE_DEVICE_UNKNOWN,\
+0x818, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+// isochronous read or write (by endpoint direction) that also returns
+// the result of every packet, see libusb_iso_packet_result_t
+#define LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX CTL_CODE(FILE_DEVICE_UNKNOWN,\
+0x819, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
 #include <pshpack1.h>
 
 enum LIBUSB0_TRANSFER_FLAGS
 {
 	TRANSFER_FLAGS_SHORT_NOT_OK = 1 << 0,
+	// iso_start_frame_latency holds the absolute start frame number
+	// (requires TRANSFER_FLAGS_ISO_SET_START_FRAME)
+	TRANSFER_FLAGS_ISO_ABSOLUTE_START_FRAME = 1 << 29,
 	TRANSFER_FLAGS_ISO_SET_START_FRAME = 1 << 30,
 	TRANSFER_FLAGS_ISO_ADD_LATENCY = 1 << 31,
 };
 
+// The transfer buffer of LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX holds the
+// packet data, followed by one libusb_iso_packet_result_t per packet and
+// a libusb_iso_transfer_info_t.  The caller sets packet_count, the driver
+// fills in everything else when the transfer completes.
+typedef struct
+{
+	unsigned int offset;	// offset of the packet in the packet data
+	unsigned int length;	// bytes transferred
+	unsigned int status;	// USBD status of the packet, 0 on success
+} libusb_iso_packet_result_t;
+
+typedef struct
+{
+	unsigned int packet_count;
+	unsigned int start_frame;	// frame of the first packet
+	unsigned int error_count;	// number of failed packets
+} libusb_iso_transfer_info_t;
+
 /*
 typedef struct
 {
@@ -0,0 +1,97 @@
+/* libusb-win32, Generic Windows USB Library
+ * Copyright (c) 2002-2005 Stephan Meyer <ste_meyer@web.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include "endpoint_map.h"
+
+#define ENDPOINT_MAP_DIR_MASK 0x80
+#define ENDPOINT_MAP_NUMBER_MASK 0x0F
+
+int endpoint_map_index(int address)
+{
+    if (address & ~(ENDPOINT_MAP_DIR_MASK | ENDPOINT_MAP_NUMBER_MASK))
+    {
+        return -1;
+    }
+
+    return ((address & ENDPOINT_MAP_DIR_MASK) >> 3)
+        | (address & ENDPOINT_MAP_NUMBER_MASK);
+}
+
+void endpoint_map_clear(endpoint_map_t map)
+{
+    memset(map, 0, sizeof(endpoint_map_t));
+}
+
+int endpoint_map_add(endpoint_map_t map, int address, void *entry)
+{
+    int index = endpoint_map_index(address);
+
+    if (index < 0 || map[index])
+    {
+        return 0;
+    }
+
+    map[index] = entry;
+    return 1;
+}
+
+void *endpoint_map_lookup(endpoint_map_t map, int address)
+{
+    int index = endpoint_map_index(address);
+
+    if (index < 0)
+    {
+        return NULL;
+    }
+
+    return ((void *volatile *)map)[index];
+}
+
+void endpoint_map_publish(endpoint_map_t dst, endpoint_map_t src,
+                          endpoint_map_exchange_t exchange)
+{
+    int index;
+
+    for (index = 0; index < LIBUSB_ENDPOINT_MAP_SIZE; index++)
+    {
+        if (dst[index] != src[index])
+        {
+            exchange((void *volatile *)&dst[index], src[index]);
+        }
+    }
+}
+
+void endpoint_map_unpublish(endpoint_map_t map, const void *begin,
+                            const void *end,
+                            endpoint_map_exchange_t exchange)
+{
+    int index;
+    const char *entry;
+
+    for (index = 0; index < LIBUSB_ENDPOINT_MAP_SIZE; index++)
+    {
+        entry = map[index];
+
+        if (entry && entry >= (const char *)begin
+                && entry < (const char *)end)
+        {
+            exchange((void *volatile *)&map[index], NULL);
+        }
+    }
+}
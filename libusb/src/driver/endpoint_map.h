@@ -0,0 +1,59 @@
+/* libusb-win32, Generic Windows USB Library
+ * Copyright (c) 2002-2005 Stephan Meyer <ste_meyer@web.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ENDPOINT_MAP_H__
+#define __ENDPOINT_MAP_H__
+
+/* Endpoint address to pipe lookup table of the driver. It uses no DDK
+ * types, so it can be built and tested on any host. Entries are opaque
+ * pointers, the driver stores its libusb_endpoint_t entries. */
+
+/* direction bit and endpoint number, 0x00-0x0F OUT and 0x10-0x1F IN */
+#define LIBUSB_ENDPOINT_MAP_SIZE 32
+
+typedef void *endpoint_map_t[LIBUSB_ENDPOINT_MAP_SIZE];
+
+/* atomically replaces '*entry' with 'value', returns the old value */
+typedef void *(*endpoint_map_exchange_t)(void *volatile *entry, void *value);
+
+/* returns the table index of an endpoint address, -1 if the address has
+ * bits set other than the direction bit and the endpoint number */
+int endpoint_map_index(int address);
+
+void endpoint_map_clear(endpoint_map_t map);
+
+/* adds an entry unless its address is invalid or already taken, the first
+ * entry added for an address wins; returns nonzero if it was added */
+int endpoint_map_add(endpoint_map_t map, int address, void *entry);
+
+/* returns the entry of an address, NULL if there is none */
+void *endpoint_map_lookup(endpoint_map_t map, int address);
+
+/* stores the entries of 'src' in 'dst' one by one, a concurrent lookup
+ * finds either the old or the new entry of an address, never a cleared
+ * table */
+void endpoint_map_publish(endpoint_map_t dst, endpoint_map_t src,
+                          endpoint_map_exchange_t exchange);
+
+/* removes the entries of 'map' that point into [begin, end), before the
+ * memory they point to is changed */
+void endpoint_map_unpublish(endpoint_map_t map, const void *begin,
+                            const void *end,
+                            endpoint_map_exchange_t exchange);
+
+#endif
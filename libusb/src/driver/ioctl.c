@@ -82,7 +82,8 @@
 	request->endpoint.transfer_flags,				\
 	request->endpoint.iso_start_frame_latency,		\
 	transfer_buffer_mdl,							\
-	transfer_buffer_length);						\
+	transfer_buffer_length,							\
+	iso_results);									\
 	else											\
 	/* normal transfer */							\
 	return transfer(dev, irp,						\
@@ -93,7 +94,8 @@
 	request->endpoint.transfer_flags,				\
 	request->endpoint.iso_start_frame_latency,		\
 	transfer_buffer_mdl,							\
-	transfer_buffer_length);
+	transfer_buffer_length,							\
+	iso_results);
 
 NTSTATUS dispatch_ioctl(libusb_device_t *dev, IRP *irp)
 {
@@ -117,6 +119,10 @@ NTSTATUS dispatch_ioctl(libusb_device_t *dev, IRP *irp)
 	const char* dispCtlCode		 = NULL;
 	int urbFunction				 = -1;
 	int usbdDirection			 = -1;
+	libusb_iso_packet_result_t *iso_results = NULL;
+	libusb_iso_transfer_info_t *iso_info;
+	char *iso_buffer;
+	ULONG iso_packets, iso_results_size, iso_packet_size;
 
 	status = remove_lock_acquire(dev);
 
@@ -247,8 +253,9 @@ IoctlIsochronousRead:
 		urbFunction = URB_FUNCTION_ISOCH_TRANSFER;
 		usbdDirection = USBD_TRANSFER_DIRECTION_IN;
 
-		// Do not use large transfers/splitting for ISO.
-		maxTransferSize = 0x7fffffff;
+		// requests above the packets per urb limit are split into stages
+		maxTransferSize = get_iso_max_transfer_size(dev, pipe_info,
+			request->endpoint.packet_size, request->endpoint.max_transfer_size);
 
 		// ensure that the urb function and direction we set matches the
 		// pipe information
@@ -288,8 +295,85 @@ IoctlIsochronousWrite:
 		usbdDirection = USBD_TRANSFER_DIRECTION_OUT;
 		TRANSFER_IOCTL_CHECK_FUNCTION_AND_DIRECTION();
 
-		// Do not use large transfers/splitting for ISO.
-		maxTransferSize = 0x7fffffff;
+		// requests above the packets per urb limit are split into stages
+		maxTransferSize = get_iso_max_transfer_size(dev, pipe_info,
+			request->endpoint.packet_size, request->endpoint.max_transfer_size);
+
+		// ensure that the urb function and direction we set matches the
+		// pipe information
+		//
+		TRANSFER_IOCTL_CHECK_FUNCTION_AND_DIRECTION();
+
+		TRANSFER_IOCTL_EXECUTE();
+
+	case LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX:
+
+		dispCtlCode = "ISOCHRONOUS_TRANSFER_EX";
+
+		// check if the request and buffer is valid
+		if (!request || !transfer_buffer_mdl || input_buffer_length < sizeof(libusb_request)
+			|| transfer_buffer_length <= sizeof(libusb_iso_transfer_info_t))
+		{
+			USBERR("%s: invalid transfer request\n", dispCtlCode);
+			status = STATUS_INVALID_PARAMETER;
+			goto IOCTL_Done;
+		}
+
+		// check if the pipe exists and get the pipe information
+		TRANSFER_IOCTL_GET_PIPEINFO();
+
+		// must be an isochronous endpoint
+		if (!IS_ISOC_PIPE(pipe_info))
+		{
+			USBERR("%s: incorrect pipe type: %02Xh\n", 
+				dispCtlCode, pipe_info->pipe_type);
+			status = STATUS_INVALID_PARAMETER;
+			goto IOCTL_Done;
+		}
+
+		iso_buffer = MmGetSystemAddressForMdlSafe(transfer_buffer_mdl, NormalPagePriority);
+		if (!iso_buffer)
+		{
+			USBERR("%s: failed mapping the transfer buffer\n", dispCtlCode);
+			status = STATUS_INSUFFICIENT_RESOURCES;
+			goto IOCTL_Done;
+		}
+
+		// the packet results and the transfer info follow the packet data,
+		// which must be exactly packet_count packets
+		iso_info = (libusb_iso_transfer_info_t*)
+			(iso_buffer + transfer_buffer_length - sizeof(libusb_iso_transfer_info_t));
+		iso_packets = iso_info->packet_count;
+		iso_results_size = iso_packets * sizeof(libusb_iso_packet_result_t);
+		iso_packet_size = request->endpoint.packet_size ? request->endpoint.packet_size :
+			pipe_info->bytes_per_interval;
+
+		if (!iso_packets
+			|| iso_packets > (transfer_buffer_length - sizeof(libusb_iso_transfer_info_t))
+				/ sizeof(libusb_iso_packet_result_t)
+			|| iso_results_size >= transfer_buffer_length - sizeof(libusb_iso_transfer_info_t)
+			|| transfer_buffer_length - sizeof(libusb_iso_transfer_info_t) - iso_results_size
+				!= (ULONGLONG)iso_packets * iso_packet_size)
+		{
+			USBERR("%s: buffer length %d does not match %d packets of %d bytes\n",
+				dispCtlCode, transfer_buffer_length, iso_packets, iso_packet_size);
+			status = STATUS_INVALID_PARAMETER;
+			goto IOCTL_Done;
+		}
+
+		transfer_buffer_length -= sizeof(libusb_iso_transfer_info_t) + iso_results_size;
+		iso_results = (libusb_iso_packet_result_t*)(iso_buffer + transfer_buffer_length);
+		RtlZeroMemory(iso_results, iso_results_size);
+		iso_info->start_frame = 0;
+		iso_info->error_count = 0;
+
+		urbFunction = URB_FUNCTION_ISOCH_TRANSFER;
+		usbdDirection = (request->endpoint.endpoint & 0x80) ?
+			USBD_TRANSFER_DIRECTION_IN : USBD_TRANSFER_DIRECTION_OUT;
+
+		// requests above the packets per urb limit are split into stages
+		maxTransferSize = get_iso_max_transfer_size(dev, pipe_info,
+			request->endpoint.packet_size, request->endpoint.max_transfer_size);
 
 		// ensure that the urb function and direction we set matches the
 		// pipe information
@@ -507,6 +591,19 @@ NULL : input_buffer + sizeof(libusb_request),
 		status = reset_device_ex(dev, request->timeout, request->reset_ex.reset_type);
 		break;
 
+	case LIBUSB_IOCTL_GET_CURRENT_FRAME:
+
+		if (!output_buffer || output_buffer_length < sizeof(ULONG))
+		{
+			USBERR0("get_current_frame: invalid output buffer\n");
+			status = STATUS_INVALID_PARAMETER;
+			break;
+		}
+
+		*((ULONG*)output_buffer) = get_current_frame(dev, irp);
+		ret = sizeof(ULONG);
+		break;
+
 	case LIBUSB_IOCTL_SET_DEBUG_LEVEL:
 		usb_log_set_level(request->debug.level);
 		break;
@@ -589,7 +686,22 @@ NULL : input_buffer + sizeof(libusb_request),
 		break;
 
 	case LIBUSB_IOCTL_QUERY_DEVICE_INFORMATION:	// METHOD_BUFFERED (QUERY_DEVICE_INFORMATION)
-		status = STATUS_NOT_IMPLEMENTED;
+		if (request->query_device.information_type != DEVICE_SPEED)
+		{
+			status = STATUS_NOT_IMPLEMENTED;
+			break;
+		}
+		if (!output_buffer || output_buffer_length < sizeof(ULONG))
+		{
+			USBERR0("query_device_information: invalid output buffer\n");
+			status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+		// full speed is reported for low speed devices as well, as the
+		// driver only tells high speed apart
+		*((PULONG)output_buffer) = dev->is_high_speed ? HighSpeed : FullSpeed;
+		ret = sizeof(ULONG);
+		status = STATUS_SUCCESS;
 		break;
 
 	case LIBUSB_IOCTL_SET_PIPE_POLICY:			// METHOD_BUFFERED (SET_PIPE_POLICY)
@@ -680,7 +792,7 @@ NULL : input_buffer + sizeof(libusb_request),
 			transfer_buffer_length,
 			USBD_TRANSFER_DIRECTION_OUT,
 			&ret,
-			dev->control_write_timeout,
+			request->timeout ? request->timeout : dev->control_write_timeout,
 			request->control.RequestType,
 			request->control.Request,
 			request->control.Value,
@@ -705,7 +817,7 @@ NULL : input_buffer + sizeof(libusb_request),
 			transfer_buffer_length,
 			USBD_TRANSFER_DIRECTION_IN,
 			&ret,
-			dev->control_read_timeout,
+			request->timeout ? request->timeout : dev->control_read_timeout,
 			request->control.RequestType,
 			request->control.Request,
 			request->control.Value,
@@ -0,0 +1,95 @@
+/* libusb-win32, Generic Windows USB Library
+ * Copyright (c) 2002-2005 Stephan Meyer <ste_meyer@web.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "iso_stage.h"
+
+#define ISO_STAGE_MAX_SIZE 0x7fffffff
+
+/*-----------------------------------------------------------------------------
+get_iso_stage_policy() selects the urb limits for the device speed and
+get_iso_stagesize() returns the size of the next stage for the remaining
+transfer length.  Both are pure functions of their arguments.
+
+Full speed stages carry at most 255 packets.  High speed stages carry
+at most 1024 packets and, unless it is the final stage, a multiple of 8
+so every urb starts on a frame boundary.  Stages are always whole
+packets and are limited to maxTransferSize where possible.
+*/
+void get_iso_stage_policy(int high_speed, int packet_size,
+						  libusb_iso_stage_policy_t *policy)
+{
+	policy->packet_size = packet_size;
+
+	if (high_speed)
+	{
+		policy->max_packets = LIBUSB_MAX_ISO_PACKETS_HIGH_SPEED;
+		policy->packet_align = LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED;
+	}
+	else
+	{
+		policy->max_packets = LIBUSB_MAX_ISO_PACKETS_FULL_SPEED;
+		policy->packet_align = 1;
+	}
+}
+
+int get_iso_stagesize(int total_length, int max_transfer_size,
+					  const libusb_iso_stage_policy_t *policy)
+{
+	int packets;
+
+	if (policy->packet_size <= 0)
+		return total_length;
+
+	packets = policy->max_packets;
+
+	if (max_transfer_size > 0 && max_transfer_size / policy->packet_size < packets)
+		packets = max_transfer_size / policy->packet_size;
+
+	// a stage is at least one full frame, even if this exceeds the
+	// maximum transfer size
+	packets -= packets % policy->packet_align;
+	if (packets <= 0)
+		packets = policy->packet_align;
+
+	if (total_length > packets * policy->packet_size)
+		return packets * policy->packet_size;
+
+	return total_length;
+}
+
+int get_iso_urb_max_transfer_size(int high_speed, int packet_size,
+								  int req_max_transfer_size)
+{
+	int max_packets = high_speed ? LIBUSB_MAX_ISO_PACKETS_HIGH_SPEED
+		: LIBUSB_MAX_ISO_PACKETS_FULL_SPEED;
+	int max_transfer_size;
+
+	// transfer() rejects invalid packet sizes
+	if (packet_size <= 0)
+		return ISO_STAGE_MAX_SIZE;
+
+	if (packet_size > ISO_STAGE_MAX_SIZE / max_packets)
+		max_transfer_size = ISO_STAGE_MAX_SIZE;
+	else
+		max_transfer_size = packet_size * max_packets;
+
+	if (req_max_transfer_size > 0 && req_max_transfer_size < max_transfer_size)
+		max_transfer_size = req_max_transfer_size;
+
+	return max_transfer_size;
+}
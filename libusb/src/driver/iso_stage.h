@@ -0,0 +1,54 @@
+/* libusb-win32, Generic Windows USB Library
+ * Copyright (c) 2002-2005 Stephan Meyer <ste_meyer@web.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ISO_STAGE_H__
+#define __ISO_STAGE_H__
+
+/* Iso stage planning of the driver. It uses no DDK types, so it can be
+ * built and tested on any host. */
+
+/* iso packets per urb accepted by the host controller drivers */
+#define LIBUSB_MAX_ISO_PACKETS_FULL_SPEED 255
+#define LIBUSB_MAX_ISO_PACKETS_HIGH_SPEED 1024
+/* high speed iso urbs must span whole frames (8 microframes) */
+#define LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED 8
+/* bytes per service interval of an endpoint descriptor, bits 11-12 of
+ * wMaxPacketSize hold the number of additional high bandwidth transactions.
+ * Only valid for the raw descriptor value; the pipe information may already
+ * report the total. */
+#define LIBUSB_ISO_BYTES_PER_INTERVAL(max_packet_size) \
+	(((max_packet_size) & 0x7FF) * ((((max_packet_size) >> 11) & 3) + 1))
+
+typedef struct
+{
+	int packet_size;  /* bytes per iso packet */
+	int max_packets;  /* packets per urb */
+	int packet_align; /* packets per urb are a multiple of this */
+} libusb_iso_stage_policy_t;
+
+void get_iso_stage_policy(int high_speed, int packet_size,
+						  libusb_iso_stage_policy_t *policy);
+int get_iso_stagesize(int total_length, int max_transfer_size,
+					  const libusb_iso_stage_policy_t *policy);
+
+/* the largest request of 'packet_size' packets one urb takes, limited to
+ * 'req_max_transfer_size' if that is positive */
+int get_iso_urb_max_transfer_size(int high_speed, int packet_size,
+								  int req_max_transfer_size);
+
+#endif
@@ -362,6 +362,8 @@ NTSTATUS DDKAPI add_device(DRIVER_OBJECT *driver_object,
         return STATUS_NO_SUCH_DEVICE;
     }
 
+	transfer_pool_initialize(dev);
+
 	if (dev->is_filter)
     {
 		USBDBG("[filter-mode] id=#%d %s\n",dev->id, dev->device_id);
@@ -529,63 +531,170 @@ bool_t accept_irp(libusb_device_t *dev, IRP *irp)
 	return FALSE;
 }
 
+// USB_BUS_INTERFACE_USBDI_GUID, version 1 of the usbdi bus interface
+// (usbbusif.h).  Only the members used here are typed.
+//
+static const GUID usbdi_bus_interface_guid =
+{ 0xb1a96a13, 0x3de0, 0x4574, { 0x9b, 0x01, 0xc0, 0x8f, 0xea, 0xb3, 0x18, 0xd6 } };
+
+#define USBDI_BUS_INTERFACE_VERSION_1 0x0001
+
+typedef BOOLEAN (__stdcall *usbdi_is_device_high_speed_t)(PVOID bus_context);
+
+typedef struct
+{
+	USHORT Size;
+	USHORT Version;
+	PVOID BusContext;
+	PINTERFACE_REFERENCE InterfaceReference;
+	PINTERFACE_DEREFERENCE InterfaceDereference;
+	PVOID GetUSBDIVersion;
+	PVOID QueryBusTime;
+	PVOID SubmitIsoOutUrb;
+	PVOID QueryBusInformation;
+	usbdi_is_device_high_speed_t IsDeviceHighSpeed;
+} usbdi_bus_interface_v1_t;
+
+bool_t query_device_high_speed(libusb_device_t *dev)
+{
+	usbdi_bus_interface_v1_t bus_interface;
+	IO_STACK_LOCATION *next_irp_stack;
+	IO_STATUS_BLOCK io_status;
+	KEVENT event;
+	NTSTATUS status;
+	IRP *irp;
+	bool_t high_speed = FALSE;
+
+	KeInitializeEvent(&event, NotificationEvent, FALSE);
+
+	irp = IoBuildSynchronousFsdRequest(IRP_MJ_PNP, dev->next_stack_device,
+		NULL, 0, NULL, &event, &io_status);
+
+	if (!irp)
+	{
+		return FALSE;
+	}
+
+	memset(&bus_interface, 0, sizeof(bus_interface));
+
+	/* pnp irps must be initialized with STATUS_NOT_SUPPORTED */
+	irp->IoStatus.Status = STATUS_NOT_SUPPORTED;
+
+	next_irp_stack = IoGetNextIrpStackLocation(irp);
+	next_irp_stack->MinorFunction = IRP_MN_QUERY_INTERFACE;
+	next_irp_stack->Parameters.QueryInterface.InterfaceType = &usbdi_bus_interface_guid;
+	next_irp_stack->Parameters.QueryInterface.Size = sizeof(bus_interface);
+	next_irp_stack->Parameters.QueryInterface.Version = USBDI_BUS_INTERFACE_VERSION_1;
+	next_irp_stack->Parameters.QueryInterface.Interface = (PINTERFACE)&bus_interface;
+	next_irp_stack->Parameters.QueryInterface.InterfaceSpecificData = NULL;
+
+	status = IoCallDriver(dev->next_stack_device, irp);
+	if (status == STATUS_PENDING)
+	{
+		KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, NULL);
+		status = io_status.Status;
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		USBWRN("usbdi bus interface not available, status=%08Xh\n", status);
+		return FALSE;
+	}
+
+	if (bus_interface.IsDeviceHighSpeed)
+	{
+		high_speed = bus_interface.IsDeviceHighSpeed(bus_interface.BusContext) ? TRUE : FALSE;
+	}
+
+	if (bus_interface.InterfaceDereference)
+	{
+		bus_interface.InterfaceDereference(bus_interface.BusContext);
+	}
+
+	USBMSG("high-speed=%c %s\n", high_speed ? 'Y' : 'N', dev->device_id);
+
+	return high_speed;
+}
+
+static void update_endpoint_map(libusb_device_t *dev);
+
+static void *exchange_endpoint(void *volatile *entry, void *value)
+{
+    return InterlockedExchangePointer((PVOID volatile *)entry, value);
+}
+
 bool_t get_pipe_handle(libusb_device_t *dev, int endpoint_address,
                        USBD_PIPE_HANDLE *pipe_handle)
 {
-    int i, j;
+    libusb_endpoint_t *pipe_info;
 
     *pipe_handle = NULL;
 
-    for (i = 0; i < LIBUSB_MAX_NUMBER_OF_INTERFACES; i++)
+    if (!get_pipe_info(dev, endpoint_address, &pipe_info))
     {
-        if (dev->config.interfaces[i].valid)
-        {
-            for (j = 0; j < LIBUSB_MAX_NUMBER_OF_ENDPOINTS; j++)
-            {
-                if (dev->config.interfaces[i].endpoints[j].address
-                        == endpoint_address)
-                {
-                    *pipe_handle = dev->config.interfaces[i].endpoints[j].handle;
-
-                    return !*pipe_handle ? FALSE : TRUE;
-                }
-            }
-        }
+        return FALSE;
     }
 
-    return FALSE;
+    *pipe_handle = pipe_info->handle;
+
+    return !*pipe_handle ? FALSE : TRUE;
 }
 
 bool_t get_pipe_info(libusb_device_t *dev, int endpoint_address,
                        libusb_endpoint_t** pipe_info)
+{
+    *pipe_info = endpoint_map_lookup(dev->config.endpoint_map, endpoint_address);
+
+    /* the entry may have been looked up just before update_pipe_info() */
+    /* removed it from the map and started to change it */
+    if (!*pipe_info || !(*pipe_info)->handle
+            || (*pipe_info)->address != endpoint_address)
+    {
+        *pipe_info = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void clear_pipe_info(libusb_device_t *dev)
+{
+    endpoint_map_unpublish(dev->config.endpoint_map, dev->config.interfaces,
+                           dev->config.interfaces + LIBUSB_MAX_NUMBER_OF_INTERFACES,
+                           exchange_endpoint);
+    memset(dev->config.interfaces, 0 , sizeof(dev->config.interfaces));
+}
+
+/* Rebuilds the endpoint address lookup table used by get_pipe_info(). */
+/* This is only done when the pipe information changes, so the transfer */
+/* path doesn't have to scan all interfaces and endpoints. If an endpoint */
+/* address shows up more than once, the lowest interface number wins. */
+/* The map is built locally and then stored entry by entry, so a */
+/* concurrent lookup never sees a cleared table. */
+static void update_endpoint_map(libusb_device_t *dev)
 {
     int i, j;
+    libusb_endpoint_t *endpoint;
+    endpoint_map_t endpoint_map;
 
-    *pipe_info = NULL;
+    endpoint_map_clear(endpoint_map);
 
     for (i = 0; i < LIBUSB_MAX_NUMBER_OF_INTERFACES; i++)
     {
-        if (dev->config.interfaces[i].valid)
+        if (!dev->config.interfaces[i].valid)
+            continue;
+
+        for (j = 0; j < LIBUSB_MAX_NUMBER_OF_ENDPOINTS; j++)
         {
-            for (j = 0; j < LIBUSB_MAX_NUMBER_OF_ENDPOINTS; j++)
-            {
-                if (dev->config.interfaces[i].endpoints[j].address
-                        == endpoint_address)
-                {
-                    *pipe_info = &dev->config.interfaces[i].endpoints[j];
+            endpoint = &dev->config.interfaces[i].endpoints[j];
 
-                    return !*pipe_info ? FALSE : TRUE;
-                }
-            }
+            if (endpoint->handle)
+                endpoint_map_add(endpoint_map, endpoint->address, endpoint);
         }
     }
 
-    return FALSE;
-}
-
-void clear_pipe_info(libusb_device_t *dev)
-{
-    memset(dev->config.interfaces, 0 , sizeof(dev->config.interfaces));
+    endpoint_map_publish(dev->config.endpoint_map, endpoint_map,
+                         exchange_endpoint);
 }
 
 bool_t update_pipe_info(libusb_device_t *dev,
@@ -595,6 +704,7 @@ bool_t update_pipe_info(libusb_device_t *dev,
     int number;
 	int maxTransferSize;
 	int maxPacketSize;
+	USB_ENDPOINT_DESCRIPTOR *endpoint_desc;
 
     if (!interface_info)
     {
@@ -610,6 +720,14 @@ bool_t update_pipe_info(libusb_device_t *dev,
 
     USBMSG("interface %d\n", number);
 
+    /* lookups must not find the pipes of this interface while they */
+    /* change, update_endpoint_map() adds them again below */
+    endpoint_map_unpublish(dev->config.endpoint_map,
+                           dev->config.interfaces[number].endpoints,
+                           dev->config.interfaces[number].endpoints
+                           + LIBUSB_MAX_NUMBER_OF_ENDPOINTS,
+                           exchange_endpoint);
+
     dev->config.interfaces[number].valid = TRUE;
 
     for (i = 0; i < LIBUSB_MAX_NUMBER_OF_ENDPOINTS; i++)
@@ -667,8 +785,35 @@ bool_t update_pipe_info(libusb_device_t *dev,
 				}
 			}
 			dev->config.interfaces[number].endpoints[i].maximum_transfer_size = maxTransferSize;
+
+			// The pipe information of a high bandwidth iso endpoint may
+			// hold the raw wMaxPacketSize or the bytes per interval,
+			// depending on the host controller driver. Decode the
+			// descriptor instead.
+			dev->config.interfaces[number].endpoints[i].bytes_per_interval = maxPacketSize;
+			if ((interface_info->Pipes[i].PipeType & 3) == UsbdPipeTypeIsochronous)
+			{
+				endpoint_desc = find_endpoint_desc(dev->config.descriptor,
+					dev->config.total_size,
+					interface_info->InterfaceNumber,
+					interface_info->AlternateSetting,
+					interface_info->Pipes[i].EndpointAddress);
+				if (endpoint_desc)
+				{
+					dev->config.interfaces[number].endpoints[i].bytes_per_interval =
+						LIBUSB_ISO_BYTES_PER_INTERVAL(endpoint_desc->wMaxPacketSize);
+				}
+				else
+				{
+					USBWRN("EP%02Xh endpoint descriptor not found, using pipe packet size %d\n",
+						interface_info->Pipes[i].EndpointAddress, maxPacketSize);
+				}
+			}
 		}
 	}
+
+    update_endpoint_map(dev);
+
     return TRUE;
 }
 
@@ -909,6 +1054,51 @@ find_endpoint_desc_by_index(USB_INTERFACE_DESCRIPTOR *interface_desc,
 }
 
 
+USB_ENDPOINT_DESCRIPTOR *
+find_endpoint_desc(USB_CONFIGURATION_DESCRIPTOR *config_desc,
+                   unsigned int size, int interface_number, int altsetting,
+                   int endpoint_address)
+{
+    USB_INTERFACE_DESCRIPTOR *if_desc;
+    usb_descriptor_header_t *desc;
+    char *p;
+
+    if_desc = find_interface_desc(config_desc, size, interface_number, altsetting);
+    if (!if_desc)
+        return NULL;
+
+    size = config_desc->wTotalLength - (unsigned int)((char *)if_desc - (char *)config_desc);
+    p = (char *)if_desc;
+    desc = (usb_descriptor_header_t *)p;
+
+    // skip the interface descriptor, then search up to the next one; class
+    // specific descriptors may sit between the endpoint descriptors
+    size -= desc->length;
+    p += desc->length;
+    desc = (usb_descriptor_header_t *)p;
+
+    while (size >= sizeof(usb_descriptor_header_t) && desc->length
+            && desc->length <= size)
+    {
+        if (desc->type == USB_INTERFACE_DESCRIPTOR_TYPE)
+            break;
+
+        if (desc->type == USB_ENDPOINT_DESCRIPTOR_TYPE
+                && desc->length >= sizeof(USB_ENDPOINT_DESCRIPTOR)
+                && ((USB_ENDPOINT_DESCRIPTOR *)desc)->bEndpointAddress == (UCHAR)endpoint_address)
+        {
+            return (USB_ENDPOINT_DESCRIPTOR *)desc;
+        }
+
+        size -= desc->length;
+        p += desc->length;
+        desc = (usb_descriptor_header_t *)p;
+    }
+
+    return NULL;
+}
+
+
 ULONG get_current_frame(IN PDEVICE_EXTENSION deviceExtension, IN PIRP Irp)
 /*++
 
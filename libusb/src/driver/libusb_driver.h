@@ -44,6 +44,8 @@
 #include "driver_debug.h"
 #include "error.h"
 #include "driver_api.h"
+#include "endpoint_map.h"
+#include "iso_stage.h"
 
 /* some missing defines */
 #ifdef __GNUC__
@@ -76,6 +78,9 @@
 #define LIBUSB_MAX_NUMBER_OF_ENDPOINTS  32
 #define LIBUSB_MAX_NUMBER_OF_INTERFACES 32
 
+/* iso urb size classes of the transfer pool, largest packet count of each */
+#define LIBUSB_ISO_URB_CLASS_COUNT 5
+#define LIBUSB_ISO_URB_CLASS_PACKETS {8, 32, 128, 256, 1024}
 
 #define LIBUSB_DEFAULT_TIMEOUT 5000
 #define LIBUSB_MAX_CONTROL_TRANSFER_TIMEOUT 5000
@@ -179,8 +184,19 @@ typedef struct
     int maximum_transfer_size; // Maximum size for a single request
                                // in bytes.
     int pipe_flags;
+	int bytes_per_interval;   // Iso bytes per service interval, taken from
+	                          // the endpoint descriptor
 } libusb_endpoint_t;
 
+/* per device lookaside caches for the large_transfer() sub requests */
+typedef struct
+{
+	bool_t initialized;
+	NPAGED_LOOKASIDE_LIST sub_request;
+	NPAGED_LOOKASIDE_LIST bulk_urb;
+	NPAGED_LOOKASIDE_LIST iso_urb[LIBUSB_ISO_URB_CLASS_COUNT];
+} libusb_transfer_pool_t;
+
 typedef struct
 {
     bool_t valid;
@@ -207,6 +223,8 @@ typedef struct
         int value;
 		int index;
         libusb_interface_t interfaces[LIBUSB_MAX_NUMBER_OF_INTERFACES];
+		/* endpoint address to pipe lookup, rebuilt with the pipe info */
+		endpoint_map_t endpoint_map;
 		PUSB_CONFIGURATION_DESCRIPTOR descriptor; 
 		int total_size;
     } config;
@@ -221,6 +239,8 @@ typedef struct
 	UNICODE_STRING device_interface_name;
 	int control_read_timeout;
 	int control_write_timeout;
+	bool_t is_high_speed;
+	libusb_transfer_pool_t transfer_pool;
 } libusb_device_t, DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 
@@ -249,6 +269,8 @@ NTSTATUS pass_irp_down(libusb_device_t *dev, IRP *irp,
 
 bool_t accept_irp(libusb_device_t *dev, IRP *irp);
 
+bool_t query_device_high_speed(libusb_device_t *dev);
+
 bool_t get_pipe_handle(libusb_device_t *dev, int endpoint_address,
                        USBD_PIPE_HANDLE *pipe_handle);
 
@@ -259,6 +281,12 @@ void clear_pipe_info(libusb_device_t *dev);
 bool_t update_pipe_info(libusb_device_t *dev,
                         USBD_INTERFACE_INFORMATION *interface_info);
 
+int get_iso_max_transfer_size(libusb_device_t *dev, libusb_endpoint_t *endpoint,
+							  int packet_size, int req_max_transfer_size);
+
+void transfer_pool_initialize(libusb_device_t *dev);
+void transfer_pool_delete(libusb_device_t *dev);
+
 void remove_lock_initialize(libusb_device_t *dev);
 NTSTATUS remove_lock_acquire(libusb_device_t *dev);
 void remove_lock_release(libusb_device_t *dev);
@@ -332,6 +360,11 @@ USB_ENDPOINT_DESCRIPTOR *
 find_endpoint_desc_by_index(USB_INTERFACE_DESCRIPTOR *interface_desc,
                     unsigned int size, int pipe_index);
 
+USB_ENDPOINT_DESCRIPTOR *
+find_endpoint_desc(USB_CONFIGURATION_DESCRIPTOR *config_desc,
+                   unsigned int size, int interface_number, int altsetting,
+                   int endpoint_address);
+
 /*
 Gets a device property for the device_object.
 
@@ -360,7 +393,8 @@ NTSTATUS transfer(libusb_device_t* dev,
 				  IN int transferFlags,
 				  IN int isoLatency,
 				  IN PMDL mdlAddress,
-				  IN int totalLength);
+				  IN int totalLength,
+				  IN libusb_iso_packet_result_t* isoResults);
 
 NTSTATUS large_transfer(IN libusb_device_t* dev,
 						IN PIRP irp,
@@ -372,7 +406,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 						IN int transferFlags,
 						IN int isoLatency,
 						IN PMDL mdlAddress,
-						IN int totalLength);
+						IN int totalLength,
+						IN libusb_iso_packet_result_t* isoResults);
 
 ULONG get_current_frame(IN PDEVICE_EXTENSION dev, IN PIRP Irp);
 
@@ -89,6 +89,7 @@ NTSTATUS dispatch_pnp(libusb_device_t *dev, IRP *irp)
 			RtlFreeUnicodeString(&dev->device_interface_name);
 		}
 		UpdateContextConfigDescriptor(dev,NULL,0,0,-1);
+		transfer_pool_delete(dev);
 
         /* delete the device object */
         IoDetachDevice(dev->next_stack_device);
@@ -201,6 +202,10 @@ on_start_complete(DEVICE_OBJECT *device_object, IRP *irp, void *context)
     {
         device_object->Characteristics |= FILE_REMOVABLE_MEDIA;
     }
+
+	// the iso stage planning in large_transfer() depends on the bus speed
+	dev->is_high_speed = query_device_high_speed(dev);
+
 #ifndef SKIP_CONFIGURE_NORMAL_DEVICES
 	// select initial configuration if not a filter
 	if (!dev->is_filter && !dev->is_started)
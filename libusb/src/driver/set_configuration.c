@@ -188,11 +188,14 @@ NTSTATUS set_configuration(libusb_device_t *dev,
 
     clear_pipe_info(dev);
 
+	// update_pipe_info() reads the endpoint descriptors of the new
+	// configuration, so it must be cached first.
+	UpdateContextConfigDescriptor(dev, configuration_descriptor, desc_size, configuration_descriptor->bConfigurationValue, config_index);
+
     for (i = 0; i < configuration_descriptor->bNumInterfaces; i++)
     {
         update_pipe_info(dev, interfaces[i].Interface);
     }
-	UpdateContextConfigDescriptor(dev, configuration_descriptor, desc_size, configuration_descriptor->bConfigurationValue, config_index);
 
 SetConfigurationDone:
     if (interfaces)
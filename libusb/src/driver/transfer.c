@@ -24,10 +24,22 @@ typedef struct
 {
 	URB *urb;
 	int sequence;
+	libusb_iso_packet_result_t *iso_results;
 } context_t;
 
 static LONG sequence = 0;
 
+// Sub request array kept on the stack for transfers that need no more
+// than this many irp/urb pairs.
+#define LARGE_TRANSFER_STACK_IRPS 16
+
+static const int iso_urb_class_packets[LIBUSB_ISO_URB_CLASS_COUNT] = LIBUSB_ISO_URB_CLASS_PACKETS;
+
+// Pool a sub request urb came from, see allocate_suburb().  The iso urb
+// size classes are 0 to LIBUSB_ISO_URB_CLASS_COUNT - 1.
+#define SUBURB_POOL_BULK		(-1)
+#define SUBURB_POOL_NONPAGED	(-2)
+
 static const char* read_pipe_display_names[]  = {"ctrl-read", "iso-read", "bulk-read", "int-read"};
 static const char* write_pipe_display_names[] = {"ctrl-write","iso-write","bulk-write","int-write"};
 
@@ -87,8 +99,20 @@ typedef struct _SUB_REQUEST_CONTEXT
 	PURB        SubUrb;
 	PMDL        SubMdl;
 
+	// SUBURB_POOL_* or iso urb class SubUrb was allocated from.  The
+	// urb length can't tell, the USBD build macros rewrite it.
+	//
+	int			SubUrbPool;
+
 	ULONG		startOffset;
 
+	// Packet results of an iso stage (LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX
+	// only).  isoResults points to the result of the first packet of the
+	// stage, isoInfo is shared by all stages of the main request.
+	//
+	libusb_iso_packet_result_t* isoResults;
+	libusb_iso_transfer_info_t* isoInfo;
+
 } SUB_REQUEST_CONTEXT, *PSUB_REQUEST_CONTEXT;
 
 static const char* GetPipeDisplayName(libusb_endpoint_t* endpoint);
@@ -113,13 +137,18 @@ NTSTATUS large_transfer_complete(IN PDEVICE_OBJECT DeviceObjectIsNULL,
 								 IN PIRP irp,
 								 IN PVOID Context);
 
-static int get_iso_stagesize(int totalLength, int packetSize, int maxTransferSize);
+static PSUB_REQUEST_CONTEXT allocate_sub_request(libusb_device_t* dev);
+static void free_sub_request(libusb_device_t* dev,
+							 PSUB_REQUEST_CONTEXT subRequestContext);
 
-static NTSTATUS allocate_suburb(USHORT urbFunction,
+static NTSTATUS allocate_suburb(libusb_device_t* dev,
+								USHORT urbFunction,
 								int stageSize,
 								int packetSize,
 								ULONG* nPackets,
-								PURB* subUrbRef);
+								PURB* subUrbRef,
+								int* urbPool);
+static void free_suburb(libusb_device_t* dev, PURB subUrb, int urbPool);
 
 void set_urb_transfer_flags(libusb_device_t* dev,
 							PIRP irp,
@@ -127,6 +156,17 @@ void set_urb_transfer_flags(libusb_device_t* dev,
 							int transfer_flags,
 							int isoLatency);
 
+static ULONG get_iso_start_frame(libusb_device_t* dev,
+								 PIRP irp,
+								 int transfer_flags,
+								 int isoLatency);
+
+static ULONG get_iso_urb_frames(libusb_device_t* dev, PURB subUrb);
+
+static ULONG set_iso_packet_results(PURB subUrb,
+									ULONG dataOffset,
+									libusb_iso_packet_result_t* results);
+
 NTSTATUS transfer(libusb_device_t* dev,
 				  IN PIRP irp,
 				  IN int direction,
@@ -136,7 +176,8 @@ NTSTATUS transfer(libusb_device_t* dev,
 				  IN int transferFlags,
 				  IN int isoLatency,
 				  IN PMDL mdlAddress,
-				  IN int totalLength)
+				  IN int totalLength,
+				  IN libusb_iso_packet_result_t* isoResults)
 {
 	IO_STACK_LOCATION *stack_location = NULL;
 	context_t *context;
@@ -148,7 +189,7 @@ NTSTATUS transfer(libusb_device_t* dev,
 	// status = reset_endpoint(dev,endpoint->address, LIBUSB_DEFAULT_TIMEOUT);
 	//
 	if (!packetSize)
-		packetSize = endpoint->maximum_packet_size;
+		packetSize = endpoint->bytes_per_interval;
 
 	if (urbFunction == URB_FUNCTION_ISOCH_TRANSFER)
 	{
@@ -180,6 +221,8 @@ NTSTATUS transfer(libusb_device_t* dev,
 
 
 	context->sequence = sequenceID;
+	context->iso_results =
+		(urbFunction == URB_FUNCTION_ISOCH_TRANSFER) ? isoResults : NULL;
 
 	stack_location = IoGetNextIrpStackLocation(irp);
 
@@ -242,6 +285,15 @@ NTSTATUS DDKAPI transfer_complete(DEVICE_OBJECT *device_object, IRP *irp,
 		}
 	}
 
+	if (c->iso_results)
+	{
+		libusb_iso_transfer_info_t* info = (libusb_iso_transfer_info_t*)
+			(c->iso_results + c->urb->UrbIsochronousTransfer.NumberOfPackets);
+
+		info->start_frame = c->urb->UrbIsochronousTransfer.StartFrame;
+		info->error_count = set_iso_packet_results(c->urb, 0, c->iso_results);
+	}
+
 	ExFreePool(c->urb);
 	ExFreePool(c);
 
@@ -283,7 +335,8 @@ static NTSTATUS create_urb(libusb_device_t *dev, URB **urb, int direction,
 			return STATUS_INVALID_PARAMETER;
 		}
 
-		if (num_packets > 255)
+		if (num_packets > (dev->is_high_speed ? LIBUSB_MAX_ISO_PACKETS_HIGH_SPEED
+			: LIBUSB_MAX_ISO_PACKETS_FULL_SPEED))
 		{
 			USBERR0("transfer size too large\n");
 			return STATUS_INVALID_PARAMETER;
@@ -391,7 +444,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 						IN int transferFlags,
 						IN int isoLatency,
 						IN PMDL mdlAddress,
-						IN int totalLength)
+						IN int totalLength,
+						IN libusb_iso_packet_result_t* isoResults)
 {
 	PIO_STACK_LOCATION      irpStack;
 	BOOLEAN                 read;
@@ -399,6 +453,7 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 	ULONG                   numIrps;
 	PMAIN_REQUEST_CONTEXT   mainRequestContext;
 	PSUB_REQUEST_CONTEXT *  subRequestContextArray;
+	PSUB_REQUEST_CONTEXT    subRequestContextStack[LARGE_TRANSFER_STACK_IRPS];
 	PSUB_REQUEST_CONTEXT    subRequestContext;
 	CCHAR                   stackSize;
 	PUCHAR                  virtualAddress;
@@ -411,6 +466,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 	LONG					sequenceID;
 	const char*				dispTransfer;
 	int						startOffset;
+	libusb_iso_stage_policy_t	isoPolicy;
+	libusb_iso_transfer_info_t*	isoInfo;
 
 	// TODO: reset pipe flag 
 	// if (urbFunction != URB_FUNCTION_ISOCH_TRANSFER && pipe_flags & RESET)
@@ -432,10 +489,19 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 		maxTransferSize = endpoint->maximum_transfer_size;
 
 	if (!packetSize)
-		packetSize = endpoint->maximum_packet_size;
+		packetSize = endpoint->bytes_per_interval;
 
 	startOffset = 0;
 
+	// the transfer info follows the results of all packets
+	isoInfo = NULL;
+	if (isoResults && urbFunction == URB_FUNCTION_ISOCH_TRANSFER)
+	{
+		isoInfo = (libusb_iso_transfer_info_t*)
+			(isoResults + (totalLength + packetSize - 1) / packetSize);
+		isoInfo->error_count = 0;
+	}
+
 	read = (direction == USBD_TRANSFER_DIRECTION_IN) ? TRUE : FALSE;
 	dispTransfer = GetPipeDisplayName(endpoint);
 	pipeHandle = endpoint->handle;
@@ -444,24 +510,31 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 	stageSize = totalLength;
 	numIrps = 1;
 
-	// Full speed ISO note:
+	// ISO note:
 	// There is an inherent limit on the number of packets that can be
-	// passed down the stack with each irp/urb pair (255)
+	// passed down the stack with each irp/urb pair (255 for full speed,
+	// 1024 for high speed).  High speed urbs must also span whole
+	// frames, i.e. a multiple of 8 microframe packets.
 	//
-	// If the number of required packets is > 255, we shall create
-	// "(required-packets / 255) [+ 1]" number of irp/urb pairs.
+	// If the number of required packets is larger, we shall create
+	// "(required-packets / max-packets) [+ 1]" number of irp/urb pairs.
 	//
 	// Each irp/urb pair transfer is also called a stage transfer.
 	//
-
-	// TODO: detect and optimize for high speed devices.
-	//
 	if (urbFunction == URB_FUNCTION_ISOCH_TRANSFER)
 	{
-		stageSize = get_iso_stagesize(totalLength, packetSize, maxTransferSize);
+		get_iso_stage_policy(dev->is_high_speed, packetSize, &isoPolicy);
+		stageSize = get_iso_stagesize(totalLength, maxTransferSize, &isoPolicy);
 		numIrps = (totalLength + stageSize - 1) / stageSize;
-		USBMSG("[%s #%d] EP%02Xh total-size=%d stage-size=%d IRPs=%d packet-size=%d\n",
-			dispTransfer, sequenceID, endpoint->address, totalLength, stageSize, numIrps, packetSize);
+		USBMSG("[%s #%d] EP%02Xh total-size=%d stage-size=%d IRPs=%d packet-size=%d max-packets=%d\n",
+			dispTransfer, sequenceID, endpoint->address, totalLength, stageSize, numIrps, packetSize, isoPolicy.max_packets);
+
+		if (dev->is_high_speed &&
+			((totalLength + packetSize - 1) / packetSize) % isoPolicy.packet_align)
+		{
+			USBWRN("[%s #%d] %d bytes is not a multiple of %d high speed packets\n",
+				dispTransfer, sequenceID, totalLength, isoPolicy.packet_align);
+		}
 	}
 	else
 	{
@@ -496,11 +569,19 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 	// Allocate an array to keep track of the sub requests that will be
 	// allocated below.  This array exists only during the execution of
 	// this routine and is used only to keep track of the sub requests
-	// before calling them down the driver stack.
+	// before calling them down the driver stack.  Most transfers fit in
+	// the stack array.
 	//
-	subRequestContextArray = (PSUB_REQUEST_CONTEXT *)
-		ExAllocatePool(NonPagedPool,
-		numIrps * sizeof(PSUB_REQUEST_CONTEXT));
+	if (numIrps <= LARGE_TRANSFER_STACK_IRPS)
+	{
+		subRequestContextArray = subRequestContextStack;
+	}
+	else
+	{
+		subRequestContextArray = (PSUB_REQUEST_CONTEXT *)
+			ExAllocatePool(NonPagedPool,
+			numIrps * sizeof(PSUB_REQUEST_CONTEXT));
+	}
 
 	if (subRequestContextArray == NULL)
 	{
@@ -544,8 +625,7 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 		// 1. Allocate a Sub Request Context (SUB_REQUEST_CONTEXT)
 		//
 
-		subRequestContext = (PSUB_REQUEST_CONTEXT)
-			ExAllocatePool(NonPagedPool, sizeof(SUB_REQUEST_CONTEXT));
+		subRequestContext = allocate_sub_request(dev);
 
 		if (subRequestContext == NULL)
 		{
@@ -557,8 +637,6 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 			goto transfer_Free;
 		}
 
-		RtlZeroMemory(subRequestContext, sizeof(SUB_REQUEST_CONTEXT));
-
 		// Attach it to the main request irp.
 		//
 		InsertTailList(&mainRequestContext->SubRequestList, &subRequestContext->ListEntry);
@@ -574,6 +652,20 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 		// Remember the start offset 
 		subRequestContext->startOffset = startOffset;
 
+		// Stages are whole packets, the results of this stage start at
+		// the result of its first packet.
+		//
+		if (isoInfo)
+		{
+			subRequestContext->isoResults = isoResults + startOffset / packetSize;
+			subRequestContext->isoInfo = isoInfo;
+		}
+		else
+		{
+			subRequestContext->isoResults = NULL;
+			subRequestContext->isoInfo = NULL;
+		}
+
 		// The reference count on the sub request prevents it from being
 		// freed until the completion routine for the sub request
 		// executes.
@@ -596,7 +688,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 
 		subRequestContext->SubIrp = subIrp;
 
-		ntStatus = allocate_suburb((USHORT)urbFunction, stageSize, packetSize, &nPackets, &subUrb);
+		ntStatus = allocate_suburb(dev, (USHORT)urbFunction, stageSize, packetSize,
+			&nPackets, &subUrb, &subRequestContext->SubUrbPool);
 		if (!NT_SUCCESS(ntStatus))
 		{
 			USBERR("[%s #%d] failed allocating subUrb\n", dispTransfer, sequenceID);
@@ -641,6 +734,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 
 		totalLength    -= stageSize;
 
+		startOffset    += stageSize;
+
 		//
 		// Initialize the sub request urb.
 		//
@@ -754,7 +849,7 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 		// Update loop variables for next iteration.
 		//
 		if (urbFunction == URB_FUNCTION_ISOCH_TRANSFER)
-			stageSize = get_iso_stagesize(totalLength, packetSize, maxTransferSize);
+			stageSize = get_iso_stagesize(totalLength, maxTransferSize, &isoPolicy);
 		else
 		{
 			if (totalLength > (maxTransferSize))
@@ -762,7 +857,6 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 			else
 				stageSize = totalLength;
 		}
-		startOffset += stageSize;
 	}
 
 	//
@@ -780,6 +874,17 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 
 		IoMarkIrpPending(irp);
 
+		// Scheduled iso stages must run back to back.  Resolve the start
+		// frame of the first stage once and place every following stage
+		// on the frame after the previous one ends.
+		//
+		if (urbFunction == URB_FUNCTION_ISOCH_TRANSFER &&
+			(transferFlags & TRANSFER_FLAGS_ISO_SET_START_FRAME))
+		{
+			isoLatency = (int)get_iso_start_frame(dev, irp, transferFlags, isoLatency);
+			transferFlags |= TRANSFER_FLAGS_ISO_ABSOLUTE_START_FRAME;
+		}
+
 		// The cancel routine might run simultaneously as soon as it is
 		// set.  Do not access the main request irp in any way after
 		// setting the cancel routine.
@@ -808,6 +913,9 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 			//
 			set_urb_transfer_flags(dev,irp, subRequestContext->SubUrb, transferFlags, isoLatency);
 
+			if (transferFlags & TRANSFER_FLAGS_ISO_ABSOLUTE_START_FRAME)
+				isoLatency += (int)get_iso_urb_frames(dev, subRequestContext->SubUrb);
+
 			IoCallDriver(dev->target_device, subRequestContext->SubIrp);
 		}
 
@@ -817,7 +925,8 @@ NTSTATUS large_transfer(IN libusb_device_t* dev,
 		// Main request irp is completed only in sub request completion
 		// routine.
 
-		ExFreePool(subRequestContextArray);
+		if (subRequestContextArray != subRequestContextStack)
+			ExFreePool(subRequestContextArray);
 
 		return STATUS_PENDING;
 	}
@@ -850,26 +959,12 @@ transfer_Free:
 
 			if (subRequestContext != NULL)
 			{
-				if (subRequestContext->SubIrp != NULL)
-				{
-					IoFreeIrp(subRequestContext->SubIrp);
-				}
-
-				if (subRequestContext->SubUrb != NULL)
-				{
-					ExFreePool(subRequestContext->SubUrb);
-				}
-
-				if (subRequestContext->SubMdl != NULL)
-				{
-					IoFreeMdl(subRequestContext->SubMdl);
-				}
-
-				ExFreePool(subRequestContext);
+				free_sub_request(dev, subRequestContext);
 			}
 		}
 
-		ExFreePool(subRequestContextArray);
+		if (subRequestContextArray != subRequestContextStack)
+			ExFreePool(subRequestContextArray);
 	}
 
 	irp->IoStatus.Status = ntStatus;
@@ -1021,6 +1116,20 @@ NTSTATUS large_transfer_complete(IN PDEVICE_OBJECT DeviceObjectIsNULL,
 	//
 	IoAcquireCancelSpinLock(&irql);
 
+	// The cancel spin lock also serializes the stages updating the
+	// shared transfer info.
+	//
+	if (subRequestContext->isoResults)
+	{
+		if (subRequestContext->startOffset == 0)
+		{
+			subRequestContext->isoInfo->start_frame =
+				subUrb->UrbIsochronousTransfer.StartFrame;
+		}
+		subRequestContext->isoInfo->error_count += set_iso_packet_results(subUrb,
+			subRequestContext->startOffset, subRequestContext->isoResults);
+	}
+
 	if (subUrb->UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER)
 	{
 		/*
@@ -1149,13 +1258,7 @@ NTSTATUS large_transfer_complete(IN PDEVICE_OBJECT DeviceObjectIsNULL,
 		// sub request and can no longer access it because it has been
 		// removed from the main request sub request list.)
 		//
-		IoFreeIrp(subRequestContext->SubIrp);
-
-		ExFreePool(subRequestContext->SubUrb);
-
-		IoFreeMdl(subRequestContext->SubMdl);
-
-		ExFreePool(subRequestContext);
+		free_sub_request(deviceObject->DeviceExtension, subRequestContext);
 	}
 	else
 	{
@@ -1233,6 +1336,7 @@ VOID large_transfer_cancel(IN PIRP irp, BOOLEAN releaseCancelSpinlock)
 	LIST_ENTRY              cancelList;
 	PLIST_ENTRY             subRequestEntry;
 	PSUB_REQUEST_CONTEXT    subRequestContext;
+	libusb_device_t*        dev;
 
 	// The main request irp context is overlaid on top of
 	// irp->Tail.Overlay.DriverContext.  Get a pointer to it.
@@ -1240,6 +1344,29 @@ VOID large_transfer_cancel(IN PIRP irp, BOOLEAN releaseCancelSpinlock)
 	mainRequestContext = (PMAIN_REQUEST_CONTEXT)
 		irp->Tail.Overlay.DriverContext;
 
+	// The sub requests are returned to the device transfer pool, which
+	// must outlive the main irp.  Take a remove lock reference for the
+	// time the sub requests are referenced below.
+	//
+	// Once removal has started the pool may be deleted as soon as the
+	// main irp completes, so leave the sub requests alone then.  The bus
+	// driver fails them during the removal and their completion routine
+	// frees them and completes the main irp.
+	//
+	dev = IoGetCurrentIrpStackLocation(irp)->DeviceObject->DeviceExtension;
+	if (!NT_SUCCESS(remove_lock_acquire(dev)))
+	{
+		USBWRN("[%s #%d] device is being removed, not cancelling sub requests\n",
+			mainRequestContext->dispTransfer,
+			mainRequestContext->sequenceID);
+
+		if (releaseCancelSpinlock)
+		{
+			IoReleaseCancelSpinLock(irp->CancelIrql);
+		}
+		return;
+	}
+
 	// The mainRequestContext SubRequestList cannot be simultaneously
 	// changed by anything else as long as the cancel spin lock is still
 	// held, but can be changed immediately by the completion routine
@@ -1308,13 +1435,7 @@ VOID large_transfer_cancel(IN PIRP irp, BOOLEAN releaseCancelSpinlock)
 			// routine already ran for the sub request but did not free
 			// the sub request so it can be freed now.
 			//
-			IoFreeIrp(subRequestContext->SubIrp);
-
-			ExFreePool(subRequestContext->SubUrb);
-
-			IoFreeMdl(subRequestContext->SubMdl);
-
-			ExFreePool(subRequestContext);
+			free_sub_request(dev, subRequestContext);
 		}
 		else
 		{
@@ -1324,34 +1445,123 @@ VOID large_transfer_cancel(IN PIRP irp, BOOLEAN releaseCancelSpinlock)
 			// the sub request completion routine executes.
 		}
 	}
+
+	remove_lock_release(dev);
+}
+
+/*-----------------------------------------------------------------------------
+Iso stage planning
+
+The stage sizes are planned by iso_stage.c.  get_iso_max_transfer_size()
+returns the largest request the iso ioctls pass to transfer(); anything
+larger is split by large_transfer().
+*/
+int get_iso_max_transfer_size(libusb_device_t *dev, libusb_endpoint_t *endpoint,
+							  int packet_size, int req_max_transfer_size)
+{
+	if (!packet_size)
+		packet_size = endpoint->bytes_per_interval;
+
+	return get_iso_urb_max_transfer_size(dev->is_high_speed, packet_size,
+		req_max_transfer_size);
 }
 
-static int get_iso_stagesize(int totalLength, int packetSize, int maxTransferSize)
+/*-----------------------------------------------------------------------------
+Transfer pool
+
+Sub request contexts, bulk/interrupt urbs and iso urbs of up to
+1024 packets are taken from per device lookaside lists.  Iso urbs are
+kept in size classes by packet count; larger iso urbs come from the
+non-paged pool.  The pool is set up in add_device() and deleted on
+IRP_MN_REMOVE_DEVICE once all requests are finished.
+*/
+void transfer_pool_initialize(libusb_device_t *dev)
 {
-	int stageSize;
+	libusb_transfer_pool_t* pool = &dev->transfer_pool;
+	int i;
+
+	ExInitializeNPagedLookasideList(&pool->sub_request, NULL, NULL, 0,
+		sizeof(SUB_REQUEST_CONTEXT), POOL_TAG, 0);
 
-	if (totalLength > (packetSize * 255) || totalLength > maxTransferSize)
+	ExInitializeNPagedLookasideList(&pool->bulk_urb, NULL, NULL, 0,
+		sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER), POOL_TAG, 0);
+
+	for (i = 0; i < LIBUSB_ISO_URB_CLASS_COUNT; i++)
 	{
-		stageSize = packetSize * 255;
-		if (stageSize > maxTransferSize)
-			stageSize = maxTransferSize;
+		ExInitializeNPagedLookasideList(&pool->iso_urb[i], NULL, NULL, 0,
+			GET_ISO_URB_SIZE(iso_urb_class_packets[i]), POOL_TAG, 0);
+	}
 
-		//		stageSize = stageSize - (stageSize % packetSize);
+	pool->initialized = TRUE;
+}
 
+void transfer_pool_delete(libusb_device_t *dev)
+{
+	libusb_transfer_pool_t* pool = &dev->transfer_pool;
+	int i;
+
+	if (!pool->initialized)
+		return;
+
+	ExDeleteNPagedLookasideList(&pool->sub_request);
+	ExDeleteNPagedLookasideList(&pool->bulk_urb);
+
+	for (i = 0; i < LIBUSB_ISO_URB_CLASS_COUNT; i++)
+	{
+		ExDeleteNPagedLookasideList(&pool->iso_urb[i]);
 	}
-	else
+
+	pool->initialized = FALSE;
+}
+
+static int get_iso_urb_class(ULONG nPackets)
+{
+	int i;
+
+	for (i = 0; i < LIBUSB_ISO_URB_CLASS_COUNT; i++)
 	{
-		stageSize = totalLength;
+		if (nPackets <= (ULONG)iso_urb_class_packets[i])
+			return i;
 	}
 
-	return stageSize;
+	return -1;
+}
+
+static PSUB_REQUEST_CONTEXT allocate_sub_request(libusb_device_t* dev)
+{
+	PSUB_REQUEST_CONTEXT subRequestContext;
+
+	subRequestContext = (PSUB_REQUEST_CONTEXT)
+		ExAllocateFromNPagedLookasideList(&dev->transfer_pool.sub_request);
+
+	if (subRequestContext)
+		RtlZeroMemory(subRequestContext, sizeof(SUB_REQUEST_CONTEXT));
+
+	return subRequestContext;
+}
+
+static void free_sub_request(libusb_device_t* dev,
+							 PSUB_REQUEST_CONTEXT subRequestContext)
+{
+	if (subRequestContext->SubIrp != NULL)
+		IoFreeIrp(subRequestContext->SubIrp);
+
+	if (subRequestContext->SubUrb != NULL)
+		free_suburb(dev, subRequestContext->SubUrb, subRequestContext->SubUrbPool);
+
+	if (subRequestContext->SubMdl != NULL)
+		IoFreeMdl(subRequestContext->SubMdl);
+
+	ExFreeToNPagedLookasideList(&dev->transfer_pool.sub_request, subRequestContext);
 }
 
-static NTSTATUS allocate_suburb(USHORT urbFunction,
+static NTSTATUS allocate_suburb(libusb_device_t* dev,
+								USHORT urbFunction,
 								int stageSize,
 								int packetSize,
 								ULONG* nPackets,
-								PURB* subUrbRef)
+								PURB* subUrbRef,
+								int* urbPool)
 {
 	int urbSize;
 	//
@@ -1361,15 +1571,26 @@ static NTSTATUS allocate_suburb(USHORT urbFunction,
 	{
 		*nPackets = (stageSize + packetSize - 1) / packetSize;
 		urbSize = GET_ISO_URB_SIZE(*nPackets);
+		*urbPool = get_iso_urb_class(*nPackets);
+
+		if (*urbPool >= 0)
+		{
+			*subUrbRef = (PURB)ExAllocateFromNPagedLookasideList(&dev->transfer_pool.iso_urb[*urbPool]);
+		}
+		else
+		{
+			*urbPool = SUBURB_POOL_NONPAGED;
+			*subUrbRef = (PURB)ExAllocatePool(NonPagedPool, urbSize);
+		}
 	}
 	else
 	{
 		*nPackets = 0;
 		urbSize = sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER);
+		*urbPool = SUBURB_POOL_BULK;
+		*subUrbRef = (PURB)ExAllocateFromNPagedLookasideList(&dev->transfer_pool.bulk_urb);
 	}
 
-	*subUrbRef = (PURB)ExAllocatePool(NonPagedPool, urbSize);
-
 	if ((*subUrbRef) == NULL)
 		return STATUS_INSUFFICIENT_RESOURCES;
 
@@ -1381,6 +1602,16 @@ static NTSTATUS allocate_suburb(USHORT urbFunction,
 	return STATUS_SUCCESS;
 }
 
+static void free_suburb(libusb_device_t* dev, PURB subUrb, int urbPool)
+{
+	if (urbPool == SUBURB_POOL_BULK)
+		ExFreeToNPagedLookasideList(&dev->transfer_pool.bulk_urb, subUrb);
+	else if (urbPool == SUBURB_POOL_NONPAGED)
+		ExFreePool(subUrb);
+	else
+		ExFreeToNPagedLookasideList(&dev->transfer_pool.iso_urb[urbPool], subUrb);
+}
+
 static const char* GetPipeDisplayName(libusb_endpoint_t* endpoint)
 {
 	if (endpoint->address & 0x80)
@@ -1404,9 +1635,8 @@ void set_urb_transfer_flags(libusb_device_t* dev, PIRP irp, PURB subUrb,int tran
 			subUrb->UrbIsochronousTransfer.TransferFlags |= USBD_START_ISO_TRANSFER_ASAP;
 		else
 		{
-			subUrb->UrbIsochronousTransfer.StartFrame = get_current_frame(dev, irp);
-			if (transfer_flags & TRANSFER_FLAGS_ISO_ADD_LATENCY)
-				subUrb->UrbIsochronousTransfer.StartFrame += isoLatency;
+			subUrb->UrbIsochronousTransfer.StartFrame =
+				get_iso_start_frame(dev, irp, transfer_flags, isoLatency);
 		}
 	}
 
@@ -1491,3 +1721,62 @@ NTSTATUS control_transfer(libusb_device_t* dev,
 
     return status;
 }
+
+static ULONG get_iso_start_frame(libusb_device_t* dev, PIRP irp, int transfer_flags, int isoLatency)
+{
+	ULONG startFrame;
+
+	if (transfer_flags & TRANSFER_FLAGS_ISO_ABSOLUTE_START_FRAME)
+		return (ULONG)isoLatency;
+
+	startFrame = get_current_frame(dev, irp);
+	if (transfer_flags & TRANSFER_FLAGS_ISO_ADD_LATENCY)
+		startFrame += isoLatency;
+
+	return startFrame;
+}
+
+// number of (1ms) bus frames spanned by an iso urb
+static ULONG get_iso_urb_frames(libusb_device_t* dev, PURB subUrb)
+{
+	ULONG nPackets = subUrb->UrbIsochronousTransfer.NumberOfPackets;
+
+	if (dev->is_high_speed)
+		return (nPackets + LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED - 1) /
+			LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED;
+
+	return nPackets;
+}
+
+// Copies the packet results of an iso urb and returns the number of
+// failed packets.  dataOffset is the offset of the urb in the packet data
+// of the main request.
+static ULONG set_iso_packet_results(PURB subUrb, ULONG dataOffset, libusb_iso_packet_result_t* results)
+{
+	struct _URB_ISOCH_TRANSFER* isoUrb = &subUrb->UrbIsochronousTransfer;
+	ULONG i, end;
+	ULONG errors = 0;
+
+	for (i = 0; i < isoUrb->NumberOfPackets; i++)
+	{
+		results[i].offset = dataOffset + isoUrb->IsoPacket[i].Offset;
+
+		if (isoUrb->TransferFlags & USBD_TRANSFER_DIRECTION_IN)
+		{
+			results[i].length = isoUrb->IsoPacket[i].Length;
+		}
+		else
+		{
+			// the length is only reported for IN packets
+			end = (i + 1 < isoUrb->NumberOfPackets) ?
+				isoUrb->IsoPacket[i + 1].Offset : isoUrb->TransferBufferLength;
+			results[i].length = end - isoUrb->IsoPacket[i].Offset;
+		}
+
+		results[i].status = (unsigned int)isoUrb->IsoPacket[i].Status;
+		if (!USBD_SUCCESS(isoUrb->IsoPacket[i].Status))
+			errors++;
+	}
+
+	return errors;
+}
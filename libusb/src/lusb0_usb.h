@@ -305,6 +305,54 @@ struct usb_version
 };
 
 
+/* Result of one packet of a transfer submitted with */
+/* usb_submit_async_iso_results() */
+struct usb_iso_packet_result
+{
+    unsigned int offset;          /* offset of the packet in the data */
+    unsigned int length;          /* bytes transferred */
+    unsigned int status;          /* USBD status, 0 on success */
+};
+
+struct usb_iso_transfer_info
+{
+    unsigned int packet_count;
+    unsigned int start_frame;     /* frame of the first packet */
+    unsigned int error_count;     /* number of failed packets */
+};
+
+/* room needed after 'size' bytes of data for the packet results */
+#define USB_ISO_RESULTS_SIZE(size, pktsize) \
+    ((int)(((size) / (pktsize)) * sizeof(struct usb_iso_packet_result) \
+           + sizeof(struct usb_iso_transfer_info)))
+
+/* Counters of a stream opened with usb_stream_open() */
+struct usb_stream_stats
+{
+    unsigned long transfers;      /* completed transfers */
+    unsigned long bytes;          /* bytes received */
+    unsigned long overruns;       /* transfers dropped because the reader */
+    unsigned long dropped_bytes;  /* was behind, and their size */
+    unsigned long errors;         /* failed transfers, ends the stream */
+    unsigned long buffered;       /* transfers waiting to be read */
+};
+
+/* Counters of a stream opened with usb_iso_stream_open() */
+struct usb_iso_stream_stats
+{
+    unsigned long transfers;      /* completed transfers */
+    unsigned long bytes;          /* bytes received */
+    unsigned long overruns;       /* transfers dropped because the reader */
+    unsigned long dropped_bytes;  /* was behind, and their size */
+    unsigned long errors;         /* failed transfers, ends the stream */
+    unsigned long buffered;       /* transfers waiting to be read */
+    unsigned long late_transfers; /* times the queue ran dry and the */
+    unsigned long dropped_frames; /* frames skipped to catch up */
+    unsigned long next_frame;     /* start frame of the next transfer */
+    unsigned long packet_errors;  /* failed packets, their data is */
+                                  /* skipped */
+};
+
 struct usb_dev_handle;
 typedef struct usb_dev_handle usb_dev_handle;
 
@@ -405,6 +453,9 @@ extern "C"
 
     const struct usb_version *usb_get_version(void);
 
+#define LIBUSB_HAS_SET_PIPELINE_DEPTH_NP 1
+    int usb_set_pipeline_depth_np(usb_dev_handle *dev, int depth);
+
     int usb_isochronous_setup_async(usb_dev_handle *dev, void **context,
                                     unsigned char ep, int pktsize);
     int usb_bulk_setup_async(usb_dev_handle *dev, void **context,
@@ -415,9 +466,34 @@ extern "C"
     int usb_submit_async(void *context, char *bytes, int size);
     int usb_reap_async(void *context, int timeout);
     int usb_reap_async_nocancel(void *context, int timeout);
+    int usb_reap_async_many(void **contexts, int count, int timeout,
+                            void **completed);
     int usb_cancel_async(void *context);
     int usb_free_async(void **context);
 
+#define LIBUSB_HAS_ISO_PACKET_RESULTS 1
+    int usb_submit_async_iso_results(void *context, char *bytes, int size);
+    int usb_get_iso_results(void *context,
+                            struct usb_iso_packet_result **results,
+                            struct usb_iso_transfer_info **info);
+
+#define LIBUSB_HAS_STREAM 1
+    int usb_stream_open(usb_dev_handle *dev, void **stream, unsigned char ep,
+                        int transfer_size, int num_transfers);
+    int usb_stream_read(void *stream, char *bytes, int size, int timeout);
+    int usb_stream_get_stats(void *stream, struct usb_stream_stats *stats);
+    int usb_stream_close(void *stream);
+
+#define LIBUSB_HAS_ISO_STREAM 1
+    int usb_iso_stream_open(usb_dev_handle *dev, void **stream,
+                            unsigned char ep, int packet_size,
+                            int packets_per_transfer, int packets_per_frame,
+                            int num_transfers);
+    int usb_iso_stream_read(void *stream, char *bytes, int size,
+                            unsigned int *start_frame, int timeout);
+    int usb_iso_stream_get_stats(void *stream,
+                                 struct usb_iso_stream_stats *stats);
+
 
 #ifdef __cplusplus
 }
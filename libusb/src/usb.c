@@ -98,13 +98,29 @@ int usb_find_devices(void)
 
     for (bus = usb_busses; bus; bus = bus->next)
     {
-        struct usb_device *devices, *dev;
+        struct usb_device *devices, *dev, *ndev;
+        struct usb_device *by_devnum[256];
+        int devnum_unique = 1;
 
         /* Find all of the devices and put them into a temporary list */
         ret = usb_os_find_devices(bus, &devices);
         if (ret < 0)
             return ret;
 
+        /*
+         * Index the new list by device number, which is unique on a bus
+         * for all ports we know of. Should a port ever report a number
+         * twice, fall back to searching the whole list.
+         */
+        memset(by_devnum, 0, sizeof(by_devnum));
+        for (ndev = devices; ndev; ndev = ndev->next)
+        {
+            if (by_devnum[ndev->devnum])
+                devnum_unique = 0;
+            else
+                by_devnum[ndev->devnum] = ndev;
+        }
+
         /*
          * Now walk through all of the devices we know about and compare
          * against this new list. Any duplicates will be removed from the new
@@ -115,24 +131,31 @@ int usb_find_devices(void)
         while (dev)
         {
             int found = 0;
-            struct usb_device *ndev, *tdev = dev->next;
+            struct usb_device *tdev = dev->next;
 
-            ndev = devices;
-            while (ndev)
-            {
-                struct usb_device *tndev = ndev->next;
+            ndev = by_devnum[dev->devnum];
+            if (ndev && strcmp(dev->filename, ndev->filename))
+                ndev = NULL;
 
-                if (!strcmp(dev->filename, ndev->filename))
+            if (!ndev && !devnum_unique)
+            {
+                for (ndev = devices; ndev; ndev = ndev->next)
                 {
-                    /* Remove it from the new devices list */
-                    LIST_DEL(devices, ndev);
-
-                    usb_free_dev(ndev);
-                    found = 1;
-                    break;
+                    if (!strcmp(dev->filename, ndev->filename))
+                        break;
                 }
+            }
+
+            if (ndev)
+            {
+                if (by_devnum[ndev->devnum] == ndev)
+                    by_devnum[ndev->devnum] = NULL;
 
-                ndev = tndev;
+                /* Remove it from the new devices list */
+                LIST_DEL(devices, ndev);
+
+                usb_free_dev(ndev);
+                found = 1;
             }
 
             if (!found)
@@ -172,7 +195,8 @@ int usb_find_devices(void)
                 udev = usb_open(dev);
                 if (udev)
                 {
-                    usb_fetch_and_parse_descriptors(udev);
+                    if (usb_desc_cache_fetch(udev) < 0)
+                        usb_fetch_and_parse_descriptors(udev);
 
                     usb_close(udev);
                 }
@@ -192,6 +216,8 @@ int usb_find_devices(void)
         usb_os_determine_children(bus);
     }
 
+    usb_desc_cache_flush();
+
     return changes;
 }
 
@@ -200,6 +226,9 @@ void usb_init(void)
     if (getenv("USB_DEBUG"))
         usb_set_debug(atoi(getenv("USB_DEBUG")));
 
+    if (getenv("USB_DESC_CACHE"))
+        usb_desc_cache_init(getenv("USB_DESC_CACHE"));
+
     usb_os_init();
 }
 
@@ -215,6 +244,8 @@ usb_dev_handle *usb_open(struct usb_device *dev)
     udev->device = dev;
     udev->bus = dev->bus;
     udev->config = udev->interface = udev->altsetting = -1;
+    udev->impl_context_pool = NULL;
+    udev->pipeline_depth = 1;
 
     if (usb_os_open(udev) < 0)
     {
@@ -55,14 +55,35 @@ struct usb_dev_handle
 
     /* Added by RMT so implementations can store other per-open-device data */
     void *impl_info;
+
+    /* recycled async transfer contexts, owned by the OS specific code */
+    void *impl_context_pool;
+
+    /* number of requests kept in flight by the sync transfer functions */
+    int pipeline_depth;
 };
 
 /* descriptors.c */
 int usb_parse_descriptor(unsigned char *source, char *description, void *dest);
+int usb_parse_header(unsigned char *source,
+                     struct usb_descriptor_header *dest);
+int usb_parse_device_descriptor(unsigned char *source,
+                                struct usb_device_descriptor *dest);
+int usb_parse_config_descriptor(unsigned char *source,
+                                struct usb_config_descriptor *dest);
+int usb_parse_interface_descriptor(unsigned char *source,
+                                   struct usb_interface_descriptor *dest);
+int usb_parse_endpoint_descriptor(unsigned char *source,
+                                  struct usb_endpoint_descriptor *dest);
 int usb_parse_configuration(struct usb_config_descriptor *config,
                             unsigned char *buffer);
 void usb_fetch_and_parse_descriptors(usb_dev_handle *udev);
 void usb_destroy_configuration(struct usb_device *dev);
+void usb_desc_cache_insert(struct usb_device *dev, unsigned char *data,
+                           int size);
+int usb_desc_cache_fetch(usb_dev_handle *udev);
+void usb_desc_cache_init(const char *path);
+void usb_desc_cache_flush(void);
 
 /* OS specific routines */
 int usb_os_find_busses(struct usb_bus **busses);
@@ -41,16 +41,142 @@
 #define LIBUSB_BUS_NAME "bus-0"
 #define LIBUSB_MAX_DEVICES 256
 
-typedef struct
+/* maximum number of idle transfer contexts kept per open device */
+#define LIBUSB_CONTEXT_POOL_MAX 32
+
+/* maximum number of requests the sync transfer functions keep in flight */
+#define LIBUSB_MAX_PIPELINE_DEPTH 16
+
+/* control payloads up to this size are sent from a stack buffer */
+#define LIBUSB_CONTROL_STACK_BUFFER_SIZE 4096
+
+/* number of device nodes probed concurrently by usb_os_find_devices() */
+#define LIBUSB_PROBE_MAX_WORKERS 8
+
+/* maximum number of transfers a stream keeps queued */
+#define LIBUSB_STREAM_MAX_TRANSFERS 64
+
+/* number of completed transfers a stream can buffer per queued transfer */
+#define LIBUSB_STREAM_SLOTS_PER_TRANSFER 4
+
+/* frames between the current bus frame and the first scheduled frame of */
+/* an iso stream, and after a resync */
+#define LIBUSB_ISO_STREAM_LATENCY 8
+
+/* an iso transfer scheduled closer than this to the current frame is */
+/* considered late and the stream is moved ahead */
+#define LIBUSB_ISO_STREAM_MIN_LEAD 2
+
+/* LIBUSB_IOCTL_QUERY_DEVICE_INFORMATION type and result, as in WinUSB */
+#define LIBUSB_DEVICE_INFO_SPEED 0x01
+#define LIBUSB_DEVICE_SPEED_HIGH 0x03
+
+/* iso packets per frame at full and at high speed (microframes) */
+#define LIBUSB_ISO_PACKETS_PER_FRAME_FULL_SPEED 1
+#define LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED 8
+
+typedef struct _usb_context_pool_t usb_context_pool_t;
+
+typedef struct _usb_context_t
 {
+    struct _usb_context_t *next;
+    usb_context_pool_t *pool;
     usb_dev_handle *dev;
     libusb_request req;
     char *bytes;
     int size;
     DWORD control_code;
+    int iso_results; /* submitted with usb_submit_async_iso_results() */
     OVERLAPPED ol;
 } usb_context_t;
 
+/* Per-device free list of transfer contexts. Contexts keep their event */
+/* when they are returned, so the sync transfer functions and the */
+/* usb_*_setup_async() functions don't need a malloc() and a */
+/* CreateEvent() for each call once the list is warm. */
+/* The pool is reference counted by the open handle and by every context */
+/* handed out, so contexts may safely outlive usb_close(). */
+struct _usb_context_pool_t
+{
+    CRITICAL_SECTION lock;
+    usb_context_t *free_list;
+    int free_count;
+    int ref_count;
+    int closed;
+};
+
+/* One completed transfer buffered by a stream. */
+typedef struct
+{
+    int length;
+    char *data;
+    ULONG start_frame;
+} usb_stream_slot_t;
+
+/* Streaming reader. A thread keeps 'num_transfers' reads queued on the */
+/* endpoint and copies each completed transfer into the next free slot */
+/* of a single producer, single consumer ring. 'head' is only advanced by */
+/* that thread, 'tail' only by usb_stream_read(), so the reader takes */
+/* buffered data without locks or system calls. When the ring is full */
+/* the completed transfer is dropped and counted as an overrun, the */
+/* endpoint is kept busy either way. */
+/* Iso streams schedule every transfer on the frame after the previous */
+/* one ends, so the data has no gaps as long as the queue doesn't run */
+/* dry. If it does, the schedule is moved ahead of the bus and the */
+/* skipped frames are counted. Iso transfers return the result of every */
+/* packet, only the data of the packets that succeeded is buffered. */
+typedef struct
+{
+    usb_dev_handle *dev;
+    int transfer_size;
+    int buffer_size; /* transfer_size and the iso packet results */
+    int num_transfers;
+    void *contexts[LIBUSB_STREAM_MAX_TRANSFERS];
+    int pending[LIBUSB_STREAM_MAX_TRANSFERS];
+    char *transfer_data;
+
+    int num_slots;
+    usb_stream_slot_t *slots;
+    volatile LONG head;
+    volatile LONG tail;
+    int tail_offset;
+
+    HANDLE data_event;
+    HANDLE stop_event;
+    HANDLE thread;
+    volatile LONG error;
+
+    struct usb_stream_stats stats;
+
+    /* iso streams only */
+    int frames_per_transfer;
+    ULONG next_frame;
+    ULONG start_frames[LIBUSB_STREAM_MAX_TRANSFERS];
+    unsigned long late_transfers;
+    unsigned long dropped_frames;
+    unsigned long packet_errors;
+} usb_stream_t;
+
+/* Result of probing one \\.\libusb0-NNNN node during a bus scan. */
+typedef struct
+{
+    int status; /* 0: no such node, 1: found, -1: descriptor request failed */
+    unsigned char descriptor[USB_DT_DEVICE_SIZE]; /* as sent by the device */
+} usb_probe_result_t;
+
+/* Bus scan shared by the probe workers. Each worker claims the next */
+/* device number until all of them are taken and stores its result in */
+/* the slot of that number, so the merged list doesn't depend on the */
+/* order the probes complete in. The workers run on the system thread */
+/* pool, 'done' is set when the last of them has finished. */
+typedef struct
+{
+    volatile LONG next;
+    volatile LONG pending;
+    HANDLE done;
+    usb_probe_result_t results[LIBUSB_MAX_DEVICES];
+} usb_probe_t;
+
 
 static struct usb_version _usb_version =
 {
@@ -68,14 +194,41 @@ static int _usb_setup_async(usb_dev_handle *dev, void **context,
 static int _usb_transfer_sync(usb_dev_handle *dev, int control_code,
                               int ep, int pktsize, char *bytes, int size,
                               int timeout);
+static int _usb_transfer_sync_pipelined(usb_dev_handle *dev, int control_code,
+                                        int ep, int pktsize, char *bytes,
+                                        int size, int timeout, int depth);
 
 static int usb_get_configuration(usb_dev_handle *dev, bool_t cached);
+static int _usb_context_pool_create(usb_dev_handle *dev);
+static void _usb_context_pool_close(usb_dev_handle *dev);
+static void _usb_context_pool_unref(usb_context_pool_t *pool);
+static int _usb_context_alloc(usb_dev_handle *dev, usb_context_t **context);
+static void _usb_context_release(usb_context_t *context);
 static int _usb_cancel_io(usb_context_t *context);
 static int _usb_abort_ep(usb_dev_handle *dev, unsigned int ep);
 
 static int _usb_io_sync(HANDLE dev, unsigned int code, void *in, int in_size,
                         void *out, int out_size, int *ret);
+static int _usb_io_sync_timeout(HANDLE dev, unsigned int code,
+                                void *in, int in_size,
+                                void *out, int out_size, int *ret,
+                                DWORD timeout);
+static void _usb_probe_device(int devnum, usb_probe_result_t *result);
+static void _usb_probe_run(usb_probe_t *probe);
+static DWORD WINAPI _usb_probe_worker(LPVOID param);
 static int _usb_reap_async(void *context, int timeout, int cancel);
+static int _usb_get_current_frame(usb_dev_handle *dev, ULONG *frame);
+static int _usb_is_high_speed(usb_dev_handle *dev);
+static void _usb_stream_publish(usb_stream_t *s, char *data, int length,
+                                ULONG start_frame);
+static int _usb_stream_submit(usb_stream_t *s, int index);
+static int _usb_iso_stream_pack(usb_stream_t *s, void *context, char *data,
+                                ULONG *start_frame);
+static int _usb_stream_wait(usb_stream_t *s, int timeout);
+static DWORD WINAPI _usb_stream_thread(LPVOID param);
+static int _usb_stream_start(usb_stream_t *s, unsigned char ep,
+                             int packet_size);
+static void _usb_stream_free(usb_stream_t *s);
 static int _usb_add_virtual_hub(struct usb_bus *bus);
 
 static void _usb_free_bus_list(struct usb_bus *bus);
@@ -184,6 +337,13 @@ int usb_os_open(usb_dev_handle *dev)
 		return -ENOENT;
 	}
 
+	if (_usb_context_pool_create(dev) < 0)
+	{
+		CloseHandle(dev->impl_info);
+		dev->impl_info = INVALID_HANDLE_VALUE;
+		return -ENOMEM;
+	}
+
 	// get the cached configuration (no device i/o)
 	config = usb_get_configuration(dev, TRUE);
 	if (config > 0)
@@ -211,6 +371,8 @@ int usb_os_close(usb_dev_handle *dev)
         dev->altsetting = -1;
     }
 
+    _usb_context_pool_close(dev);
+
     return 0;
 }
 
@@ -371,6 +533,7 @@ static int _usb_setup_async(usb_dev_handle *dev, void **context,
                             unsigned char ep, int pktsize)
 {
     usb_context_t **c = (usb_context_t **)context;
+    int ret;
 
     if (((control_code == LIBUSB_IOCTL_INTERRUPT_OR_BULK_WRITE)
             || (control_code == LIBUSB_IOCTL_ISOCHRONOUS_WRITE))
@@ -388,45 +551,23 @@ static int _usb_setup_async(usb_dev_handle *dev, void **context,
         return -EINVAL;
     }
 
-    *c = malloc(sizeof(usb_context_t));
-
-    if (!*c)
+    if ((ret = _usb_context_alloc(dev, c)) < 0)
     {
-        USBERR0("memory allocation error\n");
-        return -ENOMEM;
+        *c = NULL;
+        return ret;
     }
 
-    memset(*c, 0, sizeof(usb_context_t));
-
     (*c)->dev = dev;
     (*c)->req.endpoint.endpoint = ep;
     (*c)->req.endpoint.packet_size = pktsize;
     (*c)->control_code = control_code;
 
-    (*c)->ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-
-    if (!(*c)->ol.hEvent)
-    {
-        free(*c);
-        *c = NULL;
-        USBERR("creating event failed: win error: %s",
-                  usb_win_error_to_string());
-        return -usb_win_error_to_errno();
-    }
-
     return 0;
 }
 
-int usb_submit_async(void *context, char *bytes, int size)
+static int _usb_submit_async(usb_context_t *c, DWORD control_code,
+                             char *bytes, int size, int buffer_size)
 {
-    usb_context_t *c = (usb_context_t *)context;
-
-    if (!c)
-    {
-        USBERR0("invalid context");
-        return -EINVAL;
-    }
-
     if (c->dev->impl_info == INVALID_HANDLE_VALUE)
     {
         USBERR0("device not open\n");
@@ -454,10 +595,10 @@ int usb_submit_async(void *context, char *bytes, int size)
     ResetEvent(c->ol.hEvent);
 
     if (!DeviceIoControl(c->dev->impl_info,
-                         c->control_code,
+                         control_code,
                          &c->req, sizeof(libusb_request),
                          c->bytes,
-                         c->size, NULL, &c->ol))
+                         buffer_size, NULL, &c->ol))
     {
         if (GetLastError() != ERROR_IO_PENDING)
         {
@@ -470,6 +611,87 @@ int usb_submit_async(void *context, char *bytes, int size)
     return 0;
 }
 
+int usb_submit_async(void *context, char *bytes, int size)
+{
+    usb_context_t *c = (usb_context_t *)context;
+
+    if (!c)
+    {
+        USBERR0("invalid context");
+        return -EINVAL;
+    }
+
+    c->iso_results = FALSE;
+
+    return _usb_submit_async(c, c->control_code, bytes, size, size);
+}
+
+/* Submits an isochronous transfer of 'size' bytes that also returns the */
+/* result of every packet. 'bytes' must have USB_ISO_RESULTS_SIZE() bytes */
+/* of room after the data, where the driver stores the results. */
+int usb_submit_async_iso_results(void *context, char *bytes, int size)
+{
+    usb_context_t *c = (usb_context_t *)context;
+    struct usb_iso_transfer_info info;
+    int pktsize, results_size;
+
+    if (!c || (c->control_code != LIBUSB_IOCTL_ISOCHRONOUS_READ
+               && c->control_code != LIBUSB_IOCTL_ISOCHRONOUS_WRITE))
+    {
+        USBERR0("invalid context\n");
+        return -EINVAL;
+    }
+
+    pktsize = c->req.endpoint.packet_size;
+
+    if (!bytes || pktsize <= 0 || size <= 0 || size % pktsize)
+    {
+        USBERR("size %d is not a multiple of the packet size %d\n",
+               size, pktsize);
+        return -EINVAL;
+    }
+
+    results_size = USB_ISO_RESULTS_SIZE(size, pktsize);
+
+    /* the results may not be aligned, the driver reads the packet count */
+    /* from the info that follows them */
+    memset(&info, 0, sizeof(info));
+    info.packet_count = size / pktsize;
+    memcpy(bytes + size + results_size - sizeof(info), &info, sizeof(info));
+
+    c->iso_results = TRUE;
+
+    return _usb_submit_async(c, LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX,
+                             bytes, size, size + results_size);
+}
+
+/* Returns the number of packets of a reaped context that was submitted */
+/* with usb_submit_async_iso_results(), and points 'results' and 'info' */
+/* to the packet results stored after its data. */
+int usb_get_iso_results(void *context, struct usb_iso_packet_result **results,
+                        struct usb_iso_transfer_info **info)
+{
+    usb_context_t *c = (usb_context_t *)context;
+    struct usb_iso_packet_result *r;
+    int count;
+
+    if (!c || !c->iso_results)
+    {
+        USBERR0("invalid context\n");
+        return -EINVAL;
+    }
+
+    count = c->size / c->req.endpoint.packet_size;
+    r = (struct usb_iso_packet_result *)(c->bytes + c->size);
+
+    if (results)
+        *results = r;
+    if (info)
+        *info = (struct usb_iso_transfer_info *)(r + count);
+
+    return count;
+}
+
 static int _usb_reap_async(void *context, int timeout, int cancel)
 {
     usb_context_t *c = (usb_context_t *)context;
@@ -512,6 +734,65 @@ int usb_reap_async_nocancel(void *context, int timeout)
     return _usb_reap_async(context, timeout, FALSE);
 }
 
+/* Waits until at least one of the submitted contexts has completed and */
+/* stores every completed context in 'completed', in the order they */
+/* appear in 'contexts'. Returns the number of completed contexts. The */
+/* transfer results are collected with usb_reap_async_nocancel(), which */
+/* doesn't block for a completed context. Nothing is cancelled on */
+/* timeout. */
+int usb_reap_async_many(void **contexts, int count, int timeout,
+                        void **completed)
+{
+    HANDLE events[MAXIMUM_WAIT_OBJECTS];
+    usb_context_t *c;
+    DWORD ret;
+    int done = 0;
+    int i;
+
+    if (!contexts || !completed || count <= 0
+            || count > MAXIMUM_WAIT_OBJECTS)
+    {
+        USBERR("invalid context list, count %d\n", count);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        c = (usb_context_t *)contexts[i];
+
+        if (!c)
+        {
+            USBERR("invalid context at index %d\n", i);
+            return -EINVAL;
+        }
+
+        events[i] = c->ol.hEvent;
+    }
+
+    ret = WaitForMultipleObjects(count, events, FALSE, timeout);
+
+    if (ret == WAIT_TIMEOUT)
+    {
+        return -ETRANSFER_TIMEDOUT;
+    }
+
+    if (ret == WAIT_FAILED)
+    {
+        USBERR("waiting for requests failed, win error: %s\n",
+               usb_win_error_to_string());
+        return -usb_win_error_to_errno();
+    }
+
+    /* collect everything that has completed so far, not just the first */
+    for (i = 0; i < count; i++)
+    {
+        if (WaitForSingleObject(events[i], 0) == WAIT_OBJECT_0)
+            completed[done++] = contexts[i];
+    }
+
+    return done;
+}
+
 
 int usb_cancel_async(void *context)
 {
@@ -548,14 +829,558 @@ int usb_free_async(void **context)
         return -EINVAL;
     }
 
-    CloseHandle((*c)->ol.hEvent);
-
-    free(*c);
+    _usb_context_release(*c);
     *c = NULL;
 
     return 0;
 }
 
+/* called by the stream thread only */
+static void _usb_stream_publish(usb_stream_t *s, char *data, int length,
+                                ULONG start_frame)
+{
+    LONG head = s->head;
+    usb_stream_slot_t *slot;
+
+    if ((ULONG)(head - s->tail) >= (ULONG)s->num_slots)
+    {
+        s->stats.overruns++;
+        s->stats.dropped_bytes += length;
+        return;
+    }
+
+    slot = &s->slots[(ULONG)head % s->num_slots];
+    memcpy(slot->data, data, length);
+    slot->length = length;
+    slot->start_frame = start_frame;
+
+    /* the slot must be filled before the reader can see it */
+    InterlockedExchange(&s->head, head + 1);
+    SetEvent(s->data_event);
+}
+
+/* called by the stream thread, and by _usb_stream_start() before the */
+/* thread is running */
+static int _usb_stream_submit(usb_stream_t *s, int index)
+{
+    usb_context_t *c = (usb_context_t *)s->contexts[index];
+    ULONG frame;
+    int ret;
+
+    if (s->frames_per_transfer)
+    {
+        /* the host controller rejects a transfer whose start frame has */
+        /* passed, move the schedule ahead if the queue has run dry */
+        if (_usb_get_current_frame(s->dev, &frame) < 0)
+            frame = s->next_frame - LIBUSB_ISO_STREAM_MIN_LEAD;
+
+        if ((LONG)(s->next_frame - frame) < LIBUSB_ISO_STREAM_MIN_LEAD)
+        {
+            frame += LIBUSB_ISO_STREAM_LATENCY;
+            if (s->stats.transfers)
+            {
+                USBWRN("iso stream late, skipping %lu frames\n",
+                       (unsigned long)(frame - s->next_frame));
+                s->late_transfers++;
+                s->dropped_frames += frame - s->next_frame;
+            }
+            s->next_frame = frame;
+        }
+
+        c->req.endpoint.transfer_flags = TRANSFER_FLAGS_ISO_SET_START_FRAME
+                                         | TRANSFER_FLAGS_ISO_ABSOLUTE_START_FRAME;
+        c->req.endpoint.iso_start_frame_latency = s->next_frame;
+        s->start_frames[index] = s->next_frame;
+        s->next_frame += s->frames_per_transfer;
+
+        ret = usb_submit_async_iso_results(c, s->transfer_data
+                                           + index * s->buffer_size,
+                                           s->transfer_size);
+    }
+    else
+    {
+        ret = usb_submit_async(c, s->transfer_data + index * s->buffer_size,
+                               s->transfer_size);
+    }
+    s->pending[index] = ret < 0 ? FALSE : TRUE;
+
+    return ret;
+}
+
+/* Moves the data of the packets that succeeded to the start of 'data', */
+/* counts the failed ones and returns the number of bytes. Iso IN */
+/* packets are stored at fixed offsets, a short packet leaves a gap. */
+/* called by the stream thread only */
+static int _usb_iso_stream_pack(usb_stream_t *s, void *context, char *data,
+                                ULONG *start_frame)
+{
+    struct usb_iso_packet_result *results;
+    struct usb_iso_transfer_info *info;
+    int count, i, length = 0;
+
+    if ((count = usb_get_iso_results(context, &results, &info)) < 0)
+        return count;
+
+    *start_frame = info->start_frame;
+
+    for (i = 0; i < count; i++)
+    {
+        if (results[i].status
+                || results[i].offset > (unsigned int)s->transfer_size
+                || results[i].length > s->transfer_size - results[i].offset)
+        {
+            s->packet_errors++;
+            continue;
+        }
+
+        memmove(data + length, data + results[i].offset, results[i].length);
+        length += results[i].length;
+    }
+
+    return length;
+}
+
+static DWORD WINAPI _usb_stream_thread(LPVOID param)
+{
+    usb_stream_t *s = (usb_stream_t *)param;
+    usb_context_t *c;
+    HANDLE events[2];
+    ULONG start_frame;
+    char *data;
+    int i = 0, ret;
+
+    events[0] = s->stop_event;
+
+    while (!s->error)
+    {
+        /* transfers complete in the order they were queued */
+        c = (usb_context_t *)s->contexts[i];
+        events[1] = c->ol.hEvent;
+
+        if (WaitForMultipleObjects(2, events, FALSE, INFINITE)
+                != WAIT_OBJECT_0 + 1)
+            break;
+
+        s->pending[i] = FALSE;
+        ret = usb_reap_async_nocancel(c, 0);
+
+        data = s->transfer_data + i * s->buffer_size;
+        start_frame = s->start_frames[i];
+
+        if (ret >= 0 && s->frames_per_transfer)
+            ret = _usb_iso_stream_pack(s, c, data, &start_frame);
+
+        if (ret < 0)
+        {
+            s->stats.errors++;
+            InterlockedExchange(&s->error, ret);
+            SetEvent(s->data_event);
+            break;
+        }
+
+        s->stats.transfers++;
+        s->stats.bytes += ret;
+
+        if (ret > 0)
+            _usb_stream_publish(s, data, ret, start_frame);
+
+        ret = _usb_stream_submit(s, i);
+        if (ret < 0)
+        {
+            s->stats.errors++;
+            InterlockedExchange(&s->error, ret);
+            SetEvent(s->data_event);
+            break;
+        }
+
+        i = (i + 1) % s->num_transfers;
+    }
+
+    return 0;
+}
+
+/* allocates the buffers of a stream, queues its transfers and starts */
+/* the stream thread, frees the stream on failure */
+static int _usb_stream_start(usb_stream_t *s, unsigned char ep,
+                             int packet_size)
+{
+    char *slot_data;
+    int i, ret;
+
+    s->num_slots = s->num_transfers * LIBUSB_STREAM_SLOTS_PER_TRANSFER;
+
+    s->transfer_data = malloc(s->num_transfers * s->buffer_size);
+    s->slots = malloc(s->num_slots * (sizeof(usb_stream_slot_t)
+                                      + s->transfer_size));
+    s->data_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    s->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (!s->transfer_data || !s->slots || !s->data_event || !s->stop_event)
+    {
+        USBERR0("memory allocation failed\n");
+        _usb_stream_free(s);
+        return -ENOMEM;
+    }
+
+    slot_data = (char *)(s->slots + s->num_slots);
+    for (i = 0; i < s->num_slots; i++)
+        s->slots[i].data = slot_data + i * s->transfer_size;
+
+    for (i = 0; i < s->num_transfers; i++)
+    {
+        if (s->frames_per_transfer)
+            ret = usb_isochronous_setup_async(s->dev, &s->contexts[i], ep,
+                                              packet_size);
+        else
+            ret = usb_bulk_setup_async(s->dev, &s->contexts[i], ep);
+        if (ret >= 0)
+            ret = _usb_stream_submit(s, i);
+        if (ret < 0)
+        {
+            _usb_stream_free(s);
+            return ret;
+        }
+    }
+
+    s->thread = CreateThread(NULL, 0, _usb_stream_thread, s, 0, NULL);
+    if (!s->thread)
+    {
+        USBERR("creating stream thread failed, win error: %s\n",
+               usb_win_error_to_string());
+        ret = -usb_win_error_to_errno();
+        _usb_stream_free(s);
+        return ret;
+    }
+
+    return 0;
+}
+
+static void _usb_stream_free(usb_stream_t *s)
+{
+    int i;
+
+    /* aborting the endpoint completes every queued transfer */
+    for (i = 0; i < s->num_transfers; i++)
+    {
+        if (s->pending[i])
+        {
+            _usb_cancel_io((usb_context_t *)s->contexts[i]);
+            break;
+        }
+    }
+
+    for (i = 0; i < s->num_transfers; i++)
+    {
+        if (s->pending[i])
+            usb_reap_async_nocancel(s->contexts[i], INFINITE);
+        if (s->contexts[i])
+            usb_free_async(&s->contexts[i]);
+    }
+
+    if (s->data_event)
+        CloseHandle(s->data_event);
+    if (s->stop_event)
+        CloseHandle(s->stop_event);
+    if (s->slots)
+        free(s->slots);
+    if (s->transfer_data)
+        free(s->transfer_data);
+    free(s);
+}
+
+int usb_stream_open(usb_dev_handle *dev, void **stream, unsigned char ep,
+                    int transfer_size, int num_transfers)
+{
+    usb_stream_t *s;
+    int ret;
+
+    if (!stream)
+    {
+        USBERR0("invalid stream\n");
+        return -EINVAL;
+    }
+
+    *stream = NULL;
+
+    if (!(ep & USB_ENDPOINT_IN))
+    {
+        USBERR("invalid endpoint 0x%02x\n", ep);
+        return -EINVAL;
+    }
+
+    if (transfer_size <= 0 || num_transfers < 1
+            || num_transfers > LIBUSB_STREAM_MAX_TRANSFERS)
+    {
+        USBERR("invalid stream size %d x %d, valid number of transfers is "
+               "1-%d\n", num_transfers, transfer_size,
+               LIBUSB_STREAM_MAX_TRANSFERS);
+        return -EINVAL;
+    }
+
+    if (!(s = malloc(sizeof(*s))))
+    {
+        USBERR0("memory allocation failed\n");
+        return -ENOMEM;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->dev = dev;
+    s->transfer_size = transfer_size;
+    s->buffer_size = transfer_size;
+    s->num_transfers = num_transfers;
+
+    if ((ret = _usb_stream_start(s, ep, 0)) < 0)
+        return ret;
+
+    *stream = s;
+    return 0;
+}
+
+int usb_iso_stream_open(usb_dev_handle *dev, void **stream,
+                        unsigned char ep, int packet_size,
+                        int packets_per_transfer, int packets_per_frame,
+                        int num_transfers)
+{
+    usb_stream_t *s;
+    int high_speed;
+    int ret;
+
+    if (!stream)
+    {
+        USBERR0("invalid stream\n");
+        return -EINVAL;
+    }
+
+    *stream = NULL;
+
+    if (!(ep & USB_ENDPOINT_IN))
+    {
+        USBERR("invalid endpoint 0x%02x\n", ep);
+        return -EINVAL;
+    }
+
+    /* frame numbers count 1 ms frames, a frame holds 8 microframe packets */
+    /* at high speed; a driver that can't report the speed allows both */
+    high_speed = _usb_is_high_speed(dev);
+    if ((high_speed > 0
+            && packets_per_frame != LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED)
+            || (!high_speed
+                && packets_per_frame != LIBUSB_ISO_PACKETS_PER_FRAME_FULL_SPEED)
+            || (high_speed < 0
+                && packets_per_frame != LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED
+                && packets_per_frame != LIBUSB_ISO_PACKETS_PER_FRAME_FULL_SPEED))
+    {
+        USBERR("invalid number of packets per frame %d, must be %d at full "
+               "and %d at high speed\n", packets_per_frame,
+               LIBUSB_ISO_PACKETS_PER_FRAME_FULL_SPEED,
+               LIBUSB_ISO_PACKETS_PER_FRAME_HIGH_SPEED);
+        return -EINVAL;
+    }
+
+    /* a transfer must span whole frames to keep the schedule contiguous */
+    if (packet_size <= 0 || packets_per_frame <= 0
+            || packets_per_transfer < packets_per_frame
+            || packets_per_transfer % packets_per_frame)
+    {
+        USBERR("invalid iso stream layout, %d packets of %d bytes per "
+               "transfer, %d packets per frame\n", packets_per_transfer,
+               packet_size, packets_per_frame);
+        return -EINVAL;
+    }
+
+    if (num_transfers < 1 || num_transfers > LIBUSB_STREAM_MAX_TRANSFERS)
+    {
+        USBERR("invalid number of transfers %d, valid range is 1-%d\n",
+               num_transfers, LIBUSB_STREAM_MAX_TRANSFERS);
+        return -EINVAL;
+    }
+
+    if (!(s = malloc(sizeof(*s))))
+    {
+        USBERR0("memory allocation failed\n");
+        return -ENOMEM;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->dev = dev;
+    s->transfer_size = packet_size * packets_per_transfer;
+    s->buffer_size = s->transfer_size
+                     + USB_ISO_RESULTS_SIZE(s->transfer_size, packet_size);
+    s->num_transfers = num_transfers;
+    s->frames_per_transfer = packets_per_transfer / packets_per_frame;
+
+    if ((ret = _usb_get_current_frame(dev, &s->next_frame)) < 0)
+    {
+        free(s);
+        return ret;
+    }
+    s->next_frame += LIBUSB_ISO_STREAM_LATENCY;
+
+    if ((ret = _usb_stream_start(s, ep, packet_size)) < 0)
+        return ret;
+
+    *stream = s;
+    return 0;
+}
+
+/* waits until the stream has buffered data */
+static int _usb_stream_wait(usb_stream_t *s, int timeout)
+{
+    DWORD start = GetTickCount(), elapsed;
+
+    while (s->tail == s->head)
+    {
+        /* report a stream error only after the buffered data */
+        if (s->error)
+            return s->error;
+
+        elapsed = GetTickCount() - start;
+        if ((DWORD)timeout != INFINITE && elapsed >= (DWORD)timeout)
+            return -ETRANSFER_TIMEDOUT;
+
+        WaitForSingleObject(s->data_event, (DWORD)timeout == INFINITE
+                            ? INFINITE : (DWORD)timeout - elapsed);
+    }
+
+    return 0;
+}
+
+int usb_stream_read(void *stream, char *bytes, int size, int timeout)
+{
+    usb_stream_t *s = (usb_stream_t *)stream;
+    usb_stream_slot_t *slot;
+    LONG tail;
+    int done = 0, length, ret;
+
+    if (!s || !bytes || size <= 0)
+    {
+        USBERR0("invalid parameter\n");
+        return -EINVAL;
+    }
+
+    if ((ret = _usb_stream_wait(s, timeout)) < 0)
+        return ret;
+
+    tail = s->tail;
+
+    while (done < size && tail != s->head)
+    {
+        slot = &s->slots[(ULONG)tail % s->num_slots];
+        length = slot->length - s->tail_offset;
+        if (length > size - done)
+            length = size - done;
+
+        memcpy(bytes + done, slot->data + s->tail_offset, length);
+        done += length;
+        s->tail_offset += length;
+
+        if (s->tail_offset == slot->length)
+        {
+            /* hand the slot back to the stream thread */
+            s->tail_offset = 0;
+            InterlockedExchange(&s->tail, ++tail);
+        }
+    }
+
+    return done;
+}
+
+int usb_stream_get_stats(void *stream, struct usb_stream_stats *stats)
+{
+    usb_stream_t *s = (usb_stream_t *)stream;
+
+    if (!s || !stats)
+    {
+        USBERR0("invalid parameter\n");
+        return -EINVAL;
+    }
+
+    memcpy(stats, &s->stats, sizeof(*stats));
+    stats->buffered = (ULONG)(s->head - s->tail);
+    return 0;
+}
+
+/* Reads from a single transfer of an iso stream and returns the frame */
+/* it was scheduled on. A gap in the frame numbers of two consecutive */
+/* reads means frames were skipped. What doesn't fit into 'bytes' is */
+/* returned by the next call. */
+int usb_iso_stream_read(void *stream, char *bytes, int size,
+                        unsigned int *start_frame, int timeout)
+{
+    usb_stream_t *s = (usb_stream_t *)stream;
+    usb_stream_slot_t *slot;
+    int length, ret;
+
+    if (!s || !s->frames_per_transfer || !bytes || size <= 0)
+    {
+        USBERR0("invalid parameter\n");
+        return -EINVAL;
+    }
+
+    if ((ret = _usb_stream_wait(s, timeout)) < 0)
+        return ret;
+
+    slot = &s->slots[(ULONG)s->tail % s->num_slots];
+    length = slot->length - s->tail_offset;
+    if (length > size)
+        length = size;
+
+    memcpy(bytes, slot->data + s->tail_offset, length);
+    s->tail_offset += length;
+
+    if (start_frame)
+        *start_frame = slot->start_frame;
+
+    if (s->tail_offset == slot->length)
+    {
+        s->tail_offset = 0;
+        InterlockedExchange(&s->tail, s->tail + 1);
+    }
+
+    return length;
+}
+
+int usb_iso_stream_get_stats(void *stream, struct usb_iso_stream_stats *stats)
+{
+    usb_stream_t *s = (usb_stream_t *)stream;
+
+    if (!s || !s->frames_per_transfer || !stats)
+    {
+        USBERR0("invalid parameter\n");
+        return -EINVAL;
+    }
+
+    stats->transfers = s->stats.transfers;
+    stats->bytes = s->stats.bytes;
+    stats->overruns = s->stats.overruns;
+    stats->dropped_bytes = s->stats.dropped_bytes;
+    stats->errors = s->stats.errors;
+    stats->buffered = (ULONG)(s->head - s->tail);
+    stats->late_transfers = s->late_transfers;
+    stats->dropped_frames = s->dropped_frames;
+    stats->next_frame = s->next_frame;
+    stats->packet_errors = s->packet_errors;
+    return 0;
+}
+
+int usb_stream_close(void *stream)
+{
+    usb_stream_t *s = (usb_stream_t *)stream;
+
+    if (!s)
+    {
+        USBERR0("invalid stream\n");
+        return -EINVAL;
+    }
+
+    SetEvent(s->stop_event);
+    WaitForSingleObject(s->thread, INFINITE);
+    CloseHandle(s->thread);
+
+    _usb_stream_free(s);
+    return 0;
+}
+
 static int _usb_transfer_sync(usb_dev_handle *dev, int control_code,
                               int ep, int pktsize, char *bytes, int size,
                               int timeout)
@@ -566,6 +1391,16 @@ static int _usb_transfer_sync(usb_dev_handle *dev, int control_code,
     int requested;
 
 	if (!timeout) timeout=INFINITE;
+
+#ifdef LIBUSB_WIN32_DLL_LARGE_TRANSFER_SUPPORT
+    if (dev->pipeline_depth > 1 && size > LIBUSB_MAX_READ_WRITE)
+    {
+        return _usb_transfer_sync_pipelined(dev, control_code, ep, pktsize,
+                                            bytes, size, timeout,
+                                            dev->pipeline_depth);
+    }
+#endif
+
     ret = _usb_setup_async(dev, &context, control_code, (unsigned char )ep,
                            pktsize);
 
@@ -574,38 +1409,179 @@ static int _usb_transfer_sync(usb_dev_handle *dev, int control_code,
         return ret;
     }
 
-    do
-    {
-#ifdef LIBUSB_WIN32_DLL_LARGE_TRANSFER_SUPPORT
-        requested = size > LIBUSB_MAX_READ_WRITE ? LIBUSB_MAX_READ_WRITE : size;
-#else
-        requested = size;
-#endif
-        ret = usb_submit_async(context, bytes, requested);
+    do
+    {
+#ifdef LIBUSB_WIN32_DLL_LARGE_TRANSFER_SUPPORT
+        requested = size > LIBUSB_MAX_READ_WRITE ? LIBUSB_MAX_READ_WRITE : size;
+#else
+        requested = size;
+#endif
+        ret = usb_submit_async(context, bytes, requested);
+
+        if (ret < 0)
+        {
+            transmitted = ret;
+            break;
+        }
+
+        ret = usb_reap_async(context, timeout);
+
+        if (ret < 0)
+        {
+            transmitted = ret;
+            break;
+        }
+
+        transmitted += ret;
+        bytes += ret;
+        size -= ret;
+    }
+    while (size > 0 && ret == requested);
+
+    usb_free_async(&context);
+
+    return transmitted;
+}
+
+/* Splits a large transfer into LIBUSB_MAX_READ_WRITE sized requests and */
+/* keeps up to 'depth' of them queued, so the bus doesn't go idle while a */
+/* completed request is reaped and the next one is submitted. If a read */
+/* ends short while later requests already received data, that data is */
+/* dropped and -EIO is returned. */
+static int _usb_transfer_sync_pipelined(usb_dev_handle *dev, int control_code,
+                                        int ep, int pktsize, char *bytes,
+                                        int size, int timeout, int depth)
+{
+    void *context[LIBUSB_MAX_PIPELINE_DEPTH];
+    int requested[LIBUSB_MAX_PIPELINE_DEPTH];
+    char *next = bytes;
+    int remaining = size;
+    int transmitted = 0;
+    int short_packet = FALSE;
+    int overrun = FALSE;
+    int queued = 0;
+    int head = 0;
+    int count;
+    int ret;
+    int i;
+
+    count = (size + LIBUSB_MAX_READ_WRITE - 1) / LIBUSB_MAX_READ_WRITE;
+
+    if (depth > LIBUSB_MAX_PIPELINE_DEPTH)
+        depth = LIBUSB_MAX_PIPELINE_DEPTH;
+    if (depth > count)
+        depth = count;
+
+    memset(context, 0, sizeof(context));
 
+    for (i = 0; i < depth; i++)
+    {
+        ret = _usb_setup_async(dev, &context[i], control_code,
+                               (unsigned char)ep, pktsize);
         if (ret < 0)
         {
             transmitted = ret;
-            break;
+            goto done;
         }
+    }
 
-        ret = usb_reap_async(context, timeout);
+    while (queued > 0 || remaining > 0)
+    {
+        /* keep the pipeline filled */
+        while (queued < depth && remaining > 0)
+        {
+            i = (head + queued) % depth;
+            requested[i] = remaining > LIBUSB_MAX_READ_WRITE
+                           ? LIBUSB_MAX_READ_WRITE : remaining;
+
+            ret = usb_submit_async(context[i], next, requested[i]);
+
+            if (ret < 0)
+            {
+                transmitted = ret;
+                goto cancel;
+            }
+
+            next += requested[i];
+            remaining -= requested[i];
+            queued++;
+        }
+
+        ret = usb_reap_async(context[head], timeout);
+        i = head;
+        head = (head + 1) % depth;
+        queued--;
 
         if (ret < 0)
         {
             transmitted = ret;
-            break;
+            goto cancel;
         }
 
         transmitted += ret;
-        bytes += ret;
-        size -= ret;
+
+        /* a short packet terminates the transfer */
+        if (ret < requested[i])
+        {
+            short_packet = TRUE;
+            goto cancel;
+        }
     }
-    while (size > 0 && ret == requested);
 
-    usb_free_async(&context);
+cancel:
+    if (queued > 0)
+    {
+        /* aborts every request still pending on this endpoint */
+        usb_cancel_async(context[head]);
 
-    return transmitted;
+        while (queued > 0)
+        {
+            ret = usb_reap_async_nocancel(context[head], timeout);
+
+            /* Requests queued behind a short packet may already have */
+            /* received data of the next transfer. It can't be returned */
+            /* without breaking the short packet framing, so it is */
+            /* dropped and the transfer fails. */
+            if (short_packet && ret > 0)
+            {
+                USBERR("%d bytes received after a short packet on ep 0x%02x, "
+                       "data lost\n", ret, ep);
+                overrun = TRUE;
+            }
+
+            head = (head + 1) % depth;
+            queued--;
+        }
+    }
+
+done:
+    for (i = 0; i < depth; i++)
+    {
+        if (context[i])
+            usb_free_async(&context[i]);
+    }
+
+    return overrun ? -EIO : transmitted;
+}
+
+int usb_set_pipeline_depth_np(usb_dev_handle *dev, int depth)
+{
+    if (!dev)
+    {
+        USBERR("invalid device handle %p", dev);
+        return -EINVAL;
+    }
+
+    if (depth < 1 || depth > LIBUSB_MAX_PIPELINE_DEPTH)
+    {
+        USBERR("invalid pipeline depth %d, valid range is 1-%d\n",
+               depth, LIBUSB_MAX_PIPELINE_DEPTH);
+        return -EINVAL;
+    }
+
+    dev->pipeline_depth = depth;
+
+    return 0;
 }
 
 int usb_bulk_write(usb_dev_handle *dev, int ep, char *bytes, int size,
@@ -668,6 +1644,47 @@ int usb_interrupt_setup_async(usb_dev_handle *dev, void **context,
                                 ep, 0);
 }
 
+/* the direct control ioctls were added with the 1.2 driver series */
+static int _usb_control_direct_supported(void)
+{
+    if (_usb_version.driver.major != 1)
+        return _usb_version.driver.major > 1;
+
+    return _usb_version.driver.minor >= 2;
+}
+
+/* vendor and class requests larger than the stack buffer go through */
+/* LIBUSB_IOCTL_CONTROL_READ/WRITE; the driver maps the caller's buffer */
+/* instead of copying it. */
+static int _usb_control_msg_direct(usb_dev_handle *dev, int requesttype,
+                                   int request, int value, int index,
+                                   char *bytes, int size, int timeout)
+{
+    libusb_request req;
+    int code;
+    int ret = 0;
+
+    memset(&req, 0, sizeof(req));
+    req.timeout = timeout;
+    req.control.RequestType = (UCHAR)requesttype;
+    req.control.Request = (UCHAR)request;
+    req.control.Value = (USHORT)value;
+    req.control.Index = (USHORT)index;
+    req.control.Length = (USHORT)size;
+
+    code = (requesttype & USB_ENDPOINT_IN) ?
+           LIBUSB_IOCTL_CONTROL_READ : LIBUSB_IOCTL_CONTROL_WRITE;
+
+    if (!_usb_io_sync(dev->impl_info, code, &req, sizeof(libusb_request),
+                      bytes, size, &ret))
+    {
+        USBERR("sending control message failed, win error: %s\n", usb_win_error_to_string());
+        return -usb_win_error_to_errno();
+    }
+
+    return ret;
+}
+
 int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
                     int value, int index, char *bytes, int size, int timeout)
 {
@@ -678,6 +1695,7 @@ int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
     void *in = bytes;
     int in_size = size;
     int code;
+    char out_buf[sizeof(libusb_request) + LIBUSB_CONTROL_STACK_BUFFER_SIZE];
 
     if (dev->impl_info == INVALID_HANDLE_VALUE)
     {
@@ -759,6 +1777,14 @@ int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
     case USB_TYPE_VENDOR:
     case USB_TYPE_CLASS:
 
+        if (size > LIBUSB_CONTROL_STACK_BUFFER_SIZE && size <= 0xFFFF
+                && _usb_control_direct_supported())
+        {
+            return _usb_control_msg_direct(dev, requesttype, request,
+                                           value, index, bytes, size,
+                                           timeout);
+        }
+
         req.vendor.type = (requesttype >> 5) & 0x03;
         req.vendor.recipient = requesttype & 0x1F;
         req.vendor.request = request;
@@ -778,10 +1804,14 @@ int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
         return -EINVAL;
     }
 
-    /* out request? */
+    /* out request? the payload follows the request header */
     if (!(requesttype & USB_ENDPOINT_IN))
     {
-        if (!(out = malloc(sizeof(libusb_request) + size)))
+        if (size <= LIBUSB_CONTROL_STACK_BUFFER_SIZE)
+        {
+            out = out_buf;
+        }
+        else if (!(out = malloc(sizeof(libusb_request) + size)))
         {
             USBERR0("memory allocation failed\n");
             return -ENOMEM;
@@ -797,19 +1827,21 @@ int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
     if (!_usb_io_sync(dev->impl_info, code, out, out_size, in, in_size, &read))
     {
         USBERR("sending control message failed, win error: %s\n", usb_win_error_to_string());
-        if (!(requesttype & USB_ENDPOINT_IN))
+        if (out != &req && out != out_buf)
         {
             free(out);
         }
         return -usb_win_error_to_errno();
     }
 
-    /* out request? */
-    if (!(requesttype & USB_ENDPOINT_IN))
+    if (out != &req && out != out_buf)
     {
         free(out);
-        return size;
     }
+
+    /* out request? */
+    if (!(requesttype & USB_ENDPOINT_IN))
+        return size;
     else
         return read;
 }
@@ -839,70 +1871,143 @@ int usb_os_find_busses(struct usb_bus **busses)
     return 0;
 }
 
+static void _usb_probe_device(int devnum, usb_probe_result_t *result)
+{
+    char dev_name[LIBUSB_PATH_MAX];
+    HANDLE handle;
+    libusb_request req;
+    int ret = 0;
+
+    result->status = 0;
+
+    _snprintf(dev_name, sizeof(dev_name) - 1,"%s%04d",
+              LIBUSB_DEVICE_NAME, devnum);
+
+    handle = CreateFile(dev_name, 0, 0, NULL, OPEN_EXISTING,
+                        FILE_FLAG_OVERLAPPED, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+
+    /* retrieve device descriptor */
+    req.descriptor.type = USB_DT_DEVICE;
+    req.descriptor.recipient = USB_RECIP_DEVICE;
+    req.descriptor.index = 0;
+    req.descriptor.language_id = 0;
+    req.timeout = LIBUSB_DEFAULT_TIMEOUT;
+
+    _usb_io_sync_timeout(handle, LIBUSB_IOCTL_GET_DESCRIPTOR,
+                         &req, sizeof(libusb_request),
+                         result->descriptor, USB_DT_DEVICE_SIZE, &ret,
+                         LIBUSB_DEFAULT_TIMEOUT);
+
+    result->status = ret < USB_DT_DEVICE_SIZE ? -1 : 1;
+
+    CloseHandle(handle);
+}
+
+static void _usb_probe_run(usb_probe_t *probe)
+{
+    LONG devnum;
+
+    while ((devnum = InterlockedIncrement(&probe->next)) < LIBUSB_MAX_DEVICES)
+    {
+        _usb_probe_device((int)devnum, &probe->results[devnum]);
+    }
+}
+
+static DWORD WINAPI _usb_probe_worker(LPVOID param)
+{
+    usb_probe_t *probe = (usb_probe_t *)param;
+
+    _usb_probe_run(probe);
+
+    if (!InterlockedDecrement(&probe->pending))
+        SetEvent(probe->done);
+
+    return 0;
+}
+
 int usb_os_find_devices(struct usb_bus *bus, struct usb_device **devices)
 {
     int i;
     struct usb_device *dev, *fdev = NULL;
     char dev_name[LIBUSB_PATH_MAX];
-    int ret;
-    HANDLE handle;
-    libusb_request req;
+    usb_probe_t *probe;
 
-    for (i = 1; i < LIBUSB_MAX_DEVICES; i++)
+    if (!(probe = malloc(sizeof(*probe))))
     {
-        ret = 0;
+        USBERR0("memory allocation failed\n");
+        return -ENOMEM;
+    }
 
-        _snprintf(dev_name, sizeof(dev_name) - 1,"%s%04d",
-                  LIBUSB_DEVICE_NAME, i);
+    /* 'next' starts at 0, device numbers start at 1 */
+    memset(probe, 0, sizeof(*probe));
 
-        if (!(dev = malloc(sizeof(*dev))))
+    /* The calling thread is one of the workers and holds a reference on */
+    /* 'pending' until it is done. The others are queued to the system */
+    /* thread pool, which reuses its threads across scans. If none can be */
+    /* queued the calling thread probes all nodes on its own. */
+    probe->pending = 1;
+    probe->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    for (i = 0; probe->done && i < LIBUSB_PROBE_MAX_WORKERS - 1; i++)
+    {
+        InterlockedIncrement(&probe->pending);
+        if (!QueueUserWorkItem(_usb_probe_worker, probe, WT_EXECUTEDEFAULT))
         {
-            USBERR0("memory allocation failed\n");
-            return -ENOMEM;
+            InterlockedDecrement(&probe->pending);
+            break;
         }
+    }
 
-        memset(dev, 0, sizeof(*dev));
-        dev->bus = bus;
-        dev->devnum = (unsigned char)i;
+    _usb_probe_run(probe);
 
-        handle = CreateFile(dev_name, 0, 0, NULL, OPEN_EXISTING,
-                            FILE_FLAG_OVERLAPPED, NULL);
+    if (probe->done)
+    {
+        if (InterlockedDecrement(&probe->pending))
+            WaitForSingleObject(probe->done, INFINITE);
+        CloseHandle(probe->done);
+    }
 
-        if (handle == INVALID_HANDLE_VALUE)
+    /* merge in device number order, as a sequential scan would */
+    for (i = 1; i < LIBUSB_MAX_DEVICES; i++)
+    {
+        if (probe->results[i].status < 0)
         {
-            free(dev);
+            USBERR0("couldn't read device descriptor\n");
             continue;
         }
 
-        /* retrieve device descriptor */
-        req.descriptor.type = USB_DT_DEVICE;
-        req.descriptor.recipient = USB_RECIP_DEVICE;
-        req.descriptor.index = 0;
-        req.descriptor.language_id = 0;
-        req.timeout = LIBUSB_DEFAULT_TIMEOUT;
-
-        _usb_io_sync(handle, LIBUSB_IOCTL_GET_DESCRIPTOR,
-                     &req, sizeof(libusb_request),
-                     &dev->descriptor, USB_DT_DEVICE_SIZE, &ret);
+        if (!probe->results[i].status)
+            continue;
 
-        if (ret < USB_DT_DEVICE_SIZE)
+        if (!(dev = malloc(sizeof(*dev))))
         {
-            USBERR0("couldn't read device descriptor\n");
-            free(dev);
-            CloseHandle(handle);
-            continue;
+            USBERR0("memory allocation failed\n");
+            _usb_free_dev_list(fdev);
+            free(probe);
+            return -ENOMEM;
         }
 
+        memset(dev, 0, sizeof(*dev));
+        dev->bus = bus;
+        dev->devnum = (unsigned char)i;
+        usb_parse_device_descriptor(probe->results[i].descriptor,
+                                    &dev->descriptor);
+
+        _snprintf(dev_name, sizeof(dev_name) - 1,"%s%04d",
+                  LIBUSB_DEVICE_NAME, i);
         _snprintf(dev->filename, LIBUSB_PATH_MAX - 1, "%s--0x%04x-0x%04x",
                   dev_name, dev->descriptor.idVendor, dev->descriptor.idProduct);
 
-        CloseHandle(handle);
-
         LIST_ADD(fdev, dev);
 
         USBMSG("found %s on %s\n", dev->filename, bus->dirname);
     }
 
+    free(probe);
+
     *devices = fdev;
 
     return 0;
@@ -936,9 +2041,10 @@ void usb_os_init(void)
             continue;
         }
 
-        if (!_usb_io_sync(dev, LIBUSB_IOCTL_GET_VERSION,
-                          &req, sizeof(libusb_request),
-                          &req, sizeof(libusb_request), &ret)
+        if (!_usb_io_sync_timeout(dev, LIBUSB_IOCTL_GET_VERSION,
+                                  &req, sizeof(libusb_request),
+                                  &req, sizeof(libusb_request), &ret,
+                                  LIBUSB_DEFAULT_TIMEOUT)
                 || (ret < sizeof(libusb_request)))
         {
             USBERR0("getting driver version failed\n");
@@ -1152,6 +2258,163 @@ int usb_os_determine_children(struct usb_bus *bus)
     return 0;
 }
 
+static int _usb_context_pool_create(usb_dev_handle *dev)
+{
+    usb_context_pool_t *pool;
+
+    if (!(pool = malloc(sizeof(usb_context_pool_t))))
+    {
+        USBERR0("memory allocation failed\n");
+        return -ENOMEM;
+    }
+
+    memset(pool, 0, sizeof(usb_context_pool_t));
+    InitializeCriticalSection(&pool->lock);
+
+    /* one reference for the open device handle */
+    pool->ref_count = 1;
+    dev->impl_context_pool = pool;
+
+    return 0;
+}
+
+static void _usb_context_pool_close(usb_dev_handle *dev)
+{
+    usb_context_pool_t *pool = (usb_context_pool_t *)dev->impl_context_pool;
+    usb_context_t *list, *next;
+
+    if (!pool)
+        return;
+
+    dev->impl_context_pool = NULL;
+
+    EnterCriticalSection(&pool->lock);
+    pool->closed = TRUE;
+    list = pool->free_list;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    LeaveCriticalSection(&pool->lock);
+
+    while (list)
+    {
+        next = list->next;
+        CloseHandle(list->ol.hEvent);
+        free(list);
+        _usb_context_pool_unref(pool);
+        list = next;
+    }
+
+    _usb_context_pool_unref(pool);
+}
+
+static void _usb_context_pool_unref(usb_context_pool_t *pool)
+{
+    int ref_count;
+
+    EnterCriticalSection(&pool->lock);
+    ref_count = --pool->ref_count;
+    LeaveCriticalSection(&pool->lock);
+
+    if (!ref_count)
+    {
+        DeleteCriticalSection(&pool->lock);
+        free(pool);
+    }
+}
+
+static int _usb_context_alloc(usb_dev_handle *dev, usb_context_t **context)
+{
+    usb_context_pool_t *pool = (usb_context_pool_t *)dev->impl_context_pool;
+    usb_context_t *c = NULL;
+    HANDLE event;
+
+    if (pool)
+    {
+        EnterCriticalSection(&pool->lock);
+        if ((c = pool->free_list))
+        {
+            pool->free_list = c->next;
+            pool->free_count--;
+        }
+        else
+        {
+            /* every context handed out holds a pool reference */
+            pool->ref_count++;
+        }
+        LeaveCriticalSection(&pool->lock);
+    }
+
+    if (c)
+    {
+        /* recycled context, keep the event but clear the signal of its */
+        /* last request, a wait before the next submit must not see it */
+        event = c->ol.hEvent;
+        memset(c, 0, sizeof(usb_context_t));
+        c->ol.hEvent = event;
+        ResetEvent(event);
+        c->pool = pool;
+
+        *context = c;
+        return 0;
+    }
+
+    if (!(c = malloc(sizeof(usb_context_t))))
+    {
+        USBERR0("memory allocation error\n");
+        if (pool)
+            _usb_context_pool_unref(pool);
+        return -ENOMEM;
+    }
+
+    memset(c, 0, sizeof(usb_context_t));
+    c->pool = pool;
+
+    c->ol.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (!c->ol.hEvent)
+    {
+        USBERR("creating event failed: win error: %s",
+                  usb_win_error_to_string());
+        free(c);
+        if (pool)
+            _usb_context_pool_unref(pool);
+        return -usb_win_error_to_errno();
+    }
+
+    *context = c;
+    return 0;
+}
+
+static void _usb_context_release(usb_context_t *context)
+{
+    usb_context_pool_t *pool = context->pool;
+    int recycled = FALSE;
+
+    /* a context with a request still in flight can't be reused */
+    if (pool && HasOverlappedIoCompleted(&context->ol))
+    {
+        EnterCriticalSection(&pool->lock);
+        if (!pool->closed && pool->free_count < LIBUSB_CONTEXT_POOL_MAX)
+        {
+            context->next = pool->free_list;
+            pool->free_list = context;
+            pool->free_count++;
+            recycled = TRUE;
+        }
+        LeaveCriticalSection(&pool->lock);
+
+        /* pooled contexts hold a reference until the pool is closed */
+        if (recycled)
+            return;
+    }
+
+    CloseHandle(context->ol.hEvent);
+    free(context);
+
+    if (pool)
+        _usb_context_pool_unref(pool);
+}
+
 static int _usb_cancel_io(usb_context_t *context)
 {
     int ret;
@@ -1183,8 +2446,62 @@ static int _usb_abort_ep(usb_dev_handle *dev, unsigned int ep)
     return 0;
 }
 
+static int _usb_get_current_frame(usb_dev_handle *dev, ULONG *frame)
+{
+    libusb_request req;
+    int ret;
+
+    memset(&req, 0, sizeof(req));
+    req.timeout = LIBUSB_DEFAULT_TIMEOUT;
+
+    if (!_usb_io_sync(dev->impl_info, LIBUSB_IOCTL_GET_CURRENT_FRAME,
+                      &req, sizeof(libusb_request), frame, sizeof(*frame),
+                      &ret))
+    {
+        USBERR("getting current frame failed, win error: %s\n",
+               usb_win_error_to_string());
+        return -usb_win_error_to_errno();
+    }
+
+    return ret == sizeof(*frame) ? 0 : -EIO;
+}
+
+/* returns 1 for a high speed device, 0 for a full or low speed device */
+/* and a negative error if the driver doesn't report the speed */
+static int _usb_is_high_speed(usb_dev_handle *dev)
+{
+    libusb_request req;
+    ULONG speed = 0;
+    int ret;
+
+    memset(&req, 0, sizeof(req));
+    req.timeout = LIBUSB_DEFAULT_TIMEOUT;
+    req.query_device.information_type = LIBUSB_DEVICE_INFO_SPEED;
+
+    if (!_usb_io_sync(dev->impl_info, LIBUSB_IOCTL_QUERY_DEVICE_INFORMATION,
+                      &req, sizeof(libusb_request), &speed, sizeof(speed),
+                      &ret) || ret != sizeof(speed))
+    {
+        USBWRN0("device speed unknown\n");
+        return -EIO;
+    }
+
+    return speed == LIBUSB_DEVICE_SPEED_HIGH ? 1 : 0;
+}
+
 static int _usb_io_sync(HANDLE dev, unsigned int code, void *out, int out_size,
                         void *in, int in_size, int *ret)
+{
+    return _usb_io_sync_timeout(dev, code, out, out_size, in, in_size, ret,
+                                INFINITE);
+}
+
+/* like _usb_io_sync(), but cancels the request if it doesn't complete */
+/* within 'timeout' milliseconds */
+static int _usb_io_sync_timeout(HANDLE dev, unsigned int code,
+                                void *out, int out_size,
+                                void *in, int in_size, int *ret,
+                                DWORD timeout)
 {
     OVERLAPPED ol;
     DWORD _ret;
@@ -1208,6 +2525,17 @@ static int _usb_io_sync(HANDLE dev, unsigned int code, void *out, int out_size,
         }
     }
 
+    if (timeout != INFINITE
+            && WaitForSingleObject(ol.hEvent, timeout) == WAIT_TIMEOUT)
+    {
+        /* wait for the cancelled request to be completed by the driver */
+        CancelIo(dev);
+        GetOverlappedResult(dev, &ol, &_ret, TRUE);
+        CloseHandle(ol.hEvent);
+        SetLastError(ERROR_TIMEOUT);
+        return FALSE;
+    }
+
     if (GetOverlappedResult(dev, &ol, &_ret, TRUE))
     {
         if (ret)
@@ -76,13 +76,7 @@ static void _usb_free_device_list(struct usb_device *list);
 static void _usb_fetch_descriptors(struct usb_device *dev);
 static void *_usb_fetch_configs(usbi_device_t usbi_dev, int num_config);
 static struct usb_interface *
-_usb_fetch_interfaces(usbi_device_t usbi_dev, int config, int num_interfaces);
-static struct usb_interface_descriptor *
-_usb_fetch_altsettings(usbi_device_t usbi_dev, int config, 
-                       int interface, int num_alt);
-static void *_usb_fetch_endpoints(usbi_device_t usbi_dev, int config, 
-                                  int interface, int alt_setting, 
-                                  int num_endpoints);
+_usb_parse_interfaces(const uint8_t *desc, int size, int num_interfaces);
 
 static int _usb_setup_async(usb_dev_handle *dev, void **context,
                             usbi_transfer_t type, int endpoint,
@@ -179,6 +173,7 @@ static void *_usb_fetch_configs(usbi_device_t usbi_dev, int num_config)
 {
   int size, c;
   struct usb_config_descriptor *d;
+  const void *desc;
 
   if(!num_config)
     return NULL;
@@ -188,94 +183,86 @@ static void *_usb_fetch_configs(usbi_device_t usbi_dev, int num_config)
   USBI_DEBUG_ASSERT(d, "memory allocation failed", NULL);
   
   for(c = 0; c < num_config; c++) {
-    if(usbi_get_config_descriptor(usbi_dev, c, d + c,
-                                  USB_DT_CONFIG_SIZE) != USB_DT_CONFIG_SIZE)
+    size = usbi_get_cached_config_descriptor(usbi_dev, c, &desc);
+    if(size < USB_DT_CONFIG_SIZE)
       continue;
-    d[c].interface = _usb_fetch_interfaces(usbi_dev, c, d->bNumInterfaces);
+    memcpy(d + c, desc, USB_DT_CONFIG_SIZE);
+    d[c].interface = _usb_parse_interfaces(desc, size, d[c].bNumInterfaces);
   }
   return d;
 }
 
+/* builds the interface/altsetting/endpoint tree of one configuration from
+   its complete descriptor: a first walk over the descriptor counts the
+   alternate settings of each interface so that every array can be
+   allocated with its final size, the second walk fills them in */
 static struct usb_interface *
-_usb_fetch_interfaces(usbi_device_t usbi_dev, int config, int num_interfaces)
+_usb_parse_interfaces(const uint8_t *desc, int size, int num_interfaces)
 {
   struct usb_interface *interface;
-  struct usb_interface_descriptor idesc;
-  int i, size;
+  struct usb_interface_descriptor *alt;
+  const uint8_t *p;
+  int pass, left, number, i, e;
 
   if(!num_interfaces)
     return NULL;
 
-  size = num_interfaces * sizeof(struct usb_interface);
-  
-  interface = _usb_malloc(size);
+  interface = _usb_malloc(num_interfaces * sizeof(struct usb_interface));
   USBI_DEBUG_ASSERT(interface, "memory allocation failed", NULL);
-  
-  for(i = 0; i < num_interfaces; i++) {
-    int num_alt = 0;
-    while(1) {
-      if(usbi_get_interface_descriptor(usbi_dev, config, i, num_alt, &idesc,
-                                       USB_DT_INTERFACE_SIZE)
-         != USB_DT_INTERFACE_SIZE)
-        break;
-      num_alt++;
-    }
-    if(num_alt) {
-      interface[i].altsetting = _usb_fetch_altsettings(usbi_dev, config, i,
-                                                       num_alt);
-      if(interface[i].altsetting)
-        interface[i].num_altsetting = num_alt;
-    }
-  }
-  return interface;
-}
 
-static struct usb_interface_descriptor *
-_usb_fetch_altsettings(usbi_device_t usbi_dev, int config, 
-                       int interface, int num_alt)
-{
-  struct usb_interface_descriptor *idesc;
-  int size, a;
+  for(pass = 0; pass < 2; pass++) {
+    i = -1;
+    e = 0;
+    number = -1;
+    alt = NULL;
+    p = desc + USB_DT_CONFIG_SIZE;
+    left = size - USB_DT_CONFIG_SIZE;
+
+    while(left >= 2 && p[0] >= 2 && p[0] <= left) {
+      if(p[1] == USB_DT_INTERFACE && p[0] >= USB_DT_INTERFACE_SIZE) {
+        /* alternate settings follow the default setting of their
+           interface, anything else starts the next interface */
+        if(!p[3] || p[2] != number) {
+          if(i + 1 >= num_interfaces)
+            break;
+          i++;
+          number = p[2];
+        }
+        if(!pass) {
+          interface[i].num_altsetting++;
+        } else if(interface[i].altsetting) {
+          alt = interface[i].altsetting + interface[i].num_altsetting++;
+          memcpy(alt, p, USB_DT_INTERFACE_SIZE);
+          e = 0;
+          if(alt->bNumEndpoints) {
+            alt->endpoint = _usb_malloc(alt->bNumEndpoints
+                                        * sizeof(struct usb_endpoint_descriptor));
+            if(!alt->endpoint)
+              alt->bNumEndpoints = 0;
+          }
+        } else {
+          alt = NULL;
+        }
+      } else if(alt && p[1] == USB_DT_ENDPOINT && p[0] >= USB_DT_ENDPOINT_SIZE
+                && e < alt->bNumEndpoints) {
+        memcpy(alt->endpoint + e++, p, p[0] < USB_DT_ENDPOINT_AUDIO_SIZE 
+               ? p[0] : USB_DT_ENDPOINT_AUDIO_SIZE);
+      }
+      left -= p[0];
+      p += p[0];
+    }
 
-  if(!num_alt)
-    return NULL;
-  
-  size = num_alt * sizeof(struct usb_interface_descriptor);
-  
-  idesc = _usb_malloc(size);
-  USBI_DEBUG_ASSERT(idesc, "memory allocation failed", NULL);
-  
-  for(a = 0; a < num_alt; a++) {
-    if(usbi_get_interface_descriptor(usbi_dev, config, interface, a, 
-                                     idesc + a, USB_DT_INTERFACE_SIZE)
-       == USB_DT_INTERFACE_SIZE) {
-      idesc[a].endpoint = _usb_fetch_endpoints(usbi_dev, config,
-                                               interface, a,
-                                               idesc[a].bNumEndpoints);
+    if(!pass) {
+      for(i = 0; i < num_interfaces; i++) {
+        if(interface[i].num_altsetting)
+          interface[i].altsetting = 
+            _usb_malloc(interface[i].num_altsetting 
+                        * sizeof(struct usb_interface_descriptor));
+        interface[i].num_altsetting = 0;
+      }
     }
   }
-  return idesc;
-}
-
-static void *_usb_fetch_endpoints(usbi_device_t usbi_dev, int config, 
-                                  int interface, int alt_setting, 
-                                  int num_endpoints)
-{
-  struct usb_endpoint_descriptor *edesc;
-  int size, e;
-
-  if(!num_endpoints)
-    return NULL;
-  
-  size = num_endpoints * sizeof(struct usb_endpoint_descriptor);
-  
-  edesc = _usb_malloc(size);
-  USBI_DEBUG_ASSERT(edesc, "memory allocation failed", NULL);
-  
-  for(e = 0; e < num_endpoints; e++)
-    usbi_get_endpoint_descriptor(usbi_dev, config, interface, alt_setting,
-                                 e, edesc + e, USB_DT_ENDPOINT_SIZE);
-  return edesc;
+  return interface;
 }
 
 /* DLL main entry point */
@@ -529,6 +516,33 @@ int usb_bulk_read(usb_dev_handle *dev, int ep, char *bytes, int size,
   return _usbi_to_errno(ret);
 }
 
+/* the buffers go out as one transfer, 'struct usb_iovec' has the layout */
+/* of usbi_iovec_t */
+int usb_bulk_writev(usb_dev_handle *dev, int ep, const struct usb_iovec *iov,
+                    int iov_count, int timeout)
+{
+  int ret;
+
+  USBI_DEBUG_ASSERT_PARAM(USBI_ENDPOINT_OUT(ep), ep, -EINVAL);
+
+  ret = usbi_transfer_v_sync(dev, ep, USBI_TRANSFER_BULK,
+                             (const usbi_iovec_t *)iov, iov_count, timeout);
+  return _usbi_to_errno(ret);
+}
+
+/* a short packet ends the transfer, later buffers are left untouched */
+int usb_bulk_readv(usb_dev_handle *dev, int ep, const struct usb_iovec *iov,
+                   int iov_count, int timeout)
+{
+  int ret;
+
+  USBI_DEBUG_ASSERT_PARAM(USBI_ENDPOINT_IN(ep), ep, -EINVAL);
+
+  ret = usbi_transfer_v_sync(dev, ep, USBI_TRANSFER_BULK,
+                             (const usbi_iovec_t *)iov, iov_count, timeout);
+  return _usbi_to_errno(ret);
+}
+
 int usb_interrupt_write(usb_dev_handle *dev, int ep, char *bytes, int size,
                         int timeout)
 {
@@ -293,6 +293,12 @@ typedef struct usbi_device_t usb_dev_handle;
 
 #include <poppack.h>
 
+/* one buffer of usb_bulk_writev() and usb_bulk_readv() */
+struct usb_iovec {
+  void *data;
+  int size;
+};
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -324,6 +330,14 @@ extern "C" {
                           int timeout);
   int usb_interrupt_read(usb_dev_handle *dev, int ep, char *bytes, int size,
                          int timeout);
+
+  #define LIBUSB_HAS_BULK_IOVEC 1
+  int usb_bulk_writev(usb_dev_handle *dev, int ep, 
+                      const struct usb_iovec *iov, int iov_count,
+                      int timeout);
+  int usb_bulk_readv(usb_dev_handle *dev, int ep, 
+                     const struct usb_iovec *iov, int iov_count,
+                     int timeout);
   int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
                       int value, int index, char *bytes, int size, 
                       int timeout);
@@ -1,13 +1,36 @@
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0500 /* RegisterWaitForSingleObject() */
+#endif
+
 #include <stddef.h>
 #include <stdio.h>
+#include <limits.h>
 #include <string.h>
 #include "usbi.h"
+#include <dbt.h>
 #include "usbi_backend_libusb0.h"
 #include "usbi_backend_winusb.h"
 #include "usbi_backend_hid.h"
+#include "usbi_backend_loopback.h"
 
 #define USBI_MAX_DEVICES 255
 
+/* number of buckets of the device name hash, must be a power of two */
+#define USBI_DEVICE_HASH_SIZE 256
+
+/* number of device arrivals and removals remembered for 
+   usbi_get_changes() */
+#define USBI_MAX_CHANGES 256
+
+/* time to wait for a burst of device change messages to settle before
+   refreshing the device list, in ms */
+#define USBI_HOTPLUG_SETTLE_TIME 100
+
+#define USBI_HOTPLUG_WINDOW_CLASS "usbi_hotplug"
+
+/* maximum number of completed requests kept per device for reuse */
+#define USBI_MAX_CACHED_IO 32
+
 #define DRIVER_ENTRY(prefix) {         \
   sizeof(struct prefix##_device_t),    \
   sizeof(struct prefix##_io_t),        \
@@ -26,9 +49,12 @@
   (void *)prefix##_release_interface,  \
   (void *)prefix##_control_msg,        \
   (void *)prefix##_transfer,           \
+  (void *)prefix##_transfer_iso_results, \
+  (void *)prefix##_transfer_v,         \
   (void *)prefix##_wait,               \
   (void *)prefix##_poll,               \
-  (void *)prefix##_cancel }
+  (void *)prefix##_cancel,             \
+  (void *)prefix##_get_event }
 
 static struct {
   int device_size;
@@ -50,20 +76,79 @@ static struct {
                      int value, int index, void *data, int size, usbi_io_t io);
   int (*transfer)(usbi_device_t dev, int endpoint, usbi_transfer_t type,
                   void *data, int size, int packet_size, usbi_io_t io);
+  int (*transfer_iso_results)(usbi_device_t dev, int endpoint, void *data,
+                              int size, int packet_size, usbi_io_t io);
+  int (*transfer_v)(usbi_device_t dev, int endpoint, usbi_transfer_t type,
+                    const usbi_iovec_t *iov, int iov_count, usbi_io_t io);
   int (*wait)(usbi_device_t dev, usbi_io_t io, int timeout);
   int (*poll)(usbi_device_t dev, usbi_io_t io);
   int (*cancel)(usbi_device_t dev, usbi_io_t io);
+  HANDLE (*get_event)(usbi_device_t dev, usbi_io_t io);
 } drivers[] = {
   DRIVER_ENTRY(libusb0),
   DRIVER_ENTRY(winusb),
-  DRIVER_ENTRY(hid)
+  DRIVER_ENTRY(hid),
+  DRIVER_ENTRY(loopback)
 };
 
 static struct {
   int driver;
   char *name;
+  unsigned int hash;
+  int hash_next;
+  unsigned int seen;
+  /* identity used to filter hot-plug notifications, kept after removal */
+  int vid;
+  int pid;
+  uint8_t classes[32];
 } devices[USBI_MAX_DEVICES];
 
+/* first device ID of each hash bucket, chained through 'hash_next', 
+   0 terminates a chain */
+static int device_hash[USBI_DEVICE_HASH_SIZE];
+
+/* ring buffer of device arrivals and removals */
+static struct {
+  usbi_change_t change;
+  int generation;
+} changes[USBI_MAX_CHANGES];
+
+static int num_changes = 0;
+static int generation = 0;
+static int dropped_generation = 0;
+static unsigned int refresh_count = 0;
+
+struct usbi_hotplug_t {
+  struct usbi_hotplug_t *next;
+  int vid;
+  int pid;
+  int dev_class;
+  usbi_hotplug_callback_t callback;
+  void *context;
+};
+
+/* a callback due to a subscription, collected with 'lock' held and 
+   invoked after it is released */
+struct usbi_hotplug_notification_t {
+  struct usbi_hotplug_t *h;
+  int id;
+  usbi_change_type_t type;
+};
+
+/* 'lock' serializes device list refreshes with hot-plug notifications,
+   'callback_lock' is held while callbacks run, it keeps them in order and
+   the subscriptions alive; it is always taken before 'lock' */
+static struct {
+  CRITICAL_SECTION lock;
+  CRITICAL_SECTION callback_lock;
+  int initialized;
+  struct usbi_hotplug_t *subscriptions;
+  int generation;
+  HANDLE thread;
+  DWORD thread_id;
+  HANDLE ready;
+} hotplug;
+
 #define MAX_DRIVER (sizeof(drivers)/sizeof(drivers[0]))
 
 #define USBI_DRIVERS_FOREACH(d) \
@@ -97,18 +182,48 @@ static struct {
  } while(0)
 
 
+struct usbi_event_loop_t {
+  HANDLE port;
+  volatile LONG pending;
+};
+
 static usbi_debug_level_t _usbi_debug_level = USBI_DEBUG_LEVEL_NONE;
 
-static int _usbi_update_config_desc_cache(usbi_device_t dev, int config);
-static void *_usbi_find_interface_desc(usbi_device_t dev, int interface, 
-                                       int alt_setting);
-static void *_usbi_find_endpoint_desc(void *interface_desc, int size, 
-                                      int endpoint);
+static int _usbi_fetch_config_desc(usbi_device_t dev, int config, 
+                                   void **desc);
+static usbi_config_cache_t *_usbi_index_config_desc(void *desc, int size);
+static int _usbi_get_config_cache(usbi_device_t dev, int config,
+                                  usbi_config_cache_t **cache);
+static usbi_interface_index_t *
+_usbi_find_interface_desc(usbi_config_cache_t *cache, int interface, 
+                          int alt_setting);
 static usbi_device_t _usbi_alloc_dev(int id);
+static void _usbi_free_dev(usbi_device_t dev);
 static usbi_io_t _usbi_alloc_io(usbi_device_t dev, int endpoint, 
                                usbi_transfer_t type, int direction, int size);
+static void _usbi_free_io(usbi_io_t io);
+static void _usbi_unbounce_io(usbi_io_t io, int ret);
+static void _usbi_flush_io_cache(usbi_device_t dev);
 
+static unsigned int _usbi_hash_name(const char *name);
+static int _usbi_find_device(const char *name, unsigned int hash);
 static void _usbi_add_device(const char *name, int driver);
+static void _usbi_remove_device(int id);
+static void _usbi_add_change(int id, usbi_change_type_t type);
+static void _usbi_refresh_ids(void);
+static void _usbi_get_device_identity(int id);
+static int _usbi_hotplug_match(struct usbi_hotplug_t *h, int id);
+static int _usbi_hotplug_collect(struct usbi_hotplug_notification_t **n);
+static void _usbi_hotplug_invoke(struct usbi_hotplug_notification_t *n,
+                                 int count);
+static HMODULE _usbi_hotplug_load_module(void);
+static LRESULT CALLBACK _usbi_hotplug_window_proc(HWND window, UINT msg,
+                                                  WPARAM wparam, 
+                                                  LPARAM lparam);
+static DWORD WINAPI _usbi_hotplug_thread(LPVOID param);
+static void _usbi_hotplug_stop(HANDLE thread, DWORD thread_id);
+static void _usbi_event_loop_post(usbi_io_t io);
+static VOID CALLBACK _usbi_event_loop_signaled(PVOID param, BOOLEAN timeout);
 
 static usbi_device_t _usbi_alloc_dev(int id)
 {
@@ -123,19 +238,44 @@ static usbi_device_t _usbi_alloc_dev(int id)
   dev->id = id;
   strcpy(dev->name, devices[id].name);
   dev->interface.value = -1;
+  InitializeCriticalSection(&dev->io_cache.lock);
   return dev;
 }
 
+static void _usbi_free_dev(usbi_device_t dev)
+{
+  _usbi_flush_io_cache(dev);
+  DeleteCriticalSection(&dev->io_cache.lock);
+  free(dev);
+}
+
+/* Requests are taken from the device's cache of completed requests when
+   possible. A reused request keeps the event of its overlapped block, the
+   backends only create one the first time a request is used
+   asynchronously. */
 static usbi_io_t _usbi_alloc_io(usbi_device_t dev, int endpoint, 
                                usbi_transfer_t type, int direction, int size)
 {
   usbi_io_t io;
   int io_size;
+  HANDLE event = NULL;
   
   io_size = drivers[dev->driver].io_size;
-  if(!(io = malloc(io_size)))
+
+  EnterCriticalSection(&dev->io_cache.lock);
+  if((io = dev->io_cache.free)) {
+    dev->io_cache.free = io->next_free;
+    dev->io_cache.num_free--;
+  }
+  LeaveCriticalSection(&dev->io_cache.lock);
+
+  if(io)
+    event = io->overlapped.hEvent;
+  else if(!(io = malloc(io_size)))
     return NULL;
+
   memset(io, 0, io_size);
+  io->overlapped.hEvent = event;
   io->dev = dev;
   io->endpoint = endpoint;
   io->type = type;
@@ -144,25 +284,146 @@ static usbi_io_t _usbi_alloc_io(usbi_device_t dev, int endpoint,
   return io;
 }
 
+static void _usbi_free_io(usbi_io_t io)
+{
+  usbi_device_t dev = io->dev;
+
+  if(io->bounce.data)
+    free(io->bounce.data);
+
+  EnterCriticalSection(&dev->io_cache.lock);
+  if(dev->io_cache.num_free < USBI_MAX_CACHED_IO) {
+    io->next_free = dev->io_cache.free;
+    dev->io_cache.free = io;
+    dev->io_cache.num_free++;
+    io = NULL;
+  }
+  LeaveCriticalSection(&dev->io_cache.lock);
+
+  if(io) {
+    if(io->overlapped.hEvent)
+      CloseHandle(io->overlapped.hEvent);
+    free(io);
+  }
+}
+
+/* copies the data of a completed vectored read from the bounce buffer */
+/* back to the caller's buffers */
+static void _usbi_unbounce_io(usbi_io_t io, int ret)
+{
+  const usbi_iovec_t *iov = io->bounce.iov;
+  char *p = io->bounce.data;
+  int i, n;
+
+  if(!p || io->direction != USBI_DIRECTION_IN)
+    return;
+
+  for(i = 0; i < io->bounce.iov_count && ret > 0; i++) {
+    n = iov[i].size < ret ? iov[i].size : ret;
+    if(n)
+      memcpy(iov[i].data, p, n);
+    p += n;
+    ret -= n;
+  }
+}
+
+static void _usbi_flush_io_cache(usbi_device_t dev)
+{
+  usbi_io_t io;
+
+  EnterCriticalSection(&dev->io_cache.lock);
+  while((io = dev->io_cache.free)) {
+    dev->io_cache.free = io->next_free;
+    if(io->overlapped.hEvent)
+      CloseHandle(io->overlapped.hEvent);
+    free(io);
+  }
+  dev->io_cache.num_free = 0;
+  LeaveCriticalSection(&dev->io_cache.lock);
+}
+
+/* FNV-1a */
+static unsigned int _usbi_hash_name(const char *name)
+{
+  unsigned int hash = 2166136261U;
+
+  while(*name) {
+    hash ^= (unsigned char)*name++;
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static int _usbi_find_device(const char *name, unsigned int hash)
+{
+  int i;
+
+  for(i = device_hash[hash & (USBI_DEVICE_HASH_SIZE - 1)]; i; 
+      i = devices[i].hash_next) {
+    if(devices[i].hash == hash && !strcmp(name, devices[i].name))
+      return i;
+  }
+  return 0;
+}
+
 static void _usbi_add_device(const char *name, int driver)
 {
   int i;
+  unsigned int hash = _usbi_hash_name(name);
 
   /* device already present? */
-  USBI_DEVICES_FOREACH(i) {
-    if(devices[i].name && !strcmp(name, devices[i].name))
-      return;
-    }
+  if((i = _usbi_find_device(name, hash))) {
+    devices[i].seen = refresh_count;
+    return;
+  }
 
   /* add device */
   USBI_DEVICES_FOREACH(i) {
     if(!devices[i].name) {
       if((devices[i].name = strdup(name))) {
         devices[i].driver = driver;
-        return;
+        devices[i].hash = hash;
+        devices[i].seen = refresh_count;
+        devices[i].hash_next = device_hash[hash & (USBI_DEVICE_HASH_SIZE - 1)];
+        device_hash[hash & (USBI_DEVICE_HASH_SIZE - 1)] = i;
+        _usbi_add_change(i, USBI_CHANGE_ADDED);
       }
+      return;
+    }
+  }
+}
+
+static void _usbi_remove_device(int id)
+{
+  int *i;
+
+  for(i = &device_hash[devices[id].hash & (USBI_DEVICE_HASH_SIZE - 1)]; *i;
+      i = &devices[*i].hash_next) {
+    if(*i == id) {
+      *i = devices[id].hash_next;
+      break;
     }
   }
+
+  free(devices[id].name);
+  devices[id].name = NULL;
+  devices[id].driver = -1;
+  devices[id].hash_next = 0;
+  _usbi_add_change(id, USBI_CHANGE_REMOVED);
+}
+
+/* records a change for the generation the current refresh will create */
+static void _usbi_add_change(int id, usbi_change_type_t type)
+{
+  int slot = num_changes % USBI_MAX_CHANGES;
+
+  if(num_changes >= USBI_MAX_CHANGES)
+    dropped_generation = changes[slot].generation;
+
+  changes[slot].change.id = id;
+  changes[slot].change.type = type;
+  changes[slot].generation = generation + 1;
+  num_changes++;
 }
 
 int usbi_init(void)
@@ -171,8 +432,19 @@ int usbi_init(void)
   
   /* initialize device structures */
   memset(devices, 0, sizeof(devices));
+  memset(device_hash, 0, sizeof(device_hash));
   USBI_DEVICES_FOREACH(i)
     devices[i].driver = -1;
+  num_changes = 0;
+  generation = 0;
+  dropped_generation = 0;
+
+  if(!hotplug.initialized) {
+    InitializeCriticalSection(&hotplug.lock);
+    InitializeCriticalSection(&hotplug.callback_lock);
+    hotplug.initialized = TRUE;
+  }
+  hotplug.generation = 0;
 
   /* initialize backend drivers */
   USBI_DRIVERS_FOREACH(i) {
@@ -186,6 +458,19 @@ int usbi_init(void)
 int usbi_deinit(void)
 {
   int i;
+  struct usbi_hotplug_t *h;
+
+  /* the notification thread holds a reference to this module, so it can
+     only be left running here on process exit, when it is already gone;
+     applications stop it with usbi_hotplug_deregister() */
+  if(hotplug.thread) {
+    CloseHandle(hotplug.thread);
+    hotplug.thread = NULL;
+  }
+  while((h = hotplug.subscriptions)) {
+    hotplug.subscriptions = h->next;
+    free(h);
+  }
 
   USBI_DEVICES_FOREACH(i)
     if(devices[i].name)
@@ -225,30 +510,398 @@ void _usbi_debug_printf(FILE *stream, usbi_debug_level_t level,
 
 void usbi_refresh_ids(void)
 {
-  int i, n;
+  struct usbi_hotplug_notification_t *n = NULL;
+  int count = 0;
+
+  if(!hotplug.initialized) {
+    _usbi_refresh_ids();
+    return;
+  }
+
+  EnterCriticalSection(&hotplug.callback_lock);
+  EnterCriticalSection(&hotplug.lock);
+  _usbi_refresh_ids();
+  if(hotplug.subscriptions)
+    count = _usbi_hotplug_collect(&n);
+  else
+    hotplug.generation = generation;
+  LeaveCriticalSection(&hotplug.lock);
+
+  /* the callbacks may open devices, which takes 'lock' */
+  _usbi_hotplug_invoke(n, count);
+  LeaveCriticalSection(&hotplug.callback_lock);
+}
+
+static void _usbi_refresh_ids(void)
+{
+  int i, n, changed;
   char name[1024];
-  usbi_device_t dev;
 
-  /* remove old devices */
+  /* the backends only enumerate devices that are present, so every known
+     device that isn't reported again has been removed */
+  refresh_count++;
+  changed = num_changes;
+
+  USBI_DRIVERS_FOREACH_VALID(i) {
+    n = 0;
+    while(drivers[i].get_name(n++, name, sizeof(name)) >= 0)
+      _usbi_add_device(name, i);
+  }
+
   USBI_DEVICES_FOREACH(i) {
-    if(devices[i].name) {
-      if(usbi_open(i, &dev) >= 0) {
-        /* device is still present */
-        usbi_close(dev);
+    if(devices[i].name && devices[i].seen != refresh_count)
+      _usbi_remove_device(i);
+  }
+
+  if(num_changes != changed)
+    generation++;
+}
+
+int usbi_get_generation(void)
+{
+  return generation;
+}
+
+int usbi_get_changes(int since, usbi_change_t *change, int size)
+{
+  int i, count = 0;
+
+  USBI_DEBUG_ASSERT_PARAM(since >= 0, since, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(change || !size, change, USBI_STATUS_PARAM);
+
+  /* changes the caller hasn't seen yet have already been overwritten */
+  if(since < dropped_generation)
+    return USBI_STATUS_STATE;
+
+  i = num_changes > USBI_MAX_CHANGES ? num_changes - USBI_MAX_CHANGES : 0;
+  for(; i < num_changes; i++) {
+    if(changes[i % USBI_MAX_CHANGES].generation > since) {
+      if(count < size)
+        change[count] = changes[i % USBI_MAX_CHANGES].change;
+      count++;
+    }
+  }
+  return count;
+}
+
+/* reads the IDs and classes hot-plug subscriptions are matched against */
+static void _usbi_get_device_identity(int id)
+{
+  usbi_device_t dev;
+  usbi_device_descriptor_t desc;
+  const uint8_t *p;
+  int size;
+
+  devices[id].vid = -1;
+  devices[id].pid = -1;
+  memset(devices[id].classes, 0, sizeof(devices[id].classes));
+
+  if(usbi_open(id, &dev) < 0)
+    return;
+
+  if(usbi_get_device_descriptor(dev, &desc, sizeof(desc)) == sizeof(desc)) {
+    devices[id].vid = desc.idVendor;
+    devices[id].pid = desc.idProduct;
+    devices[id].classes[desc.bDeviceClass / 8] |= 1 << (desc.bDeviceClass % 8);
+
+    /* the class is defined per interface */
+    if(!desc.bDeviceClass) {
+      size = usbi_get_cached_config_descriptor(dev, 0, (const void **)&p);
+      while(size >= 2 && p[0] >= 2 && p[0] <= size) {
+        if(p[1] == USBI_DESC_TYPE_INTERFACE && p[0] >= USBI_DESC_LEN_INTERFACE)
+          devices[id].classes[p[5] / 8] |= 1 << (p[5] % 8);
+        size -= p[0];
+        p += p[0];
       }
-      else {
-        /* device has been removed */
-        free(devices[i].name);
-        devices[i].name = NULL;
+    }
+  }
+  usbi_close(dev);
+}
+
+static int _usbi_hotplug_match(struct usbi_hotplug_t *h, int id)
+{
+  int c = h->dev_class & 0xFF;
+
+  if(h->vid != USBI_HOTPLUG_MATCH_ANY && h->vid != devices[id].vid)
+    return FALSE;
+  if(h->pid != USBI_HOTPLUG_MATCH_ANY && h->pid != devices[id].pid)
+    return FALSE;
+  if(h->dev_class != USBI_HOTPLUG_MATCH_ANY
+     && !(devices[id].classes[c / 8] & (1 << (c % 8))))
+    return FALSE;
+  return TRUE;
+}
+
+/* collects the callbacks due to the changes since the last notification,
+   called with the lock held, returns the number of entries in '*n' */
+static int _usbi_hotplug_collect(struct usbi_hotplug_notification_t **n)
+{
+  usbi_change_t change[USBI_MAX_CHANGES];
+  struct usbi_hotplug_t *h;
+  int i, reported, subscribed = 0, count = 0;
+
+  *n = NULL;
+
+  reported = usbi_get_changes(hotplug.generation, change, USBI_MAX_CHANGES);
+  hotplug.generation = generation;
+
+  /* more changes than remembered, can only happen if the application 
+     refreshed the list many times without a subscription */
+  if(reported < 0) {
+    USBI_DEBUG_ERROR("hot-plug changes lost");
+    return 0;
+  }
+  if(reported > USBI_MAX_CHANGES)
+    reported = USBI_MAX_CHANGES;
+  if(!reported)
+    return 0;
+
+  for(h = hotplug.subscriptions; h; h = h->next)
+    subscribed++;
+
+  if(!(*n = malloc(reported * subscribed * sizeof(**n)))) {
+    USBI_DEBUG_ERROR("hot-plug changes lost, out of memory");
+    return 0;
+  }
+
+  for(i = 0; i < reported; i++) {
+    /* a removed device keeps the identity read at its arrival */
+    if(change[i].type == USBI_CHANGE_ADDED && devices[change[i].id].name)
+      _usbi_get_device_identity(change[i].id);
+
+    for(h = hotplug.subscriptions; h; h = h->next) {
+      if(_usbi_hotplug_match(h, change[i].id)) {
+        (*n)[count].h = h;
+        (*n)[count].id = change[i].id;
+        (*n)[count].type = change[i].type;
+        count++;
       }
     }
   }
+  return count;
+}
 
-  USBI_DRIVERS_FOREACH_VALID(i) {
-    n = 0;
-    while(drivers[i].get_name(n++, name, sizeof(name)) >= 0)
-      _usbi_add_device(name, i);
+/* runs the collected callbacks and frees them, called with the callback
+   lock held but not the lock */
+static void _usbi_hotplug_invoke(struct usbi_hotplug_notification_t *n,
+                                 int count)
+{
+  int i;
+
+  for(i = 0; i < count; i++)
+    n[i].h->callback(n[i].id, n[i].type, n[i].h->context);
+
+  if(n)
+    free(n);
+}
+
+static LRESULT CALLBACK _usbi_hotplug_window_proc(HWND window, UINT msg,
+                                                  WPARAM wparam, 
+                                                  LPARAM lparam)
+{
+  switch(msg) {
+  case WM_DEVICECHANGE:
+    /* devices come and go in bursts of messages, refresh once after the 
+       last one */
+    if(wparam == DBT_DEVNODES_CHANGED || wparam == DBT_DEVICEARRIVAL
+       || wparam == DBT_DEVICEREMOVECOMPLETE)
+      SetTimer(window, 1, USBI_HOTPLUG_SETTLE_TIME, NULL);
+    return TRUE;
+  case WM_TIMER:
+    KillTimer(window, 1);
+    usbi_refresh_ids();
+    return 0;
+  default:
+    return DefWindowProcA(window, msg, wparam, lparam);
+  }
+}
+
+/* returns a new reference to the module containing this code, the 
+   notification thread keeps it loaded until the thread has exited */
+static HMODULE _usbi_hotplug_load_module(void)
+{
+  MEMORY_BASIC_INFORMATION info;
+  char path[MAX_PATH];
+
+  if(!VirtualQuery((LPCVOID)_usbi_hotplug_load_module, &info, sizeof(info))
+     || !GetModuleFileNameA((HMODULE)info.AllocationBase, path, 
+                            sizeof(path)))
+    return NULL;
+
+  return LoadLibraryA(path);
+}
+
+/* the device change event source: a hidden top level window receives the 
+   WM_DEVICECHANGE broadcasts, 'param' is the module reference taken by 
+   _usbi_hotplug_load_module() */
+static DWORD WINAPI _usbi_hotplug_thread(LPVOID param)
+{
+  HMODULE module = (HMODULE)param;
+  WNDCLASSA window_class;
+  HWND window;
+  MSG msg;
+
+  memset(&window_class, 0, sizeof(window_class));
+  window_class.lpfnWndProc = _usbi_hotplug_window_proc;
+  window_class.hInstance = module;
+  window_class.lpszClassName = USBI_HOTPLUG_WINDOW_CLASS;
+  RegisterClassA(&window_class);
+
+  window = CreateWindowA(USBI_HOTPLUG_WINDOW_CLASS, "", 0, 0, 0, 0, 0,
+                         NULL, NULL, module, NULL);
+
+  /* the thread's message queue exists now, WM_QUIT can be posted to it */
+  PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE);
+  SetEvent(hotplug.ready);
+
+  if(!window) {
+    USBI_DEBUG_ERROR("creating hot-plug window failed");
+    UnregisterClassA(USBI_HOTPLUG_WINDOW_CLASS, module);
+    FreeLibraryAndExitThread(module, 1);
+    return 1;
+  }
+
+  while(GetMessage(&msg, NULL, 0, 0) > 0) {
+    TranslateMessage(&msg);
+    DispatchMessage(&msg);
+  }
+
+  DestroyWindow(window);
+  UnregisterClassA(USBI_HOTPLUG_WINDOW_CLASS, module);
+  FreeLibraryAndExitThread(module, 0);
+  return 0;
+}
+
+static void _usbi_hotplug_stop(HANDLE thread, DWORD thread_id)
+{
+  PostThreadMessage(thread_id, WM_QUIT, 0, 0);
+
+  if(GetCurrentThreadId() != thread_id)
+    WaitForSingleObject(thread, INFINITE);
+
+  CloseHandle(thread);
+}
+
+int usbi_hotplug_register(int vid, int pid, int dev_class, int flags,
+                          usbi_hotplug_callback_t callback, void *context,
+                          usbi_hotplug_t *handle)
+{
+  struct usbi_hotplug_t *h;
+  HMODULE module;
+  int ids[USBI_MAX_DEVICES];
+  int i, count = 0, ret = USBI_STATUS_SUCCESS;
+
+  USBI_DEBUG_ASSERT_PARAM(handle, handle, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(callback, callback, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT(hotplug.initialized, "usbi_init() not called", 
+                    USBI_STATUS_STATE);
+
+  *handle = NULL;
+
+  if(!(h = malloc(sizeof(*h))))
+    return USBI_STATUS_NOMEM;
+
+  memset(h, 0, sizeof(*h));
+  h->vid = vid;
+  h->pid = pid;
+  h->dev_class = dev_class;
+  h->callback = callback;
+  h->context = context;
+
+  EnterCriticalSection(&hotplug.callback_lock);
+
+  /* bring the existing subscriptions up to date first */
+  usbi_refresh_ids();
+
+  EnterCriticalSection(&hotplug.lock);
+
+  if(!hotplug.thread) {
+    if(!(hotplug.ready = CreateEvent(NULL, TRUE, FALSE, NULL))) {
+      ret = USBI_STATUS_UNKNOWN;
+    } else if(!(module = _usbi_hotplug_load_module())) {
+      ret = USBI_STATUS_UNKNOWN;
+    } else {
+      hotplug.thread = CreateThread(NULL, 0, _usbi_hotplug_thread, module, 
+                                    0, &hotplug.thread_id);
+      if(hotplug.thread) {
+        WaitForSingleObject(hotplug.ready, INFINITE);
+      } else {
+        FreeLibrary(module);
+        ret = USBI_STATUS_UNKNOWN;
+      }
+    }
+    if(hotplug.ready) {
+      CloseHandle(hotplug.ready);
+      hotplug.ready = NULL;
+    }
+  }
+
+  if(ret < 0) {
+    USBI_DEBUG_ERROR("starting hot-plug thread failed");
+    LeaveCriticalSection(&hotplug.lock);
+    LeaveCriticalSection(&hotplug.callback_lock);
+    free(h);
+    return ret;
+  }
+
+  h->next = hotplug.subscriptions;
+  hotplug.subscriptions = h;
+
+  if(flags & USBI_HOTPLUG_ENUMERATE) {
+    USBI_DEVICES_FOREACH(i) {
+      if(devices[i].name) {
+        _usbi_get_device_identity(i);
+        if(_usbi_hotplug_match(h, i))
+          ids[count++] = i;
+      }
+    }
+  }
+
+  LeaveCriticalSection(&hotplug.lock);
+
+  for(i = 0; i < count; i++)
+    h->callback(ids[i], USBI_CHANGE_ADDED, h->context);
+
+  LeaveCriticalSection(&hotplug.callback_lock);
+
+  *handle = h;
+  return USBI_STATUS_SUCCESS;
+}
+
+int usbi_hotplug_deregister(usbi_hotplug_t handle)
+{
+  struct usbi_hotplug_t **h;
+  HANDLE thread = NULL;
+  DWORD thread_id = 0;
+
+  USBI_DEBUG_ASSERT_PARAM(handle, handle, USBI_STATUS_PARAM);
+
+  EnterCriticalSection(&hotplug.lock);
+
+  for(h = &hotplug.subscriptions; *h; h = &(*h)->next) {
+    if(*h == handle) {
+      *h = handle->next;
+      break;
+    }
   }
+  if(!hotplug.subscriptions && hotplug.thread) {
+    thread = hotplug.thread;
+    thread_id = hotplug.thread_id;
+    hotplug.thread = NULL;
+  }
+
+  LeaveCriticalSection(&hotplug.lock);
+
+  /* wait for callbacks running on other threads to return */
+  EnterCriticalSection(&hotplug.callback_lock);
+  LeaveCriticalSection(&hotplug.callback_lock);
+
+  /* the thread may be waiting for the lock, wait for it outside */
+  if(thread)
+    _usbi_hotplug_stop(thread, thread_id);
+
+  free(handle);
+  return USBI_STATUS_SUCCESS;
 }
 
 int usbi_get_first_id(void)
@@ -300,16 +953,24 @@ int usbi_open(int id, usbi_device_t *dev)
                USBI_STATUS_PARAM);
   USBI_DEBUG_ASSERT(devices[id].name, "invalid device ID", USBI_STATUS_NODEV);
 
-  *dev = _usbi_alloc_dev(id);
-  USBI_DEBUG_ASSERT(*dev, "memory allocation failed", USBI_STATUS_NOMEM);
+  /* the hot-plug thread may remove the device meanwhile */
+  if(hotplug.initialized)
+    EnterCriticalSection(&hotplug.lock);
 
-  ret = drivers[devices[id].driver].open(*dev, devices[id].name);
+  if(devices[id].name && (*dev = _usbi_alloc_dev(id))) {
+    ret = drivers[devices[id].driver].open(*dev, devices[id].name);
 
-  if(ret < 0) {
-    USBI_DEBUG_ERROR("unable to open device %s", devices[id].name);
-    free(*dev);
-    *dev = NULL;
+    if(ret < 0) {
+      USBI_DEBUG_ERROR("unable to open device %s", devices[id].name);
+      _usbi_free_dev(*dev);
+      *dev = NULL;
+    }
+  } else {
+    ret = devices[id].name ? USBI_STATUS_NOMEM : USBI_STATUS_NODEV;
   }
+
+  if(hotplug.initialized)
+    LeaveCriticalSection(&hotplug.lock);
     
   return ret;
 }
@@ -328,13 +989,15 @@ int usbi_close(usbi_device_t dev)
   if(dev->interface.value >= 0)
     usbi_release_interface(dev, dev->interface.value);
   ret = drivers[dev->driver].close(dev);
-  free(dev);
+  usbi_flush_config_cache(dev);
+  _usbi_free_dev(dev);
   return ret;
 }
 
 int usbi_reset(usbi_device_t dev)
 {
   USBI_DEBUG_ASSERT_DEV(dev);
+  usbi_flush_config_cache(dev);
   return drivers[dev->driver].reset(dev);
 }
 
@@ -358,6 +1021,7 @@ int usbi_set_configuration(usbi_device_t dev, int config)
     dev->config.value = config;
     dev->interface.value = -1;
   }
+  usbi_flush_config_cache(dev);
   return ret;
 }
 
@@ -415,7 +1079,7 @@ int usbi_control_msg(usbi_device_t dev, int request_type, int request,
   ret = drivers[dev->driver].control_msg(dev, request_type, request, 
                                          value, index, data, size, *io); 
   if(ret < 0) {
-    free(*io);
+    _usbi_free_io(*io);
     *io = NULL;
   }
   return ret;
@@ -436,12 +1100,120 @@ int usbi_transfer(usbi_device_t dev, int endpoint, usbi_transfer_t type,
   ret = drivers[dev->driver].transfer(dev, endpoint, type, data, size, 
                                       packet_size, *io);
   if(ret < 0) {
-    free(*io);
+    _usbi_free_io(*io);
+    *io = NULL;
+  }
+  return ret;
+}
+
+int usbi_transfer_iso_results(usbi_device_t dev, int endpoint, void *data,
+                              int size, int packet_size, usbi_io_t *io)
+{
+  int ret;
+
+  USBI_DEBUG_ASSERT_DEV(dev);
+  USBI_DEBUG_ASSERT_CONFIG(dev);
+  USBI_DEBUG_ASSERT_INTERFACE(dev);
+  USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(packet_size > 0, packet_size, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(size > 0 && !(size % packet_size), size,
+                          USBI_STATUS_PARAM);
+
+  *io = _usbi_alloc_io(dev, endpoint, USBI_TRANSFER_ISOCHRONOUS,
+                       endpoint & 0x80, size);
+  USBI_DEBUG_ASSERT(*io, "memory allocation failed", USBI_STATUS_NOMEM);
+
+  ret = drivers[dev->driver].transfer_iso_results(dev, endpoint, data, size,
+                                                  packet_size, *io);
+  if(ret < 0) {
+    _usbi_free_io(*io);
     *io = NULL;
   }
   return ret;
 }
 
+int usbi_transfer_v(usbi_device_t dev, int endpoint, usbi_transfer_t type,
+                    const usbi_iovec_t *iov, int iov_count, usbi_io_t *io)
+{
+  int ret;
+  int i, size = 0;
+  char *p;
+
+  USBI_DEBUG_ASSERT_DEV(dev);
+  USBI_DEBUG_ASSERT_CONFIG(dev);
+  USBI_DEBUG_ASSERT_INTERFACE(dev);
+  USBI_DEBUG_ASSERT_PARAM(iov, iov, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(iov_count > 0, iov_count, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(type == USBI_TRANSFER_BULK 
+                          || type == USBI_TRANSFER_INTERRUPT, type,
+                          USBI_STATUS_PARAM);
+
+  for(i = 0; i < iov_count; i++) {
+    USBI_DEBUG_ASSERT_PARAM(iov[i].size >= 0 
+                            && size <= INT_MAX - iov[i].size,
+                            iov[i].size, USBI_STATUS_PARAM);
+    USBI_DEBUG_ASSERT_PARAM(iov[i].data || !iov[i].size, iov[i].data,
+                            USBI_STATUS_PARAM);
+    size += iov[i].size;
+  }
+
+  *io = _usbi_alloc_io(dev, endpoint, type, endpoint & 0x80, size);
+  USBI_DEBUG_ASSERT(*io, "memory allocation failed", USBI_STATUS_NOMEM);
+
+  ret = drivers[dev->driver].transfer_v(dev, endpoint, type, iov, iov_count,
+                                        *io);
+
+  /* fall back to a single request from one contiguous buffer */
+  if(ret == USBI_STATUS_NOT_SUPPORTED) {
+    if(iov_count == 1) {
+      ret = drivers[dev->driver].transfer(dev, endpoint, type, iov[0].data,
+                                          iov[0].size, 0, *io);
+    } else if(!((*io)->bounce.data = malloc(size ? size : 1))) {
+      ret = USBI_STATUS_NOMEM;
+    } else {
+      (*io)->bounce.iov = iov;
+      (*io)->bounce.iov_count = iov_count;
+
+      if(USBI_ENDPOINT_OUT(endpoint)) {
+        /* empty buffers may be NULL */
+        for(i = 0, p = (*io)->bounce.data; i < iov_count; i++) {
+          if(iov[i].size)
+            memcpy(p, iov[i].data, iov[i].size);
+          p += iov[i].size;
+        }
+      }
+      ret = drivers[dev->driver].transfer(dev, endpoint, type, 
+                                          (*io)->bounce.data, size, 0, *io);
+    }
+  }
+
+  if(ret < 0) {
+    _usbi_free_io(*io);
+    *io = NULL;
+  }
+  return ret;
+}
+
+int usbi_get_iso_results(void *data, int size, int packet_size,
+                         usbi_iso_packet_result_t **results,
+                         usbi_iso_transfer_info_t **info)
+{
+  usbi_iso_packet_result_t *r;
+  int count;
+
+  USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(packet_size > 0, packet_size, USBI_STATUS_PARAM);
+
+  count = size / packet_size;
+  r = (usbi_iso_packet_result_t *)((char *)data + size);
+
+  if(results)
+    *results = r;
+  if(info)
+    *info = (usbi_iso_transfer_info_t *)(r + count);
+  return count;
+}
+
 int usbi_wait(usbi_io_t io, int timeout)
 {
   int ret;
@@ -449,7 +1221,8 @@ int usbi_wait(usbi_io_t io, int timeout)
   USBI_DEBUG_ASSERT_IO(io);
 
   ret = drivers[io->dev->driver].wait(io->dev, io, timeout);
-  free(io);
+  _usbi_unbounce_io(io, ret);
+  _usbi_free_io(io);
   return ret;
 }
 
@@ -459,8 +1232,11 @@ int usbi_poll(usbi_io_t io)
 
   USBI_DEBUG_ASSERT_IO(io);
 
-  if((ret = drivers[io->dev->driver].poll(io->dev, io)) != USBI_STATUS_PENDING)
-    free(io);
+  if((ret = drivers[io->dev->driver].poll(io->dev, io)) 
+     != USBI_STATUS_PENDING) {
+    _usbi_unbounce_io(io, ret);
+    _usbi_free_io(io);
+  }
   return ret;
 }
 
@@ -469,7 +1245,162 @@ int usbi_cancel(usbi_io_t io)
   USBI_DEBUG_ASSERT_IO(io);
 
   drivers[io->dev->driver].cancel(io->dev, io);
-  free(io);
+  _usbi_free_io(io);
+  return USBI_STATUS_SUCCESS;
+}
+
+/* the wait callback and the registering thread both call this, the request
+   may complete before RegisterWaitForSingleObject() has returned, so only
+   the second caller posts it, the wait handle has been stored by then */
+static void _usbi_event_loop_post(usbi_io_t io)
+{
+  if(InterlockedIncrement(&io->event_loop.handover) != 2)
+    return;
+
+  /* don't touch 'io' after posting, the dequeuing thread owns it then */
+  PostQueuedCompletionStatus(io->event_loop.loop->port, 0, (ULONG_PTR)io,
+                             NULL);
+}
+
+static VOID CALLBACK _usbi_event_loop_signaled(PVOID param, BOOLEAN timeout)
+{
+  _usbi_event_loop_post((usbi_io_t)param);
+}
+
+int usbi_event_loop_create(usbi_event_loop_t *loop)
+{
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+
+  if(!(*loop = malloc(sizeof(struct usbi_event_loop_t))))
+    return USBI_STATUS_NOMEM;
+  memset(*loop, 0, sizeof(struct usbi_event_loop_t));
+
+  (*loop)->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+  if(!(*loop)->port) {
+    USBI_DEBUG_ERROR("creating completion port failed");
+    free(*loop);
+    *loop = NULL;
+    return USBI_STATUS_UNKNOWN;
+  }
+  return USBI_STATUS_SUCCESS;
+}
+
+int usbi_event_loop_destroy(usbi_event_loop_t loop)
+{
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT(!loop->pending, "requests are still queued", 
+                    USBI_STATUS_BUSY);
+
+  CloseHandle(loop->port);
+  free(loop);
+  return USBI_STATUS_SUCCESS;
+}
+
+int usbi_event_loop_add(usbi_event_loop_t loop, usbi_io_t io, void *context)
+{
+  HANDLE event;
+
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_IO(io);
+  USBI_DEBUG_ASSERT(!io->event_loop.loop, "request already added", 
+                    USBI_STATUS_PARAM);
+
+  io->event_loop.loop = loop;
+  io->event_loop.context = context;
+  io->event_loop.handover = 0;
+  InterlockedIncrement(&loop->pending);
+
+  event = drivers[io->dev->driver].get_event(io->dev, io);
+
+  /* request has been completed synchronously by the backend */
+  if(!event) {
+    PostQueuedCompletionStatus(loop->port, 0, (ULONG_PTR)io, NULL);
+    return USBI_STATUS_SUCCESS;
+  }
+
+  /* the thread pool turns the request's event into a completion packet */
+  if(!RegisterWaitForSingleObject(&io->event_loop.wait, event, 
+                                  _usbi_event_loop_signaled, io, INFINITE,
+                                  WT_EXECUTEONLYONCE 
+                                  | WT_EXECUTEINWAITTHREAD)) {
+    USBI_DEBUG_ERROR("registering wait failed");
+    io->event_loop.loop = NULL;
+    io->event_loop.wait = NULL;
+    InterlockedDecrement(&loop->pending);
+    return USBI_STATUS_UNKNOWN;
+  }
+
+  _usbi_event_loop_post(io);
+  return USBI_STATUS_SUCCESS;
+}
+
+int usbi_event_loop_transfer(usbi_event_loop_t loop, usbi_device_t dev,
+                             int endpoint, usbi_transfer_t type,
+                             void *data, int size, int packet_size,
+                             void *context)
+{
+  int ret;
+  usbi_io_t io;
+
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+
+  ret = usbi_transfer(dev, endpoint, type, data, size, packet_size, &io);
+  if(!USBI_SUCCESS(ret))
+    return ret;
+  if((ret = usbi_event_loop_add(loop, io, context)) < 0)
+    usbi_cancel(io);
+  return ret;
+}
+
+int usbi_event_loop_control_msg(usbi_event_loop_t loop, usbi_device_t dev,
+                                int request_type, int request, int value,
+                                int index, void *data, int size,
+                                void *context)
+{
+  int ret;
+  usbi_io_t io;
+
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+
+  ret = usbi_control_msg(dev, request_type, request, value, index, 
+                         data, size, &io);
+  if(!USBI_SUCCESS(ret))
+    return ret;
+  if((ret = usbi_event_loop_add(loop, io, context)) < 0)
+    usbi_cancel(io);
+  return ret;
+}
+
+int usbi_event_loop_dequeue(usbi_event_loop_t loop, void **context,
+                            int *result, int timeout)
+{
+  DWORD size;
+  ULONG_PTR key;
+  OVERLAPPED *ol;
+  usbi_io_t io;
+
+  USBI_DEBUG_ASSERT_PARAM(loop, loop, USBI_STATUS_PARAM);
+  USBI_DEBUG_ASSERT_PARAM(result, result, USBI_STATUS_PARAM);
+
+  if(!GetQueuedCompletionStatus(loop->port, &size, &key, &ol, timeout)) {
+    if(GetLastError() == WAIT_TIMEOUT)
+      return USBI_STATUS_TIMEOUT;
+    return USBI_STATUS_UNKNOWN;
+  }
+
+  io = (usbi_io_t)key;
+  InterlockedDecrement(&loop->pending);
+
+  /* the wait has already fired, this releases it once its callback has 
+     returned, nothing refers to 'io' afterwards */
+  if(io->event_loop.wait)
+    UnregisterWaitEx(io->event_loop.wait, INVALID_HANDLE_VALUE);
+
+  if(context)
+    *context = io->event_loop.context;
+
+  /* the request is complete, this doesn't block */
+  *result = usbi_wait(io, 0);
   return USBI_STATUS_SUCCESS;
 }
 
@@ -509,6 +1440,18 @@ int usbi_transfer_sync(usbi_device_t dev, int endpoint, usbi_transfer_t type,
   return usbi_wait(io, timeout);
 }
 
+int usbi_transfer_v_sync(usbi_device_t dev, int endpoint, 
+                         usbi_transfer_t type, const usbi_iovec_t *iov,
+                         int iov_count, int timeout)
+{
+  int ret;
+  usbi_io_t io;
+  ret = usbi_transfer_v(dev, endpoint, type, iov, iov_count, &io);
+  if(!USBI_SUCCESS(ret))
+    return ret;
+  return usbi_wait(io, timeout);
+}
+
 int usbi_get_configuration(usbi_device_t dev, int *config)
 {
   int ret;
@@ -576,30 +1519,86 @@ int usbi_get_config_descriptor(usbi_device_t dev, int config,
                                USBI_DEFAULT_TIMEOUT);
 }
 
+/* returns the complete configuration descriptor (including all interface,
+   endpoint, and class specific descriptors) from the device's descriptor
+   cache; the returned pointer stays valid until the cache is flushed or
+   the device is closed */
+int usbi_get_cached_config_descriptor(usbi_device_t dev, int config,
+                                      const void **descriptor)
+{
+  usbi_config_cache_t *cache;
+  int ret;
+
+  USBI_DEBUG_ASSERT_DEV(dev);
+  USBI_DEBUG_ASSERT_PARAM(descriptor, descriptor, USBI_STATUS_PARAM);
+
+  *descriptor = NULL;
+
+  ret = _usbi_get_config_cache(dev, config, &cache);
+  if(ret < 0)
+    return ret;
+
+  *descriptor = cache->desc;
+  return cache->size;
+}
+
+/* drops all cached configuration descriptors, called whenever the
+   device's descriptors may have changed */
+void usbi_flush_config_cache(usbi_device_t dev)
+{
+  int c;
+
+  if(!dev || !dev->config.cache)
+    return;
+
+  for(c = 0; c < dev->config.num_cached; c++) {
+    if(dev->config.cache[c]) {
+      free(dev->config.cache[c]->desc);
+      free(dev->config.cache[c]);
+    }
+  }
+  free(dev->config.cache);
+  dev->config.cache = NULL;
+  dev->config.num_cached = 0;
+}
+
+int usbi_get_config_cache_stats(usbi_device_t dev, unsigned long *hits,
+                                unsigned long *misses)
+{
+  USBI_DEBUG_ASSERT_DEV(dev);
+
+  if(hits)
+    *hits = dev->config.hits;
+  if(misses)
+    *misses = dev->config.misses;
+  return USBI_STATUS_SUCCESS;
+}
+
 int usbi_get_interface_descriptor(usbi_device_t dev, int config, 
                                   int interface, int alt_setting,
                                   void *descriptor, int size)
 {
   int ret;
-  void *interface_desc = NULL;
+  usbi_config_cache_t *cache;
+  usbi_interface_index_t *interface_index;
 
   USBI_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(descriptor, descriptor, USBI_STATUS_PARAM);
   USBI_DEBUG_ASSERT_PARAM(size, size, USBI_STATUS_PARAM);
 
-  ret = _usbi_update_config_desc_cache(dev, config);
+  ret = _usbi_get_config_cache(dev, config, &cache);
   if(ret < 0)
     return ret;
 
   memset(descriptor, 0, size);
 
-  interface_desc = _usbi_find_interface_desc(dev, interface, alt_setting);
+  interface_index = _usbi_find_interface_desc(cache, interface, alt_setting);
 
-  if(!interface_desc)
+  if(!interface_index)
     return USBI_STATUS_PARAM;
 
   size = size > USBI_DESC_LEN_INTERFACE ? USBI_DESC_LEN_INTERFACE : size;
-  memcpy(descriptor, interface_desc, size);
+  memcpy(descriptor, (uint8_t *)cache->desc + interface_index->offset, size);
   return size;
 }
 
@@ -607,47 +1606,41 @@ int usbi_get_endpoint_descriptor(usbi_device_t dev, int config,
                                  int interface, int alt_setting,
                                  int endpoint, void *descriptor, int size)
 {
-  void *interface_desc = NULL;
-  void *endpoint_desc = NULL;
-  int tmp;
+  int ret;
+  usbi_config_cache_t *cache;
+  usbi_interface_index_t *interface_index;
 
   USBI_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(descriptor, descriptor, USBI_STATUS_PARAM);
   USBI_DEBUG_ASSERT_PARAM(size, size, USBI_STATUS_PARAM);
 
-  tmp = _usbi_update_config_desc_cache(dev, config);
-  if(tmp < 0)
-    return tmp;
+  ret = _usbi_get_config_cache(dev, config, &cache);
+  if(ret < 0)
+    return ret;
 
   memset(descriptor, 0, size);
 
-  interface_desc = _usbi_find_interface_desc(dev, interface, alt_setting);
+  interface_index = _usbi_find_interface_desc(cache, interface, alt_setting);
 
-  if(!interface_desc)
-    return USBI_STATUS_PARAM;
-  
-  tmp = dev->config.desc_size 
-    - ((int)interface_desc - (int)dev->config.desc);
-  
-  endpoint_desc = _usbi_find_endpoint_desc(interface_desc, tmp, endpoint);
-
-  if(!endpoint_desc)
+  if(!interface_index || endpoint < 0 
+     || endpoint >= interface_index->num_endpoints)
     return USBI_STATUS_PARAM;
 
   size = size > USBI_DESC_LEN_ENDPOINT ? USBI_DESC_LEN_ENDPOINT : size;
-  memcpy(descriptor, endpoint_desc, size);
+  memcpy(descriptor, (uint8_t *)cache->desc 
+         + cache->endpoints[interface_index->first_endpoint + endpoint], size);
   return size;
 }
 
-
-static int _usbi_update_config_desc_cache(usbi_device_t dev, int config)
+/* reads a complete configuration descriptor from the device */
+static int _usbi_fetch_config_desc(usbi_device_t dev, int config, void **desc)
 { 
   usbi_config_descriptor_t *d = NULL;
+  void *tmp;
   int ret;
   volatile int size;
 
-  if(dev->config.desc_index == config && dev->config.desc)
-    return USBI_STATUS_SUCCESS;
+  *desc = NULL;
 
   size = sizeof(usbi_config_descriptor_t);
   if(!(d = malloc(size)))
@@ -660,8 +1653,16 @@ static int _usbi_update_config_desc_cache(usbi_device_t dev, int config)
 
   size = d->wTotalLength;
 
-  if(!(d = realloc(d, size)))
+  if(size < sizeof(usbi_config_descriptor_t)) {
+    free(d);
+    return USBI_STATUS_UNKNOWN;
+  }
+
+  if(!(tmp = realloc(d, size))) {
+    free(d);
     return USBI_STATUS_NOMEM;
+  }
+  d = tmp;
 
   ret = usbi_get_config_descriptor(dev, config, d, size); 
 
@@ -673,53 +1674,119 @@ static int _usbi_update_config_desc_cache(usbi_device_t dev, int config)
     free(d);
     return USBI_STATUS_UNKNOWN;
   }
-  if(dev->config.desc)
-    free(dev->config.desc);
-  dev->config.desc = d;
-  dev->config.desc_index = config;
-  dev->config.desc_size = ret;
+  *desc = d;
   return ret;
 }
 
-static void *_usbi_find_interface_desc(usbi_device_t dev, int interface, 
-                                       int alt_setting)
+/* builds the interface and endpoint index of a configuration descriptor,
+   the first walk counts the descriptors, the second one records their
+   offsets */
+static usbi_config_cache_t *_usbi_index_config_desc(void *desc, int size)
 {
-  uint8_t *p = dev->config.desc;
-  int size = dev->config.desc_size;
-
-  p += USBI_DESC_LEN_CONFIG;
-  size -= USBI_DESC_LEN_CONFIG;
-  while(size >= USBI_DESC_LEN_INTERFACE) {
-    usbi_interface_descriptor_t *i = (usbi_interface_descriptor_t *)p;
-    if(i->bDescriptorType == USBI_DESC_TYPE_INTERFACE) {
-      if(!interface && i->bAlternateSetting == alt_setting)
-        return p;
-      if(i->bAlternateSetting == alt_setting && interface)
-        interface--;
+  usbi_config_cache_t *cache = NULL;
+  int num_alt[256];
+  int pass, offset, i, e, num_interfaces = 0, num_endpoints = 0;
+  uint8_t *p = desc;
+
+  for(pass = 0; pass < 2; pass++) {
+    memset(num_alt, 0, sizeof(num_alt));
+    i = -1;
+    e = 0;
+    offset = USBI_DESC_LEN_CONFIG;
+    while(size - offset >= 2 && p[offset] >= 2 
+          && p[offset] <= size - offset) {
+      if(p[offset + 1] == USBI_DESC_TYPE_INTERFACE
+         && p[offset] >= USBI_DESC_LEN_INTERFACE) {
+        i++;
+        if(pass) {
+          usbi_interface_descriptor_t *d 
+            = (usbi_interface_descriptor_t *)(p + offset);
+          cache->interfaces[i].offset = offset;
+          cache->interfaces[i].alt_setting = d->bAlternateSetting;
+          cache->interfaces[i].interface = num_alt[d->bAlternateSetting]++;
+          cache->interfaces[i].first_endpoint = e;
+        }
+      } else if(p[offset + 1] == USBI_DESC_TYPE_ENDPOINT
+                && p[offset] >= USBI_DESC_LEN_ENDPOINT && i >= 0) {
+        if(pass) {
+          cache->endpoints[e] = offset;
+          cache->interfaces[i].num_endpoints++;
+        }
+        e++;
+      }
+      offset += p[offset];
+    }
+    if(!pass) {
+      num_interfaces = i + 1;
+      num_endpoints = e;
+      cache = malloc(sizeof(usbi_config_cache_t)
+                     + num_interfaces * sizeof(usbi_interface_index_t)
+                     + num_endpoints * sizeof(int));
+      if(!cache)
+        return NULL;
+      memset(cache, 0, sizeof(usbi_config_cache_t)
+             + num_interfaces * sizeof(usbi_interface_index_t));
+      cache->desc = desc;
+      cache->size = size;
+      cache->num_interfaces = num_interfaces;
+      cache->interfaces = (usbi_interface_index_t *)(cache + 1);
+      cache->endpoints = (int *)(cache->interfaces + num_interfaces);
     }
-    p += i->bLength;
-    size -= i->bLength;
   }
-  return NULL;
+  return cache;
 }
 
-static void *_usbi_find_endpoint_desc(void *interface_desc, int size, 
-                                      int endpoint)
+static int _usbi_get_config_cache(usbi_device_t dev, int config,
+                                  usbi_config_cache_t **cache)
 {
-  uint8_t *p = interface_desc;
+  usbi_config_cache_t **tmp;
+  void *desc;
+  int ret;
 
-  p += USBI_DESC_LEN_INTERFACE;
-  size = size - USBI_DESC_LEN_INTERFACE;
-  while(size >= USBI_DESC_LEN_ENDPOINT) {
-    usbi_endpoint_descriptor_t *e = (usbi_endpoint_descriptor_t *)p;
-    if(e->bDescriptorType == USBI_DESC_TYPE_ENDPOINT) {
-      if(!endpoint)
-        return p;
-      else
-        endpoint--;
-    }
-    p += e->bLength;
-    size -= e->bLength;
+  *cache = NULL;
+  config &= 0xFF;
+
+  if(config < dev->config.num_cached && dev->config.cache[config]) {
+    dev->config.hits++;
+    *cache = dev->config.cache[config];
+    return USBI_STATUS_SUCCESS;
+  }
+
+  dev->config.misses++;
+
+  if(config >= dev->config.num_cached) {
+    tmp = realloc(dev->config.cache, (config + 1) * sizeof(*tmp));
+    if(!tmp)
+      return USBI_STATUS_NOMEM;
+    memset(tmp + dev->config.num_cached, 0, 
+           (config + 1 - dev->config.num_cached) * sizeof(*tmp));
+    dev->config.cache = tmp;
+    dev->config.num_cached = config + 1;
+  }
+
+  ret = _usbi_fetch_config_desc(dev, config, &desc);
+  if(ret < 0)
+    return ret;
+
+  *cache = _usbi_index_config_desc(desc, ret);
+  if(!*cache) {
+    free(desc);
+    return USBI_STATUS_NOMEM;
+  }
+  dev->config.cache[config] = *cache;
+  return ret;
+}
+
+static usbi_interface_index_t *
+_usbi_find_interface_desc(usbi_config_cache_t *cache, int interface, 
+                          int alt_setting)
+{
+  int i;
+
+  for(i = 0; i < cache->num_interfaces; i++) {
+    if(cache->interfaces[i].alt_setting == alt_setting
+       && cache->interfaces[i].interface == interface)
+      return cache->interfaces + i;
   }
   return NULL;
 }
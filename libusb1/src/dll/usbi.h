@@ -207,30 +207,120 @@ typedef enum {
 
 #define USBI_DEVICE_NAME_SIZE 512
 
+/* one interface descriptor of a cached configuration, 'interface' counts
+   the interface descriptors with the same alternate setting */
+typedef struct {
+  int offset;
+  int interface;
+  int alt_setting;
+  int first_endpoint;
+  int num_endpoints;
+} usbi_interface_index_t;
+
+/* a complete configuration descriptor together with the offsets of its
+   interface and endpoint descriptors */
+typedef struct {
+  void *desc;
+  int size;
+  int num_interfaces;
+  usbi_interface_index_t *interfaces;
+  int *endpoints;
+} usbi_config_cache_t;
+
 typedef struct usbi_device_t {
   int driver; 
   int id;
   char name[USBI_DEVICE_NAME_SIZE];
   struct { 
     int value;
-    int desc_index;
-    int desc_size; 
-    void *desc; 
+    int num_cached;
+    usbi_config_cache_t **cache;
+    unsigned long hits;
+    unsigned long misses;
   } config;
   struct {
     int value;
     HANDLE mutex;
   } interface;
+  /* completed requests kept for reuse, see _usbi_alloc_io() */
+  struct {
+    CRITICAL_SECTION lock;
+    struct usbi_io_t *free;
+    int num_free;
+  } io_cache;
 } *usbi_device_t;
 
+typedef struct usbi_event_loop_t *usbi_event_loop_t;
+
+typedef enum {
+  USBI_CHANGE_ADDED,
+  USBI_CHANGE_REMOVED
+} usbi_change_type_t;
+
+typedef struct {
+  int id;
+  usbi_change_type_t type;
+} usbi_change_t;
+
+typedef struct usbi_hotplug_t *usbi_hotplug_t;
+
+/* called for every device arrival or removal matching a subscription */
+typedef void (*usbi_hotplug_callback_t)(int id, usbi_change_type_t type,
+                                        void *context);
+
+#define USBI_HOTPLUG_MATCH_ANY -1
+
+/* report the devices already present as arrivals when subscribing */
+#define USBI_HOTPLUG_ENUMERATE 0x01
+
+/* one buffer of a vectored request, see usbi_transfer_v() */
+typedef struct {
+  void *data;
+  int size;
+} usbi_iovec_t;
+
 typedef struct usbi_io_t {
   usbi_device_t dev;
+  struct usbi_io_t *next_free;
+  /* used by the backends for asynchronous I/O, the event survives reuse */
+  OVERLAPPED overlapped;
   int endpoint;
   usbi_transfer_t type;
   int direction; 
   int size;
+  struct {
+    usbi_event_loop_t loop;
+    HANDLE wait;
+    void *context;
+    /* wait callback and registering thread, the second one posts */
+    volatile LONG handover;
+  } event_loop;
+  /* contiguous copy of a vectored request the backend can't handle */
+  struct {
+    void *data;
+    const usbi_iovec_t *iov;
+    int iov_count;
+  } bounce;
 } *usbi_io_t;
 
+/* result of one packet of a request sent with usbi_transfer_iso_results() */
+typedef struct {
+  unsigned int offset; /* offset of the packet in the data */
+  unsigned int length; /* bytes transferred */
+  unsigned int status; /* USBD status, 0 on success */
+} usbi_iso_packet_result_t;
+
+typedef struct {
+  unsigned int packet_count;
+  unsigned int start_frame; /* frame of the first packet */
+  unsigned int error_count; /* number of failed packets */
+} usbi_iso_transfer_info_t;
+
+/* room needed after 'size' bytes of data for the packet results */
+#define USBI_ISO_RESULTS_SIZE(size, packet_size)                   \
+  ((int)(((size) / (packet_size)) * sizeof(usbi_iso_packet_result_t) \
+         + sizeof(usbi_iso_transfer_info_t)))
+
 /* backend API */
 
 #define USBI_DEFINE_BACKEND_INTERFACE(backend)                             \
@@ -253,10 +343,17 @@ typedef struct usbi_io_t {
   int backend##_transfer(backend##_device_t dev, int endpoint,             \
                          usbi_transfer_t type, void *data, int size,       \
                          int packet_size, backend##_io_t io);              \
+  int backend##_transfer_iso_results(backend##_device_t dev, int endpoint, \
+                                     void *data, int size, int packet_size,\
+                                     backend##_io_t io);                   \
+  int backend##_transfer_v(backend##_device_t dev, int endpoint,           \
+                           usbi_transfer_t type, const usbi_iovec_t *iov,  \
+                           int iov_count, backend##_io_t io);              \
   int backend##_wait(backend##_device_t dev, backend##_io_t io,            \
                      int timeout);                                         \
   int backend##_poll(backend##_device_t dev, backend##_io_t io);           \
-  int backend##_cancel(backend##_device_t dev, backend##_io_t io)
+  int backend##_cancel(backend##_device_t dev, backend##_io_t io);          \
+  HANDLE backend##_get_event(backend##_device_t dev, backend##_io_t io)
 
 
 
@@ -279,6 +376,39 @@ void _usbi_debug_printf(FILE *stream, usbi_debug_level_t level,
 
 
 void usbi_refresh_ids(void);
+
+/* returns the device list generation, incremented by every call to
+   usbi_refresh_ids() that found devices added or removed */
+int usbi_get_generation(void);
+
+/* retrieves the devices added and removed after generation 'since' */
+/* params: since: generation the caller is up to date with */
+/*         change: array to fill, size: number of elements in 'change' */
+/* return: number of changes (may exceed 'size'), or USBI_STATUS_STATE if */
+/*         the changes are no longer known and all IDs must be rescanned */
+int usbi_get_changes(int since, usbi_change_t *change, int size);
+
+/* subscribes to device arrivals and removals, the device list is */
+/* refreshed whenever Windows reports a device change, and the callback */
+/* runs on the thread calling usbi_refresh_ids(), which is an internal */
+/* notification thread unless the application refreshes the list itself */
+/* params: vid, pid: vendor and product ID to match */
+/*         dev_class: device class or class of any interface to match */
+/*         (each of them can be USBI_HOTPLUG_MATCH_ANY) */
+/*         flags: USBI_HOTPLUG_ENUMERATE or 0 */
+/*         callback, context: function to call and its user data */
+/*         handle: subscription handle (return value) */
+/* return: status code */
+int usbi_hotplug_register(int vid, int pid, int dev_class, int flags,
+                          usbi_hotplug_callback_t callback, void *context,
+                          usbi_hotplug_t *handle);
+
+/* cancels a subscription, don't call this from a hot-plug callback; no */
+/* callback for it runs after this returns, and the notification thread, */
+/* which keeps the library loaded, exits with the last subscription */
+/* params: handle: subscription handle */
+/* return: status code */
+int usbi_hotplug_deregister(usbi_hotplug_t handle);
 int usbi_get_first_id(void);
 int usbi_get_next_id(int id);
 int usbi_get_prev_id(int id);
@@ -353,6 +483,36 @@ int usbi_control_msg(usbi_device_t dev, int request_type, int request,
 int usbi_transfer(usbi_device_t dev, int endpoint, usbi_transfer_t type,
                   void *data, int size, int packet_size, usbi_io_t *io);
 
+/* sends an isochronous read/write request that also returns the result */
+/* of every packet */
+/* params: see usbi_transfer(), 'size' must be a multiple of 'packet_size' */
+/*         and 'data' must have room for USBI_ISO_RESULTS_SIZE() bytes */
+/*         after the packet data */
+/* return: status code */
+int usbi_transfer_iso_results(usbi_device_t dev, int endpoint, void *data,
+                              int size, int packet_size, usbi_io_t *io);
+
+/* sends a bulk or interrupt read/write request whose data is spread over */
+/* several buffers, the buffers are transferred in order as one request */
+/* so packet boundaries are the same as for a single buffer, a short */
+/* packet ends a read request and leaves the remaining buffers untouched */
+/* params: dev, ep, type, io: see usbi_transfer() */
+/*         iov:   the buffers, must stay valid until the request completes */
+/*         iov_count: number of buffers */
+/* return: status code */
+int usbi_transfer_v(usbi_device_t dev, int endpoint, usbi_transfer_t type,
+                    const usbi_iovec_t *iov, int iov_count, usbi_io_t *io);
+
+/* locates the packet results of a completed usbi_transfer_iso_results() */
+/* request */
+/* params: data, size, packet_size: as passed to the request */
+/*         results: result of the first packet (return value) */
+/*         info: transfer info (return value) */
+/* return: number of packets or status code */
+int usbi_get_iso_results(void *data, int size, int packet_size,
+                         usbi_iso_packet_result_t **results,
+                         usbi_iso_transfer_info_t **info);
+
 /* waits for an IO request to complete, cancels and frees the request after */
 /* 'timeout' expires */
 /* params: io:  handle to IO request*/
@@ -372,6 +532,58 @@ int usbi_poll(usbi_io_t io);
 int usbi_cancel(usbi_io_t io);
 
 
+/* event loop, one completion queue for IO requests of any device/backend */
+
+/* creates an event loop */
+/* params: loop: pointer to an event loop handle (return value) */
+/* return: status code */
+int usbi_event_loop_create(usbi_event_loop_t *loop);
+
+/* destroys an event loop, all requests must have been dequeued */
+/* params: loop: event loop to destroy */
+/* return: status code, USBI_STATUS_BUSY if requests are still queued */
+int usbi_event_loop_destroy(usbi_event_loop_t loop);
+
+/* hands a submitted IO request over to an event loop, the request's */
+/* completion is then reported by usbi_event_loop_dequeue() only, don't */
+/* pass it to usbi_wait(), usbi_poll(), or usbi_cancel() afterwards */
+/* params: loop: event loop */
+/*         io: IO request returned by usbi_control_msg() or usbi_transfer() */
+/*         context: user data returned with the completion */
+/* return: status code */
+int usbi_event_loop_add(usbi_event_loop_t loop, usbi_io_t io, void *context);
+
+/* submits a bulk, interrupt, or isochronous request through an event loop */
+/* params: loop: event loop */
+/*         see usbi_transfer() for the remaining parameters */
+/*         context: user data returned with the completion */
+/* return: status code */
+int usbi_event_loop_transfer(usbi_event_loop_t loop, usbi_device_t dev,
+                             int endpoint, usbi_transfer_t type,
+                             void *data, int size, int packet_size,
+                             void *context);
+
+/* submits a control message through an event loop */
+/* params: loop: event loop */
+/*         see usbi_control_msg() for the remaining parameters */
+/*         context: user data returned with the completion */
+/* return: status code */
+int usbi_event_loop_control_msg(usbi_event_loop_t loop, usbi_device_t dev,
+                                int request_type, int request, int value,
+                                int index, void *data, int size,
+                                void *context);
+
+/* waits for the next completed request of an event loop and frees it */
+/* params: loop: event loop */
+/*         context: the completed request's user data (return value) */
+/*         result: error/status code or the number of bytes transferred */
+/*                 of the completed request (return value) */
+/*         timeout: timeout value */
+/* return: status code, USBI_STATUS_TIMEOUT if nothing completed in time */
+int usbi_event_loop_dequeue(usbi_event_loop_t loop, void **context,
+                            int *result, int timeout);
+
+
 /* miscellaneous, driver independent functions */
 void usbi_unicode_to_ansi(wchar_t *in, char *out, int outlen);
 int usbi_control_msg_sync(usbi_device_t dev, int request_type, int request, 
@@ -379,12 +591,20 @@ int usbi_control_msg_sync(usbi_device_t dev, int request_type, int request,
                           int timeout);
 int usbi_transfer_sync(usbi_device_t dev, int endpoint, usbi_transfer_t type,
                        void *data, int size, int packet_size, int timeout);
+int usbi_transfer_v_sync(usbi_device_t dev, int endpoint, 
+                         usbi_transfer_t type, const usbi_iovec_t *iov,
+                         int iov_count, int timeout);
 
 int usbi_get_configuration(usbi_device_t dev, int *config);
 int usbi_get_interface(usbi_device_t dev, int interface, int *alt_setting);
 int usbi_get_device_descriptor(usbi_device_t dev, void *descriptor, int size);
 int usbi_get_config_descriptor(usbi_device_t dev, int config, 
                                void *descriptor, int size);
+int usbi_get_cached_config_descriptor(usbi_device_t dev, int config,
+                                      const void **descriptor);
+void usbi_flush_config_cache(usbi_device_t dev);
+int usbi_get_config_cache_stats(usbi_device_t dev, unsigned long *hits,
+                                unsigned long *misses);
 int usbi_get_interface_descriptor(usbi_device_t dev, int config, 
                                   int interface, int alt_setting,
                                   void *descriptor, int size);
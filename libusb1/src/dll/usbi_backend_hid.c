@@ -651,13 +651,29 @@ int hid_transfer(hid_device_t dev, int endpoint, usbi_transfer_t type,
   if(type != USBI_TRANSFER_INTERRUPT)
     return USBI_STATUS_PARAM;
 
+  /* 'wio' stays NULL for the synchronous control requests */
+  io->wio = &io->base.overlapped;
   if(USBI_ENDPOINT_OUT(endpoint) && endpoint == HID_OUT_EP)
-    return winio_write_async(dev->wdev, data, size, &io->wio);
+    return winio_write_async(dev->wdev, data, size, io->wio);
   else if(USBI_ENDPOINT_IN(endpoint) && endpoint == HID_IN_EP)
-    return winio_read_async(dev->wdev, data, size, &io->wio);
+    return winio_read_async(dev->wdev, data, size, io->wio);
   return USBI_STATUS_PARAM;
 }
 
+int hid_transfer_iso_results(hid_device_t dev, int endpoint, void *data,
+                             int size, int packet_size, hid_io_t io)
+{
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
+/* the core copies the buffers into one contiguous request */
+int hid_transfer_v(hid_device_t dev, int endpoint,
+                   usbi_transfer_t type, const usbi_iovec_t *iov,
+                   int iov_count, hid_io_t io)
+{
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
 int hid_wait(hid_device_t dev, hid_io_t io, int timeout)
 {
   if(io->wio) /* asynchronous request? */
@@ -679,6 +695,12 @@ int hid_cancel(hid_device_t dev, hid_io_t io)
   return USBI_STATUS_SUCCESS;
 }
 
+HANDLE hid_get_event(hid_device_t dev, hid_io_t io)
+{
+  /* synchronous requests have no event, they are already complete */
+  return winio_get_event(io->wio);
+}
+
 
 
 
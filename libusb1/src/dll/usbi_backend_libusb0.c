@@ -9,6 +9,7 @@
 #define LIBUSB0_DEVICE_PREFIX "\\\\.\\libusb0-"
 
 static int _libusb0_abort_ep(libusb0_device_t dev, int endpoint);
+static void _libusb0_free_request(libusb0_io_t io);
 
 static int _libusb0_abort_ep(libusb0_device_t dev, int endpoint)
 {
@@ -23,6 +24,13 @@ static int _libusb0_abort_ep(libusb0_device_t dev, int endpoint)
                           &req, sizeof(libusb_request), NULL, 0, -1);
 }
 
+static void _libusb0_free_request(libusb0_io_t io)
+{
+  if(io->req && io->req != &io->request)
+    free(io->req);
+  io->req = NULL;
+}
+
 
 int libusb0_init(void)
 {
@@ -39,27 +47,79 @@ int libusb0_set_debug(usbi_debug_level_t level)
   return USBI_STATUS_SUCCESS;
 }
 
-int libusb0_get_name(int index, char *name, int size)
+/* device numbers found by the last enumeration, libusb0_get_name(0, ...) 
+   starts a new one and the following indexes are served from it, so a 
+   refresh enumerates once instead of once per device */
+static int device_numbers[LIBUSB_MAX_NUMBER_OF_DEVICES];
+static int num_devices = 0;
+
+/* a device is present if its node exists and can be opened */
+static int _libusb0_probe(int number)
 {
-  int i;
-  char tname[512];
-  int ret;
+  char name[512];
   winio_device_t dev;
-  
-  for(i = 0; i < LIBUSB_MAX_NUMBER_OF_DEVICES; i++) {
-    snprintf(tname, sizeof(tname) - 1, "%s%04d", LIBUSB0_DEVICE_PREFIX, i);
-    if((ret = winio_open_name(&dev, tname)) >= 0) {
-      if(!index) {
-        strcpy(name, tname);
-        winio_close(dev);
-        return USBI_STATUS_SUCCESS;
+
+  snprintf(name, sizeof(name) - 1, "%s%04d", LIBUSB0_DEVICE_PREFIX, number);
+  if(winio_open_name(&dev, name) < 0)
+    return FALSE;
+  winio_close(dev);
+  return TRUE;
+}
+
+static void _libusb0_enumerate(void)
+{
+  char present[LIBUSB_MAX_NUMBER_OF_DEVICES];
+  char *names = NULL, *p;
+  DWORD size = 16384;
+  int i;
+
+  memset(present, 0, sizeof(present));
+  num_devices = 0;
+
+  /* the driver creates a DOS device name for every device object, listing
+     them avoids opening all possible nodes */
+  while((names = malloc(size))) {
+    if(QueryDosDeviceA(NULL, names, size))
+      break;
+    free(names);
+    names = NULL;
+    if(GetLastError() != ERROR_INSUFFICIENT_BUFFER || size >= 0x100000)
+      break;
+    size *= 2;
+  }
+
+  if(names) {
+    for(p = names; *p; p += strlen(p) + 1) {
+      if(!_strnicmp(p, "libusb0-", 8)) {
+        i = atoi(p + 8);
+        if(i >= 0 && i < LIBUSB_MAX_NUMBER_OF_DEVICES)
+          present[i] = TRUE;
       }
-      winio_close(dev);
-      index--;
     }
+    free(names);
+  } else {
+    USBI_DEBUG_ERROR("listing DOS devices failed, probing all nodes");
+    memset(present, TRUE, sizeof(present));
+  }
+
+  for(i = 0; i < LIBUSB_MAX_NUMBER_OF_DEVICES; i++) {
+    if(present[i] && _libusb0_probe(i))
+      device_numbers[num_devices++] = i;
   }
+}
+
+int libusb0_get_name(int index, char *name, int size)
+{
+  if(!index)
+    _libusb0_enumerate();
+
+  if(index < 0 || index >= num_devices)
+    return USBI_STATUS_NODEV;
 
-  return USBI_STATUS_NODEV;
+  snprintf(name, size - 1, "%s%04d", LIBUSB0_DEVICE_PREFIX, 
+           device_numbers[index]);
+  name[size - 1] = 0;
+  return USBI_STATUS_SUCCESS;
 }
 
 int libusb0_open(libusb0_device_t dev, const char *name)
@@ -157,9 +217,14 @@ int libusb0_control_msg(libusb0_device_t dev, int request_type, int request,
   req_size = USBI_REQ_OUT(request_type) ? sizeof(libusb_request) + size
     : sizeof(libusb_request);
   
-  if(!(req = malloc(req_size)))
+  /* only control writes with data need more than the embedded request */
+  if(req_size <= sizeof(libusb_request))
+    req = &io->request;
+  else if(!(req = malloc(req_size)))
     return USBI_STATUS_NOMEM;
 
+  io->req = req;
+
   if(USBI_REQ_OUT(request_type))
     memcpy((char *)req + sizeof(libusb_request), data, size);
 
@@ -227,7 +292,7 @@ int libusb0_control_msg(libusb0_device_t dev, int request_type, int request,
           break;
 	  
         default:
-          free(req);
+          _libusb0_free_request(io);
           return USBI_STATUS_PARAM;
         }
       break;
@@ -248,7 +313,7 @@ int libusb0_control_msg(libusb0_device_t dev, int request_type, int request,
       break;
 
     default:
-      free(req);
+      _libusb0_free_request(io);
       return USBI_STATUS_PARAM;
     }
 
@@ -257,13 +322,11 @@ int libusb0_control_msg(libusb0_device_t dev, int request_type, int request,
     size = 0;
   }
 
-  io->req = req;
+  io->wio = &io->base.overlapped;
 
   if((ret = winio_ioctl_async(dev->wdev, code, req, req_size, 
-                              data, size, &io->wio)) < 0) {
-    free(req);
-    io->req = NULL;
-  }
+                              data, size, io->wio)) < 0)
+    _libusb0_free_request(io);
 
   return ret;
 }
@@ -275,11 +338,9 @@ int libusb0_transfer(libusb0_device_t dev, int endpoint, usbi_transfer_t type,
   int code;
   libusb_request *req;
 
+  req = &io->request;
   io->req = NULL;
 
-  if(!(req = malloc(sizeof(libusb_request))))
-    return USBI_STATUS_NOMEM;
-  
   req->endpoint.endpoint = endpoint;
   req->endpoint.packet_size = packet_size;
 
@@ -294,27 +355,65 @@ int libusb0_transfer(libusb0_device_t dev, int endpoint, usbi_transfer_t type,
       : LIBUSB_IOCTL_ISOCHRONOUS_WRITE;
     break;
   default:
-    free(req);
     return USBI_STATUS_PARAM;
   }
 
   io->req = req;
+  io->wio = &io->base.overlapped;
 
   if((ret = winio_ioctl_async(dev->wdev, code, req, sizeof(libusb_request), 
-                              data, size, &io->wio) < 0)) {
-    free(req);
+                              data, size, io->wio) < 0))
     io->req = NULL;
-  }
 
   return ret;
 }
 
+int libusb0_transfer_iso_results(libusb0_device_t dev, int endpoint,
+                                 void *data, int size, int packet_size,
+                                 libusb0_io_t io)
+{
+  int ret;
+  int results_size;
+  libusb_request *req;
+  libusb_iso_transfer_info_t info;
+
+  req = &io->request;
+  io->req = NULL;
+
+  req->endpoint.endpoint = endpoint;
+  req->endpoint.packet_size = packet_size;
+
+  /* the driver takes the packet count from the info after the results */
+  results_size = USBI_ISO_RESULTS_SIZE(size, packet_size);
+  memset(&info, 0, sizeof(info));
+  info.packet_count = size / packet_size;
+  memcpy((char *)data + size + results_size - sizeof(info), &info,
+         sizeof(info));
+
+  io->req = req;
+  io->wio = &io->base.overlapped;
+
+  if((ret = winio_ioctl_async(dev->wdev, LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX,
+                              req, sizeof(libusb_request), data,
+                              size + results_size, io->wio)) < 0)
+    io->req = NULL;
+
+  return ret;
+}
+
+/* the core copies the buffers into one contiguous request */
+int libusb0_transfer_v(libusb0_device_t dev, int endpoint,
+                       usbi_transfer_t type, const usbi_iovec_t *iov,
+                       int iov_count, libusb0_io_t io)
+{
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
 int libusb0_wait(libusb0_device_t dev, libusb0_io_t io, int timeout)
 {
   int ret;
   ret = winio_wait(dev->wdev, io->wio, timeout);
-  if(io->req)
-    free(io->req);
+  _libusb0_free_request(io);
   if(ret >= 0 && io->base.type == USBI_TRANSFER_CONTROL 
      && io->base.direction == USBI_DIRECTION_OUT)
     ret = io->base.size;
@@ -325,8 +424,7 @@ int libusb0_poll(libusb0_device_t dev, libusb0_io_t io)
 {
   int ret;
   if((ret = winio_poll(dev->wdev, io->wio)) != USBI_STATUS_PENDING)
-  if(io->req)
-    free(io->req);
+    _libusb0_free_request(io);
   if(ret >= 0 && io->base.type == USBI_TRANSFER_CONTROL 
      && io->base.direction == USBI_DIRECTION_OUT)
     ret = io->base.size;
@@ -339,3 +437,8 @@ int libusb0_cancel(libusb0_device_t dev, libusb0_io_t io)
   libusb0_wait(dev, io, INFINITE);
   return USBI_STATUS_SUCCESS;
 }
+
+HANDLE libusb0_get_event(libusb0_device_t dev, libusb0_io_t io)
+{
+  return winio_get_event(io->wio);
+}
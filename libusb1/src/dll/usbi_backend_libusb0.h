@@ -14,7 +14,9 @@ typedef struct libusb0_device_t {
 typedef struct libusb0_io_t {
   struct usbi_io_t base;
   winio_io_t wio;
+  /* points to 'request' unless a control write needed more room */
   libusb_request *req;
+  libusb_request request;
 } *libusb0_io_t;
 
 USBI_DEFINE_BACKEND_INTERFACE(libusb0);
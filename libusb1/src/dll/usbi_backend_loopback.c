@@ -0,0 +1,906 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "usbi_backend_loopback.h"
+
+
+/* A virtual device that needs no hardware. Whatever is written to one of
+   its OUT endpoints can be read back from the IN endpoint with the same
+   number, vendor control writes are returned by vendor control reads.
+   Requests complete on a worker thread of the device handle.
+
+   The backend is disabled unless LIBUSB_LOOPBACK_DEVICES is set to the
+   number of devices to emulate. The other LIBUSB_LOOPBACK_* variables
+   below change the descriptors and the behavior of the devices.
+
+   With LIBUSB_LOOPBACK_BENCHMARK set the devices also implement the
+   protocol of the benchmark firmware used by examples/benchmark.c: the
+   SET_TEST/GET_TEST vendor requests select whether IN endpoints send the
+   test pattern, OUT endpoints discard their data, or both loop back. */
+
+#define LOOPBACK_NAME_FORMAT "loopback-%04d"
+
+#define LOOPBACK_MANUFACTURER "libusb-win32"
+#define LOOPBACK_PRODUCT "Loopback Device"
+
+#define LOOPBACK_DEFAULT_VID 0x1234
+#define LOOPBACK_DEFAULT_PID 0x5678
+#define LOOPBACK_BENCH_VID 0x0666
+#define LOOPBACK_BENCH_PID 0x0001
+#define LOOPBACK_DEFAULT_PACKET_SIZE 512
+#define LOOPBACK_DEFAULT_FIFO_SIZE (1024 * 1024)
+
+#define LOOPBACK_MAX_PACKET_SIZE 1024
+#define LOOPBACK_MAX_INTERRUPT_PACKET_SIZE 64
+
+#define LOOPBACK_CONFIG_DESC_SIZE \
+  (USBI_DESC_LEN_CONFIG + USBI_DESC_LEN_INTERFACE \
+   + 2 * LOOPBACK_NUM_PIPES * USBI_DESC_LEN_ENDPOINT)
+
+/* USBD status of packets failed by an injected error */
+#define LOOPBACK_ISO_PACKET_ERROR 0xC0000011
+
+/* vendor requests of the benchmark firmware */
+#define LOOPBACK_BENCH_SET_TEST 0x0E
+#define LOOPBACK_BENCH_GET_TEST 0x0F
+
+/* ms a throttled pipe may be idle before it loses its unused time */
+#define LOOPBACK_RATE_IDLE 100
+
+#define LOOPBACK_PIPE(endpoint) (((endpoint) & 0x0F) - 1)
+
+
+static struct {
+  int num_devices;
+  int vid;
+  int pid;
+  int packet_size;
+  int fifo_size;
+  int latency;    /* ms until a request completes */
+  int error_rate; /* every n-th transfer fails, 0 for never */
+  int rate;       /* bytes/s of each endpoint, 0 for unlimited */
+  int benchmark;  /* emulate the benchmark firmware */
+} _loopback;
+
+/* data of a benchmark packet, byte 1 is replaced by the packet's key */
+static char _loopback_bench_pattern[LOOPBACK_MAX_PACKET_SIZE];
+
+/* endpoint types of the pipes, endpoint n is pipe n - 1 */
+static const int _loopback_pipe_types[LOOPBACK_NUM_PIPES] = {
+  USBI_ENDPOINT_TYPE_BULK,
+  USBI_ENDPOINT_TYPE_INTERRUPT,
+  USBI_ENDPOINT_TYPE_ISOCHRONOUS
+};
+
+
+static int _loopback_getenv(const char *name, int def);
+static int _loopback_packet_size(int pipe);
+static int _loopback_get_descriptor(loopback_device_t dev, int type,
+                                    int index, void *data, int size);
+static int _loopback_string_descriptor(const char *str, void *data,
+                                       int size);
+static int _loopback_control(loopback_device_t dev, int request_type,
+                             int request, int value, int index,
+                             void *data, int size);
+static int _loopback_bench_control(loopback_device_t dev, int request,
+                                   int value, void *data, int size);
+static void _loopback_bench_fill(loopback_pipe_t *pipe, loopback_io_t io,
+                                 int packet_size);
+static void _loopback_flush_pipe(loopback_pipe_t *pipe);
+static void _loopback_throttle(loopback_device_t dev, loopback_io_t io,
+                               DWORD now);
+static void _loopback_copy_io(loopback_io_t io, int offset, char *p, int n,
+                              int to_io);
+static int _loopback_move_data(loopback_device_t dev, loopback_io_t io);
+static void _loopback_complete(loopback_io_t io);
+static DWORD _loopback_process(loopback_device_t dev);
+static DWORD WINAPI _loopback_thread(LPVOID param);
+static int _loopback_submit(loopback_device_t dev, loopback_io_t io);
+static int _loopback_submit_transfer(loopback_device_t dev, int endpoint,
+                                     usbi_transfer_t type,
+                                     const usbi_iovec_t *iov, int iov_count,
+                                     loopback_io_t io);
+
+
+static int _loopback_getenv(const char *name, int def)
+{
+  const char *value = getenv(name);
+
+  if(!value || !*value)
+    return def;
+  return (int)strtol(value, NULL, 0);
+}
+
+static int _loopback_packet_size(int pipe)
+{
+  if(_loopback_pipe_types[pipe] == USBI_ENDPOINT_TYPE_INTERRUPT
+     && _loopback.packet_size > LOOPBACK_MAX_INTERRUPT_PACKET_SIZE)
+    return LOOPBACK_MAX_INTERRUPT_PACKET_SIZE;
+  return _loopback.packet_size;
+}
+
+static int _loopback_string_descriptor(const char *str, void *data,
+                                       int size)
+{
+  uint8_t tmp[2 + 2 * 126];
+  int len = 2;
+
+  while(*str && len < sizeof(tmp)) {
+    tmp[len++] = (uint8_t)*str++;
+    tmp[len++] = 0;
+  }
+  tmp[0] = (uint8_t)len;
+  tmp[1] = USBI_DESC_TYPE_STRING;
+
+  if(size > len)
+    size = len;
+  memcpy(data, tmp, size);
+  return size;
+}
+
+static int _loopback_get_descriptor(loopback_device_t dev, int type,
+                                    int index, void *data, int size)
+{
+  usbi_device_descriptor_t d;
+  uint8_t tmp[LOOPBACK_CONFIG_DESC_SIZE];
+  usbi_config_descriptor_t *cd;
+  usbi_interface_descriptor_t *id;
+  usbi_endpoint_descriptor_t *ed;
+  char serial[16];
+  int i;
+
+  switch(type) {
+  case USBI_DESC_TYPE_DEVICE:
+    d.bLength = USBI_DESC_LEN_DEVICE;
+    d.bDescriptorType = USBI_DESC_TYPE_DEVICE;
+    d.bcdUSB = 0x0200; /* 2.00 */
+    d.bDeviceClass = 0;
+    d.bDeviceSubClass = 0;
+    d.bDeviceProtocol = 0;
+    d.bMaxPacketSize0 = 64;
+    d.idVendor = (uint16_t)_loopback.vid;
+    d.idProduct = (uint16_t)_loopback.pid;
+    d.bcdDevice = 0x0100;
+    d.iManufacturer = 1;
+    d.iProduct = 2;
+    d.iSerialNumber = 3;
+    d.bNumConfigurations = 1;
+
+    if(size > USBI_DESC_LEN_DEVICE)
+      size = USBI_DESC_LEN_DEVICE;
+    memcpy(data, &d, size);
+    return size;
+
+  case USBI_DESC_TYPE_CONFIG:
+    if(index)
+      return USBI_STATUS_PARAM;
+
+    cd = (usbi_config_descriptor_t *)tmp;
+    id = (usbi_interface_descriptor_t *)(tmp + USBI_DESC_LEN_CONFIG);
+    ed = (usbi_endpoint_descriptor_t *)(tmp + USBI_DESC_LEN_CONFIG
+                                        + USBI_DESC_LEN_INTERFACE);
+
+    cd->bLength = USBI_DESC_LEN_CONFIG;
+    cd->bDescriptorType = USBI_DESC_TYPE_CONFIG;
+    cd->wTotalLength = LOOPBACK_CONFIG_DESC_SIZE;
+    cd->bNumInterfaces = 1;
+    cd->bConfigurationValue = 1;
+    cd->iConfiguration = 0;
+    cd->bmAttributes = 1 << 7; /* bus powered */
+    cd->bMaxPower = 50;
+
+    id->bLength = USBI_DESC_LEN_INTERFACE;
+    id->bDescriptorType = USBI_DESC_TYPE_INTERFACE;
+    id->bInterfaceNumber = 0;
+    id->bAlternateSetting = 0;
+    id->bNumEndpoints = 2 * LOOPBACK_NUM_PIPES;
+    id->bInterfaceClass = 0xFF; /* vendor specific */
+    id->bInterfaceSubClass = 0;
+    id->bInterfaceProtocol = 0;
+    id->iInterface = 0;
+
+    for(i = 0; i < 2 * LOOPBACK_NUM_PIPES; i++, ed++) {
+      ed->bLength = USBI_DESC_LEN_ENDPOINT;
+      ed->bDescriptorType = USBI_DESC_TYPE_ENDPOINT;
+      ed->bEndpointAddress = (i / 2 + 1) | (i & 1 ? USBI_DIRECTION_IN : 0);
+      ed->bmAttributes = (uint8_t)_loopback_pipe_types[i / 2];
+      ed->wMaxPacketSize = (uint16_t)_loopback_packet_size(i / 2);
+      ed->bInterval = 1;
+    }
+
+    if(size > LOOPBACK_CONFIG_DESC_SIZE)
+      size = LOOPBACK_CONFIG_DESC_SIZE;
+    memcpy(data, tmp, size);
+    return size;
+
+  case USBI_DESC_TYPE_STRING:
+    switch(index) {
+    case 0: /* language ID, EN-US */
+      tmp[0] = 4;
+      tmp[1] = USBI_DESC_TYPE_STRING;
+      tmp[2] = 0x09;
+      tmp[3] = 0x04;
+      if(size > 4)
+        size = 4;
+      memcpy(data, tmp, size);
+      return size;
+    case 1:
+      return _loopback_string_descriptor(LOOPBACK_MANUFACTURER, data, size);
+    case 2:
+      return _loopback_string_descriptor(LOOPBACK_PRODUCT, data, size);
+    case 3:
+      sprintf(serial, "%04d", dev->index);
+      return _loopback_string_descriptor(serial, data, size);
+    }
+    return USBI_STATUS_PARAM;
+  }
+  return USBI_STATUS_PARAM;
+}
+
+/* handles a control request, called with the device locked */
+static int _loopback_control(loopback_device_t dev, int request_type,
+                             int request, int value, int index,
+                             void *data, int size)
+{
+  uint8_t *p = data;
+  int pipe;
+
+  switch(USBI_REQ_TYPE(request_type)) {
+  case USBI_TYPE_STANDARD:
+    pipe = LOOPBACK_PIPE(index);
+    if(USBI_REQ_RECIPIENT(request_type) == USBI_RECIP_ENDPOINT
+       && (pipe < 0 || pipe >= LOOPBACK_NUM_PIPES))
+      return USBI_STATUS_PARAM;
+
+    switch(request) {
+    case USBI_REQ_GET_STATUS:
+      if(size < 2)
+        return USBI_STATUS_PARAM;
+      p[0] = 0;
+      p[1] = 0;
+      if(USBI_REQ_RECIPIENT(request_type) == USBI_RECIP_ENDPOINT)
+        p[0] = (uint8_t)dev->pipes[pipe].halted;
+      return 2;
+    case USBI_REQ_CLEAR_FEATURE:
+    case USBI_REQ_SET_FEATURE:
+      /* only ENDPOINT_HALT is supported */
+      if(USBI_REQ_RECIPIENT(request_type) != USBI_RECIP_ENDPOINT || value)
+        return USBI_STATUS_PARAM;
+      dev->pipes[pipe].halted = request == USBI_REQ_SET_FEATURE;
+      return 0;
+    case USBI_REQ_GET_DESCRIPTOR:
+      return _loopback_get_descriptor(dev, (value >> 8) & 0xFF,
+                                      value & 0xFF, data, size);
+    case USBI_REQ_GET_CONFIGURATION:
+      if(size < 1)
+        return USBI_STATUS_PARAM;
+      p[0] = (uint8_t)dev->config;
+      return 1;
+    case USBI_REQ_SET_CONFIGURATION:
+      return loopback_set_configuration(dev, value);
+    case USBI_REQ_GET_INTERFACE:
+      if(size < 1)
+        return USBI_STATUS_PARAM;
+      p[0] = 0;
+      return 1;
+    case USBI_REQ_SET_INTERFACE:
+      return loopback_set_interface(dev, index, value);
+    }
+    return USBI_STATUS_PARAM;
+
+  case USBI_TYPE_VENDOR:
+    if(_loopback.benchmark && (request == LOOPBACK_BENCH_SET_TEST
+                               || request == LOOPBACK_BENCH_GET_TEST))
+      return _loopback_bench_control(dev, request, value, data, size);
+
+    if(USBI_REQ_OUT(request_type)) {
+      if(size > sizeof(dev->control_buf))
+        return USBI_STATUS_PARAM;
+      memcpy(dev->control_buf, data, size);
+      dev->control_size = size;
+      return size;
+    }
+    if(size > dev->control_size)
+      size = dev->control_size;
+    memcpy(data, dev->control_buf, size);
+    return size;
+  }
+  return USBI_STATUS_PARAM;
+}
+
+/* SET_TEST and GET_TEST, both are IN requests returning the test type */
+static int _loopback_bench_control(loopback_device_t dev, int request,
+                                   int value, void *data, int size)
+{
+  int i;
+
+  if(size < 1)
+    return USBI_STATUS_PARAM;
+
+  if(request == LOOPBACK_BENCH_SET_TEST) {
+    dev->test_type = value & LOOPBACK_BENCH_LOOP;
+    for(i = 0; i < LOOPBACK_NUM_PIPES; i++)
+      _loopback_flush_pipe(&dev->pipes[i]);
+  }
+  *(uint8_t *)data = (uint8_t)dev->test_type;
+  return 1;
+}
+
+/* fills a read with benchmark packets: 0, key, then the pattern */
+static void _loopback_bench_fill(loopback_pipe_t *pipe, loopback_io_t io,
+                                 int packet_size)
+{
+  int offset, n;
+
+  for(offset = 0; offset < io->base.size; offset += packet_size) {
+    n = io->base.size - offset < packet_size
+      ? io->base.size - offset : packet_size;
+    _loopback_copy_io(io, offset, _loopback_bench_pattern, n, TRUE);
+    if(n > 1)
+      _loopback_copy_io(io, offset + 1, (char *)&pipe->key, 1, TRUE);
+    pipe->key++;
+  }
+  io->transferred = io->base.size;
+}
+
+static void _loopback_flush_pipe(loopback_pipe_t *pipe)
+{
+  pipe->key = 0;
+  pipe->head = 0;
+  pipe->count = 0;
+  pipe->msg_head = 0;
+  pipe->msg_count = 0;
+  pipe->halted = FALSE;
+}
+
+/* copies 'n' bytes between 'p' and the request's buffers at 'offset' */
+static void _loopback_copy_io(loopback_io_t io, int offset, char *p, int n,
+                              int to_io)
+{
+  int i, c;
+
+  for(i = 0; i < io->iov_count && n > 0; i++) {
+    if(offset >= io->iov[i].size) {
+      offset -= io->iov[i].size;
+      continue;
+    }
+    c = io->iov[i].size - offset < n ? io->iov[i].size - offset : n;
+    if(to_io)
+      memcpy((char *)io->iov[i].data + offset, p, c);
+    else
+      memcpy(p, (char *)io->iov[i].data + offset, c);
+    p += c;
+    n -= c;
+    offset = 0;
+  }
+}
+
+/* moves data between a request and its pipe, returns TRUE when the */
+/* request is complete, called with the device locked */
+static int _loopback_move_data(loopback_device_t dev, loopback_io_t io)
+{
+  loopback_pipe_t *pipe = &dev->pipes[LOOPBACK_PIPE(io->base.endpoint)];
+  int iso = io->base.type == USBI_TRANSFER_ISOCHRONOUS;
+  int size = io->base.size;
+  int packet_size = _loopback_packet_size(LOOPBACK_PIPE(io->base.endpoint));
+  int pos, n, c, short_end;
+
+  if(io->base.direction == USBI_DIRECTION_OUT
+     && dev->test_type == LOOPBACK_BENCH_WRITE) {
+    io->transferred = size;
+    return TRUE;
+  }
+  if(io->base.direction == USBI_DIRECTION_IN
+     && dev->test_type == LOOPBACK_BENCH_READ) {
+    _loopback_bench_fill(pipe, io, packet_size);
+    return TRUE;
+  }
+
+  if(io->base.direction == USBI_DIRECTION_OUT) {
+    /* a write that doesn't fit is stored in parts as the pipe drains, */
+    /* isochronous data that doesn't fit is dropped */
+    if(pipe->msg_count == LOOPBACK_MAX_MESSAGES)
+      return iso;
+    n = size - io->transferred;
+    if(n > pipe->size - pipe->count) {
+      n = pipe->size - pipe->count;
+      if(!n)
+        return iso;
+    }
+
+    pos = (pipe->head + pipe->count) % pipe->size;
+    c = n < pipe->size - pos ? n : pipe->size - pos;
+    _loopback_copy_io(io, io->transferred, pipe->buf + pos, c, FALSE);
+    _loopback_copy_io(io, io->transferred + c, pipe->buf, n - c, FALSE);
+    pipe->count += n;
+    io->transferred += n;
+
+    /* a write that isn't a multiple of the packet size ends with a short */
+    /* or zero length packet, which also ends the read receiving it */
+    short_end = io->transferred == size
+      && (!size || size % packet_size);
+    pos = (pipe->msg_head + pipe->msg_count) % LOOPBACK_MAX_MESSAGES;
+    pipe->msgs[pos].left = n;
+    pipe->msgs[pos].short_end = short_end;
+    pipe->msg_count++;
+
+    if(iso)
+      io->transferred = size;
+    return io->transferred == size;
+  }
+
+  short_end = FALSE;
+  while(io->transferred < size && pipe->msg_count && !short_end) {
+    n = pipe->msgs[pipe->msg_head].left;
+    if(n > size - io->transferred)
+      n = size - io->transferred;
+
+    c = n < pipe->size - pipe->head ? n : pipe->size - pipe->head;
+    _loopback_copy_io(io, io->transferred, pipe->buf + pipe->head, c, TRUE);
+    _loopback_copy_io(io, io->transferred + c, pipe->buf, n - c, TRUE);
+    pipe->head = (pipe->head + n) % pipe->size;
+    pipe->count -= n;
+    io->transferred += n;
+
+    if(!(pipe->msgs[pipe->msg_head].left -= n)) {
+      short_end = pipe->msgs[pipe->msg_head].short_end;
+      pipe->msg_head = (pipe->msg_head + 1) % LOOPBACK_MAX_MESSAGES;
+      pipe->msg_count--;
+    }
+  }
+
+  /* a zero length packet still queued after a full read */
+  if(!size && pipe->msg_count && !pipe->msgs[pipe->msg_head].left) {
+    pipe->msg_head = (pipe->msg_head + 1) % LOOPBACK_MAX_MESSAGES;
+    pipe->msg_count--;
+    short_end = TRUE;
+  }
+
+  /* isochronous reads return whatever has been written so far */
+  return iso || short_end || io->transferred == size;
+}
+
+/* delays a transfer by the time it takes at the configured rate, */
+/* transfers of a pipe follow each other, called with the device locked */
+static void _loopback_throttle(loopback_device_t dev, loopback_io_t io,
+                               DWORD now)
+{
+  loopback_pipe_t *pipe = &dev->pipes[LOOPBACK_PIPE(io->base.endpoint)];
+  int dir = io->base.direction == USBI_DIRECTION_IN;
+  DWORD start = pipe->rate[dir].busy_until;
+  ULONGLONG time;
+
+  /* a busy pipe catches up with the timer, an idle one starts over */
+  if(now - start > LOOPBACK_RATE_IDLE) {
+    start = now;
+    pipe->rate[dir].carry = 0;
+  }
+
+  time = (ULONGLONG)io->base.size * 1000 + pipe->rate[dir].carry;
+  pipe->rate[dir].carry = (int)(time % _loopback.rate);
+  io->due = start + (DWORD)(time / _loopback.rate);
+  io->throttled = TRUE;
+  pipe->rate[dir].busy_until = io->due;
+}
+
+/* called with the device locked, after the request has been unlinked */
+static void _loopback_complete(loopback_io_t io)
+{
+  usbi_iso_packet_result_t *results = io->iso_results;
+  usbi_iso_transfer_info_t *info;
+  int i, count, left;
+
+  if(io->ret >= 0)
+    io->ret = io->transferred;
+
+  if(results) {
+    count = io->base.size / io->packet_size;
+    info = (usbi_iso_transfer_info_t *)(results + count);
+    info->packet_count = count;
+    info->start_frame = GetTickCount();
+    info->error_count = io->ret < 0 ? count : 0;
+
+    for(i = 0; i < count; i++) {
+      left = io->transferred - i * io->packet_size;
+      results[i].offset = i * io->packet_size;
+      results[i].length = left < 0 ? 0
+        : left > io->packet_size ? io->packet_size : left;
+      results[i].status = io->ret < 0 ? LOOPBACK_ISO_PACKET_ERROR : 0;
+    }
+  }
+
+  io->done = TRUE;
+
+  /* the waiting thread may free the request now */
+  SetEvent(io->base.overlapped.hEvent);
+}
+
+/* completes everything that can be completed and returns the time until */
+/* the next request is due, called with the device locked */
+static DWORD _loopback_process(loopback_device_t dev)
+{
+  loopback_io_t io, *prev;
+  DWORD now, timeout;
+  int blocked[2][LOOPBACK_NUM_PIPES];
+  int progress, dir, pipe;
+
+  do {
+    now = GetTickCount();
+    timeout = INFINITE;
+    progress = FALSE;
+    memset(blocked, 0, sizeof(blocked));
+
+    for(prev = &dev->requests; (io = *prev); ) {
+      dir = io->base.direction == USBI_DIRECTION_IN;
+      pipe = LOOPBACK_PIPE(io->base.endpoint);
+
+      if((LONG)(io->due - now) > 0) {
+        if(io->due - now < timeout)
+          timeout = io->due - now;
+        if(io->base.type != USBI_TRANSFER_CONTROL)
+          blocked[dir][pipe] = TRUE;
+        prev = &io->next;
+        continue;
+      }
+
+      if(_loopback.rate && io->base.type != USBI_TRANSFER_CONTROL
+         && !io->throttled && !blocked[dir][pipe] && io->ret >= 0) {
+        _loopback_throttle(dev, io, now);
+        continue; /* check the new due time */
+      }
+
+      /* control requests and failed transfers already have their result, */
+      /* the requests of a pipe are completed in order */
+      if(io->base.type == USBI_TRANSFER_CONTROL || io->ret < 0
+         || (!blocked[dir][pipe] && _loopback_move_data(dev, io))) {
+        *prev = io->next;
+        _loopback_complete(io);
+        progress = TRUE;
+      } else {
+        blocked[dir][pipe] = TRUE;
+        prev = &io->next;
+      }
+    }
+  } while(progress);
+
+  return timeout;
+}
+
+static DWORD WINAPI _loopback_thread(LPVOID param)
+{
+  loopback_device_t dev = param;
+  DWORD timeout = INFINITE;
+
+  while(!dev->stop) {
+    WaitForSingleObject(dev->wake, timeout);
+    EnterCriticalSection(&dev->lock);
+    timeout = _loopback_process(dev);
+    LeaveCriticalSection(&dev->lock);
+  }
+  return 0;
+}
+
+/* queues a request for the worker thread */
+static int _loopback_submit(loopback_device_t dev, loopback_io_t io)
+{
+  loopback_io_t *prev;
+  HANDLE event = io->base.overlapped.hEvent;
+
+  /* the usbi layer keeps the event when the request is reused */
+  if(!event && !(event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+    return USBI_STATUS_NOMEM;
+  ResetEvent(event);
+  io->base.overlapped.hEvent = event;
+  io->due = GetTickCount() + _loopback.latency;
+
+  EnterCriticalSection(&dev->lock);
+  if(io->base.type != USBI_TRANSFER_CONTROL && _loopback.error_rate
+     && !(++dev->num_transfers % _loopback.error_rate))
+    io->ret = USBI_STATUS_UNKNOWN;
+  for(prev = &dev->requests; *prev; prev = &(*prev)->next);
+  *prev = io;
+  LeaveCriticalSection(&dev->lock);
+
+  SetEvent(dev->wake);
+  return USBI_STATUS_SUCCESS;
+}
+
+static int _loopback_submit_transfer(loopback_device_t dev, int endpoint,
+                                     usbi_transfer_t type,
+                                     const usbi_iovec_t *iov, int iov_count,
+                                     loopback_io_t io)
+{
+  int pipe = LOOPBACK_PIPE(endpoint);
+
+  if(pipe < 0 || pipe >= LOOPBACK_NUM_PIPES)
+    return USBI_STATUS_PARAM;
+  if((type == USBI_TRANSFER_BULK
+      && _loopback_pipe_types[pipe] != USBI_ENDPOINT_TYPE_BULK)
+     || (type == USBI_TRANSFER_INTERRUPT
+         && _loopback_pipe_types[pipe] != USBI_ENDPOINT_TYPE_INTERRUPT)
+     || (type == USBI_TRANSFER_ISOCHRONOUS
+         && _loopback_pipe_types[pipe] != USBI_ENDPOINT_TYPE_ISOCHRONOUS))
+    return USBI_STATUS_PARAM;
+  if(dev->pipes[pipe].halted)
+    return USBI_STATUS_STATE;
+
+  io->iov = iov;
+  io->iov_count = iov_count;
+  return _loopback_submit(dev, io);
+}
+
+
+int loopback_init(void)
+{
+  int i;
+  char c = 0;
+
+  _loopback.num_devices = _loopback_getenv("LIBUSB_LOOPBACK_DEVICES", 0);
+  _loopback.benchmark = _loopback_getenv("LIBUSB_LOOPBACK_BENCHMARK", 0);
+  _loopback.vid = _loopback_getenv("LIBUSB_LOOPBACK_VID", _loopback.benchmark
+                                   ? LOOPBACK_BENCH_VID
+                                   : LOOPBACK_DEFAULT_VID);
+  _loopback.pid = _loopback_getenv("LIBUSB_LOOPBACK_PID", _loopback.benchmark
+                                   ? LOOPBACK_BENCH_PID
+                                   : LOOPBACK_DEFAULT_PID);
+  _loopback.packet_size = _loopback_getenv("LIBUSB_LOOPBACK_PACKET_SIZE",
+                                           LOOPBACK_DEFAULT_PACKET_SIZE);
+  _loopback.fifo_size = _loopback_getenv("LIBUSB_LOOPBACK_FIFO_SIZE",
+                                         LOOPBACK_DEFAULT_FIFO_SIZE);
+  _loopback.latency = _loopback_getenv("LIBUSB_LOOPBACK_LATENCY", 0);
+  _loopback.error_rate = _loopback_getenv("LIBUSB_LOOPBACK_ERROR_RATE", 0);
+  _loopback.rate = _loopback_getenv("LIBUSB_LOOPBACK_RATE", 0);
+
+  if(_loopback.packet_size < 8
+     || _loopback.packet_size > LOOPBACK_MAX_PACKET_SIZE)
+    _loopback.packet_size = LOOPBACK_DEFAULT_PACKET_SIZE;
+  if(_loopback.fifo_size < _loopback.packet_size)
+    _loopback.fifo_size = LOOPBACK_DEFAULT_FIFO_SIZE;
+  if(_loopback.latency < 0)
+    _loopback.latency = 0;
+  if(_loopback.error_rate < 0)
+    _loopback.error_rate = 0;
+  if(_loopback.rate < 0)
+    _loopback.rate = 0;
+
+  /* counts up from 0, rolling over to 1 */
+  for(i = 0; i < LOOPBACK_MAX_PACKET_SIZE; i++) {
+    _loopback_bench_pattern[i] = c++;
+    if(!c)
+      c = 1;
+  }
+
+  /* no devices, don't enumerate this backend */
+  if(_loopback.num_devices <= 0)
+    return USBI_STATUS_NODEV;
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_deinit(void)
+{
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_set_debug(usbi_debug_level_t level)
+{
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_get_name(int index, char *name, int size)
+{
+  if(index < 0 || index >= _loopback.num_devices)
+    return USBI_STATUS_NODEV;
+  snprintf(name, size - 1, LOOPBACK_NAME_FORMAT, index);
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_open(loopback_device_t dev, const char *name)
+{
+  int i;
+
+  if(sscanf(name, "loopback-%d", &dev->index) != 1
+     || dev->index < 0 || dev->index >= _loopback.num_devices)
+    return USBI_STATUS_NODEV;
+
+  /* the benchmark firmware starts with a loop test */
+  dev->test_type = _loopback.benchmark ? LOOPBACK_BENCH_LOOP
+    : LOOPBACK_BENCH_NONE;
+
+  for(i = 0; i < LOOPBACK_NUM_PIPES; i++) {
+    dev->pipes[i].size = _loopback.fifo_size;
+    if(!(dev->pipes[i].buf = malloc(_loopback.fifo_size))) {
+      while(i--)
+        free(dev->pipes[i].buf);
+      return USBI_STATUS_NOMEM;
+    }
+  }
+
+  InitializeCriticalSection(&dev->lock);
+  dev->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if(dev->wake)
+    dev->thread = CreateThread(NULL, 0, _loopback_thread, dev, 0, NULL);
+
+  if(!dev->thread) {
+    USBI_DEBUG_ERROR("creating the worker thread failed");
+    if(dev->wake)
+      CloseHandle(dev->wake);
+    DeleteCriticalSection(&dev->lock);
+    for(i = 0; i < LOOPBACK_NUM_PIPES; i++)
+      free(dev->pipes[i].buf);
+    return USBI_STATUS_UNKNOWN;
+  }
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_close(loopback_device_t dev)
+{
+  loopback_io_t io;
+  int i;
+
+  dev->stop = TRUE;
+  SetEvent(dev->wake);
+  WaitForSingleObject(dev->thread, INFINITE);
+  CloseHandle(dev->thread);
+  CloseHandle(dev->wake);
+
+  /* requests nobody waited for */
+  while((io = dev->requests)) {
+    dev->requests = io->next;
+    io->ret = USBI_STATUS_NODEV;
+    _loopback_complete(io);
+  }
+
+  DeleteCriticalSection(&dev->lock);
+  for(i = 0; i < LOOPBACK_NUM_PIPES; i++)
+    free(dev->pipes[i].buf);
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_reset(loopback_device_t dev)
+{
+  int i;
+
+  EnterCriticalSection(&dev->lock);
+  for(i = 0; i < LOOPBACK_NUM_PIPES; i++)
+    _loopback_flush_pipe(&dev->pipes[i]);
+  dev->control_size = 0;
+  LeaveCriticalSection(&dev->lock);
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_reset_endpoint(loopback_device_t dev, int endpoint)
+{
+  int pipe = LOOPBACK_PIPE(endpoint);
+
+  if(pipe < 0 || pipe >= LOOPBACK_NUM_PIPES)
+    return USBI_STATUS_PARAM;
+
+  EnterCriticalSection(&dev->lock);
+  _loopback_flush_pipe(&dev->pipes[pipe]);
+  LeaveCriticalSection(&dev->lock);
+  return USBI_STATUS_SUCCESS;
+}
+
+int loopback_set_configuration(loopback_device_t dev, int value)
+{
+  if(!value || value == 1) {
+    dev->config = value;
+    return USBI_STATUS_SUCCESS;
+  }
+  return USBI_STATUS_PARAM;
+}
+
+int loopback_set_interface(loopback_device_t dev, int interface,
+                           int altsetting)
+{
+  if(interface == 0 && altsetting == 0)
+    return USBI_STATUS_SUCCESS;
+  return USBI_STATUS_PARAM;
+}
+
+int loopback_claim_interface(loopback_device_t dev, int interface)
+{
+  if(!interface)
+    return usbi_claim_interface_simple((usbi_device_t)dev, interface);
+  return USBI_STATUS_PARAM;
+}
+
+int loopback_release_interface(loopback_device_t dev, int interface)
+{
+  if(!interface)
+    return usbi_release_interface_simple((usbi_device_t)dev, interface);
+  return USBI_STATUS_PARAM;
+}
+
+int loopback_control_msg(loopback_device_t dev, int request_type,
+                         int request, int value, int index, void *data,
+                         int size, loopback_io_t io)
+{
+  int ret;
+
+  /* the request is carried out right away, only its completion is */
+  /* reported by the worker thread */
+  EnterCriticalSection(&dev->lock);
+  ret = _loopback_control(dev, request_type, request, value, index,
+                          data, size);
+  LeaveCriticalSection(&dev->lock);
+
+  if(ret < 0)
+    return ret;
+  io->transferred = ret;
+  return _loopback_submit(dev, io);
+}
+
+int loopback_transfer(loopback_device_t dev, int endpoint,
+                      usbi_transfer_t type, void *data, int size,
+                      int packet_size, loopback_io_t io)
+{
+  io->single.data = data;
+  io->single.size = size;
+  io->packet_size = packet_size;
+  return _loopback_submit_transfer(dev, endpoint, type, &io->single, 1, io);
+}
+
+int loopback_transfer_iso_results(loopback_device_t dev, int endpoint,
+                                  void *data, int size, int packet_size,
+                                  loopback_io_t io)
+{
+  io->single.data = data;
+  io->single.size = size;
+  io->packet_size = packet_size;
+  io->iso_results = (char *)data + size;
+  return _loopback_submit_transfer(dev, endpoint, USBI_TRANSFER_ISOCHRONOUS,
+                                   &io->single, 1, io);
+}
+
+int loopback_transfer_v(loopback_device_t dev, int endpoint,
+                        usbi_transfer_t type, const usbi_iovec_t *iov,
+                        int iov_count, loopback_io_t io)
+{
+  return _loopback_submit_transfer(dev, endpoint, type, iov, iov_count, io);
+}
+
+int loopback_wait(loopback_device_t dev, loopback_io_t io, int timeout)
+{
+  switch(WaitForSingleObject(io->base.overlapped.hEvent, timeout)) {
+  case WAIT_OBJECT_0:
+    return io->ret;
+  case WAIT_TIMEOUT:
+    loopback_cancel(dev, io);
+    return USBI_STATUS_TIMEOUT;
+  default:
+    loopback_cancel(dev, io);
+    return USBI_STATUS_UNKNOWN;
+  }
+}
+
+int loopback_poll(loopback_device_t dev, loopback_io_t io)
+{
+  if(WaitForSingleObject(io->base.overlapped.hEvent, 0) != WAIT_OBJECT_0)
+    return USBI_STATUS_PENDING;
+  return io->ret;
+}
+
+int loopback_cancel(loopback_device_t dev, loopback_io_t io)
+{
+  loopback_io_t *prev;
+
+  EnterCriticalSection(&dev->lock);
+  if(!io->done) {
+    for(prev = &dev->requests; *prev; prev = &(*prev)->next) {
+      if(*prev == io) {
+        *prev = io->next;
+        break;
+      }
+    }
+    io->ret = USBI_STATUS_UNKNOWN;
+    _loopback_complete(io);
+  }
+  LeaveCriticalSection(&dev->lock);
+  return USBI_STATUS_SUCCESS;
+}
+
+HANDLE loopback_get_event(loopback_device_t dev, loopback_io_t io)
+{
+  return io->base.overlapped.hEvent;
+}
@@ -0,0 +1,73 @@
+#ifndef __USBI_BACKEND_LOOPBACK_H__
+#define __USBI_BACKEND_LOOPBACK_H__
+
+#include "usbi.h"
+#include <windows.h>
+
+/* endpoint numbers 1 to LOOPBACK_NUM_PIPES, OUT data is echoed on IN */
+#define LOOPBACK_NUM_PIPES 3
+#define LOOPBACK_MAX_MESSAGES 64
+
+/* test types of the benchmark firmware, see examples/benchmark.c */
+#define LOOPBACK_BENCH_NONE  0x00
+#define LOOPBACK_BENCH_READ  0x01 /* IN endpoints send the test pattern */
+#define LOOPBACK_BENCH_WRITE 0x02 /* OUT endpoints discard the data */
+#define LOOPBACK_BENCH_LOOP  (LOOPBACK_BENCH_READ | LOOPBACK_BENCH_WRITE)
+
+typedef struct loopback_io_t *loopback_io_t;
+
+/* data written to an OUT endpoint and not yet read from the IN endpoint, */
+/* every write is one message so short packets survive the loop */
+typedef struct {
+  char *buf;
+  int size;
+  int head;
+  int count;
+  struct {
+    int left;
+    int short_end; /* the write ended with a short packet */
+  } msgs[LOOPBACK_MAX_MESSAGES];
+  int msg_head;
+  int msg_count;
+  int halted;
+  unsigned char key;         /* benchmark key of the next IN packet */
+  struct {
+    DWORD busy_until;        /* end of the last throttled transfer */
+    int carry;               /* ms fraction of it, in bytes * 1000 */
+  } rate[2];                 /* OUT, IN */
+} loopback_pipe_t;
+
+typedef struct loopback_device_t {
+  struct usbi_device_t base;
+  int index;
+  int config;
+  int test_type;             /* LOOPBACK_BENCH_*, benchmark mode only */
+  CRITICAL_SECTION lock;
+  loopback_io_t requests;    /* submitted, in order */
+  HANDLE wake;
+  HANDLE thread;
+  volatile LONG stop;
+  unsigned int num_transfers;
+  loopback_pipe_t pipes[LOOPBACK_NUM_PIPES];
+  int control_size;
+  char control_buf[256];     /* vendor control writes, read back by IN */
+} *loopback_device_t;
+
+struct loopback_io_t {
+  struct usbi_io_t base;
+  loopback_io_t next;
+  usbi_iovec_t single;       /* 'iov' of a request with one buffer */
+  const usbi_iovec_t *iov;
+  int iov_count;
+  int transferred;
+  int packet_size;
+  void *iso_results;         /* usbi_transfer_iso_results() only */
+  int ret;
+  DWORD due;
+  int throttled;             /* 'due' includes the transfer time */
+  volatile LONG done;
+};
+
+USBI_DEFINE_BACKEND_INTERFACE(loopback);
+
+#endif
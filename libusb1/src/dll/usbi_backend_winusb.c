@@ -357,13 +357,13 @@ int winusb_control_msg(winusb_device_t dev, int request_type, int request,
   sp.index = (USHORT)index;
   sp.length = (USHORT)size;
 
-  if(!(io->wio = winio_create_io()))
+  io->wio = &io->base.overlapped;
+  if(!USBI_SUCCESS(winio_init_io(io->wio)))
     return USBI_STATUS_NOMEM;
 
   if(!WinUsb_ControlTransfer(dev->interfaces[0].handle,
                              sp, data, size, &junk, io->wio)) {
     if(GetLastError() != ERROR_IO_PENDING) {
-      winio_free_io(io->wio);
       USBI_DEBUG_ERROR("WinUsb_ControlTransfer() failed");
       return USBI_STATUS_UNKNOWN;
     }
@@ -380,19 +380,33 @@ int winusb_transfer(winusb_device_t dev, int endpoint, usbi_transfer_t type,
 
   if(!(i = _winusb_interface_by_endpoint(dev, endpoint)))
     return USBI_STATUS_PARAM;
-  if(!(io->wio = winio_create_io()))
+  io->wio = &io->base.overlapped;
+  if(!USBI_SUCCESS(winio_init_io(io->wio)))
     return USBI_STATUS_NOMEM;
   if(USBI_ENDPOINT_IN(endpoint))
     ret = WinUsb_ReadPipe(i, endpoint, data, size, &junk, io->wio);
   else
     ret = WinUsb_WritePipe(i, endpoint, data, size, &junk, io->wio);
-  if(!ret && GetLastError() != ERROR_IO_PENDING) {
-    winio_free_io(io->wio);
+  if(!ret && GetLastError() != ERROR_IO_PENDING)
     return USBI_STATUS_UNKNOWN;
-  }
   return USBI_STATUS_SUCCESS;
 }
 
+int winusb_transfer_iso_results(winusb_device_t dev, int endpoint,
+                                void *data, int size, int packet_size,
+                                winusb_io_t io)
+{
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
+/* the core copies the buffers into one contiguous request */
+int winusb_transfer_v(winusb_device_t dev, int endpoint,
+                      usbi_transfer_t type, const usbi_iovec_t *iov,
+                      int iov_count, winusb_io_t io)
+{
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
 int winusb_wait(winusb_device_t dev, winusb_io_t io, int timeout)
 {
   return winio_wait(dev->wdev, io->wio, timeout);
@@ -418,3 +432,8 @@ int winusb_cancel(winusb_device_t dev, winusb_io_t io)
 
 
 
+
+HANDLE winusb_get_event(winusb_device_t dev, winusb_io_t io)
+{
+  return winio_get_event(io->wio);
+}
@@ -13,26 +13,29 @@
   USBI_DEBUG_ASSERT_PARAM((dev) != INVALID_HANDLE_VALUE, \
                           dev, USBI_STATUS_PARAM)
 
-winio_io_t winio_create_io(void)
+/* Prepares a caller owned overlapped block for a new request. An existing
+   event is kept, the I/O functions reset it when the request starts. */
+int winio_init_io(winio_io_t io)
 {
-  winio_io_t io = malloc(sizeof(*io));
+  HANDLE event = io->hEvent;
 
-  if(!io)
-    return NULL;
+  if(!event && !(event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+    return USBI_STATUS_NOMEM;
   memset(io, 0, sizeof(*io));
-  io->hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-  if(!io->hEvent) {
-    free(io);
-    return NULL;
-  }
-  return io;
+  io->hEvent = event;
+  return USBI_STATUS_SUCCESS;
 }
 
-void winio_free_io(winio_io_t io)
+void winio_deinit_io(winio_io_t io)
 {
   if(io->hEvent)
     CloseHandle(io->hEvent);
-  free(io);
+  io->hEvent = NULL;
+}
+
+HANDLE winio_get_event(winio_io_t io)
+{
+  return io ? io->hEvent : NULL;
 }
 
 int winio_open_name(winio_device_t *dev, const char *name)
@@ -127,54 +130,51 @@ int winio_close(winio_device_t dev)
 
 int winio_ioctl_async(winio_device_t dev, unsigned int code, 
                       void *write, int write_size,
-                      void *read, int read_size, winio_io_t *io)
+                      void *read, int read_size, winio_io_t io)
 {
   WINIO_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(io, io, USBI_STATUS_PARAM);
 
-  if(!(*io = winio_create_io()))
+  if(!USBI_SUCCESS(winio_init_io(io)))
     return USBI_STATUS_NOMEM;
     
   if(!DeviceIoControl(dev, code, write, write_size,
-                      read, read_size, NULL, *io)) {
+                      read, read_size, NULL, io)) {
     if(GetLastError() != ERROR_IO_PENDING) {
-      winio_free_io(*io);
       return USBI_STATUS_UNKNOWN;
     }
   }
   return USBI_STATUS_SUCCESS;
 }
 
-int winio_write_async(winio_device_t dev, void *data, int size, winio_io_t *io)
+int winio_write_async(winio_device_t dev, void *data, int size, winio_io_t io)
 {
   WINIO_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(io, io, USBI_STATUS_PARAM);
   USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
 
-  if(!(*io = winio_create_io()))
+  if(!USBI_SUCCESS(winio_init_io(io)))
     return USBI_STATUS_NOMEM;
     
-  if(!WriteFile(dev, data, size, NULL, *io)) {
+  if(!WriteFile(dev, data, size, NULL, io)) {
     if(GetLastError() != ERROR_IO_PENDING) {
-      winio_free_io(*io);
       return USBI_STATUS_UNKNOWN;
     }
   }
   return USBI_STATUS_SUCCESS;
 }
 
-int winio_read_async(winio_device_t dev, void *data, int size, winio_io_t *io)
+int winio_read_async(winio_device_t dev, void *data, int size, winio_io_t io)
 {
   WINIO_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(io, io, USBI_STATUS_PARAM);
   USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
 
-  if(!(*io = winio_create_io()))
+  if(!USBI_SUCCESS(winio_init_io(io)))
     return USBI_STATUS_NOMEM;
 
-  if(!ReadFile(dev, data, size, NULL, *io)) {
+  if(!ReadFile(dev, data, size, NULL, io)) {
     if(GetLastError() != ERROR_IO_PENDING) {
-      winio_free_io(*io);
       return USBI_STATUS_UNKNOWN;
     }
   }
@@ -186,44 +186,50 @@ int winio_ioctl_sync(winio_device_t dev, unsigned int code,
                      void *write, int write_size, void *read, int read_size, 
                      int timeout)
 {
-  winio_io_t io;
+  OVERLAPPED io;
   int ret;
 
   WINIO_DEBUG_ASSERT_DEV(dev);
+  memset(&io, 0, sizeof(io));
 
   ret = winio_ioctl_async(dev, code, write, write_size, read, read_size, &io);
-  if(!USBI_SUCCESS(ret))
-    return ret;
-  return winio_wait(dev, io, timeout);
+  if(USBI_SUCCESS(ret))
+    ret = winio_wait(dev, &io, timeout);
+  winio_deinit_io(&io);
+  return ret;
 }
 
 
 int winio_write_sync(winio_device_t dev, void *data, int size, int timeout)
 {
-  winio_io_t io;
+  OVERLAPPED io;
   int ret;
 
   WINIO_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
+  memset(&io, 0, sizeof(io));
 
   ret = winio_write_async(dev, data, size, &io);
-  if(!USBI_SUCCESS(ret))
-    return ret;
-  return winio_wait(dev, io, timeout);
+  if(USBI_SUCCESS(ret))
+    ret = winio_wait(dev, &io, timeout);
+  winio_deinit_io(&io);
+  return ret;
 }
 
 int winio_read_sync(winio_device_t dev, void *data, int size, int timeout)
 {
-  winio_io_t io;
+  OVERLAPPED io;
   int ret;
 
   WINIO_DEBUG_ASSERT_DEV(dev);
   USBI_DEBUG_ASSERT_PARAM(data, data, USBI_STATUS_PARAM);
+  memset(&io, 0, sizeof(io));
 
   ret = winio_read_async(dev, data, size, &io);
-  if(!USBI_SUCCESS(ret))
-    return ret;
-  return winio_wait(dev, io, timeout);
+  if(USBI_SUCCESS(ret))
+    ret = winio_wait(dev, &io, timeout);
+  winio_deinit_io(&io);
+  return ret;
 }
 
 int winio_wait(winio_device_t dev, winio_io_t io, int timeout)
@@ -240,13 +246,11 @@ int winio_wait(winio_device_t dev, winio_io_t io, int timeout)
       ret = (int)t;
     else
       ret = USBI_STATUS_UNKNOWN;
-    winio_free_io(io);
     return ret;
   case WAIT_TIMEOUT:
     winio_cancel(dev, io);
     return USBI_STATUS_TIMEOUT;
   default:
-    winio_free_io(io);
     return USBI_STATUS_UNKNOWN;
   }
 }
@@ -269,7 +273,6 @@ int winio_cancel(winio_device_t dev, winio_io_t io)
   CancelIo(dev);
   /* wait until the request is completed */
   WaitForSingleObject(io->hEvent, INFINITE);
-  winio_free_io(io);
   
   return USBI_STATUS_SUCCESS;
 }
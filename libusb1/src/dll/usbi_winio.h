@@ -19,15 +19,16 @@ int winio_write_sync(winio_device_t dev, void *data, int size, int timeout);
 int winio_read_sync(winio_device_t dev, void *data, int size, int timeout);
 int winio_ioctl_async(winio_device_t dev, unsigned int code, 
                       void *write, int write_size, void *read, int read_size,
-                      winio_io_t *io);
+                      winio_io_t io);
 int winio_write_async(winio_device_t dev, void *data, int size,
-                      winio_io_t *io);                      
+                      winio_io_t io);                      
 int winio_read_async(winio_device_t dev, void *data, int size,
-                     winio_io_t *io);
+                     winio_io_t io);
 int winio_wait(winio_device_t dev, winio_io_t io, int timeout);
 int winio_poll(winio_device_t dev, winio_io_t io);
 int winio_cancel(winio_device_t dev, winio_io_t io);
-winio_io_t winio_create_io(void);
-void winio_free_io(winio_io_t io);
+int winio_init_io(winio_io_t io);
+void winio_deinit_io(winio_io_t io);
+HANDLE winio_get_event(winio_io_t io);
 
 #endif
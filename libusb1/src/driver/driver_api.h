@@ -99,8 +99,28 @@ enum {
 #define LIBUSB_IOCTL_RELEASE_INTERFACE CTL_CODE(FILE_DEVICE_UNKNOWN,\
 0x816, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+/* isochronous read or write (by endpoint direction) that also returns */
+/* the result of every packet, implemented by libusb0.sys only */
+#define LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX CTL_CODE(FILE_DEVICE_UNKNOWN,\
+0x819, METHOD_OUT_DIRECT, FILE_ANY_ACCESS)
+
 #include <pshpack1.h> 
 
+/* The transfer buffer of LIBUSB_IOCTL_ISOCHRONOUS_TRANSFER_EX holds the */
+/* packet data, followed by one libusb_iso_packet_result_t per packet and */
+/* a libusb_iso_transfer_info_t. The caller sets packet_count. */
+typedef struct {
+  unsigned int offset;
+  unsigned int length;
+  unsigned int status;
+} libusb_iso_packet_result_t;
+
+typedef struct {
+  unsigned int packet_count;
+  unsigned int start_frame;
+  unsigned int error_count;
+} libusb_iso_transfer_info_t;
+
 
 typedef struct {
   unsigned int timeout;
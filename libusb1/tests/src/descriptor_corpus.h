@@ -0,0 +1,124 @@
+#ifndef __DESCRIPTOR_CORPUS_H__
+#define __DESCRIPTOR_CORPUS_H__
+
+/* configuration descriptors the descriptor parser is tested and fuzzed */
+/* with, wTotalLength always matches the size of the blob */
+
+#define CORPUS_LE16(w) ((w) & 0xFF), (((w) >> 8) & 0xFF)
+
+#define CORPUS_CONFIG(total, num_interfaces) \
+  9, 0x02, CORPUS_LE16(total), num_interfaces, 0x01, 0x00, 0x80, 0x32
+
+#define CORPUS_INTERFACE(num, alt, num_endpoints, cls, sub, proto) \
+  9, 0x04, num, alt, num_endpoints, cls, sub, proto, 0x00
+
+#define CORPUS_ENDPOINT(address, attr, size, interval) \
+  7, 0x05, address, attr, CORPUS_LE16(size), interval
+
+#define CORPUS_AUDIO_ENDPOINT(address, attr, size, interval, refresh, synch) \
+  9, 0x05, address, attr, CORPUS_LE16(size), interval, refresh, synch
+
+
+/* the vendor class configuration of the test firmware */
+static const unsigned char corpus_firmware[] = {
+  CORPUS_CONFIG(147, 2),
+  CORPUS_INTERFACE(0, 0, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x82, 0x02, 64, 0),
+  CORPUS_ENDPOINT(0x04, 0x02, 64, 0),
+  CORPUS_INTERFACE(0, 1, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x82, 0x03, 64, 1),
+  CORPUS_ENDPOINT(0x04, 0x03, 64, 1),
+  CORPUS_INTERFACE(0, 2, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x82, 0x01, 64, 1),
+  CORPUS_ENDPOINT(0x04, 0x01, 64, 1),
+  CORPUS_INTERFACE(1, 0, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x86, 0x02, 64, 0),
+  CORPUS_ENDPOINT(0x08, 0x02, 64, 0),
+  CORPUS_INTERFACE(1, 1, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x86, 0x03, 64, 1),
+  CORPUS_ENDPOINT(0x08, 0x03, 64, 1),
+  CORPUS_INTERFACE(1, 2, 2, 0xFF, 0xFF, 0xFF),
+  CORPUS_ENDPOINT(0x86, 0x01, 64, 1),
+  CORPUS_ENDPOINT(0x08, 0x01, 64, 1)
+};
+
+/* the HID configuration of the test firmware */
+static const unsigned char corpus_hid[] = {
+  CORPUS_CONFIG(41, 1),
+  CORPUS_INTERFACE(0, 0, 2, 0x03, 0x00, 0x00),
+  /* HID descriptor, one report descriptor of 43 bytes */
+  9, 0x21, CORPUS_LE16(0x0110), 0x00, 0x01, 0x22, CORPUS_LE16(43),
+  CORPUS_ENDPOINT(0x82, 0x03, 64, 10),
+  CORPUS_ENDPOINT(0x04, 0x03, 64, 10)
+};
+
+/* a bulk-only mass storage device */
+static const unsigned char corpus_storage[] = {
+  CORPUS_CONFIG(32, 1),
+  CORPUS_INTERFACE(0, 0, 2, 0x08, 0x06, 0x50),
+  CORPUS_ENDPOINT(0x81, 0x02, 512, 0),
+  CORPUS_ENDPOINT(0x02, 0x02, 512, 0)
+};
+
+/* a USB audio 1.0 speaker: a control interface with class specific */
+/* descriptors, a streaming interface with an idle alternate setting and */
+/* an isochronous audio endpoint followed by its class specific one */
+static const unsigned char corpus_audio[] = {
+  CORPUS_CONFIG(100, 2),
+  CORPUS_INTERFACE(0, 0, 0, 0x01, 0x01, 0x00),
+  /* header, input terminal, output terminal */
+  9, 0x24, 0x01, CORPUS_LE16(0x0100), CORPUS_LE16(30), 0x01, 0x01,
+  12, 0x24, 0x02, 0x01, CORPUS_LE16(0x0101), 0x00, 0x02,
+  CORPUS_LE16(0x0003), 0x00, 0x00,
+  9, 0x24, 0x03, 0x02, CORPUS_LE16(0x0301), 0x00, 0x01, 0x00,
+  CORPUS_INTERFACE(1, 0, 0, 0x01, 0x02, 0x00),
+  CORPUS_INTERFACE(1, 1, 1, 0x01, 0x02, 0x00),
+  /* general, format type I, 2 channels, 16 bit, 44.1 kHz */
+  7, 0x24, 0x01, 0x01, 0x01, CORPUS_LE16(0x0001),
+  11, 0x24, 0x02, 0x01, 0x02, 0x02, 0x10, 0x01, 0x44, 0xAC, 0x00,
+  CORPUS_AUDIO_ENDPOINT(0x01, 0x09, 192, 1, 0, 0),
+  7, 0x25, 0x01, 0x00, 0x00, CORPUS_LE16(0)
+};
+
+/* a video camera: an interface association in front of the interfaces, */
+/* class specific interface and endpoint descriptors, and isochronous */
+/* alternate settings of growing bandwidth */
+static const unsigned char corpus_video[] = {
+  CORPUS_CONFIG(132, 2),
+  /* interface association of interfaces 0 and 1 */
+  8, 0x0B, 0x00, 0x02, 0x0E, 0x03, 0x00, 0x00,
+  CORPUS_INTERFACE(0, 0, 1, 0x0E, 0x01, 0x00),
+  /* video control header, camera terminal, output terminal */
+  13, 0x24, 0x01, CORPUS_LE16(0x0100), CORPUS_LE16(39),
+  0x80, 0x8D, 0x5B, 0x00, 0x01, 0x01,
+  17, 0x24, 0x02, 0x01, CORPUS_LE16(0x0201), 0x00, 0x00,
+  CORPUS_LE16(0), CORPUS_LE16(0), CORPUS_LE16(0), 0x02, 0x0E, 0x00,
+  9, 0x24, 0x03, 0x02, CORPUS_LE16(0x0101), 0x00, 0x01, 0x00,
+  CORPUS_ENDPOINT(0x83, 0x03, 16, 6),
+  /* class specific interrupt endpoint */
+  5, 0x25, 0x03, CORPUS_LE16(16),
+  CORPUS_INTERFACE(1, 0, 0, 0x0E, 0x02, 0x00),
+  /* video streaming input header */
+  14, 0x24, 0x01, 0x01, CORPUS_LE16(14), 0x81, 0x00, 0x02,
+  0x00, 0x00, 0x00, 0x01, 0x00,
+  CORPUS_INTERFACE(1, 1, 1, 0x0E, 0x02, 0x00),
+  CORPUS_ENDPOINT(0x81, 0x05, 0x0200, 1),
+  CORPUS_INTERFACE(1, 2, 1, 0x0E, 0x02, 0x00),
+  CORPUS_ENDPOINT(0x81, 0x05, 0x0C00, 1)
+};
+
+static const struct {
+  const char *name;
+  const unsigned char *data;
+  int size;
+} corpus[] = {
+  { "firmware", corpus_firmware, sizeof(corpus_firmware) },
+  { "hid", corpus_hid, sizeof(corpus_hid) },
+  { "storage", corpus_storage, sizeof(corpus_storage) },
+  { "audio", corpus_audio, sizeof(corpus_audio) },
+  { "video", corpus_video, sizeof(corpus_video) }
+};
+
+#define CORPUS_SIZE ((int)(sizeof(corpus) / sizeof(corpus[0])))
+
+#endif
@@ -0,0 +1,463 @@
+/* tests and fuzzes the configuration descriptor parser of libusb0 and */
+/* checks its descriptor decoders, builds and runs on any host; */
+/* DESCRIPTORS_TEST_BLOB names a file of configuration descriptors (back */
+/* to back, as read from devices) to test in addition to the built in */
+/* ones, DESCRIPTORS_TEST_ITERATIONS sets the fuzz rounds */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int allocations;
+
+static void *test_malloc(size_t size)
+{
+  allocations++;
+  return malloc(size);
+}
+
+/* the parser's allocations are counted */
+#define malloc test_malloc
+#include "descriptors.c"
+#undef malloc
+
+#include "descriptor_corpus.h"
+#include "unit.h"
+
+#define TEST_FUZZ_ITERATIONS 200000
+#define TEST_BENCH_PARSES 200000
+#define TEST_DECODER_ROUNDS 10000
+#define TEST_BENCH_DECODES 2000000
+
+#define TEST_MAX_BLOBS 256
+
+int usb_debug = 0;
+
+typedef struct {
+  const unsigned char *data;
+  int size;
+} test_blob_t;
+
+static test_blob_t blobs[TEST_MAX_BLOBS];
+static int num_blobs;
+
+/* the configurations usb_control_msg() hands out */
+static test_blob_t *device_configs;
+static int num_device_configs;
+static int device_bytes;
+
+static unsigned int seed = 0x1234567;
+
+
+int usb_control_msg(usb_dev_handle *dev, int requesttype, int request,
+                    int value, int index, char *bytes, int size,
+                    int timeout)
+{
+  int i = value & 0xFF;
+
+  if(request != USB_REQ_GET_DESCRIPTOR || (value >> 8) != USB_DT_CONFIG
+     || i >= num_device_configs)
+    return -EINVAL;
+  if(size > device_configs[i].size)
+    size = device_configs[i].size;
+  memcpy(bytes, device_configs[i].data, size);
+  device_bytes += size;
+  return size;
+}
+
+static unsigned int test_random(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+/* parses a copy of exactly the given size, as the library reads it */
+static int test_parse(struct usb_config_descriptor *config,
+                      const unsigned char *data, int size)
+{
+  unsigned char *buffer;
+  int result;
+
+  buffer = malloc(size);
+  memcpy(buffer, data, size);
+  buffer[2] = (unsigned char)size;
+  buffer[3] = (unsigned char)(size >> 8);
+  memset(config, 0, sizeof(*config));
+  result = usb_parse_configuration(config, buffer);
+  free(buffer);
+  return result;
+}
+
+/* reads everything the tree points to, so the address sanitizer sees */
+/* every access an application could make */
+static int test_walk(struct usb_config_descriptor *config)
+{
+  struct usb_interface *interface;
+  struct usb_interface_descriptor *altsetting;
+  struct usb_endpoint_descriptor *endpoint;
+  int i, j, k, n, sum = 0;
+
+  for(n = 0; n < config->extralen; n++)
+    sum += config->extra[n];
+  if(!config->interface)
+    return sum;
+  for(i = 0; i < config->bNumInterfaces; i++) {
+    interface = config->interface + i;
+    if(!interface->altsetting)
+      continue;
+    for(j = 0; j < interface->num_altsetting; j++) {
+      altsetting = interface->altsetting + j;
+      sum += altsetting->bInterfaceNumber;
+      for(n = 0; n < altsetting->extralen; n++)
+        sum += altsetting->extra[n];
+      if(!altsetting->endpoint)
+        continue;
+      for(k = 0; k < altsetting->bNumEndpoints; k++) {
+        endpoint = altsetting->endpoint + k;
+        sum += endpoint->bEndpointAddress;
+        for(n = 0; n < endpoint->extralen; n++)
+          sum += endpoint->extra[n];
+      }
+    }
+  }
+  return sum;
+}
+
+static int test_fuzz(const unsigned char *data, int size, int iterations)
+{
+  struct usb_config_descriptor config;
+  unsigned char *buffer;
+  int i, j, length, sum = 0;
+
+  buffer = malloc(size);
+  for(i = 0; i < iterations; i++) {
+    memcpy(buffer, data, size);
+    for(j = test_random() % 4; j >= 0; j--)
+      buffer[test_random() % size] ^= (unsigned char)(1 << (test_random() % 8));
+    if(test_random() % 4)
+      buffer[test_random() % size] = (unsigned char)test_random();
+    length = USB_DT_CONFIG_SIZE
+      + (int)(test_random() % (size - USB_DT_CONFIG_SIZE + 1));
+    test_parse(&config, buffer, length);
+    sum += test_walk(&config);
+    free(config.interface);
+  }
+  free(buffer);
+  return sum;
+}
+
+/* a fixed layout decoder against usb_parse_descriptor() with its format */
+#define TEST_DECODER(decoder, format, type)                             \
+  static int test_##decoder(unsigned char *source)                     \
+  {                                                                     \
+    type fixed, interpreted;                                            \
+                                                                        \
+    memset(&fixed, 0, sizeof(fixed));                                   \
+    memset(&interpreted, 0, sizeof(interpreted));                       \
+    return usb_parse_##decoder(source, &fixed)                          \
+      == usb_parse_descriptor(source, format, &interpreted)             \
+      && !memcmp(&fixed, &interpreted, sizeof(fixed));                  \
+  }
+
+TEST_DECODER(header, "bb", struct usb_descriptor_header)
+TEST_DECODER(device_descriptor, "bbwbbbbwwwbbbb", struct usb_device_descriptor)
+TEST_DECODER(config_descriptor, "bbwbbbbb", struct usb_config_descriptor)
+TEST_DECODER(interface_descriptor, "bbbbbbbbb",
+             struct usb_interface_descriptor)
+
+static int test_endpoint_descriptor(unsigned char *source)
+{
+  struct usb_endpoint_descriptor fixed, interpreted;
+
+  memset(&fixed, 0, sizeof(fixed));
+  memset(&interpreted, 0, sizeof(interpreted));
+  return usb_parse_endpoint_descriptor(source, &fixed)
+    == usb_parse_descriptor(source, source[0] >= ENDPOINT_AUDIO_DESC_LENGTH
+                            ? "bbbbwbbb" : "bbbbwb", &interpreted)
+    && !memcmp(&fixed, &interpreted, sizeof(fixed));
+}
+
+/* splits a file of back to back configuration descriptors */
+static void test_load_blobs(const char *path)
+{
+  static unsigned char data[USB_DESC_CACHE_MAX_SIZE];
+  FILE *file;
+  int size, total, offset = 0;
+
+  file = fopen(path, "rb");
+  if(!file) {
+    TEST_PRINT("  unable to open %s\n", path);
+    return;
+  }
+  size = (int)fread(data, 1, sizeof(data), file);
+  fclose(file);
+
+  while(size - offset >= USB_DT_CONFIG_SIZE && num_blobs < TEST_MAX_BLOBS) {
+    total = USB_LE16(data + offset + 2);
+    if(total < USB_DT_CONFIG_SIZE || total > size - offset)
+      break;
+    blobs[num_blobs].data = data + offset;
+    blobs[num_blobs].size = total;
+    num_blobs++;
+    offset += total;
+  }
+  TEST_PRINT("  %d configurations from %s\n", num_blobs - CORPUS_SIZE, path);
+}
+
+
+TEST_SUITE_BEGIN(descriptors);
+struct usb_config_descriptor config;
+struct usb_interface_descriptor *altsetting;
+struct usb_endpoint_descriptor *endpoint;
+struct usb_device device;
+struct usb_dev_handle handle;
+test_blob_t configs[2];
+unsigned char hid[sizeof(corpus_hid)];
+clock_t start;
+double parse_time;
+volatile int sink = 0;
+int i, n, ok, iterations;
+
+for(i = 0; i < CORPUS_SIZE; i++) {
+  blobs[i].data = corpus[i].data;
+  blobs[i].size = corpus[i].size;
+}
+num_blobs = CORPUS_SIZE;
+if(getenv("DESCRIPTORS_TEST_BLOB"))
+  test_load_blobs(getenv("DESCRIPTORS_TEST_BLOB"));
+iterations = TEST_FUZZ_ITERATIONS;
+if(getenv("DESCRIPTORS_TEST_ITERATIONS"))
+  iterations = atoi(getenv("DESCRIPTORS_TEST_ITERATIONS"));
+
+TEST_BEGIN(corpus);
+for(i = 0, ok = 1; i < CORPUS_SIZE; i++)
+  ok &= USB_LE16(corpus[i].data + 2) == corpus[i].size;
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(firmware);
+TEST_ASSERT(test_parse(&config, corpus_firmware,
+                       sizeof(corpus_firmware)) == 0);
+TEST_ASSERT(config.bNumInterfaces == 2);
+TEST_ASSERT(config.interface[0].num_altsetting == 3);
+TEST_ASSERT(config.interface[1].num_altsetting == 3);
+altsetting = config.interface[1].altsetting + 2;
+TEST_ASSERT(altsetting->bInterfaceNumber == 1);
+TEST_ASSERT(altsetting->bAlternateSetting == 2);
+TEST_ASSERT(altsetting->bNumEndpoints == 2);
+TEST_ASSERT(altsetting->endpoint[0].bEndpointAddress == 0x86);
+TEST_ASSERT(altsetting->endpoint[1].bEndpointAddress == 0x08);
+TEST_ASSERT(altsetting->endpoint[1].bmAttributes == 0x01);
+TEST_ASSERT(altsetting->endpoint[1].wMaxPacketSize == 64);
+TEST_ASSERT(!altsetting->extralen && !altsetting->endpoint[1].extralen);
+free(config.interface);
+TEST_END();
+
+TEST_BEGIN(hid);
+TEST_ASSERT(test_parse(&config, corpus_hid, sizeof(corpus_hid)) == 0);
+altsetting = config.interface[0].altsetting;
+TEST_ASSERT(altsetting->extralen == 9);
+TEST_ASSERT(altsetting->extra[1] == 0x21);
+TEST_ASSERT(altsetting->endpoint[0].bInterval == 10);
+free(config.interface);
+TEST_END();
+
+TEST_BEGIN(audio);
+TEST_ASSERT(test_parse(&config, corpus_audio, sizeof(corpus_audio)) == 0);
+TEST_ASSERT(config.interface[0].altsetting->extralen == 30);
+TEST_ASSERT(config.interface[1].num_altsetting == 2);
+altsetting = config.interface[1].altsetting + 1;
+TEST_ASSERT(altsetting->extralen == 18);
+endpoint = altsetting->endpoint;
+TEST_ASSERT(endpoint->bLength == 9);
+TEST_ASSERT(endpoint->wMaxPacketSize == 192);
+TEST_ASSERT(endpoint->extralen == 7);
+TEST_ASSERT(endpoint->extra[1] == 0x25);
+free(config.interface);
+TEST_END();
+
+TEST_BEGIN(video);
+TEST_ASSERT(test_parse(&config, corpus_video, sizeof(corpus_video)) == 0);
+/* the interface association ends up in front of the interfaces */
+TEST_ASSERT(config.extralen == 8 && config.extra[1] == 0x0B);
+TEST_ASSERT(config.interface[0].altsetting->extralen == 39);
+TEST_ASSERT(config.interface[0].altsetting->endpoint->extralen == 5);
+TEST_ASSERT(config.interface[1].num_altsetting == 3);
+TEST_ASSERT(config.interface[1].altsetting->extralen == 14);
+endpoint = config.interface[1].altsetting[2].endpoint;
+TEST_ASSERT(endpoint->wMaxPacketSize == 0x0C00);
+free(config.interface);
+TEST_END();
+
+TEST_BEGIN(one_allocation);
+for(i = 0, ok = 1; i < num_blobs; i++) {
+  allocations = 0;
+  memset(&config, 0, sizeof(config));
+  usb_parse_configuration(&config, (unsigned char *)blobs[i].data);
+  ok &= allocations == 1;
+  free(config.interface);
+}
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(truncated);
+/* every length the callers let through, the parser must stay inside */
+for(i = 0; i < num_blobs; i++) {
+  for(n = USB_DT_CONFIG_SIZE; n < blobs[i].size; n++) {
+    test_parse(&config, blobs[i].data, n);
+    sink += test_walk(&config);
+    free(config.interface);
+  }
+}
+TEST_END();
+
+TEST_BEGIN(fuzz);
+for(i = 0; i < num_blobs; i++)
+  sink += test_fuzz(blobs[i].data, blobs[i].size, iterations / num_blobs);
+TEST_END();
+
+TEST_BEGIN(fetch);
+/* the path usb_os_find_devices() takes on a cache miss */
+memset(&device, 0, sizeof(device));
+memset(&handle, 0, sizeof(handle));
+handle.device = &device;
+strcpy(device.filename, "\\\\.\\libusb0-0001");
+device.descriptor.bNumConfigurations = 2;
+configs[0].data = corpus_firmware;
+configs[0].size = sizeof(corpus_firmware);
+configs[1].data = corpus_audio;
+configs[1].size = sizeof(corpus_audio);
+device_configs = configs;
+num_device_configs = 2;
+usb_fetch_and_parse_descriptors(&handle);
+TEST_ASSERT(device.config != NULL);
+TEST_ASSERT(device.config[0].wTotalLength == sizeof(corpus_firmware));
+TEST_ASSERT(device.config[1].interface[1].num_altsetting == 2);
+usb_destroy_configuration(&device);
+/* a device that sends less than it announces gets no configurations */
+configs[1].size = sizeof(corpus_audio) - 1;
+usb_fetch_and_parse_descriptors(&handle);
+TEST_ASSERT(device.config == NULL);
+TEST_END();
+
+TEST_BEGIN(cache);
+/* the first fetch above cached both configurations under the node name, */
+/* a hit only reads their headers */
+configs[1].size = sizeof(corpus_audio);
+device_bytes = 0;
+TEST_ASSERT(usb_desc_cache_fetch(&handle) == 0);
+TEST_ASSERT(device_bytes == 2 * USB_DT_CONFIG_SIZE);
+TEST_ASSERT(device.config[1].interface[1].num_altsetting == 2);
+usb_destroy_configuration(&device);
+device.config = NULL;
+/* another device with the same device descriptor replugged on the node */
+configs[1].data = corpus_hid;
+configs[1].size = sizeof(corpus_hid);
+TEST_ASSERT(usb_desc_cache_fetch(&handle) == -ENOENT);
+TEST_ASSERT(device.config == NULL);
+TEST_ASSERT(usb_desc_cache_fetch(&handle) == -ENOENT);
+usb_fetch_and_parse_descriptors(&handle);
+TEST_ASSERT(device.config[1].wTotalLength == sizeof(corpus_hid));
+usb_destroy_configuration(&device);
+device.config = NULL;
+/* the same wTotalLength but a different header */
+memcpy(hid, corpus_hid, sizeof(hid));
+hid[8] = 0xFA;
+configs[1].data = hid;
+TEST_ASSERT(usb_desc_cache_fetch(&handle) == -ENOENT);
+usb_fetch_and_parse_descriptors(&handle);
+TEST_ASSERT(device.config[1].MaxPower == 0xFA);
+usb_destroy_configuration(&device);
+device.config = NULL;
+device_bytes = 0;
+TEST_ASSERT(usb_desc_cache_fetch(&handle) == 0);
+TEST_ASSERT(device_bytes == 2 * USB_DT_CONFIG_SIZE);
+TEST_ASSERT(device.config[1].MaxPower == 0xFA);
+usb_destroy_configuration(&device);
+device.config = NULL;
+TEST_END();
+
+TEST_BEGIN(benchmark);
+start = clock();
+for(i = 0; i < TEST_BENCH_PARSES; i++) {
+  memset(&config, 0, sizeof(config));
+  usb_parse_configuration(&config, (unsigned char *)corpus_video);
+  sink += config.interface[1].num_altsetting;
+  free(config.interface);
+}
+parse_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+TEST_ASSERT(sink);
+TEST_END();
+TEST_PRINT("  parse of the video configuration: %.1f ns\n",
+           parse_time * 1e9 / TEST_BENCH_PARSES);
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN(decoders);
+unsigned char source[DEVICE_DESC_LENGTH];
+struct usb_device_descriptor descriptor;
+clock_t start;
+double fixed_time, interpreted_time;
+volatile int sink = 0;
+int i, j, ok;
+
+TEST_BEGIN(match_format);
+for(i = 0, ok = 1; i < TEST_DECODER_ROUNDS; i++) {
+  for(j = 0; j < DEVICE_DESC_LENGTH; j++)
+    source[j] = (unsigned char)test_random();
+  /* both endpoint layouts */
+  source[0] = (unsigned char)(i & 1 ? ENDPOINT_AUDIO_DESC_LENGTH
+                              : ENDPOINT_DESC_LENGTH);
+  ok &= test_header(source);
+  ok &= test_device_descriptor(source);
+  ok &= test_config_descriptor(source);
+  ok &= test_interface_descriptor(source);
+  ok &= test_endpoint_descriptor(source);
+}
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(little_endian);
+memset(source, 0, sizeof(source));
+source[2] = 0x10;
+source[3] = 0x02;
+source[8] = 0x2B;
+source[9] = 0x08;
+usb_parse_device_descriptor(source, &descriptor);
+TEST_ASSERT(descriptor.bcdUSB == 0x0210);
+TEST_ASSERT(descriptor.idVendor == 0x082B);
+TEST_END();
+
+TEST_BEGIN(benchmark);
+for(j = 0; j < DEVICE_DESC_LENGTH; j++)
+  source[j] = (unsigned char)j;
+start = clock();
+for(i = 0; i < TEST_BENCH_DECODES; i++) {
+  source[17] = (unsigned char)i;
+  usb_parse_device_descriptor(source, &descriptor);
+  sink += descriptor.bNumConfigurations;
+}
+fixed_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+start = clock();
+for(i = 0; i < TEST_BENCH_DECODES; i++) {
+  source[17] = (unsigned char)i;
+  usb_parse_descriptor(source, "bbwbbbbwwwbbbb", &descriptor);
+  sink += descriptor.bNumConfigurations;
+}
+interpreted_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+TEST_ASSERT(sink);
+TEST_END();
+TEST_PRINT("  device descriptor: fixed %.1f ns, format string %.1f ns\n",
+           fixed_time * 1e9 / TEST_BENCH_DECODES,
+           interpreted_time * 1e9 / TEST_BENCH_DECODES);
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(descriptors);
+TEST_SUITE_DEFINE(decoders);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(descriptors);
+TEST_SUITE_RUN(decoders);
+TEST_MAIN_END();
@@ -0,0 +1,168 @@
+/* tests the descriptor tree of the libusb0 API, from the built in */
+/* configurations and from the loopback backend, no device needed */
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "dll_api_v0.c"
+#include "usbi_backend_loopback.h"
+#include "descriptor_corpus.h"
+#include "unit.h"
+
+
+static void test_free(struct usb_interface *interface, int num_interfaces)
+{
+  int i, a;
+
+  if(!interface)
+    return;
+  for(i = 0; i < num_interfaces; i++) {
+    if(!interface[i].altsetting)
+      continue;
+    for(a = 0; a < interface[i].num_altsetting; a++)
+      free(interface[i].altsetting[a].endpoint);
+    free(interface[i].altsetting);
+  }
+  free(interface);
+}
+
+/* parses a copy of exactly the given size, as the usbi cache holds it */
+static struct usb_interface *test_parse(const unsigned char *data, int size)
+{
+  struct usb_interface *interface;
+  uint8_t *desc;
+
+  desc = malloc(size);
+  memcpy(desc, data, size);
+  interface = _usb_parse_interfaces(desc, size, desc[4]);
+  free(desc);
+  return interface;
+}
+
+/* reads everything the tree points to, so the address sanitizer sees */
+/* every access an application could make */
+static int test_walk(struct usb_interface *interface, int num_interfaces)
+{
+  struct usb_interface_descriptor *alt;
+  int i, a, e, sum = 0;
+
+  if(!interface)
+    return 0;
+  for(i = 0; i < num_interfaces; i++) {
+    for(a = 0; a < interface[i].num_altsetting; a++) {
+      alt = interface[i].altsetting + a;
+      sum += alt->bInterfaceNumber;
+      if(!alt->endpoint)
+        continue;
+      for(e = 0; e < alt->bNumEndpoints; e++)
+        sum += alt->endpoint[e].bEndpointAddress;
+    }
+  }
+  return sum;
+}
+
+
+TEST_SUITE_BEGIN(parse_interfaces);
+struct usb_interface *interface;
+struct usb_interface_descriptor *alt;
+unsigned char audio[sizeof(corpus_audio)];
+volatile int sink = 0;
+int i, n;
+
+TEST_BEGIN(firmware);
+interface = test_parse(corpus_firmware, sizeof(corpus_firmware));
+TEST_ASSERT(interface != NULL);
+TEST_ASSERT(interface[0].num_altsetting == 3);
+TEST_ASSERT(interface[1].num_altsetting == 3);
+alt = interface[1].altsetting + 2;
+TEST_ASSERT(alt->bInterfaceNumber == 1 && alt->bAlternateSetting == 2);
+TEST_ASSERT(alt->bNumEndpoints == 2);
+TEST_ASSERT(alt->endpoint[0].bEndpointAddress == 0x86);
+TEST_ASSERT(alt->endpoint[1].bEndpointAddress == 0x08);
+TEST_ASSERT(alt->endpoint[1].wMaxPacketSize == 64);
+test_free(interface, 2);
+TEST_END();
+
+TEST_BEGIN(class_descriptors);
+/* class specific descriptors between the standard ones are skipped */
+interface = test_parse(corpus_hid, sizeof(corpus_hid));
+TEST_ASSERT(interface[0].num_altsetting == 1);
+TEST_ASSERT(interface[0].altsetting->endpoint[0].bEndpointAddress == 0x82);
+TEST_ASSERT(interface[0].altsetting->endpoint[1].bEndpointAddress == 0x04);
+test_free(interface, 1);
+interface = test_parse(corpus_video, sizeof(corpus_video));
+TEST_ASSERT(interface[0].num_altsetting == 1);
+TEST_ASSERT(interface[0].altsetting->endpoint[0].bEndpointAddress == 0x83);
+TEST_ASSERT(interface[1].num_altsetting == 3);
+TEST_ASSERT(interface[1].altsetting[2].endpoint[0].wMaxPacketSize == 0x0C00);
+test_free(interface, 2);
+TEST_END();
+
+TEST_BEGIN(audio_endpoint);
+/* bRefresh and bSynchAddress of the 9 byte endpoint are kept, they are */
+/* the two bytes in front of the class specific endpoint descriptor */
+memcpy(audio, corpus_audio, sizeof(audio));
+audio[sizeof(audio) - 9] = 3;
+audio[sizeof(audio) - 8] = 0x82;
+interface = test_parse(audio, sizeof(audio));
+TEST_ASSERT(interface[1].num_altsetting == 2);
+TEST_ASSERT(interface[1].altsetting[0].endpoint == NULL);
+alt = interface[1].altsetting + 1;
+TEST_ASSERT(alt->endpoint[0].bLength == USB_DT_ENDPOINT_AUDIO_SIZE);
+TEST_ASSERT(alt->endpoint[0].bmAttributes == 0x09);
+TEST_ASSERT(alt->endpoint[0].wMaxPacketSize == 192);
+TEST_ASSERT(alt->endpoint[0].bRefresh == 3);
+TEST_ASSERT(alt->endpoint[0].bSynchAddress == 0x82);
+test_free(interface, 2);
+TEST_END();
+
+TEST_BEGIN(truncated);
+/* every size the cache can hand out, the walk must stay inside */
+for(i = 0; i < CORPUS_SIZE; i++) {
+  for(n = USB_DT_CONFIG_SIZE; n < corpus[i].size; n++) {
+    interface = test_parse(corpus[i].data, n);
+    sink += test_walk(interface, corpus[i].data[4]);
+    test_free(interface, corpus[i].data[4]);
+  }
+}
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN(find_devices);
+struct usb_device *dev;
+struct usb_interface_descriptor *alt;
+int i, ok;
+
+putenv("LIBUSB_LOOPBACK_DEVICES=1");
+putenv("LIBUSB_LOOPBACK_BENCHMARK=0");
+
+TEST_BEGIN(loopback);
+usb_init();
+TEST_ASSERT(usb_find_devices() == 0);
+dev = usb_get_busses()->devices;
+TEST_ASSERT(dev && !dev->next);
+TEST_ASSERT(dev->descriptor.bNumConfigurations == 1);
+TEST_ASSERT(dev->config && dev->config->bNumInterfaces == 1);
+TEST_ASSERT(dev->config->interface->num_altsetting == 1);
+alt = dev->config->interface->altsetting;
+TEST_ASSERT(alt->bNumEndpoints == 2 * LOOPBACK_NUM_PIPES);
+for(i = 0, ok = 1; i < alt->bNumEndpoints; i++)
+  ok &= alt->endpoint[i].bEndpointAddress
+    == ((i / 2 + 1) | (i & 1 ? USB_ENDPOINT_IN : 0));
+TEST_ASSERT(ok);
+/* a second scan frees and rebuilds the tree */
+TEST_ASSERT(usb_find_devices() == 0);
+TEST_ASSERT(usb_get_busses()->devices->config->interface->num_altsetting
+            == 1);
+_usb_deinit();
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(parse_interfaces);
+TEST_SUITE_DEFINE(find_devices);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(parse_interfaces);
+TEST_SUITE_RUN(find_devices);
+TEST_MAIN_END();
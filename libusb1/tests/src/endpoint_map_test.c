@@ -0,0 +1,201 @@
+/* tests the endpoint map of the libusb0 driver, builds and runs on any host */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "endpoint_map.h"
+#include "unit.h"
+
+/* same limits as the driver's pipe information */
+#define TEST_MAX_INTERFACES 32
+#define TEST_MAX_ENDPOINTS 32
+
+#define TEST_BENCH_LOOKUPS 2000000
+
+/* the parts of libusb_endpoint_t the lookups use */
+typedef struct {
+  void *handle;
+  int address;
+} test_endpoint_t;
+
+typedef struct {
+  int valid;
+  test_endpoint_t endpoints[TEST_MAX_ENDPOINTS];
+} test_interface_t;
+
+static test_interface_t interfaces[TEST_MAX_INTERFACES];
+static int exchanges;
+
+
+static void *test_exchange(void *volatile *entry, void *value)
+{
+  void *old = *entry;
+
+  *entry = value;
+  exchanges++;
+  return old;
+}
+
+/* the lookup the driver did before it had the map */
+static test_endpoint_t *test_scan(int address)
+{
+  int i, j;
+
+  for(i = 0; i < TEST_MAX_INTERFACES; i++) {
+    if(!interfaces[i].valid)
+      continue;
+    for(j = 0; j < TEST_MAX_ENDPOINTS; j++) {
+      if(interfaces[i].endpoints[j].handle
+         && interfaces[i].endpoints[j].address == address)
+        return &interfaces[i].endpoints[j];
+    }
+  }
+  return NULL;
+}
+
+/* what update_endpoint_map() in the driver does */
+static void test_build(endpoint_map_t map)
+{
+  endpoint_map_t tmp;
+  int i, j;
+
+  endpoint_map_clear(tmp);
+  for(i = 0; i < TEST_MAX_INTERFACES; i++) {
+    if(!interfaces[i].valid)
+      continue;
+    for(j = 0; j < TEST_MAX_ENDPOINTS; j++) {
+      if(interfaces[i].endpoints[j].handle)
+        endpoint_map_add(tmp, interfaces[i].endpoints[j].address,
+                         &interfaces[i].endpoints[j]);
+    }
+  }
+  endpoint_map_publish(map, tmp, test_exchange);
+}
+
+/* a composite device: 4 interfaces with a bulk pair and an interrupt */
+/* endpoint each, interface 3 reuses the addresses of interface 0 */
+static void test_configure(void)
+{
+  int i;
+
+  memset(interfaces, 0, sizeof(interfaces));
+  for(i = 0; i < 4; i++) {
+    interfaces[i].valid = 1;
+    interfaces[i].endpoints[0].address = 0x01 + (i % 3) * 2;
+    interfaces[i].endpoints[1].address = 0x81 + (i % 3) * 2;
+    interfaces[i].endpoints[2].address = 0x82 + (i % 3) * 2;
+    interfaces[i].endpoints[0].handle = (void *)(size_t)(0x100 + i * 4);
+    interfaces[i].endpoints[1].handle = (void *)(size_t)(0x101 + i * 4);
+    interfaces[i].endpoints[2].handle = (void *)(size_t)(0x102 + i * 4);
+  }
+}
+
+
+TEST_SUITE_BEGIN(endpoint_map);
+endpoint_map_t map;
+test_endpoint_t a, b;
+clock_t start;
+double map_time, scan_time;
+volatile size_t sink = 0;
+int i, ok;
+
+TEST_BEGIN(index);
+TEST_ASSERT(endpoint_map_index(0x00) == 0);
+TEST_ASSERT(endpoint_map_index(0x0F) == 15);
+TEST_ASSERT(endpoint_map_index(0x80) == 16);
+TEST_ASSERT(endpoint_map_index(0x81) == 17);
+TEST_ASSERT(endpoint_map_index(0x8F) == 31);
+TEST_ASSERT(endpoint_map_index(0x10) == -1);
+TEST_ASSERT(endpoint_map_index(0x40) == -1);
+TEST_ASSERT(endpoint_map_index(0x100) == -1);
+TEST_ASSERT(endpoint_map_index(-1) == -1);
+TEST_END();
+
+TEST_BEGIN(add_lookup);
+endpoint_map_clear(map);
+TEST_ASSERT(endpoint_map_add(map, 0x81, &a));
+TEST_ASSERT(!endpoint_map_add(map, 0x81, &b));
+TEST_ASSERT(endpoint_map_add(map, 0x01, &b));
+TEST_ASSERT(!endpoint_map_add(map, 0x91, &b));
+TEST_ASSERT(endpoint_map_lookup(map, 0x81) == &a);
+TEST_ASSERT(endpoint_map_lookup(map, 0x01) == &b);
+TEST_ASSERT(endpoint_map_lookup(map, 0x02) == NULL);
+/* 0x91 would alias 0x81 without the address check */
+TEST_ASSERT(endpoint_map_lookup(map, 0x91) == NULL);
+TEST_ASSERT(endpoint_map_lookup(map, 0x181) == NULL);
+TEST_END();
+
+TEST_BEGIN(publish);
+test_configure();
+endpoint_map_clear(map);
+exchanges = 0;
+test_build(map);
+TEST_ASSERT(exchanges == 9);
+/* an unchanged configuration stores nothing */
+exchanges = 0;
+test_build(map);
+TEST_ASSERT(exchanges == 0);
+/* the lowest interface wins an address */
+TEST_ASSERT(endpoint_map_lookup(map, 0x01) == &interfaces[0].endpoints[0]);
+TEST_ASSERT(endpoint_map_lookup(map, 0x85) == &interfaces[2].endpoints[1]);
+TEST_END();
+
+TEST_BEGIN(unpublish);
+/* update_pipe_info() of interface 0: its entries disappear first, */
+/* interface 3 takes over its addresses after the rebuild */
+test_configure();
+endpoint_map_clear(map);
+test_build(map);
+endpoint_map_unpublish(map, interfaces[0].endpoints,
+                       interfaces[0].endpoints + TEST_MAX_ENDPOINTS,
+                       test_exchange);
+TEST_ASSERT(endpoint_map_lookup(map, 0x01) == NULL);
+TEST_ASSERT(endpoint_map_lookup(map, 0x81) == NULL);
+TEST_ASSERT(endpoint_map_lookup(map, 0x82) == NULL);
+TEST_ASSERT(endpoint_map_lookup(map, 0x03) == &interfaces[1].endpoints[0]);
+interfaces[0].valid = 0;
+test_build(map);
+TEST_ASSERT(endpoint_map_lookup(map, 0x01) == &interfaces[3].endpoints[0]);
+TEST_ASSERT(endpoint_map_lookup(map, 0x82) == &interfaces[3].endpoints[2]);
+/* clear_pipe_info() */
+endpoint_map_unpublish(map, interfaces, interfaces + TEST_MAX_INTERFACES,
+                       test_exchange);
+for(i = 0, ok = 1; i < LIBUSB_ENDPOINT_MAP_SIZE; i++)
+  ok &= map[i] == NULL;
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(matches_scan);
+test_configure();
+endpoint_map_clear(map);
+test_build(map);
+for(i = 0, ok = 1; i < 0x200; i++)
+  ok &= endpoint_map_lookup(map, i) == test_scan(i);
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(benchmark);
+test_configure();
+endpoint_map_clear(map);
+test_build(map);
+start = clock();
+for(i = 0; i < TEST_BENCH_LOOKUPS; i++)
+  sink += (size_t)endpoint_map_lookup(map, 0x86);
+map_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+start = clock();
+for(i = 0; i < TEST_BENCH_LOOKUPS; i++)
+  sink += (size_t)test_scan(0x86);
+scan_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+TEST_ASSERT(sink);
+TEST_END();
+TEST_PRINT("  lookup of the last endpoint: map %.1f ns, scan %.1f ns\n",
+           map_time * 1e9 / TEST_BENCH_LOOKUPS,
+           scan_time * 1e9 / TEST_BENCH_LOOKUPS);
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(endpoint_map);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(endpoint_map);
+TEST_MAIN_END();
@@ -0,0 +1,19 @@
+#ifndef __HOST_WINDOWS_H__
+#define __HOST_WINDOWS_H__
+
+/* the few Win32 types the libusb0 headers use, so code that is otherwise */
+/* portable can be tested on any host */
+
+#include <string.h>
+
+typedef void *HWND;
+typedef void *HINSTANCE;
+typedef char *LPSTR;
+typedef const char *LPCSTR;
+typedef const unsigned short *LPCWSTR;
+
+#define CALLBACK
+
+#define _strdup strdup
+
+#endif
@@ -0,0 +1,146 @@
+/* tests the iso stage planning of the libusb0 driver, builds and runs on */
+/* any host */
+
+#include <stdlib.h>
+
+#include "iso_stage.h"
+#include "unit.h"
+
+/* a full speed audio stream, 48 kHz 24 bit stereo */
+#define TEST_FS_PACKET_SIZE 288
+/* a high bandwidth high speed endpoint, 3 transactions of 1024 bytes */
+#define TEST_HS_MAX_PACKET_SIZE 0x1400
+
+#define TEST_MAX_SIZE 0x7fffffff
+
+
+/* splits 'total_length' into stages the way large_transfer() does, */
+/* returns zero if a stage breaks a rule of the policy */
+static int test_stages(int high_speed, int packet_size, int max_transfer_size,
+                       int total_length)
+{
+  libusb_iso_stage_policy_t policy;
+  int first, stage, num_irps, remaining = total_length, irps = 0;
+  int limit;
+
+  get_iso_stage_policy(high_speed, packet_size, &policy);
+  first = get_iso_stagesize(total_length, max_transfer_size, &policy);
+  if(first <= 0)
+    return 0;
+  num_irps = (total_length + first - 1) / first;
+
+  /* the smallest stage the policy allows is one frame */
+  limit = max_transfer_size > policy.packet_align * packet_size
+    ? max_transfer_size : policy.packet_align * packet_size;
+
+  while(remaining) {
+    stage = get_iso_stagesize(remaining, max_transfer_size, &policy);
+    if(stage <= 0 || stage > remaining)
+      return 0;
+    /* every stage but the last one is the same, as large_transfer() */
+    /* counts its irps from the first */
+    if(stage < remaining && stage != first)
+      return 0;
+    if(stage < remaining) {
+      if(stage % packet_size
+         || stage / packet_size > policy.max_packets
+         || (stage / packet_size) % policy.packet_align
+         || (max_transfer_size > 0 && stage > limit))
+        return 0;
+    }
+    remaining -= stage;
+    irps++;
+  }
+  return irps == num_irps;
+}
+
+
+TEST_SUITE_BEGIN(iso_stage);
+static const int packet_sizes[] = { 1, 8, 188, TEST_FS_PACKET_SIZE, 1023,
+                                    1024, 3072 };
+static const int max_sizes[] = { 0, -1, 1, 1000, 8192, 65536, 1 << 20 };
+libusb_iso_stage_policy_t policy;
+int hs, p, m, packets, ok;
+
+TEST_BEGIN(policy);
+get_iso_stage_policy(0, TEST_FS_PACKET_SIZE, &policy);
+TEST_ASSERT(policy.packet_size == TEST_FS_PACKET_SIZE);
+TEST_ASSERT(policy.max_packets == 255 && policy.packet_align == 1);
+get_iso_stage_policy(1, 1024, &policy);
+TEST_ASSERT(policy.max_packets == 1024 && policy.packet_align == 8);
+TEST_END();
+
+TEST_BEGIN(full_speed);
+/* 1000 packets go out as 255, 255, 255 and 235 */
+get_iso_stage_policy(0, TEST_FS_PACKET_SIZE, &policy);
+TEST_ASSERT(get_iso_stagesize(1000 * TEST_FS_PACKET_SIZE, 0, &policy)
+            == 255 * TEST_FS_PACKET_SIZE);
+TEST_ASSERT(get_iso_stagesize(235 * TEST_FS_PACKET_SIZE, 0, &policy)
+            == 235 * TEST_FS_PACKET_SIZE);
+/* the maximum transfer size is rounded down to whole packets */
+TEST_ASSERT(get_iso_stagesize(1000 * TEST_FS_PACKET_SIZE,
+                              10 * TEST_FS_PACKET_SIZE + 1, &policy)
+            == 10 * TEST_FS_PACKET_SIZE);
+/* but a stage has at least one */
+TEST_ASSERT(get_iso_stagesize(1000 * TEST_FS_PACKET_SIZE, 1, &policy)
+            == TEST_FS_PACKET_SIZE);
+TEST_END();
+
+TEST_BEGIN(high_speed);
+get_iso_stage_policy(1, 3072, &policy);
+TEST_ASSERT(get_iso_stagesize(4096 * 3072, 0, &policy) == 1024 * 3072);
+/* 20 packets round down to 2 frames */
+TEST_ASSERT(get_iso_stagesize(4096 * 3072, 20 * 3072, &policy) == 16 * 3072);
+/* less than a frame is a frame */
+TEST_ASSERT(get_iso_stagesize(4096 * 3072, 3072, &policy) == 8 * 3072);
+/* the final stage may end inside a frame */
+TEST_ASSERT(get_iso_stagesize(3 * 3072, 0, &policy) == 3 * 3072);
+/* no packet size, no staging */
+get_iso_stage_policy(1, 0, &policy);
+TEST_ASSERT(get_iso_stagesize(4096, 1024, &policy) == 4096);
+TEST_END();
+
+TEST_BEGIN(stages);
+for(hs = 0, ok = 1; hs < 2; hs++) {
+  for(p = 0; p < (int)(sizeof(packet_sizes) / sizeof(packet_sizes[0])); p++) {
+    for(m = 0; m < (int)(sizeof(max_sizes) / sizeof(max_sizes[0])); m++) {
+      for(packets = 1; packets <= 4 * 1024 + 9; packets += 1 + packets / 16) {
+        ok &= test_stages(hs, packet_sizes[p], max_sizes[m],
+                          packets * packet_sizes[p]);
+        /* a partial last packet */
+        if(packet_sizes[p] > 1)
+          ok &= test_stages(hs, packet_sizes[p], max_sizes[m],
+                            packets * packet_sizes[p] - 1);
+      }
+    }
+  }
+}
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(max_transfer_size);
+TEST_ASSERT(get_iso_urb_max_transfer_size(0, TEST_FS_PACKET_SIZE, 0)
+            == 255 * TEST_FS_PACKET_SIZE);
+TEST_ASSERT(get_iso_urb_max_transfer_size(1, 3072, 0) == 1024 * 3072);
+TEST_ASSERT(get_iso_urb_max_transfer_size(1, 3072, 65536) == 65536);
+TEST_ASSERT(get_iso_urb_max_transfer_size(1, 3072, 1 << 30) == 1024 * 3072);
+TEST_ASSERT(get_iso_urb_max_transfer_size(1, 0, 65536) == TEST_MAX_SIZE);
+/* no overflow for absurd packet sizes */
+TEST_ASSERT(get_iso_urb_max_transfer_size(1, TEST_MAX_SIZE / 2, 0)
+            == TEST_MAX_SIZE);
+TEST_ASSERT(get_iso_urb_max_transfer_size(0, TEST_MAX_SIZE / 255 + 1, 0)
+            == TEST_MAX_SIZE);
+TEST_END();
+
+TEST_BEGIN(bytes_per_interval);
+TEST_ASSERT(LIBUSB_ISO_BYTES_PER_INTERVAL(TEST_HS_MAX_PACKET_SIZE) == 3072);
+TEST_ASSERT(LIBUSB_ISO_BYTES_PER_INTERVAL(0x0BFF) == 2046);
+TEST_ASSERT(LIBUSB_ISO_BYTES_PER_INTERVAL(1023) == 1023);
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(iso_stage);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(iso_stage);
+TEST_MAIN_END();
@@ -0,0 +1,344 @@
+/* tests the loopback backend and its benchmark emulation, no device needed */
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "usbi_backend_loopback.c"
+#include "unit.h"
+
+/* only reached if something is broken, generous for loaded machines */
+#define LOOPBACK_TEST_TIMEOUT 10000
+
+/* the backend only needs these from the usbi core */
+int usbi_claim_interface_simple(usbi_device_t dev, int interface)
+{
+  return USBI_STATUS_SUCCESS;
+}
+
+int usbi_release_interface_simple(usbi_device_t dev, int interface)
+{
+  return USBI_STATUS_SUCCESS;
+}
+
+void _usbi_debug_printf(FILE *stream, usbi_debug_level_t level,
+                        const char *format, ...)
+{
+}
+
+static loopback_io_t test_io(int endpoint, usbi_transfer_t type, int size)
+{
+  loopback_io_t io = calloc(1, sizeof(*io));
+
+  io->base.endpoint = endpoint;
+  io->base.type = type;
+  io->base.direction = USBI_ENDPOINT_IN(endpoint)
+    ? USBI_DIRECTION_IN : USBI_DIRECTION_OUT;
+  io->base.size = size;
+  return io;
+}
+
+static void test_io_free(loopback_io_t io)
+{
+  if(io->base.overlapped.hEvent)
+    CloseHandle(io->base.overlapped.hEvent);
+  free(io);
+}
+
+static int test_wait(loopback_io_t io, DWORD timeout)
+{
+  return WaitForSingleObject(io->base.overlapped.hEvent, timeout)
+    == WAIT_OBJECT_0;
+}
+
+static int test_set_test(loopback_device_t dev, int type)
+{
+  loopback_io_t io = test_io(0, USBI_TRANSFER_CONTROL, 1);
+  char c;
+  int ret;
+
+  ret = !loopback_control_msg(dev, 0xC0, LOOPBACK_BENCH_SET_TEST, type, 0,
+                              &c, 1, io)
+    && test_wait(io, LOOPBACK_TEST_TIMEOUT) && io->ret == 1 && c == type;
+  test_io_free(io);
+  return ret;
+}
+
+static int test_transfer(loopback_device_t dev, int endpoint,
+                         usbi_transfer_t type, void *data, int size)
+{
+  loopback_io_t io = test_io(endpoint, type, size);
+  int ret = USBI_STATUS_UNKNOWN;
+
+  if(!loopback_transfer(dev, endpoint, type, data, size, 0, io)
+     && test_wait(io, LOOPBACK_TEST_TIMEOUT))
+    ret = io->ret;
+  test_io_free(io);
+  return ret;
+}
+
+static int test_control(loopback_device_t dev, int request_type,
+                        int request, int value, void *data, int size)
+{
+  loopback_io_t io = test_io(0, USBI_TRANSFER_CONTROL, size);
+  int ret;
+
+  ret = loopback_control_msg(dev, request_type, request, value, 0, data,
+                             size, io);
+  if(!ret)
+    ret = test_wait(io, LOOPBACK_TEST_TIMEOUT) ? io->ret
+      : USBI_STATUS_UNKNOWN;
+  test_io_free(io);
+  return ret;
+}
+
+static void test_fill(char *p, int size, int seed)
+{
+  int i;
+
+  for(i = 0; i < size; i++)
+    p[i] = (char)(seed + i * 7);
+}
+
+TEST_SUITE_BEGIN(loopback);
+static struct loopback_device_t dev;
+static char out[4096], in[4096];
+static char iso[2048 + USBI_ISO_RESULTS_SIZE(2048, 512)];
+usbi_device_descriptor_t desc;
+usbi_iso_packet_result_t *results;
+usbi_iso_transfer_info_t *info;
+loopback_io_t io, a, b;
+DWORD start;
+
+putenv("LIBUSB_LOOPBACK_DEVICES=2");
+putenv("LIBUSB_LOOPBACK_BENCHMARK=0");
+putenv("LIBUSB_LOOPBACK_VID=0x1111");
+putenv("LIBUSB_LOOPBACK_PID=0x2222");
+putenv("LIBUSB_LOOPBACK_PACKET_SIZE=512");
+
+TEST_BEGIN(open);
+TEST_ASSERT(loopback_init() == USBI_STATUS_SUCCESS);
+TEST_ASSERT(loopback_open(&dev, "loopback-0002") == USBI_STATUS_NODEV);
+TEST_ASSERT(loopback_open(&dev, "loopback-0001") == USBI_STATUS_SUCCESS);
+TEST_ASSERT(dev.test_type == LOOPBACK_BENCH_NONE);
+TEST_END();
+
+TEST_BEGIN(descriptors);
+TEST_ASSERT(test_control(&dev, USBI_DIRECTION_IN, USBI_REQ_GET_DESCRIPTOR,
+                         USBI_DESC_TYPE_DEVICE << 8, &desc, sizeof(desc))
+            == USBI_DESC_LEN_DEVICE);
+TEST_ASSERT(desc.idVendor == 0x1111 && desc.idProduct == 0x2222);
+TEST_ASSERT(test_control(&dev, USBI_DIRECTION_IN, USBI_REQ_GET_DESCRIPTOR,
+                         USBI_DESC_TYPE_CONFIG << 8, in, sizeof(in))
+            == LOOPBACK_CONFIG_DESC_SIZE);
+TEST_END();
+
+TEST_BEGIN(vendor_control);
+test_fill(out, 16, 1);
+TEST_ASSERT(test_control(&dev, USBI_TYPE_VENDOR, 0x01, 0, out, 16) == 16);
+TEST_ASSERT(test_control(&dev, USBI_TYPE_VENDOR | USBI_DIRECTION_IN, 0x01,
+                         0, in, sizeof(in)) == 16);
+TEST_ASSERT(!memcmp(in, out, 16));
+TEST_END();
+
+TEST_BEGIN(bulk_echo);
+/* the read ends with the short packet of the second write */
+test_fill(out, 1124, 2);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 1024)
+            == 1024);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out + 1024, 100)
+            == 100);
+TEST_ASSERT(test_transfer(&dev, 0x81, USBI_TRANSFER_BULK, in, sizeof(in))
+            == 1124);
+TEST_ASSERT(!memcmp(in, out, 1124));
+TEST_END();
+
+TEST_BEGIN(bulk_zlp);
+/* a write of full packets only ends a read with a zero length packet */
+test_fill(out, 512, 3);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 512) == 512);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 0) == 0);
+TEST_ASSERT(test_transfer(&dev, 0x81, USBI_TRANSFER_BULK, in, sizeof(in))
+            == 512);
+TEST_ASSERT(!memcmp(in, out, 512));
+/* without it the read stays pending */
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 512) == 512);
+io = test_io(0x81, USBI_TRANSFER_BULK, sizeof(in));
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, in, sizeof(in), 0, io);
+TEST_ASSERT(!test_wait(io, 50));
+loopback_cancel(&dev, io);
+TEST_ASSERT(test_wait(io, 0) && io->ret < 0);
+test_io_free(io);
+TEST_ASSERT(loopback_reset_endpoint(&dev, 0x01) == USBI_STATUS_SUCCESS);
+TEST_END();
+
+TEST_BEGIN(interrupt_echo);
+test_fill(out, 10, 4);
+TEST_ASSERT(test_transfer(&dev, 0x02, USBI_TRANSFER_INTERRUPT, out, 10)
+            == 10);
+TEST_ASSERT(test_transfer(&dev, 0x82, USBI_TRANSFER_INTERRUPT, in, 64)
+            == 10);
+TEST_ASSERT(!memcmp(in, out, 10));
+/* the pipe types are enforced */
+TEST_ASSERT(test_transfer(&dev, 0x02, USBI_TRANSFER_BULK, out, 10)
+            == USBI_STATUS_UNKNOWN);
+TEST_END();
+
+TEST_BEGIN(iso_results);
+test_fill(out, 1000, 5);
+TEST_ASSERT(test_transfer(&dev, 0x03, USBI_TRANSFER_ISOCHRONOUS, out, 1000)
+            == 1000);
+io = test_io(0x83, USBI_TRANSFER_ISOCHRONOUS, 2048);
+TEST_ASSERT(!loopback_transfer_iso_results(&dev, 0x83, iso, 2048, 512, io));
+TEST_ASSERT(test_wait(io, LOOPBACK_TEST_TIMEOUT) && io->ret == 1000);
+TEST_ASSERT(!memcmp(iso, out, 1000));
+/* the packet results follow the data, see usbi_get_iso_results() */
+results = (usbi_iso_packet_result_t *)(iso + 2048);
+info = (usbi_iso_transfer_info_t *)(results + 4);
+TEST_ASSERT(info->packet_count == 4 && info->error_count == 0);
+TEST_ASSERT(results[0].offset == 0 && results[0].length == 512);
+TEST_ASSERT(results[1].offset == 512 && results[1].length == 488);
+TEST_ASSERT(results[2].length == 0 && results[3].length == 0);
+TEST_ASSERT(!results[0].status && !results[3].status);
+test_io_free(io);
+TEST_END();
+
+TEST_BEGIN(error_injection);
+/* every second transfer fails, its data isn't looped back */
+_loopback.error_rate = 2;
+dev.num_transfers = 0;
+test_fill(out, 200, 6);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 100) == 100);
+TEST_ASSERT(test_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out + 100, 100)
+            == USBI_STATUS_UNKNOWN);
+_loopback.error_rate = 1;
+io = test_io(0x83, USBI_TRANSFER_ISOCHRONOUS, 2048);
+TEST_ASSERT(!loopback_transfer_iso_results(&dev, 0x83, iso, 2048, 512, io));
+TEST_ASSERT(test_wait(io, LOOPBACK_TEST_TIMEOUT) && io->ret < 0);
+TEST_ASSERT(info->error_count == 4);
+TEST_ASSERT(results[0].status == LOOPBACK_ISO_PACKET_ERROR
+            && results[3].status == LOOPBACK_ISO_PACKET_ERROR);
+test_io_free(io);
+_loopback.error_rate = 0;
+TEST_ASSERT(test_transfer(&dev, 0x81, USBI_TRANSFER_BULK, in, sizeof(in))
+            == 100);
+TEST_ASSERT(!memcmp(in, out, 100));
+TEST_END();
+
+TEST_BEGIN(latency);
+/* checked through the due time, like the rate limit */
+_loopback.latency = 200;
+a = test_io(0x01, USBI_TRANSFER_BULK, 10);
+b = test_io(0x81, USBI_TRANSFER_BULK, sizeof(in));
+start = GetTickCount();
+loopback_transfer(&dev, 0x01, USBI_TRANSFER_BULK, out, 10, 0, a);
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, in, sizeof(in), 0, b);
+TEST_ASSERT(test_wait(a, LOOPBACK_TEST_TIMEOUT) && a->ret == 10);
+TEST_ASSERT((LONG)(a->due - start) >= 200);
+TEST_ASSERT((LONG)(GetTickCount() - a->due) >= 0);
+TEST_ASSERT(test_wait(b, LOOPBACK_TEST_TIMEOUT) && b->ret == 10);
+TEST_ASSERT((LONG)(GetTickCount() - b->due) >= 0);
+_loopback.latency = 0;
+test_io_free(a);
+test_io_free(b);
+TEST_END();
+
+TEST_BEGIN(close);
+TEST_ASSERT(loopback_close(&dev) == USBI_STATUS_SUCCESS);
+TEST_END();
+
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN(benchmark);
+static struct loopback_device_t dev;
+static char buf[4096], data[1000];
+loopback_io_t io, a, b;
+DWORD start;
+int i, errors;
+
+putenv("LIBUSB_LOOPBACK_DEVICES=1");
+putenv("LIBUSB_LOOPBACK_BENCHMARK=1");
+putenv("LIBUSB_LOOPBACK_VID=");
+putenv("LIBUSB_LOOPBACK_PID=");
+
+TEST_BEGIN(open);
+TEST_ASSERT(loopback_init() == USBI_STATUS_SUCCESS);
+TEST_ASSERT(_loopback.vid == LOOPBACK_BENCH_VID
+            && _loopback.pid == LOOPBACK_BENCH_PID);
+TEST_ASSERT(loopback_open(&dev, "loopback-0000") == USBI_STATUS_SUCCESS);
+TEST_ASSERT(dev.test_type == LOOPBACK_BENCH_LOOP);
+TEST_END();
+
+TEST_BEGIN(read_pattern);
+TEST_ASSERT(test_set_test(&dev, LOOPBACK_BENCH_READ));
+io = test_io(0x81, USBI_TRANSFER_BULK, sizeof(buf));
+TEST_ASSERT(!loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, buf,
+                               sizeof(buf), 0, io));
+TEST_ASSERT(test_wait(io, LOOPBACK_TEST_TIMEOUT) && io->ret == sizeof(buf));
+for(i = 0, errors = 0; i < sizeof(buf); i++) {
+  int offset = i % 512;
+  int expected = offset == 1 ? i / 512
+    : _loopback_bench_pattern[offset] & 0xFF;
+  errors += (buf[i] & 0xFF) != expected;
+}
+TEST_ASSERT(!errors);
+test_io_free(io);
+TEST_END();
+
+TEST_BEGIN(loop_short_write);
+TEST_ASSERT(test_set_test(&dev, LOOPBACK_BENCH_LOOP));
+memset(data, 7, sizeof(data));
+a = test_io(0x81, USBI_TRANSFER_BULK, 4096);
+b = test_io(0x81, USBI_TRANSFER_BULK, 2048);
+io = test_io(0x01, USBI_TRANSFER_BULK, sizeof(data));
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, buf, 4096, 0, a);
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, buf, 2048, 0, b);
+loopback_transfer(&dev, 0x01, USBI_TRANSFER_BULK, data, sizeof(data), 0, io);
+TEST_ASSERT(test_wait(io, LOOPBACK_TEST_TIMEOUT) && io->ret == sizeof(data));
+/* the short write ends the first read, the second one stays pending */
+TEST_ASSERT(test_wait(a, LOOPBACK_TEST_TIMEOUT) && a->ret == sizeof(data));
+TEST_ASSERT(buf[sizeof(data) - 1] == 7);
+TEST_ASSERT(!test_wait(b, 50));
+TEST_ASSERT(loopback_cancel(&dev, b) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(test_wait(b, 0) && b->ret < 0 && !dev.requests);
+test_io_free(io);
+test_io_free(a);
+test_io_free(b);
+TEST_END();
+
+TEST_BEGIN(rate);
+/* 100 ms per transfer, checked through the computed due times, so the */
+/* test doesn't depend on how fast the worker thread gets to run */
+_loopback.rate = 40960;
+TEST_ASSERT(test_set_test(&dev, LOOPBACK_BENCH_READ));
+a = test_io(0x81, USBI_TRANSFER_BULK, 4096);
+b = test_io(0x81, USBI_TRANSFER_BULK, 4096);
+start = GetTickCount();
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, buf, 4096, 0, a);
+loopback_transfer(&dev, 0x81, USBI_TRANSFER_BULK, buf, 4096, 0, b);
+TEST_ASSERT(test_wait(a, LOOPBACK_TEST_TIMEOUT) && a->throttled);
+TEST_ASSERT((LONG)(a->due - start) >= 100);
+TEST_ASSERT((LONG)(GetTickCount() - a->due) >= 0);
+/* the second transfer starts when the first one ends */
+TEST_ASSERT(test_wait(b, LOOPBACK_TEST_TIMEOUT) && b->throttled);
+TEST_ASSERT(b->due - a->due == 100);
+TEST_ASSERT((LONG)(GetTickCount() - b->due) >= 0);
+_loopback.rate = 0;
+test_io_free(a);
+test_io_free(b);
+TEST_END();
+
+TEST_BEGIN(close);
+TEST_ASSERT(loopback_close(&dev) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(loopback_deinit() == USBI_STATUS_SUCCESS);
+TEST_END();
+
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(loopback);
+TEST_SUITE_DEFINE(benchmark);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(loopback);
+TEST_SUITE_RUN(benchmark);
+TEST_MAIN_END();
@@ -0,0 +1,419 @@
+/* tests the usbi core against the loopback backend and the built in */
+/* configurations, no device needed */
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "usbi.c"
+#include "descriptor_corpus.h"
+#include "unit.h"
+
+/* only reached if something is broken, generous for loaded machines */
+#define USBI_TEST_TIMEOUT 10000
+
+#define USBI_TEST_REQUESTS (8 * USBI_MAX_CACHED_IO)
+#define USBI_TEST_BATCH (2 * USBI_MAX_CACHED_IO)
+
+#define USBI_TEST_PACKET_SIZE 8
+
+#define USBI_TEST_MAX_ENDPOINTS 32
+
+
+static struct {
+  usbi_event_loop_t loop;
+  int count;
+  int errors;
+  char seen[USBI_TEST_REQUESTS];
+} test_dequeuer;
+
+
+static int test_open(const char *name, usbi_device_t *dev)
+{
+  int id;
+
+  for(id = usbi_get_first_id(); id; id = usbi_get_next_id(id)) {
+    if(strcmp(devices[id].name, name))
+      continue;
+    return usbi_open(id, dev) == USBI_STATUS_SUCCESS
+      && usbi_set_configuration(*dev, 1) == USBI_STATUS_SUCCESS
+      && usbi_claim_interface(*dev, 0) == USBI_STATUS_SUCCESS;
+  }
+  return FALSE;
+}
+
+/* the interface lookup of usbi_get_interface_descriptor() before the */
+/* index: the n-th interface descriptor with the given alternate setting */
+static uint8_t *test_scan_interface(uint8_t *desc, int size, int interface,
+                                    int alt_setting)
+{
+  int offset = USBI_DESC_LEN_CONFIG;
+
+  while(size - offset >= 2 && desc[offset] >= 2
+        && desc[offset] <= size - offset) {
+    if(desc[offset + 1] == USBI_DESC_TYPE_INTERFACE
+       && desc[offset] >= USBI_DESC_LEN_INTERFACE
+       && desc[offset + 3] == alt_setting && !interface--)
+      return desc + offset;
+    offset += desc[offset];
+  }
+  return NULL;
+}
+
+/* the n-th endpoint descriptor of an interface, before the next one */
+static uint8_t *test_scan_endpoint(uint8_t *desc, int size,
+                                   uint8_t *interface, int endpoint)
+{
+  int offset = (int)(interface - desc) + interface[0];
+
+  while(size - offset >= 2 && desc[offset] >= 2
+        && desc[offset] <= size - offset) {
+    if(desc[offset + 1] == USBI_DESC_TYPE_INTERFACE
+       && desc[offset] >= USBI_DESC_LEN_INTERFACE)
+      break;
+    if(desc[offset + 1] == USBI_DESC_TYPE_ENDPOINT
+       && desc[offset] >= USBI_DESC_LEN_ENDPOINT && !endpoint--)
+      return desc + offset;
+    offset += desc[offset];
+  }
+  return NULL;
+}
+
+/* every lookup through the index against the scans, with the copy of */
+/* the descriptor of exactly the given size the cache would hold */
+static int test_index(const uint8_t *data, int size)
+{
+  usbi_config_cache_t *cache;
+  usbi_interface_index_t *index;
+  uint8_t *desc, *interface, *endpoint;
+  int i, a, e, ok = TRUE;
+
+  desc = malloc(size);
+  memcpy(desc, data, size);
+  cache = _usbi_index_config_desc(desc, size);
+  if(!cache) {
+    free(desc);
+    return FALSE;
+  }
+  for(i = 0; i < 4; i++) {
+    for(a = 0; a < 4; a++) {
+      index = _usbi_find_interface_desc(cache, i, a);
+      interface = test_scan_interface(desc, size, i, a);
+      if(!index || !interface) {
+        ok &= !index && !interface;
+        continue;
+      }
+      ok &= desc + index->offset == interface;
+      for(e = 0; e < USBI_TEST_MAX_ENDPOINTS; e++) {
+        endpoint = test_scan_endpoint(desc, size, interface, e);
+        if(e >= index->num_endpoints) {
+          ok &= !endpoint;
+          break;
+        }
+        ok &= desc + cache->endpoints[index->first_endpoint + e] == endpoint;
+      }
+    }
+  }
+  free(cache);
+  free(desc);
+  return ok;
+}
+
+static int test_transfer_v_calls;
+
+/* a backend without vectored requests */
+static int test_transfer_v_unsupported(usbi_device_t dev, int endpoint,
+                                       usbi_transfer_t type,
+                                       const usbi_iovec_t *iov, int iov_count,
+                                       usbi_io_t io)
+{
+  test_transfer_v_calls++;
+  return USBI_STATUS_NOT_SUPPORTED;
+}
+
+/* writes "0123456789abcdef" from 3 buffers, one of them empty, and reads */
+/* it back into 3 buffers whose last one is left untouched */
+static int test_transfer_v(usbi_device_t dev, usbi_event_loop_t loop)
+{
+  static const char data[] = "0123456789abcdef";
+  char in[3][12];
+  usbi_iovec_t out_iov[3], in_iov[3];
+  usbi_io_t io;
+  int result;
+
+  out_iov[0].data = (void *)data;
+  out_iov[0].size = 3;
+  out_iov[1].data = NULL;
+  out_iov[1].size = 0;
+  out_iov[2].data = (void *)(data + 3);
+  out_iov[2].size = 13;
+  memset(in, '-', sizeof(in));
+  in_iov[0].data = in[0];
+  in_iov[0].size = 10;
+  in_iov[1].data = in[1];
+  in_iov[1].size = 12;
+  in_iov[2].data = in[2];
+  in_iov[2].size = 12;
+
+  if(usbi_transfer_v_sync(dev, 0x01, USBI_TRANSFER_BULK, out_iov, 3,
+                          USBI_TEST_TIMEOUT) != 16)
+    return FALSE;
+  if(loop) {
+    if(usbi_transfer_v(dev, 0x81, USBI_TRANSFER_BULK, in_iov, 3, &io)
+       != USBI_STATUS_SUCCESS
+       || usbi_event_loop_add(loop, io, NULL) != USBI_STATUS_SUCCESS
+       || usbi_event_loop_dequeue(loop, NULL, &result, USBI_TEST_TIMEOUT)
+       != USBI_STATUS_SUCCESS)
+      return FALSE;
+  } else {
+    result = usbi_transfer_v_sync(dev, 0x81, USBI_TRANSFER_BULK, in_iov, 3,
+                                  USBI_TEST_TIMEOUT);
+  }
+  return result == 16
+    && !memcmp(in[0], data, 10)
+    && !memcmp(in[1], data + 10, 6)
+    && in[1][6] == '-' && in[2][0] == '-';
+}
+
+/* dequeues USBI_TEST_REQUESTS control writes while they are added */
+static DWORD WINAPI test_dequeue_thread(LPVOID param)
+{
+  void *context;
+  int i, result;
+
+  while(test_dequeuer.count < USBI_TEST_REQUESTS) {
+    if(usbi_event_loop_dequeue(test_dequeuer.loop, &context, &result,
+                               USBI_TEST_TIMEOUT) != USBI_STATUS_SUCCESS) {
+      test_dequeuer.errors++;
+      break;
+    }
+    i = (int)(INT_PTR)context;
+    if(i < 0 || i >= USBI_TEST_REQUESTS || test_dequeuer.seen[i]
+       || result != USBI_TEST_PACKET_SIZE)
+      test_dequeuer.errors++;
+    else
+      test_dequeuer.seen[i] = 1;
+    test_dequeuer.count++;
+  }
+  return 0;
+}
+
+
+TEST_SUITE_BEGIN(config_cache);
+usbi_device_t dev;
+uint8_t desc[USBI_DESC_LEN_ENDPOINT];
+const void *config;
+unsigned long hits, misses;
+int i, n, ok;
+
+putenv("LIBUSB_LOOPBACK_DEVICES=2");
+putenv("LIBUSB_LOOPBACK_BENCHMARK=0");
+
+TEST_BEGIN(index);
+for(i = 0, ok = TRUE; i < CORPUS_SIZE; i++)
+  ok &= test_index(corpus[i].data, corpus[i].size);
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(truncated);
+for(i = 0, ok = TRUE; i < CORPUS_SIZE; i++) {
+  for(n = USBI_DESC_LEN_CONFIG; n < corpus[i].size; n++)
+    ok &= test_index(corpus[i].data, n);
+}
+TEST_ASSERT(ok);
+TEST_END();
+
+TEST_BEGIN(loopback);
+TEST_ASSERT(usbi_init() == USBI_STATUS_SUCCESS);
+usbi_refresh_ids();
+TEST_ASSERT(test_open("loopback-0000", &dev));
+n = usbi_get_cached_config_descriptor(dev, 0, &config);
+TEST_ASSERT(n == ((usbi_config_descriptor_t *)config)->wTotalLength);
+TEST_ASSERT(usbi_get_endpoint_descriptor(dev, 0, 0, 0, 1, desc, sizeof(desc))
+            == USBI_DESC_LEN_ENDPOINT);
+TEST_ASSERT(desc[2] == 0x81);
+/* endpoints of the interface only */
+TEST_ASSERT(usbi_get_endpoint_descriptor(dev, 0, 0, 0, 2 * LOOPBACK_NUM_PIPES,
+                                         desc, sizeof(desc))
+            == USBI_STATUS_PARAM);
+TEST_ASSERT(usbi_get_interface_descriptor(dev, 0, 1, 0, desc, sizeof(desc))
+            == USBI_STATUS_PARAM);
+TEST_ASSERT(usbi_get_config_cache_stats(dev, &hits, &misses)
+            == USBI_STATUS_SUCCESS);
+TEST_ASSERT(misses == 1 && hits == 3);
+TEST_ASSERT(usbi_close(dev) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_deinit() == USBI_STATUS_SUCCESS);
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN(transfer_v);
+usbi_device_t dev;
+usbi_event_loop_t loop;
+usbi_iovec_t iov;
+char data[USBI_TEST_PACKET_SIZE];
+void *transfer_v;
+
+TEST_BEGIN(open);
+TEST_ASSERT(usbi_init() == USBI_STATUS_SUCCESS);
+usbi_refresh_ids();
+TEST_ASSERT(test_open("loopback-0000", &dev));
+TEST_ASSERT(usbi_event_loop_create(&loop) == USBI_STATUS_SUCCESS);
+TEST_END();
+
+TEST_BEGIN(backend);
+TEST_ASSERT(test_transfer_v(dev, NULL));
+TEST_ASSERT(test_transfer_v(dev, loop));
+TEST_END();
+
+TEST_BEGIN(bounce);
+/* the data goes through one contiguous buffer, a read is copied back */
+/* by usbi_wait(), also when it completes through an event loop */
+transfer_v = (void *)drivers[dev->driver].transfer_v;
+drivers[dev->driver].transfer_v = test_transfer_v_unsupported;
+test_transfer_v_calls = 0;
+TEST_ASSERT(test_transfer_v(dev, NULL));
+TEST_ASSERT(test_transfer_v(dev, loop));
+TEST_ASSERT(test_transfer_v_calls == 4);
+/* a single buffer needs no copy */
+memcpy(data, "single!", sizeof(data));
+iov.data = data;
+iov.size = sizeof(data);
+TEST_ASSERT(usbi_transfer_v_sync(dev, 0x01, USBI_TRANSFER_BULK, &iov, 1,
+                                 USBI_TEST_TIMEOUT) == sizeof(data));
+memset(data, 0, sizeof(data));
+TEST_ASSERT(usbi_transfer_v_sync(dev, 0x81, USBI_TRANSFER_BULK, &iov, 1,
+                                 USBI_TEST_TIMEOUT) == sizeof(data));
+TEST_ASSERT(!memcmp(data, "single!", sizeof(data)));
+drivers[dev->driver].transfer_v = transfer_v;
+TEST_END();
+
+TEST_BEGIN(close);
+TEST_ASSERT(usbi_event_loop_destroy(loop) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_close(dev) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_deinit() == USBI_STATUS_SUCCESS);
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_BEGIN(event_loop);
+static char out[2][USBI_TEST_REQUESTS * USBI_TEST_PACKET_SIZE];
+static char in[2][USBI_TEST_REQUESTS * USBI_TEST_PACKET_SIZE];
+usbi_device_t dev[2];
+usbi_event_loop_t loop;
+usbi_io_t batch[USBI_TEST_BATCH];
+HANDLE thread;
+void *context;
+int i, j, result, ok;
+
+putenv("LIBUSB_LOOPBACK_DEVICES=2");
+putenv("LIBUSB_LOOPBACK_BENCHMARK=0");
+
+TEST_BEGIN(open);
+TEST_ASSERT(usbi_init() == USBI_STATUS_SUCCESS);
+usbi_refresh_ids();
+TEST_ASSERT(test_open("loopback-0000", &dev[0]));
+TEST_ASSERT(test_open("loopback-0001", &dev[1]));
+TEST_ASSERT(usbi_event_loop_create(&loop) == USBI_STATUS_SUCCESS);
+TEST_END();
+
+TEST_BEGIN(pending);
+/* a read with no data stays queued until the write that feeds it */
+TEST_ASSERT(usbi_event_loop_transfer(loop, dev[0], 0x81, USBI_TRANSFER_BULK,
+                                     in[0], USBI_TEST_PACKET_SIZE, 0,
+                                     (void *)1) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_event_loop_dequeue(loop, &context, &result, 0)
+            == USBI_STATUS_TIMEOUT);
+memcpy(out[0], "pending", USBI_TEST_PACKET_SIZE);
+TEST_ASSERT(usbi_event_loop_transfer(loop, dev[0], 0x01, USBI_TRANSFER_BULK,
+                                     out[0], USBI_TEST_PACKET_SIZE, 0,
+                                     (void *)2) == USBI_STATUS_SUCCESS);
+ok = 0;
+for(i = 0; i < 2; i++) {
+  TEST_ASSERT(usbi_event_loop_dequeue(loop, &context, &result,
+                                      USBI_TEST_TIMEOUT)
+              == USBI_STATUS_SUCCESS);
+  ok |= (int)(INT_PTR)context;
+  TEST_ASSERT(result == USBI_TEST_PACKET_SIZE);
+}
+TEST_ASSERT(ok == 3);
+TEST_ASSERT(!memcmp(in[0], "pending", USBI_TEST_PACKET_SIZE));
+TEST_END();
+
+TEST_BEGIN(two_devices);
+/* reads and writes of both devices complete through one queue */
+for(i = 0; i < USBI_TEST_REQUESTS; i++) {
+  for(j = 0; j < 2; j++) {
+    memset(out[j] + i * USBI_TEST_PACKET_SIZE, i + j,
+           USBI_TEST_PACKET_SIZE);
+    TEST_ASSERT(usbi_event_loop_transfer(loop, dev[j], 0x81,
+                                         USBI_TRANSFER_BULK,
+                                         in[j] + i * USBI_TEST_PACKET_SIZE,
+                                         USBI_TEST_PACKET_SIZE, 0, NULL)
+                == USBI_STATUS_SUCCESS);
+    TEST_ASSERT(usbi_event_loop_transfer(loop, dev[j], 0x01,
+                                         USBI_TRANSFER_BULK,
+                                         out[j] + i * USBI_TEST_PACKET_SIZE,
+                                         USBI_TEST_PACKET_SIZE, 0, NULL)
+                == USBI_STATUS_SUCCESS);
+  }
+}
+ok = TRUE;
+for(i = 0; i < 4 * USBI_TEST_REQUESTS; i++) {
+  if(usbi_event_loop_dequeue(loop, NULL, &result, USBI_TEST_TIMEOUT)
+     != USBI_STATUS_SUCCESS || result != USBI_TEST_PACKET_SIZE)
+    ok = FALSE;
+}
+TEST_ASSERT(ok);
+TEST_ASSERT(!loop->pending);
+TEST_ASSERT(!memcmp(in[0], out[0], sizeof(in[0])));
+TEST_ASSERT(!memcmp(in[1], out[1], sizeof(in[1])));
+TEST_END();
+
+TEST_BEGIN(completed_before_add);
+/* the wait fires as soon as it is registered, while another thread
+   dequeues the requests; each batch overflows the device's IO cache, so
+   most of them are really freed */
+memset(&test_dequeuer, 0, sizeof(test_dequeuer));
+test_dequeuer.loop = loop;
+thread = CreateThread(NULL, 0, test_dequeue_thread, NULL, 0, NULL);
+TEST_ASSERT(thread != NULL);
+ok = TRUE;
+for(i = 0; i < USBI_TEST_REQUESTS; i += USBI_TEST_BATCH) {
+  for(j = 0; j < USBI_TEST_BATCH; j++) {
+    if(usbi_control_msg(dev[(i / USBI_TEST_BATCH) & 1], USBI_TYPE_VENDOR,
+                        0x01, 0, 0, out[0], USBI_TEST_PACKET_SIZE, &batch[j])
+       != USBI_STATUS_SUCCESS)
+      ok = FALSE;
+  }
+  for(j = 0; j < USBI_TEST_BATCH && ok; j++) {
+    if(WaitForSingleObject(batch[j]->overlapped.hEvent, USBI_TEST_TIMEOUT)
+       != WAIT_OBJECT_0
+       || usbi_event_loop_add(loop, batch[j], (void *)(INT_PTR)(i + j))
+       != USBI_STATUS_SUCCESS)
+      ok = FALSE;
+  }
+}
+TEST_ASSERT(ok);
+TEST_ASSERT(WaitForSingleObject(thread, USBI_TEST_TIMEOUT) == WAIT_OBJECT_0);
+CloseHandle(thread);
+TEST_ASSERT(test_dequeuer.count == USBI_TEST_REQUESTS);
+TEST_ASSERT(!test_dequeuer.errors);
+TEST_ASSERT(!loop->pending);
+TEST_END();
+
+TEST_BEGIN(close);
+TEST_ASSERT(usbi_event_loop_destroy(loop) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_close(dev[0]) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_close(dev[1]) == USBI_STATUS_SUCCESS);
+TEST_ASSERT(usbi_deinit() == USBI_STATUS_SUCCESS);
+TEST_END();
+TEST_SUITE_END();
+
+TEST_SUITE_DEFINE(config_cache);
+TEST_SUITE_DEFINE(transfer_v);
+TEST_SUITE_DEFINE(event_loop);
+
+TEST_MAIN_BEGIN();
+TEST_SUITE_RUN(config_cache);
+TEST_SUITE_RUN(transfer_v);
+TEST_SUITE_RUN(event_loop);
+TEST_MAIN_END();